@@ -0,0 +1,122 @@
+#include "base/Epoch.hpp"
+
+#include <limits>
+#include <sched.h>
+
+namespace tsdb{
+namespace base{
+
+// retire() only scans the reader slots once this many cleanups are pending.
+static const int RECLAIM_BATCH = 64;
+
+// EpochThreadSlot remembers the slot of the current thread and gives it back
+// when the thread exits.
+class EpochThreadSlot{
+    public:
+        int slot;
+        int depth; // Nested EpochGuards only publish the outermost epoch.
+
+        EpochThreadSlot(): slot(-1), depth(0){}
+
+        ~EpochThreadSlot(){
+            if(slot >= 0)
+                EpochManager::instance().release_slot(slot);
+        }
+};
+
+static thread_local EpochThreadSlot thread_slot;
+
+EpochManager::EpochManager(): global_epoch(1), num_slots(0){
+    for(int i = 0; i < MAX_THREADS; ++ i){
+        slots[i].epoch.store(0);
+        slots[i].used.store(false);
+    }
+}
+
+EpochManager & EpochManager::instance(){
+    // Never destructed, threads may exit after static destructors have run.
+    static EpochManager * manager = new EpochManager();
+    return *manager;
+}
+
+int EpochManager::acquire_slot(){
+    while(true){
+        for(int i = 0; i < MAX_THREADS; ++ i){
+            bool expected = false;
+            if(!slots[i].used.load(std::memory_order_relaxed) &&
+                slots[i].used.compare_exchange_strong(expected, true)){
+                int n = num_slots.load();
+                while(n < i + 1 && !num_slots.compare_exchange_weak(n, i + 1));
+                return i;
+            }
+        }
+        // More threads than slots, wait for one to exit.
+        sched_yield();
+    }
+}
+
+void EpochManager::release_slot(int i){
+    slots[i].epoch.store(0);
+    slots[i].used.store(false, std::memory_order_release);
+}
+
+void EpochManager::enter(){
+    EpochThreadSlot & t = thread_slot;
+    if(t.depth ++ > 0)
+        return;
+    if(t.slot < 0)
+        t.slot = acquire_slot();
+    slots[t.slot].epoch.store(global_epoch.load());
+    // The announcement must be visible before any protected data is loaded.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EpochManager::exit(){
+    EpochThreadSlot & t = thread_slot;
+    if(-- t.depth > 0)
+        return;
+    slots[t.slot].epoch.store(0, std::memory_order_release);
+}
+
+void EpochManager::retire(const boost::function<void ()> & f){
+    MutexLockGuard lock(mutex_);
+    retired.emplace_back(global_epoch.fetch_add(1), f);
+    if(retired.size() >= RECLAIM_BATCH)
+        reclaim_locked();
+}
+
+void EpochManager::reclaim(){
+    MutexLockGuard lock(mutex_);
+    reclaim_locked();
+}
+
+void EpochManager::reclaim_locked(){
+    if(retired.empty())
+        return;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t min_epoch = std::numeric_limits<uint64_t>::max();
+    int n = num_slots.load();
+    for(int i = 0; i < n; ++ i){
+        uint64_t e = slots[i].epoch.load();
+        if(e != 0 && e < min_epoch)
+            min_epoch = e;
+    }
+
+    // A cleanup retired in epoch r can only be observed by readers which
+    // entered in epoch r or before.
+    size_t kept = 0;
+    for(size_t i = 0; i < retired.size(); ++ i){
+        if(retired[i].first < min_epoch)
+            retired[i].second();
+        else
+            retired[kept ++] = retired[i];
+    }
+    retired.resize(kept);
+}
+
+int EpochManager::pending(){
+    MutexLockGuard lock(mutex_);
+    return retired.size();
+}
+
+}}
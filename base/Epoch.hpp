@@ -0,0 +1,78 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "base/Mutex.hpp"
+
+namespace tsdb{
+namespace base{
+
+// EpochManager implements epoch based reclamation for lock-free readers.
+//
+// A reader wraps its accesses in an EpochGuard, which publishes the global
+// epoch it started in. A writer that unlinks an object hands its cleanup to
+// retire(), which bumps the global epoch. The cleanup runs once every reader
+// that was active at that time has left, i.e. all active readers started in a
+// later epoch.
+//
+// There is a single process wide manager, every thread gets a slot in it the
+// first time it enters and gives it back when it exits.
+class EpochManager: boost::noncopyable{
+    public:
+        static const int MAX_THREADS = 1024;
+
+        static EpochManager & instance();
+
+        void enter();
+        void exit();
+
+        void retire(const boost::function<void ()> & f);
+
+        // Run the cleanups that no reader can observe anymore.
+        void reclaim();
+
+        int pending();
+
+    private:
+        struct Slot{
+            std::atomic<uint64_t> epoch; // 0 if the thread is not reading.
+            std::atomic<bool> used;
+            char padding_[64 - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>)];
+        };
+
+        std::atomic<uint64_t> global_epoch;
+        Slot slots[MAX_THREADS];
+        std::atomic<int> num_slots; // High-water mark of the used slots.
+
+        MutexLock mutex_;
+        std::vector<std::pair<uint64_t, boost::function<void ()>>> retired;
+
+        EpochManager();
+
+        int acquire_slot();
+        void release_slot(int i);
+        void reclaim_locked();
+
+        friend class EpochThreadSlot;
+};
+
+class EpochGuard: boost::noncopyable{
+    public:
+        EpochGuard(){
+            EpochManager::instance().enter();
+        }
+
+        ~EpochGuard(){
+            EpochManager::instance().exit();
+        }
+};
+
+}}
+
+#endif
@@ -27,6 +27,8 @@ class ThreadPool : boost::noncopyable{
 
         const std::string& name() const{ return name_; }
 
+        int numThreads() const{ return static_cast<int>(threads_.size()); }
+
         size_t queueSize() const{
             MutexLockGuard lock(mutex_);
             return queue_.size();
@@ -1,10 +1,10 @@
 #include "block/Block.hpp"
 #include "base/Logging.hpp"
 #include "chunk/ChunkReader.hpp"
-// #include "chunk/GroupChunkReader.hpp"
+#include "chunk/GroupChunkReader.hpp"
 #include "compact/CompactorInterface.hpp"
+#include "index/GroupIndexReader.hpp"
 #include "index/IndexReader.hpp"
-// #include "index/GroupIndexReader.hpp"
 #include "querier/QuerierUtils.hpp"
 #include "tombstone/MemTombstones.hpp"
 #include "tombstone/TombstoneUtils.hpp"
@@ -36,7 +36,7 @@ BlockIndexReader::BlockIndexReader(
 std::pair<std::unique_ptr<index::PostingsInterface>, bool>
 BlockIndexReader::group_postings(uint64_t group_ref)
 {
-    return {nullptr, false};
+    return indexr->group_postings(group_ref);
 }
 
 std::pair<std::unique_ptr<index::PostingsInterface>, bool>
@@ -122,22 +122,23 @@ Block::Block(const std::string& dir, uint8_t type_)
             err_.set("error create index reader");
             return;
         }
+    } else if (type_ == static_cast<uint8_t>(GroupBlock)) {
+        chunkr = std::shared_ptr<ChunkReaderInterface>(
+            new chunk::GroupChunkReader(chunks_dir));
+        if (chunkr->error()) {
+            // LOG_ERROR << "Error creating group chunk reader";
+            err_.set("error create group chunk reader");
+            return;
+        }
+
+        indexr = std::shared_ptr<IndexReaderInterface>(
+            new index::GroupIndexReader(index_path));
+        if (indexr->error()) {
+            // LOG_ERROR << "Error creating group index reader";
+            err_.set("error create group index reader");
+            return;
+        }
     }
-    // else if(type_ == static_cast<uint8_t>(GroupBlock)){
-    //     chunkr = std::shared_ptr<ChunkReaderInterface>(new
-    //     chunk::GroupChunkReader(chunks_dir)); if(chunkr->error()){
-    //         // LOG_ERROR << "Error creating group chunk reader";
-    //         err_.set("error create group chunk reader");
-    //         return;
-    //     }
-
-    //     indexr = std::shared_ptr<IndexReaderInterface>(new
-    //     index::GroupIndexReader(index_path)); if(indexr->error()){
-    //         // LOG_ERROR << "Error creating group index reader";
-    //         err_.set("error create group index reader");
-    //         return;
-    //     }
-    // }
 
     int tombstone_size;
     std::tie(tr, tombstone_size) = tombstone::read_tombstones(dir);
@@ -322,7 +323,7 @@ Block::clean_tombstones(const std::string& dest, void* compactor)
     if (num_tombstones == 0) return {ulid::ULID(), error::Error()};
 
     std::shared_ptr<BlockInterface> b(
-        new Block(closing, dir_, meta_, chunkr, indexr, tr, err_));
+        new Block(closing, dir_, meta_, chunkr, indexr, tr, err_, type_));
     std::shared_ptr<BlockMeta> m(new BlockMeta(meta_));
     std::pair<ulid::ULID, error::Error> ulid_pair =
         ((compact::CompactorInterface*)compactor)
@@ -0,0 +1,148 @@
+#ifndef BITREADER_H
+#define BITREADER_H
+
+#include <stdint.h>
+
+#include "base/Endian.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+// BitReader reads a bit stream written by BitStream through a 64-bit buffer
+// refilled a word at a time. The bits not consumed yet are kept left aligned
+// in buf, the bits behind them are always zero.
+//
+// Reading past the end does not throw, it sets the error flag and returns 0.
+// The bytes are never read beyond the size given, so that a stream still
+// being appended to can be read in place.
+class BitReader{
+    private:
+        const uint8_t * ptr;
+        const uint8_t * end;
+        uint64_t buf;
+        int count;  // Number of valid bits in buf.
+        bool err_;
+
+    public:
+        BitReader(): ptr(nullptr), end(nullptr), buf(0), count(0), err_(false){}
+
+        BitReader(const uint8_t * stream_ptr, int size): ptr(stream_ptr), end(stream_ptr + (size > 0 ? size : 0)), buf(0), count(0), err_(false){}
+
+        // refill fills buf with whole bytes, leaving at least 57 valid bits
+        // unless the stream ends.
+        inline void refill(){
+            if(count > 56)
+                return;
+            int bytes = (64 - count) >> 3;
+            if(end - ptr >= 8){
+                uint64_t w = base::get_uint64_big_endian(ptr);
+                w = (w >> (64 - (bytes << 3))) << (64 - (bytes << 3));
+                buf |= w >> count;
+                ptr += bytes;
+                count += bytes << 3;
+            }
+            else{
+                while(count <= 56 && ptr < end){
+                    buf |= static_cast<uint64_t>(*ptr ++) << (56 - count);
+                    count += 8;
+                }
+            }
+        }
+
+        // peek returns the next bits left aligned. Only the first available()
+        // of them are valid, the others are zero.
+        inline uint64_t peek(){
+            if(count < 57)
+                refill();
+            return buf;
+        }
+
+        inline int available() const{
+            return count;
+        }
+
+        // consume drops the next num bits, at most available() and below 64.
+        inline void consume(int num){
+            buf <<= num;
+            count -= num;
+        }
+
+        inline bool read_bit(){
+            if(count == 0){
+                refill();
+                if(count == 0){
+                    err_ = true;
+                    return false;
+                }
+            }
+            bool bit = (buf >> 63) == 1;
+            buf <<= 1;
+            -- count;
+            return bit;
+        }
+
+        // read_bits reads num bits, 0 <= num <= 64.
+        inline uint64_t read_bits(int num){
+            if(num > 56){
+                uint64_t high = read_bits(32);
+                return (high << (num - 32)) | read_bits(num - 32);
+            }
+            if(num <= 0)
+                return 0;
+            if(count < num){
+                refill();
+                if(count < num){
+                    err_ = true;
+                    return 0;
+                }
+            }
+            uint64_t result = buf >> (64 - num);
+            buf <<= num;
+            count -= num;
+            return result;
+        }
+
+        // read_short_bits reads num bits, 0 <= num <= 56, without branching
+        // on num.
+        inline uint64_t read_short_bits(int num){
+            if(count < num){
+                refill();
+                if(count < num){
+                    err_ = true;
+                    return 0;
+                }
+            }
+            // Two shifts, so that 0 bits do not shift by 64.
+            uint64_t result = (buf >> 1) >> (63 - num);
+            buf <<= num;
+            count -= num;
+            return result;
+        }
+
+        inline uint64_t read_unsigned_varint(){
+            uint64_t decoded_value = 0;
+            for(int shift_amount = 0; shift_amount < 70; shift_amount += 7){
+                uint8_t current = static_cast<uint8_t>(read_bits(8));
+                if(err_)
+                    return 0;
+                decoded_value |= static_cast<uint64_t>(current & 0x7F) << shift_amount;
+                if((current & 0x80) == 0)
+                    return decoded_value;
+            }
+            err_ = true;
+            return 0;
+        }
+
+        inline int64_t read_signed_varint(){
+            uint64_t unsigned_value = read_unsigned_varint();
+            return static_cast<int64_t>(unsigned_value & 1 ? ~(unsigned_value >> 1) : (unsigned_value >> 1));
+        }
+
+        bool error() const{
+            return err_;
+        }
+};
+
+}}
+
+#endif
@@ -42,7 +42,7 @@ BitStream::BitStream(const uint8_t * stream_ptr, int size): stream_ptr(stream_pt
 
 // Write mode, tail_count
 BitStream::BitStream(){
-    stream = std::vector<uint8_t>(0);
+    stream = ChunkBuffer();
     head_count = 0;
     tail_count = 0;
     vector_mode = true;
@@ -52,8 +52,7 @@ BitStream::BitStream(){
 
 // Write mode, tail_count
 BitStream::BitStream(int size){
-    stream = std::vector<uint8_t>(size, 0);
-    stream.reserve(128);
+    stream = ChunkBuffer(size);
     head_count = 0;
     tail_count = 0;
     vector_mode = true;
@@ -398,13 +397,13 @@ std::pair<int64_t, uint8_t> BitStream::read_signed_varint(int pos){
 }
 
 // Only called when vector mode
-std::vector<uint8_t> * BitStream::bytes(){
+ChunkBuffer * BitStream::bytes(){
     return &stream;
 }
 
 const uint8_t * BitStream::bytes_ptr()const{
     if(vector_mode)
-        return &(stream[0]);
+        return stream.data();
     else
         return stream_ptr;
 }
@@ -415,7 +414,7 @@ void BitStream::pop_front(){
     ++index;
 }
 
-std::vector<uint8_t> & BitStream::get_stream(){
+ChunkBuffer & BitStream::get_stream(){
     return stream;
 }
 
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "base/TSDBException.hpp"
+#include "chunk/ChunkBuffer.hpp"
 
 namespace tsdb{
 namespace chunk{
@@ -17,7 +18,7 @@ extern const bool ONE;
 // TODO RW mode
 class BitStream{
     public:
-        std::vector<uint8_t> stream;
+        ChunkBuffer stream;
         const uint8_t * stream_ptr;
         uint8_t head_count;  // number of valid bits in current byte
         uint8_t tail_count; 
@@ -60,13 +61,13 @@ class BitStream{
         std::pair<int64_t, uint8_t> read_signed_varint(int pos);
 
         // Only called when vector mode
-        std::vector<uint8_t> * bytes();
+        ChunkBuffer * bytes();
 
         const uint8_t * bytes_ptr()const;
 
         void pop_front();
 
-        std::vector<uint8_t> & get_stream();
+        ChunkBuffer & get_stream();
 
         int size();
         int write_pos();
@@ -0,0 +1,96 @@
+#ifndef BITWRITER_H
+#define BITWRITER_H
+
+#include <memory>
+#include <stdint.h>
+
+#include "base/Endian.hpp"
+#include "chunk/ChunkBuffer.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+// BitWriter writes a bit stream in the format of BitStream. The bits are
+// gathered left aligned in a 64-bit register and stored a whole word at a
+// time, the last bits only reach the buffer on flush().
+//
+// Like ChunkBuffer, it only adds bytes behind those flushed and fills the
+// unused low bits of the last one, so that flushed bytes can be read in place
+// while appending goes on.
+class BitWriter{
+    private:
+        ChunkBuffer stream;
+        uint64_t buf;
+        int count;  // Number of bits in buf.
+        int pos;    // Bytes before buf.
+
+        inline void store(){
+            if(stream.size() < pos + 8)
+                stream.resize(pos + 8);
+            base::put_uint64_big_endian(stream.data() + pos, buf);
+            pos += 8;
+        }
+
+    public:
+        BitWriter(): buf(0), count(0), pos(0){}
+
+        // Starts behind size zeroed bytes.
+        explicit BitWriter(int size): stream(size), buf(0), count(0), pos(size){}
+
+        inline void write_bit(bool bit){
+            if(bit)
+                buf |= 1ULL << (63 - count);
+            if(++ count == 64){
+                store();
+                buf = 0;
+                count = 0;
+            }
+        }
+
+        // write_bits writes the num low bits of bits, 0 <= num <= 64.
+        inline void write_bits(uint64_t bits, int num){
+            if(num <= 0)
+                return;
+            bits <<= 64 - num;
+            buf |= bits >> count;
+            if(count + num < 64){
+                count += num;
+                return;
+            }
+            store();
+            int rest = count + num - 64;
+            buf = rest > 0 ? bits << (num - rest) : 0;
+            count = rest;
+        }
+
+        inline void write_byte(uint8_t byte){
+            write_bits(byte, 8);
+        }
+
+        // flush stores the bits written so far, the last byte padded with zeros.
+        void flush(){
+            int n = (count + 7) >> 3;
+            if(stream.size() < pos + n)
+                stream.resize(pos + n);
+            uint8_t * p = stream.data() + pos;
+            for(int i = 0; i < n; ++ i)
+                p[i] = static_cast<uint8_t>(buf >> (56 - 8 * i));
+        }
+
+        // The bytes as of the last flush().
+        uint8_t * bytes(){
+            return stream.data();
+        }
+
+        int size() const{
+            return stream.size();
+        }
+
+        ChunkBuffer & get_stream(){
+            return stream;
+        }
+};
+
+}}
+
+#endif
@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <string.h>
+
+#include "base/Endian.hpp"
+#include "base/TSDBException.hpp"
+#include "chunk/ChimpChunk.hpp"
+#include "chunk/DeltaOfDelta.hpp"
+#include "chunk/EmptyAppender.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+namespace{
+
+const uint64_t CHIMP_INDEX_MASK = (1ULL << (CHIMP_THRESHOLD + 1)) - 1;
+
+// Stored leading zeros when the next value can not reuse them.
+const uint8_t NO_LEADING_ZERO = 65;
+
+// Leading zeros are rounded down to one of 8 counts stored in 3 bits.
+const uint8_t LEADING_ROUND[8] = {0, 8, 12, 16, 18, 20, 22, 24};
+
+inline int leading_representation(int lz){
+    if(lz < 8)
+        return 0;
+    if(lz < 12)
+        return 1;
+    if(lz < 16)
+        return 2;
+    if(lz >= 24)
+        return 7;
+    return 3 + ((lz - 16) >> 1);
+}
+
+// How a value is stored, by its control bits.
+enum ChimpControl{
+    CHIMP_SAME = 0,         // 00, same as a previous value.
+    CHIMP_TRAILING = 1,     // 01, XOR with a previous value with many trailing zeros.
+    CHIMP_STORED = 2,       // 10, XOR with the last value with the stored leading zeros.
+    CHIMP_LEADING = 3,      // 11, XOR with the last value with new leading zeros.
+};
+
+// ChimpHeader is the decoding of the first five bits of a value, which tell
+// its control bits, the length of its header and the leading zeros of 11.
+struct ChimpHeader{
+    uint8_t control;
+    uint8_t bits;
+    uint8_t leading_zero;
+};
+
+struct ChimpHeaders{
+    ChimpHeader h[32];
+
+    ChimpHeaders(){
+        const uint8_t bits[4] = {2 + CHIMP_PREVIOUS_VALUES_LOG2, 2 + CHIMP_PREVIOUS_VALUES_LOG2 + 3 + 6, 2, 5};
+        for(int i = 0; i < 32; ++ i){
+            h[i].control = static_cast<uint8_t>(i >> 3);
+            h[i].bits = bits[i >> 3];
+            h[i].leading_zero = h[i].control == CHIMP_LEADING ? LEADING_ROUND[i & 7] : NO_LEADING_ZERO;
+        }
+    }
+};
+
+const ChimpHeaders CHIMP_HEADERS;
+
+// read_chimp_value reads the value of index idx > 0, last is the value before
+// it and the previous values are in values.
+//
+// The control bits of noisy values hardly repeat, so the four cases are
+// decoded alike instead of branching on them: the header is looked up from
+// one peek, then the XORed bits are read and applied to the value selected.
+inline bool read_chimp_value(BitReader & reader, uint64_t * values, unsigned idx, uint64_t & last, uint8_t & stored_leading_zero){
+    uint64_t w = reader.peek();
+    const ChimpHeader & h = CHIMP_HEADERS.h[w >> 59];
+    int control = h.control;
+    bool with_last = control >= CHIMP_STORED;
+
+    // pos, leading zeros and sigbits of 00 and 01.
+    unsigned pos = static_cast<unsigned>(w >> (62 - CHIMP_PREVIOUS_VALUES_LOG2)) & (CHIMP_PREVIOUS_VALUES - 1);
+    int trailing_leading_zero = LEADING_ROUND[(w >> (59 - CHIMP_PREVIOUS_VALUES_LOG2)) & 7];
+    int sigbits = static_cast<int>(w >> (53 - CHIMP_PREVIOUS_VALUES_LOG2)) & 0x3f;
+
+    uint8_t leading_zero = control == CHIMP_LEADING ? h.leading_zero : stored_leading_zero;
+    int num = with_last ? 64 - leading_zero : (control == CHIMP_TRAILING ? sigbits : 0);
+    int shift = control == CHIMP_TRAILING ? 64 - trailing_leading_zero - sigbits : 0;
+    bool bad = reader.available() < h.bits ||
+               (control == CHIMP_STORED && stored_leading_zero == NO_LEADING_ZERO) ||
+               (control == CHIMP_TRAILING && (sigbits == 0 || shift < 0));
+    if(bad)
+        return false;
+    reader.consume(h.bits);
+    uint64_t x = num > 56 ? reader.read_bits(num) : reader.read_short_bits(num);
+    if(reader.error())
+        return false;
+
+    uint64_t v = (with_last ? last : values[pos]) ^ (x << shift);
+    stored_leading_zero = with_last ? leading_zero : NO_LEADING_ZERO;
+    values[idx & (CHIMP_PREVIOUS_VALUES - 1)] = v;
+    last = v;
+    return true;
+}
+
+}
+
+ChimpIterator::ChimpIterator(const uint8_t * stream_ptr, int size, const std::shared_ptr<const uint8_t> & region):
+        timestamp(0),
+        value(0),
+        delta_timestamp(0),
+        stored_leading_zero(NO_LEADING_ZERO),
+        num_read(0),
+        err_(false),
+        region(region)
+{
+    num_total = base::get_uint16_big_endian(stream_ptr);
+    // Skip the first two bytes
+    reader = BitReader(stream_ptr + 2, size - 2);
+}
+
+std::pair<int64_t, double> ChimpIterator::at() const{
+    return std::make_pair(timestamp, value);
+}
+
+bool ChimpIterator::next() const{
+    if(err_ || num_read == num_total)
+        return false;
+
+    if(num_read == 0){
+        int64_t current_t = reader.read_signed_varint();
+        uint64_t current_v = reader.read_bits(64);
+        if(reader.error()){
+            err_ = true;
+            return false;
+        }
+
+        timestamp = current_t;
+        values[0] = current_v;
+        value = base::decode_double(current_v);
+        ++ num_read;
+        return true;
+    }
+    else if(num_read == 1){
+        int64_t delta_t = reader.read_signed_varint();
+        if(reader.error()){
+            err_ = true;
+            return false;
+        }
+
+        delta_timestamp = delta_t;
+        timestamp += delta_t;
+    }
+    else{
+        int64_t delta_delta;
+        if(!read_delta_delta(reader, delta_delta)){
+            err_ = true;
+            return false;
+        }
+
+        // Possible overflow
+        delta_timestamp = static_cast<uint64_t>(delta_delta + static_cast<int64_t>(delta_timestamp));
+        timestamp += static_cast<int64_t>(delta_timestamp);
+    }
+
+    uint64_t last = base::encode_double(value);
+    if(!read_chimp_value(reader, values, num_read, last, stored_leading_zero)){
+        err_ = true;
+        return false;
+    }
+    value = base::decode_double(last);
+    ++ num_read;
+    return true;
+}
+
+int ChimpIterator::next_batch(int64_t * ts, double * vs, int max) const{
+    int n = 0;
+    // The first two samples are encoded differently.
+    while(n < max && num_read < 2 && ChimpIterator::next()){
+        ts[n] = timestamp;
+        vs[n] = value;
+        ++ n;
+    }
+    if(err_ || num_read < 2)
+        return n;
+
+    // The state is kept in locals while decoding the rest.
+    BitReader r = reader;
+    int64_t t = timestamp;
+    uint64_t dt = delta_timestamp;
+    uint64_t last = base::encode_double(value);
+    uint8_t lz = stored_leading_zero;
+    unsigned idx = num_read;
+    unsigned end = idx + std::min(max - n, static_cast<int>(num_total) - static_cast<int>(idx));
+    for(; idx < end; ++ idx){
+        // Regular scrapes mostly store a delta of deltas of 0, a single 0 bit
+        // taken from the same peek as the value header.
+        int64_t delta_delta = 0;
+        if(__builtin_expect((r.peek() >> 63) == 0 && r.available() > 0, 1))
+            r.consume(1);
+        else if(!read_delta_delta(r, delta_delta)){
+            err_ = true;
+            break;
+        }
+        if(!read_chimp_value(r, values, idx, last, lz)){
+            err_ = true;
+            break;
+        }
+        dt = static_cast<uint64_t>(delta_delta + static_cast<int64_t>(dt));
+        t += static_cast<int64_t>(dt);
+        ts[n] = t;
+        vs[n] = base::decode_double(last);
+        ++ n;
+    }
+
+    reader = r;
+    timestamp = t;
+    delta_timestamp = dt;
+    stored_leading_zero = lz;
+    value = base::decode_double(last);
+    num_read = idx;
+    return n;
+}
+
+bool ChimpIterator::error() const{
+    return err_;
+}
+
+ChimpAppender::ChimpAppender(BitWriter & bstream, int & num_samples, const ChimpIterator & it):
+        bstream(bstream),
+        num_samples(num_samples),
+        timestamp(it.timestamp),
+        delta_timestamp(it.delta_timestamp),
+        stored_leading_zero(it.stored_leading_zero),
+        indices(new uint16_t[CHIMP_INDEX_MASK + 1])
+{
+    memcpy(values, it.values, sizeof(values));
+    memset(indices.get(), 0, (CHIMP_INDEX_MASK + 1) * sizeof(uint16_t));
+    // Only the indices of the values still in the window matter, the others
+    // are too old to be used anyway.
+    for(int i = std::max(0, num_samples - CHIMP_PREVIOUS_VALUES); i < num_samples; ++ i)
+        indices[values[i % CHIMP_PREVIOUS_VALUES] & CHIMP_INDEX_MASK] = i;
+}
+
+void ChimpAppender::write_value(uint64_t value){
+    int idx = num_samples;
+    int key = value & CHIMP_INDEX_MASK;
+    int pos = (idx - 1) % CHIMP_PREVIOUS_VALUES;
+    uint64_t x = value ^ values[pos];
+
+    int candidate = indices[key];
+    if(idx - candidate <= CHIMP_PREVIOUS_VALUES){
+        uint64_t candidate_x = value ^ values[candidate % CHIMP_PREVIOUS_VALUES];
+        if(candidate_x == 0 || __builtin_ctzll(candidate_x) > CHIMP_THRESHOLD){
+            pos = candidate % CHIMP_PREVIOUS_VALUES;
+            x = candidate_x;
+        }
+    }
+
+    if(x == 0){
+        bstream.write_bits(static_cast<uint64_t>(pos), 2 + CHIMP_PREVIOUS_VALUES_LOG2);    // 00
+        stored_leading_zero = NO_LEADING_ZERO;
+    }
+    else{
+        int repr = leading_representation(__builtin_clzll(x));
+        int leading_zero = LEADING_ROUND[repr];
+        int trailing_zero = __builtin_ctzll(x);
+        if(trailing_zero > CHIMP_THRESHOLD){
+            int sigbits = 64 - leading_zero - trailing_zero;
+            uint64_t bits = (1ULL << 16) | (static_cast<uint64_t>(pos) << 9) | (static_cast<uint64_t>(repr) << 6) | sigbits;
+            bstream.write_bits(bits, 2 + CHIMP_PREVIOUS_VALUES_LOG2 + 3 + 6);  // 01
+            bstream.write_bits(x >> trailing_zero, sigbits);
+            stored_leading_zero = NO_LEADING_ZERO;
+        }
+        else if(leading_zero == stored_leading_zero){
+            bstream.write_bits(0x02, 2);   // 10
+            bstream.write_bits(x, 64 - leading_zero);
+        }
+        else{
+            stored_leading_zero = leading_zero;
+            bstream.write_bits(0x18 | repr, 5);   // 11
+            bstream.write_bits(x, 64 - leading_zero);
+        }
+    }
+
+    values[idx % CHIMP_PREVIOUS_VALUES] = value;
+    indices[key] = idx;
+}
+
+void ChimpAppender::append(int64_t timestamp, double value){
+    uint64_t current_delta_timestamp = 0;
+    uint64_t v = base::encode_double(value);
+
+    if(num_samples == 0){
+        uint8_t temp[base::MAX_VARINT_LEN_64];
+        int encoded = base::encode_signed_varint(temp, timestamp);
+        for(int i = 0; i < encoded; i ++)
+            bstream.write_byte(temp[i]);
+
+        bstream.write_bits(v, 64);
+        values[0] = v;
+        indices[v & CHIMP_INDEX_MASK] = 0;
+    }
+    else if(num_samples == 1){
+        current_delta_timestamp = timestamp - this->timestamp;
+
+        uint8_t temp[base::MAX_VARINT_LEN_64];
+        int encoded = base::encode_signed_varint(temp, current_delta_timestamp);
+        for(int i = 0; i < encoded; i ++)
+            bstream.write_byte(temp[i]);
+
+        write_value(v);
+    }
+    else{
+        current_delta_timestamp = timestamp - this->timestamp;
+        write_delta_delta(bstream, current_delta_timestamp - this->delta_timestamp);
+        write_value(v);
+    }
+
+    this->timestamp = timestamp;
+    ++ num_samples;
+    this->delta_timestamp = current_delta_timestamp;
+}
+
+// The first two bytes store the num of samples using big endian
+ChimpChunk::ChimpChunk(): writer(2), num_samples_(0), read_mode(false), ptr(nullptr), size_(0){}
+
+ChimpChunk::ChimpChunk(const uint8_t * stream_ptr, uint64_t size): num_samples_(0), read_mode(true), ptr(stream_ptr), size_(size){}
+
+// The appender keeps the last bits and the number of samples to itself, they
+// are only written out when the chunk is read.
+void ChimpChunk::flush(){
+    writer.flush();
+    base::put_uint16_big_endian(writer.bytes(), num_samples_);
+}
+
+const uint8_t * ChimpChunk::bytes(){
+    if(read_mode)
+        return ptr;
+    flush();
+    return writer.bytes();
+}
+
+uint8_t ChimpChunk::encoding(){
+    return static_cast<uint8_t>(EncChimp);
+}
+
+std::unique_ptr<ChunkAppenderInterface> ChimpChunk::appender(){
+    if(read_mode)
+        return std::unique_ptr<ChunkAppenderInterface>(new EmptyAppender());
+    std::unique_ptr<ChimpIterator> it = chimp_iterator();
+    while(it->next()){}
+    if(it->error())
+        throw base::TSDBException("Broken BitStream in ChimpChunk");
+    return std::unique_ptr<ChunkAppenderInterface>(new ChimpAppender(writer, num_samples_, *it));
+}
+
+std::unique_ptr<ChunkIteratorInterface> ChimpChunk::iterator(){
+    if(read_mode)
+        return std::unique_ptr<ChunkIteratorInterface>(new ChimpIterator(ptr, size_, nullptr));
+    // Hold the buffer of a chunk not created in read mode, so that it stays
+    // valid when growing during appending new data.
+    flush();
+    return std::unique_ptr<ChunkIteratorInterface>(new ChimpIterator(writer.bytes(), writer.size(), writer.get_stream().share()));
+}
+
+std::unique_ptr<ChimpIterator> ChimpChunk::chimp_iterator(){
+    flush();
+    return std::unique_ptr<ChimpIterator>(new ChimpIterator(writer.bytes(), writer.size(), nullptr));
+}
+
+int ChimpChunk::num_samples(){
+    if(read_mode)
+        return base::get_uint16_big_endian(ptr);
+    return num_samples_;
+}
+
+uint64_t ChimpChunk::size(){
+    if(read_mode)
+        return size_;
+    flush();
+    return writer.size();
+}
+
+}}
@@ -0,0 +1,109 @@
+#ifndef CHIMPCHUNK_H
+#define CHIMPCHUNK_H
+
+#include <memory>
+
+#include "chunk/BitReader.hpp"
+#include "chunk/BitWriter.hpp"
+#include "chunk/ChunkAppenderInterface.hpp"
+#include "chunk/ChunkInterface.hpp"
+#include "chunk/ChunkIteratorInterface.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+// Number of previous values a value can be XORed with, see
+// docs/format/chimp_chunk.md.
+const int CHIMP_PREVIOUS_VALUES = 128;
+const int CHIMP_PREVIOUS_VALUES_LOG2 = 7;
+
+// A previous value is picked if its XOR with the value has more trailing
+// zeros than this, it is found by the lowest CHIMP_THRESHOLD + 1 bits.
+const int CHIMP_THRESHOLD = 6 + CHIMP_PREVIOUS_VALUES_LOG2;
+
+class ChimpIterator: public ChunkIteratorInterface{
+    public:
+        mutable BitReader reader;
+        mutable int64_t timestamp;  // Millisecond
+        mutable double value;
+        mutable uint64_t delta_timestamp;
+        mutable uint8_t stored_leading_zero;
+        mutable uint64_t values[CHIMP_PREVIOUS_VALUES];  // Previous values by their index modulo CHIMP_PREVIOUS_VALUES.
+        mutable uint16_t num_total;
+        mutable uint16_t num_read;
+        mutable bool err_;
+        // Region of the chunk being appended to which is read in place.
+        std::shared_ptr<const uint8_t> region;
+
+    public:
+        // Reads the size bytes at stream_ptr, see XORIterator for region.
+        ChimpIterator(const uint8_t * stream_ptr, int size, const std::shared_ptr<const uint8_t> & region);
+
+        std::pair<int64_t, double> at() const;
+
+        bool next() const;
+
+        int next_batch(int64_t * ts, double * vs, int max) const;
+
+        bool error() const;
+};
+
+class ChimpAppender: public ChunkAppenderInterface{
+    private:
+        BitWriter & bstream;
+        int & num_samples;
+        int64_t timestamp;  // Millisecond
+        uint64_t delta_timestamp;
+        uint8_t stored_leading_zero;
+        uint64_t values[CHIMP_PREVIOUS_VALUES];
+        // Index of the last value by its lowest CHIMP_THRESHOLD + 1 bits.
+        std::unique_ptr<uint16_t[]> indices;
+
+        void write_value(uint64_t value);
+
+    public:
+        // Continues behind the samples read by it, which must have read all
+        // of them. num_samples is the sample count of the chunk, kept up to
+        // date instead of in the stream.
+        ChimpAppender(BitWriter & bstream, int & num_samples, const ChimpIterator & it);
+
+        void append(int64_t timestamp, double value);
+};
+
+// ChimpChunk stores timestamps like XORChunk and XORs every value with the one
+// among the previous CHIMP_PREVIOUS_VALUES giving the most trailing zeros, as
+// proposed by Chimp128. It compresses noisy gauges better than XORChunk.
+class ChimpChunk: public ChunkInterface{
+    private:
+        BitWriter writer;   // Write mode
+        int num_samples_;   // Write mode, stored in the first two bytes by flush()
+        bool read_mode;
+        const uint8_t * ptr;    // Read mode
+        uint64_t size_;
+
+        void flush();
+
+        std::unique_ptr<ChimpIterator> chimp_iterator();
+
+    public:
+        // The first two bytes store the num of samples using big endian
+        ChimpChunk();
+
+        ChimpChunk(const uint8_t * stream_ptr, uint64_t size);
+
+        const uint8_t * bytes();
+
+        uint8_t encoding();
+
+        std::unique_ptr<ChunkAppenderInterface> appender();
+
+        std::unique_ptr<ChunkIteratorInterface> iterator();
+
+        int num_samples();
+
+        uint64_t size();
+};
+
+}}
+
+#endif
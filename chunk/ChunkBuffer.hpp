@@ -0,0 +1,101 @@
+#ifndef CHUNKBUFFER_H
+#define CHUNKBUFFER_H
+
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace tsdb{
+namespace chunk{
+
+// ChunkBuffer is the growable byte buffer of a chunk being written. Unlike a
+// std::vector it never moves written bytes. Once the capacity is exhausted the
+// bytes are copied into a region twice as large, the old region stays alive as
+// long as readers share() it.
+//
+// Appending only adds bytes behind size() and fills the unused low bits of
+// the last byte, so a reader which shared the region and remembered how much
+// of it was valid can keep reading in place while the buffer is appended to.
+//
+// Copies are deep, every buffer has a single writer.
+class ChunkBuffer{
+    private:
+        std::shared_ptr<uint8_t> region;
+        int len;
+        int cap;
+
+        void grow(int min_cap){
+            int new_cap = cap > 0 ? cap * 2 : 128;
+            while(new_cap < min_cap)
+                new_cap *= 2;
+            std::shared_ptr<uint8_t> r(new uint8_t[new_cap](), std::default_delete<uint8_t[]>());
+            if(len > 0)
+                memcpy(r.get(), region.get(), len);
+            region = r;
+            cap = new_cap;
+        }
+
+    public:
+        ChunkBuffer(): len(0), cap(0){}
+
+        // size zeroed bytes.
+        explicit ChunkBuffer(int size): len(0), cap(0){
+            grow(size);
+            len = size;
+        }
+
+        ChunkBuffer(const uint8_t * data, int size): len(0), cap(0){
+            if(size > 0){
+                grow(size);
+                memcpy(region.get(), data, size);
+            }
+            len = size;
+        }
+
+        ChunkBuffer(const std::vector<uint8_t> & v): ChunkBuffer(v.data(), v.size()){}
+
+        ChunkBuffer(const ChunkBuffer & b): ChunkBuffer(b.data(), b.size()){}
+
+        ChunkBuffer & operator=(const ChunkBuffer & b){
+            if(this != &b){
+                ChunkBuffer tmp(b);
+                region.swap(tmp.region);
+                len = tmp.len;
+                cap = tmp.cap;
+            }
+            return *this;
+        }
+
+        void push_back(uint8_t b){
+            if(len == cap)
+                grow(len + 1);
+            region.get()[len ++] = b;
+        }
+
+        // resize extends the buffer to size bytes, the bytes added are zero.
+        void resize(int size){
+            if(size > cap)
+                grow(size);
+            if(size > len)
+                len = size;
+        }
+
+        uint8_t & back(){ return region.get()[len - 1]; }
+
+        uint8_t & operator[](int i){ return region.get()[i]; }
+        uint8_t operator[](int i) const{ return region.get()[i]; }
+
+        uint8_t * data(){ return region.get(); }
+        const uint8_t * data() const{ return region.get(); }
+
+        int size() const{ return len; }
+
+        // The returned pointer keeps the current region alive, it stays valid
+        // for the bytes written so far whatever is appended afterwards.
+        std::shared_ptr<const uint8_t> share() const{ return region; }
+};
+
+}}
+
+#endif
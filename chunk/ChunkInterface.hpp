@@ -12,7 +12,7 @@
 namespace tsdb{
 namespace chunk{
 
-enum Encoding {EncNone, EncXOR, EncGM1, EncGD1, EncGHC};
+enum Encoding {EncNone, EncXOR, EncGM1, EncGD1, EncGHC, EncInt, EncChimp};
 
 class ChunkInterface{
     // NOTE Can only have one appender at the same time.
@@ -38,16 +38,15 @@ bool ChunkReader::validate()
     return valid;
 }
 
-// Will return EmptyChunk when error
-std::pair<std::shared_ptr<ChunkInterface>, bool>
-ChunkReader::chunk(tagtree::TSID, uint64_t ref)
+std::pair<std::pair<const uint8_t*, int>, uint8_t>
+ChunkReader::locate(uint64_t ref)
 {
     int seq = static_cast<int>(ref >> 32);
     int offset = static_cast<int>((ref << 32) >> 32);
     if (seq >= bs.size() || offset >= bs[seq]->len()) {
         LOG_ERROR << "Ref: " << ref
                   << " chunk is invalid ---- bs.size(): " << bs.size();
-        return {std::shared_ptr<ChunkInterface>(new EmptyChunk()), false};
+        return {{nullptr, 0}, EncNone};
     }
 
     // Get the length of the chunk
@@ -60,17 +59,32 @@ ChunkReader::chunk(tagtree::TSID, uint64_t ref)
     if (l > std::numeric_limits<uint32_t>::max() ||
         offset + l + decoded + 1 > bs[seq]->len()) {
         LOG_ERROR << "Ref: " << ref << " chunk length exceed uint32_t maximum";
-        return {std::shared_ptr<ChunkInterface>(new EmptyChunk()), false};
+        return {{nullptr, 0}, EncNone};
     }
+    uint8_t enc =
+        *(bs[seq]->range(offset + decoded, offset + decoded + 1).first);
 
     stream = bs[seq]->range(offset + decoded + 1,
                             offset + decoded + 1 + static_cast<int>(l));
+    return {{stream.first, static_cast<int>(l)}, enc};
+}
+
+// Will return EmptyChunk when error
+std::pair<std::shared_ptr<ChunkInterface>, bool>
+ChunkReader::chunk(tagtree::TSID, uint64_t ref)
+{
+    std::pair<std::pair<const uint8_t*, int>, uint8_t> c = locate(ref);
+    if (!c.first.first)
+        return {std::shared_ptr<ChunkInterface>(new EmptyChunk()), false};
 
-    // TODO determine different encoding
-    // A read mode XORChunk
-    return {std::shared_ptr<ChunkInterface>(
-                new XORChunk(stream.first, static_cast<int>(l))),
-            true};
+    std::shared_ptr<ChunkInterface> r =
+        from_data(c.second, c.first.first, c.first.second);
+    if (!r) {
+        LOG_ERROR << "Ref: " << ref << " unknown chunk encoding "
+                  << static_cast<int>(c.second);
+        return {std::shared_ptr<ChunkInterface>(new EmptyChunk()), false};
+    }
+    return {r, true};
 }
 
 bool ChunkReader::error() { return err_; }
@@ -14,13 +14,17 @@ namespace chunk {
 
 // TODO(Alec), more chunk types.
 class ChunkReader : public block::ChunkReaderInterface {
-private:
+protected:
     std::deque<std::shared_ptr<tsdbutil::ByteSlice>> bs;
 
     bool err_;
 
     uint64_t size_;
 
+    // locate returns <data, length> of the chunk at ref and its encoding,
+    // data is nullptr if ref is invalid.
+    std::pair<std::pair<const uint8_t*, int>, uint8_t> locate(uint64_t ref);
+
 public:
     // Implicit construct from const char *
     ChunkReader(const std::string& dir);
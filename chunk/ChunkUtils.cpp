@@ -3,8 +3,10 @@
 #include <limits>
 
 #include "chunk/ChunkUtils.hpp"
+#include "chunk/ChimpChunk.hpp"
 // #include "chunk/GroupDiskChunk1.hpp"
 // #include "chunk/GroupMemoryChunk1.hpp"
+#include "chunk/IntChunk.hpp"
 #include "chunk/XORChunk.hpp"
 // #include "querier/GroupAllChunkSeriesIterator.hpp"
 
@@ -59,17 +61,77 @@ std::deque<std::string> sequence_files(const std::string& dir)
     return r;
 }
 
+std::shared_ptr<ChunkInterface> new_chunk(uint8_t encoding)
+{
+    switch (encoding) {
+    case EncXOR:
+        return std::shared_ptr<ChunkInterface>(new XORChunk());
+    case EncInt:
+        return std::shared_ptr<ChunkInterface>(new IntChunk());
+    case EncChimp:
+        return std::shared_ptr<ChunkInterface>(new ChimpChunk());
+    default:
+        return nullptr;
+    }
+}
+
+std::shared_ptr<ChunkInterface> from_data(uint8_t encoding, const uint8_t* data,
+                                          int size)
+{
+    switch (encoding) {
+    case EncXOR:
+        return std::shared_ptr<ChunkInterface>(new XORChunk(data, size));
+    case EncInt:
+        return std::shared_ptr<ChunkInterface>(new IntChunk(data, size));
+    case EncChimp:
+        return std::shared_ptr<ChunkInterface>(new ChimpChunk(data, size));
+    default:
+        return nullptr;
+    }
+}
+
+std::pair<std::shared_ptr<chunk::ChunkInterface>, error::Error>
+recode_chunk(const std::shared_ptr<chunk::ChunkInterface>& c, uint8_t encoding)
+{
+    std::shared_ptr<chunk::ChunkInterface> r = new_chunk(encoding);
+    if (!r)
+        return {nullptr, error::Error("unknown chunk encoding " +
+                                      std::to_string(encoding))};
+    std::unique_ptr<chunk::ChunkAppenderInterface> app;
+    try {
+        app = r->appender();
+    } catch (const base::TSDBException& e) {
+        return {nullptr, error::Error(e.what())};
+    }
+
+    // Decoded in batches, the chunks of a whole block pass through here.
+    int64_t ts[128];
+    double vs[128];
+    std::unique_ptr<ChunkIteratorInterface> it = c->iterator();
+    int n;
+    while ((n = it->next_batch(ts, vs, 128)) > 0) {
+        for (int i = 0; i < n; ++i)
+            app->append(ts[i], vs[i]);
+    }
+    if (it->error())
+        return {nullptr, error::Error("Error in chunk iterator")};
+    return {r, error::Error()};
+}
+
 // merge_chunks vertically merges a and b, i.e., if there is any sample
 // with same timestamp in both a and b, the sample in a is discarded.
 std::pair<std::shared_ptr<chunk::ChunkInterface>, error::Error>
 merge_chunks(const std::shared_ptr<chunk::ChunkInterface>& c1,
              const std::shared_ptr<chunk::ChunkInterface>& c2)
 {
-    std::shared_ptr<chunk::ChunkInterface> new_chunk =
-        std::shared_ptr<chunk::XORChunk>(new chunk::XORChunk());
+    // Integral samples stay in an IntChunk.
+    std::shared_ptr<chunk::ChunkInterface> merged =
+        new_chunk(c1->encoding() == EncInt && c2->encoding() == EncInt
+                      ? EncInt
+                      : EncXOR);
     std::unique_ptr<chunk::ChunkAppenderInterface> app;
     try {
-        app = new_chunk->appender();
+        app = merged->appender();
     } catch (const base::TSDBException& e) {
         return {std::shared_ptr<chunk::ChunkInterface>(),
                 error::Error(e.what())};
@@ -112,7 +174,7 @@ merge_chunks(const std::shared_ptr<chunk::ChunkInterface>& c1,
     if (it2->error())
         return {std::shared_ptr<chunk::ChunkInterface>(),
                 error::Error("Error in second chunk iterator")};
-    return {new_chunk, error::Error()};
+    return {merged, error::Error()};
 }
 
 // merge_overlapping_chunks removes the samples whose timestamp is overlapping.
@@ -25,6 +25,21 @@ std::pair<int, std::string> next_sequence_file(const std::string& dir);
 // Will get the path including the dir name
 std::deque<std::string> sequence_files(const std::string& dir);
 
+// new_chunk returns an empty chunk to append to with the given encoding,
+// nullptr if the encoding is not known.
+std::shared_ptr<ChunkInterface> new_chunk(uint8_t encoding);
+
+// from_data returns a read mode chunk over the bytes of a chunk with the given
+// encoding, nullptr if the encoding is not known.
+std::shared_ptr<ChunkInterface> from_data(uint8_t encoding, const uint8_t* data,
+                                          int size);
+
+// recode_chunk copies the samples of c into a new chunk with the given
+// encoding.
+std::pair<std::shared_ptr<chunk::ChunkInterface>, error::Error>
+recode_chunk(const std::shared_ptr<chunk::ChunkInterface>& c,
+             uint8_t encoding);
+
 // merge_chunks vertically merges a and b, i.e., if there is any sample
 // with same timestamp in both a and b, the sample in a is discarded.
 std::pair<std::shared_ptr<chunk::ChunkInterface>, error::Error>
@@ -11,7 +11,7 @@ namespace tsdb {
 namespace chunk {
 
 class ChunkWriter : public block::ChunkWriterInterface {
-private:
+protected:
     std::string dir; // "[ulid]/chunks"
     std::deque<FILE*> files;
     std::deque<int> seqs;
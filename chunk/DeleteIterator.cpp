@@ -17,7 +17,7 @@ std::pair<int64_t, double> DeleteIterator::at() const{
 bool DeleteIterator::next() const{
     Outer:
         while(it->next()){
-            std::pair<int, int> p = it->at();
+            std::pair<int64_t, double> p = it->at();
             while(itvls_begin != itvls_end){
                 if(itvls_begin->in_bounds(p.first))
                     goto Outer;
@@ -33,6 +33,26 @@ bool DeleteIterator::next() const{
         return false;
 }
 
+int DeleteIterator::next_batch(int64_t * ts, double * vs, int max) const{
+    while(true){
+        int n = it->next_batch(ts, vs, max);
+        if(n == 0)
+            return 0;
+        int kept = 0;
+        for(int i = 0; i < n; ++ i){
+            while(itvls_begin != itvls_end && ts[i] > itvls_begin->max_time)
+                ++ itvls_begin;
+            if(itvls_begin != itvls_end && itvls_begin->in_bounds(ts[i]))
+                continue;
+            ts[kept] = ts[i];
+            vs[kept] = vs[i];
+            ++ kept;
+        }
+        if(kept > 0)
+            return kept;
+    }
+}
+
 bool DeleteIterator::error() const{
     return it->error();
 }
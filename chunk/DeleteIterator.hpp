@@ -28,6 +28,9 @@ public:
 
     bool next() const;
 
+    // The samples of a batch are filtered in place.
+    int next_batch(int64_t* ts, double* vs, int max) const;
+
     bool error() const;
 };
 
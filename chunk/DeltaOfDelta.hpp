@@ -0,0 +1,69 @@
+#ifndef DELTAOFDELTA_H
+#define DELTAOFDELTA_H
+
+#include <stdint.h>
+
+#include "chunk/BitReader.hpp"
+#include "chunk/BitWriter.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+// Timestamps of XOR and Chimp chunks from the third sample on are stored as
+// the delta of deltas, prefixed by 0, 10, 110, 1110 or 1111 followed by 0,
+// 14, 17, 20 or 64 bits.
+
+// Bits of the timestamp delta-of-delta by the number of leading ones of its
+// prefix 0, 10, 110, 1110 or 1111.
+const int DOD_BITS[5] = {0, 14, 17, 20, 64};
+
+// dod_bit_range returns if delta_delta is stored in num bits.
+inline bool dod_bit_range(int64_t delta_delta, int num){
+    return ((-((1<<(num-1))-1) <= delta_delta) && (delta_delta <= 1<<(num-1)));
+}
+
+inline void write_delta_delta(BitWriter & bstream, int64_t delta_delta){
+    if(delta_delta == 0){
+        bstream.write_bit(false);
+    }
+    else if(dod_bit_range(delta_delta, 14)){
+        bstream.write_bits(0x02, 2);   // 10
+        bstream.write_bits(static_cast<uint64_t>(delta_delta), 14);
+    }
+    else if(dod_bit_range(delta_delta, 17)){
+        bstream.write_bits(0x06, 3);   // 110
+        bstream.write_bits(static_cast<uint64_t>(delta_delta), 17);
+    }
+    else if(dod_bit_range(delta_delta, 20)){
+        bstream.write_bits(0x0e, 4);   // 1110
+        bstream.write_bits(static_cast<uint64_t>(delta_delta), 20);
+    }
+    // The above 3 cases need to consider the sign when decoding
+    else{
+        bstream.write_bits(0x0f, 4);   // 1111
+        bstream.write_bits(static_cast<uint64_t>(delta_delta), 64);
+    }
+}
+
+// Read timestamp delta-delta, the prefix is given by the leading ones of the
+// next four bits.
+inline bool read_delta_delta(BitReader & reader, int64_t & delta_delta){
+    uint64_t w = reader.peek();
+    int ones = __builtin_clzll(~w | (1ULL << 59));
+    int prefix = ones < 4 ? ones + 1 : 4;
+    if(prefix > reader.available())
+        return false;
+    reader.consume(prefix);
+
+    int size = DOD_BITS[ones];
+    delta_delta = static_cast<int64_t>(reader.read_bits(size));
+    if(reader.error())
+        return false;
+    if(size != 0 && size != 64 && delta_delta > (1 << (size - 1)))
+        delta_delta -= (1 << size);
+    return true;
+}
+
+}}
+
+#endif
@@ -0,0 +1,450 @@
+#include <algorithm>
+
+#include "base/Endian.hpp"
+#include "chunk/EmptyAppender.hpp"
+#include "chunk/GroupChunk.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+namespace{
+
+void put_uvarint(std::vector<uint8_t> & b, uint64_t v){
+    uint8_t temp[base::MAX_VARINT_LEN_64];
+    int encoded = base::encode_unsigned_varint(temp, v);
+    b.insert(b.end(), temp, temp + encoded);
+}
+
+void put_varint(ChunkBuffer & b, int64_t v){
+    uint8_t temp[base::MAX_VARINT_LEN_64];
+    int encoded = base::encode_signed_varint(temp, v);
+    for(int i = 0; i < encoded; ++ i)
+        b.push_back(temp[i]);
+}
+
+// Values are encoded as in XORChunk, see XORIterator::read_value().
+bool read_xor_value(BitReader & reader, double & value, uint8_t & leading_zero, uint8_t & trailing_zero){
+    uint64_t w = reader.peek();
+    if(reader.available() < 1)
+        return false;
+    if((w >> 63) == 0){
+        reader.consume(1);
+        return true;
+    }
+    if(reader.available() < 2)
+        return false;
+    reader.consume(2);
+
+    if(((w >> 62) & 1) != 0){
+        uint64_t bits = reader.read_bits(11);
+        if(reader.error())
+            return false;
+        leading_zero = static_cast<uint8_t>(bits >> 6);
+        int sigbits = static_cast<int>(bits & 0x3f);
+        if(sigbits == 0)
+            sigbits = 64;
+        if(leading_zero + sigbits > 64)
+            return false;
+        trailing_zero = static_cast<uint8_t>(64 - leading_zero - sigbits);
+    }
+    uint64_t bits = reader.read_bits(static_cast<int>(64 - leading_zero - trailing_zero));
+    if(reader.error())
+        return false;
+    value = base::decode_double(base::encode_double(value) ^ (bits << trailing_zero));
+    return true;
+}
+
+}
+
+GroupChunk::GroupChunk(const std::vector<tagtree::TSID> & tsids):
+        tsids_(tsids),
+        num_samples_(0),
+        read_mode(false),
+        err_(false),
+        last_timestamp(0),
+        last_delta(0),
+        value_columns(tsids.size()),
+        dirty(true),
+        ptr(nullptr),
+        size_(0)
+{
+    for(ValueColumn & c: value_columns){
+        c.value = 0;
+        c.leading_zero = 0xff;
+        c.trailing_zero = 0;
+    }
+}
+
+GroupChunk::GroupChunk(const uint8_t * stream_ptr, uint64_t size):
+        num_samples_(0),
+        read_mode(true),
+        err_(false),
+        dirty(false),
+        ptr(stream_ptr),
+        size_(size)
+{
+    const uint8_t * p = stream_ptr;
+    const uint8_t * end = stream_ptr + size;
+    int decoded = 0;
+    auto uvarint = [&](){
+        uint64_t v = base::decode_unsigned_varint(p, decoded, end - p);
+        if(decoded <= 0){
+            err_ = true;
+            return static_cast<uint64_t>(0);
+        }
+        p += decoded;
+        return v;
+    };
+
+    num_samples_ = uvarint();
+    uint64_t n = uvarint();
+    if(err_ || n > static_cast<uint64_t>(end - p) / 8){
+        err_ = true;
+        return;
+    }
+    tsids_.reserve(n);
+    for(uint64_t i = 0; i < n; ++ i){
+        tsids_.push_back(base::get_uint64_big_endian(p));
+        p += 8;
+    }
+
+    uint64_t ts_len = uvarint();
+    std::vector<uint64_t> value_lens(n);
+    for(uint64_t i = 0; i < n; ++ i)
+        value_lens[i] = uvarint();
+    if(err_ || ts_len > static_cast<uint64_t>(end - p)){
+        err_ = true;
+        return;
+    }
+
+    // Timestamps are decoded once for all the slots.
+    const uint8_t * ts_end = p + ts_len;
+    timestamps_.reserve(num_samples_);
+    int64_t t = 0;
+    int64_t delta = 0;
+    for(int i = 0; i < num_samples_; ++ i){
+        int64_t v = base::decode_signed_varint(p, decoded, ts_end - p);
+        if(decoded <= 0){
+            err_ = true;
+            return;
+        }
+        p += decoded;
+        if(i == 0)
+            t = v;
+        else{
+            delta += v;
+            t += delta;
+        }
+        timestamps_.push_back(t);
+    }
+    p = ts_end;
+
+    value_ranges.reserve(n);
+    for(uint64_t i = 0; i < n; ++ i){
+        if(value_lens[i] > static_cast<uint64_t>(end - p)){
+            err_ = true;
+            return;
+        }
+        value_ranges.emplace_back(p, static_cast<int>(value_lens[i]));
+        p += value_lens[i];
+    }
+}
+
+void GroupChunk::write_value(ValueColumn & c, double value){
+    uint64_t delta_value = base::encode_double(value) ^ base::encode_double(c.value);
+    c.value = value;
+
+    if(delta_value == 0){
+        c.bstream.write_bit(ZERO);
+        return;
+    }
+    c.bstream.write_bit(ONE);
+
+    uint8_t lz = static_cast<uint8_t>(__builtin_clzll(delta_value));
+    uint8_t tz = static_cast<uint8_t>(__builtin_ctzll(delta_value));
+    if(lz >= 32)
+        lz = 31;
+
+    if(c.leading_zero != 0xff && lz >= c.leading_zero && tz >= c.trailing_zero){
+        c.bstream.write_bit(ZERO);
+        c.bstream.write_bits(delta_value >> c.trailing_zero, 64 - static_cast<int>(c.leading_zero) - static_cast<int>(c.trailing_zero));
+    } else {
+        c.leading_zero = lz;
+        c.trailing_zero = tz;
+
+        c.bstream.write_bit(ONE);
+        c.bstream.write_bits(static_cast<uint64_t>(lz), 5);
+        // 64 significant bits are written as 0, see XORAppender.
+        int sigbits = 64 - static_cast<int>(lz) - static_cast<int>(tz);
+        c.bstream.write_bits(static_cast<uint64_t>(sigbits), 6);
+        c.bstream.write_bits(delta_value >> tz, sigbits);
+    }
+}
+
+void GroupChunk::append(int64_t timestamp, const double * values){
+    if(read_mode)
+        return;
+    base::MutexLockGuard lock(mutex_);
+
+    if(num_samples_ == 0){
+        put_varint(ts_column, timestamp);
+        for(size_t i = 0; i < value_columns.size(); ++ i){
+            value_columns[i].bstream.write_bits(base::encode_double(values[i]), 64);
+            value_columns[i].value = values[i];
+        }
+    }
+    else{
+        int64_t delta = timestamp - last_timestamp;
+        put_varint(ts_column, delta - last_delta);
+        last_delta = delta;
+        for(size_t i = 0; i < value_columns.size(); ++ i)
+            write_value(value_columns[i], values[i]);
+    }
+    last_timestamp = timestamp;
+    ++ num_samples_;
+    dirty = true;
+}
+
+void GroupChunk::encode(){
+    buf.clear();
+    put_uvarint(buf, num_samples_);
+    put_uvarint(buf, tsids_.size());
+    for(tagtree::TSID tsid: tsids_){
+        uint8_t temp[8];
+        base::put_uint64_big_endian(temp, static_cast<uint64_t>(tsid));
+        buf.insert(buf.end(), temp, temp + 8);
+    }
+    put_uvarint(buf, ts_column.size());
+    for(ValueColumn & c: value_columns)
+        put_uvarint(buf, c.bstream.size());
+    buf.insert(buf.end(), ts_column.data(), ts_column.data() + ts_column.size());
+    for(ValueColumn & c: value_columns)
+        buf.insert(buf.end(), c.bstream.bytes_ptr(), c.bstream.bytes_ptr() + c.bstream.size());
+    dirty = false;
+}
+
+const uint8_t * GroupChunk::bytes(){
+    if(read_mode)
+        return ptr;
+    base::MutexLockGuard lock(mutex_);
+    if(dirty)
+        encode();
+    return buf.data();
+}
+
+uint8_t GroupChunk::encoding(){
+    return static_cast<uint8_t>(EncGD1);
+}
+
+uint64_t GroupChunk::size(){
+    if(read_mode)
+        return size_;
+    base::MutexLockGuard lock(mutex_);
+    if(dirty)
+        encode();
+    return buf.size();
+}
+
+int GroupChunk::num_samples(){
+    if(read_mode)
+        return num_samples_;
+    base::MutexLockGuard lock(mutex_);
+    return num_samples_;
+}
+
+int GroupChunk::num_series(){
+    return tsids_.size();
+}
+
+const std::vector<tagtree::TSID> & GroupChunk::tsids(){
+    return tsids_;
+}
+
+int GroupChunk::slot(tagtree::TSID tsid){
+    std::vector<tagtree::TSID>::const_iterator it = std::lower_bound(tsids_.cbegin(), tsids_.cend(), tsid);
+    if(it == tsids_.cend() || *it != tsid)
+        return -1;
+    return it - tsids_.cbegin();
+}
+
+const std::vector<int64_t> & GroupChunk::timestamps(){
+    return timestamps_;
+}
+
+std::pair<const uint8_t *, int> GroupChunk::values(int slot){
+    return value_ranges[slot];
+}
+
+std::unique_ptr<ChunkIteratorInterface> GroupChunk::open_slot_iterator(int slot){
+    base::MutexLockGuard lock(mutex_);
+    BitStream & values = value_columns[slot].bstream;
+    return std::unique_ptr<ChunkIteratorInterface>(new GroupOpenSlotIterator(
+        ts_column.share(), ts_column.size(), values.get_stream().share(), values.size(), num_samples_));
+}
+
+bool GroupChunk::error(){
+    return err_;
+}
+
+GroupSlotIterator::GroupSlotIterator(const std::shared_ptr<GroupChunk> & group, int slot):
+        group(group),
+        reader(group->values(slot).first, group->values(slot).second),
+        num_read(0),
+        value(0),
+        leading_zero(0),
+        trailing_zero(0),
+        err_(false)
+{}
+
+std::pair<int64_t, double> GroupSlotIterator::at() const{
+    return std::make_pair(group->timestamps()[num_read - 1], value);
+}
+
+bool GroupSlotIterator::next() const{
+    if(err_ || num_read == group->num_samples())
+        return false;
+
+    if(num_read == 0){
+        value = base::decode_double(reader.read_bits(64));
+        if(reader.error()){
+            err_ = true;
+            return false;
+        }
+        ++ num_read;
+        return true;
+    }
+    if(!read_value()){
+        err_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool GroupSlotIterator::read_value() const{
+    if(!read_xor_value(reader, value, leading_zero, trailing_zero))
+        return false;
+    ++ num_read;
+    return true;
+}
+
+bool GroupSlotIterator::error() const{
+    return err_;
+}
+
+GroupOpenSlotIterator::GroupOpenSlotIterator(const std::shared_ptr<const uint8_t> & ts_region, int ts_len, const std::shared_ptr<const uint8_t> & value_region, int value_len, int num_total):
+        ts_region(ts_region),
+        value_region(value_region),
+        ts_ptr(ts_region.get()),
+        ts_end(ts_region.get() + ts_len),
+        reader(value_region.get(), value_len),
+        num_total(num_total),
+        num_read(0),
+        timestamp(0),
+        delta(0),
+        value(0),
+        leading_zero(0),
+        trailing_zero(0),
+        err_(false)
+{}
+
+std::pair<int64_t, double> GroupOpenSlotIterator::at() const{
+    return std::make_pair(timestamp, value);
+}
+
+bool GroupOpenSlotIterator::next() const{
+    if(err_ || num_read == num_total)
+        return false;
+
+    int decoded = 0;
+    int64_t v = base::decode_signed_varint(ts_ptr, decoded, ts_end - ts_ptr);
+    if(decoded <= 0){
+        err_ = true;
+        return false;
+    }
+    ts_ptr += decoded;
+
+    if(num_read == 0){
+        timestamp = v;
+        value = base::decode_double(reader.read_bits(64));
+        if(reader.error()){
+            err_ = true;
+            return false;
+        }
+    }
+    else{
+        delta += v;
+        timestamp += delta;
+        if(!read_xor_value(reader, value, leading_zero, trailing_zero)){
+            err_ = true;
+            return false;
+        }
+    }
+    ++ num_read;
+    return true;
+}
+
+bool GroupOpenSlotIterator::error() const{
+    return err_;
+}
+
+GroupSlotChunk::GroupSlotChunk(const std::shared_ptr<GroupChunk> & group, int slot): group(group), slot(slot), materialized(0), exposed(false){}
+
+std::shared_ptr<XORChunk> GroupSlotChunk::materialize(bool expose){
+    base::MutexLockGuard lock(mutex_);
+    if(xor_chunk && (group->read_only() || materialized == group->num_samples())){
+        exposed = exposed || expose;
+        return xor_chunk;
+    }
+
+    // The iterator of an open slot holds the rows appended so far, they are
+    // encoded without the lock of the group.
+    std::shared_ptr<XORChunk> c(new XORChunk());
+    std::unique_ptr<ChunkAppenderInterface> app = c->appender();
+    std::unique_ptr<ChunkIteratorInterface> it = iterator();
+    int n = 0;
+    while(it->next()){
+        std::pair<int64_t, double> p = it->at();
+        app->append(p.first, p.second);
+        ++ n;
+    }
+    // Flushed here, later flushes by readers write the same bytes in place.
+    c->bytes();
+    if(exposed)
+        retired.push_back(xor_chunk);
+    xor_chunk = c;
+    materialized = n;
+    exposed = expose;
+    return c;
+}
+
+std::shared_ptr<ChunkInterface> GroupSlotChunk::snapshot(){
+    return materialize(false);
+}
+
+const uint8_t * GroupSlotChunk::bytes(){
+    return materialize(true)->bytes();
+}
+
+uint8_t GroupSlotChunk::encoding(){
+    return static_cast<uint8_t>(EncXOR);
+}
+
+std::unique_ptr<ChunkAppenderInterface> GroupSlotChunk::appender(){
+    return std::unique_ptr<ChunkAppenderInterface>(new EmptyAppender());
+}
+
+std::unique_ptr<ChunkIteratorInterface> GroupSlotChunk::iterator(){
+    if(!group->read_only())
+        return group->open_slot_iterator(slot);
+    return std::unique_ptr<ChunkIteratorInterface>(new GroupSlotIterator(group, slot));
+}
+
+int GroupSlotChunk::num_samples(){
+    return group->num_samples();
+}
+
+uint64_t GroupSlotChunk::size(){
+    return materialize(false)->size();
+}
+
+}}
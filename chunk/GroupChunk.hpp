@@ -0,0 +1,192 @@
+#ifndef GROUPCHUNK_H
+#define GROUPCHUNK_H
+
+#include <memory>
+#include <vector>
+
+#include "base/Mutex.hpp"
+#include "chunk/BitReader.hpp"
+#include "chunk/BitStream.hpp"
+#include "chunk/ChunkBuffer.hpp"
+#include "chunk/ChunkInterface.hpp"
+#include "chunk/ChunkIteratorInterface.hpp"
+#include "chunk/XORChunk.hpp"
+#include "tagtree/tsid.h"
+
+namespace tsdb{
+namespace chunk{
+
+// GroupChunk holds the samples of series scraped together. They share one
+// timestamp column and every series keeps its values in its own slot, see
+// docs/format/group_chunk.md.
+//
+// A write mode GroupChunk is filled row by row and encoded on bytes(), a read
+// mode GroupChunk decodes its timestamps once and serves the slots from them.
+//
+// The head appends to write mode GroupChunks while their slots are read.
+// append() and the accessors take the chunk's mutex, and the columns are
+// ChunkBuffers, so that open_slot_iterator() can read them in place.
+class GroupChunk{
+    private:
+        struct ValueColumn{
+            BitStream bstream;
+            double value;
+            uint8_t leading_zero;
+            uint8_t trailing_zero;
+        };
+
+        std::vector<tagtree::TSID> tsids_;
+        int num_samples_;
+        bool read_mode;
+        bool err_;
+
+        // Write mode.
+        base::MutexLock mutex_;
+        ChunkBuffer ts_column;
+        int64_t last_timestamp;
+        int64_t last_delta;
+        std::vector<ValueColumn> value_columns;
+        std::vector<uint8_t> buf;   // Encoded chunk, valid if !dirty.
+        bool dirty;
+
+        // Read mode.
+        const uint8_t * ptr;
+        uint64_t size_;
+        std::vector<int64_t> timestamps_;
+        std::vector<std::pair<const uint8_t *, int>> value_ranges;
+
+        void encode();
+        void write_value(ValueColumn & c, double value);
+
+    public:
+        // tsids must be sorted.
+        GroupChunk(const std::vector<tagtree::TSID> & tsids);
+
+        GroupChunk(const uint8_t * stream_ptr, uint64_t size);
+
+        // values holds one value per slot.
+        void append(int64_t timestamp, const double * values);
+
+        bool read_only() const{ return read_mode; }
+
+        const uint8_t * bytes();
+
+        uint8_t encoding();
+
+        uint64_t size();
+
+        int num_samples();
+
+        int num_series();
+
+        const std::vector<tagtree::TSID> & tsids();
+
+        // Return the slot of tsid or -1.
+        int slot(tagtree::TSID tsid);
+
+        // Only in read mode.
+        const std::vector<int64_t> & timestamps();
+        std::pair<const uint8_t *, int> values(int slot);
+
+        // Only in write mode. The iterator reads the samples of the slot
+        // appended so far, whatever is appended afterwards.
+        std::unique_ptr<ChunkIteratorInterface> open_slot_iterator(int slot);
+
+        bool error();
+};
+
+// GroupSlotIterator iterates over the samples of one slot of a read mode
+// GroupChunk.
+class GroupSlotIterator: public ChunkIteratorInterface{
+    private:
+        std::shared_ptr<GroupChunk> group;
+        mutable BitReader reader;
+        mutable int num_read;
+        mutable double value;
+        mutable uint8_t leading_zero;
+        mutable uint8_t trailing_zero;
+        mutable bool err_;
+
+        bool read_value() const;
+
+    public:
+        GroupSlotIterator(const std::shared_ptr<GroupChunk> & group, int slot);
+
+        std::pair<int64_t, double> at() const;
+
+        bool next() const;
+
+        bool error() const;
+};
+
+// GroupOpenSlotIterator iterates over the samples of one slot of a write
+// mode GroupChunk. It shares the buffers of the columns and decodes the
+// timestamps as it goes.
+class GroupOpenSlotIterator: public ChunkIteratorInterface{
+    private:
+        std::shared_ptr<const uint8_t> ts_region;
+        std::shared_ptr<const uint8_t> value_region;
+        mutable const uint8_t * ts_ptr;
+        const uint8_t * ts_end;
+        mutable BitReader reader;
+        int num_total;
+        mutable int num_read;
+        mutable int64_t timestamp;
+        mutable int64_t delta;
+        mutable double value;
+        mutable uint8_t leading_zero;
+        mutable uint8_t trailing_zero;
+        mutable bool err_;
+
+    public:
+        GroupOpenSlotIterator(const std::shared_ptr<const uint8_t> & ts_region, int ts_len, const std::shared_ptr<const uint8_t> & value_region, int value_len, int num_total);
+
+        std::pair<int64_t, double> at() const;
+
+        bool next() const;
+
+        bool error() const;
+};
+
+// GroupSlotChunk is the chunk of one series inside a GroupChunk. Its bytes
+// are those of an equivalent XORChunk encoded on first use, so that it can
+// be written like any other chunk. For a write mode GroupChunk they are
+// encoded again once more samples have been appended, bytes() and size()
+// may then see different rows. snapshot() returns both from the same rows.
+class GroupSlotChunk: public ChunkInterface{
+    private:
+        std::shared_ptr<GroupChunk> group;
+        int slot;
+        base::MutexLock mutex_;
+        std::shared_ptr<XORChunk> xor_chunk;
+        int materialized;   // Number of samples in xor_chunk.
+        bool exposed;       // Whether bytes() returned those of xor_chunk.
+        // Replaced encodings whose bytes() were returned, they stay valid.
+        std::vector<std::shared_ptr<XORChunk>> retired;
+
+        std::shared_ptr<XORChunk> materialize(bool expose);
+
+    public:
+        GroupSlotChunk(const std::shared_ptr<GroupChunk> & group, int slot);
+
+        // snapshot returns an XORChunk of the samples appended so far, which
+        // later rows leave untouched.
+        std::shared_ptr<ChunkInterface> snapshot();
+
+        const uint8_t * bytes();
+
+        uint8_t encoding();
+
+        // Slots are read only, the returned appender drops all samples.
+        std::unique_ptr<ChunkAppenderInterface> appender();
+
+        std::unique_ptr<ChunkIteratorInterface> iterator();
+
+        int num_samples();
+
+        uint64_t size();
+};
+
+}}
+
+#endif
@@ -0,0 +1,64 @@
+#include "chunk/GroupChunkReader.hpp"
+#include "base/Logging.hpp"
+#include "chunk/ChunkUtils.hpp"
+#include "chunk/EmptyChunk.hpp"
+
+namespace tsdb {
+namespace chunk {
+
+GroupChunkReader::GroupChunkReader(const std::string& dir) : ChunkReader(dir)
+{}
+
+std::shared_ptr<GroupChunk>
+GroupChunkReader::group(uint64_t ref, const uint8_t* data, int len)
+{
+    base::MutexLockGuard lock(mutex_);
+    std::shared_ptr<GroupChunk> g = groups[ref].lock();
+    if (g) return g;
+
+    g.reset(new GroupChunk(data, len));
+    groups[ref] = g;
+    if (groups.size() > 4096) {
+        // Drop the group chunks no longer in use.
+        for (auto it = groups.begin(); it != groups.end();) {
+            if (it->second.expired())
+                it = groups.erase(it);
+            else
+                ++it;
+        }
+    }
+    return g;
+}
+
+// Will return EmptyChunk when error
+std::pair<std::shared_ptr<ChunkInterface>, bool>
+GroupChunkReader::chunk(tagtree::TSID tsid, uint64_t ref)
+{
+    std::pair<std::pair<const uint8_t*, int>, uint8_t> c = locate(ref);
+    if (!c.first.first)
+        return {std::shared_ptr<ChunkInterface>(new EmptyChunk()), false};
+
+    // Series not in any group have chunks of their own.
+    if (c.second != EncGD1) {
+        std::shared_ptr<ChunkInterface> r =
+            from_data(c.second, c.first.first, c.first.second);
+        if (!r) {
+            LOG_ERROR << "Ref: " << ref << " unknown chunk encoding "
+                      << static_cast<int>(c.second);
+            return {std::shared_ptr<ChunkInterface>(new EmptyChunk()), false};
+        }
+        return {r, true};
+    }
+
+    std::shared_ptr<GroupChunk> g = group(ref, c.first.first, c.first.second);
+    int slot = g->error() ? -1 : g->slot(tsid);
+    if (slot < 0) {
+        LOG_ERROR << "Ref: " << ref << " invalid group chunk for " << tsid;
+        return {std::shared_ptr<ChunkInterface>(new EmptyChunk()), false};
+    }
+    return {std::shared_ptr<ChunkInterface>(new GroupSlotChunk(g, slot)),
+            true};
+}
+
+} // namespace chunk
+} // namespace tsdb
@@ -0,0 +1,38 @@
+#ifndef GROUPCHUNKREADER_H
+#define GROUPCHUNKREADER_H
+
+#include <unordered_map>
+
+#include "base/Mutex.hpp"
+#include "chunk/ChunkReader.hpp"
+#include "chunk/GroupChunk.hpp"
+
+namespace tsdb {
+namespace chunk {
+
+// GroupChunkReader reads the chunks of a GroupBlock. The chunk of a series
+// inside a group chunk is served as a GroupSlotChunk, all other chunks by
+// their encoding like ChunkReader does.
+//
+// Group chunks in use are shared, so that the series of a group read together
+// decode the timestamps only once.
+class GroupChunkReader : public ChunkReader {
+private:
+    base::MutexLock mutex_;
+    std::unordered_map<uint64_t, std::weak_ptr<GroupChunk>> groups;
+
+    std::shared_ptr<GroupChunk> group(uint64_t ref, const uint8_t* data,
+                                      int len);
+
+public:
+    GroupChunkReader(const std::string& dir);
+
+    // Will return EmptyChunk when error
+    std::pair<std::shared_ptr<ChunkInterface>, bool> chunk(tagtree::TSID tsid,
+                                                           uint64_t ref);
+};
+
+} // namespace chunk
+} // namespace tsdb
+
+#endif
@@ -0,0 +1,33 @@
+#include "chunk/GroupChunkWriter.hpp"
+#include "base/Checksum.hpp"
+#include "base/Endian.hpp"
+
+namespace tsdb {
+namespace chunk {
+
+GroupChunkWriter::GroupChunkWriter(const std::string& dir) : ChunkWriter(dir)
+{}
+
+uint64_t GroupChunkWriter::write_group(GroupChunk* c)
+{
+    uint64_t max_len = 5 + base::MAX_VARINT_LEN_32 + c->size();
+    if (files.empty() || pos > chunk_size ||
+        (pos + max_len > chunk_size && max_len <= chunk_size))
+        cut();
+
+    uint64_t ref = (seq() << 32) | static_cast<uint64_t>(pos);
+
+    // Framed like the chunks of write_chunks().
+    uint8_t b[base::MAX_VARINT_LEN_32];
+    int encoded = base::encode_unsigned_varint(b, c->size());
+    write(b, encoded);
+    b[0] = c->encoding();
+    write(b, 1);
+    write(c->bytes(), c->size());
+    base::put_uint32_big_endian(b, base::GetCrc32(c->bytes(), c->size()));
+    write(b, 4);
+    return ref;
+}
+
+} // namespace chunk
+} // namespace tsdb
@@ -0,0 +1,24 @@
+#ifndef GROUPCHUNKWRITER_H
+#define GROUPCHUNKWRITER_H
+
+#include "chunk/ChunkWriter.hpp"
+#include "chunk/GroupChunk.hpp"
+
+namespace tsdb {
+namespace chunk {
+
+// GroupChunkWriter writes the chunks of a GroupBlock. Group chunks go into the
+// same files as the chunks of series not belonging to any group.
+class GroupChunkWriter : public ChunkWriter {
+public:
+    GroupChunkWriter(const std::string& dir);
+
+    // write_group returns the ref of the written group chunk, which is shared
+    // by the chunk metas of all its series.
+    uint64_t write_group(GroupChunk* c);
+};
+
+} // namespace chunk
+} // namespace tsdb
+
+#endif
@@ -0,0 +1,481 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "base/Endian.hpp"
+#include "base/TSDBException.hpp"
+#include "chunk/EmptyAppender.hpp"
+#include "chunk/IntChunk.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+const int INT_CHUNK_BLOCK = 128;
+
+namespace{
+
+void put_uvarint(std::vector<uint8_t> & b, uint64_t v){
+    uint8_t temp[base::MAX_VARINT_LEN_64];
+    int encoded = base::encode_unsigned_varint(temp, v);
+    b.insert(b.end(), temp, temp + encoded);
+}
+
+void put_varint(std::vector<uint8_t> & b, int64_t v){
+    uint8_t temp[base::MAX_VARINT_LEN_64];
+    int encoded = base::encode_signed_varint(temp, v);
+    b.insert(b.end(), temp, temp + encoded);
+}
+
+inline uint64_t zigzag(uint64_t v){
+    return (v << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(v) >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v){
+    return static_cast<int64_t>((v >> 1) ^ (0 - (v & 1)));
+}
+
+inline int bit_width(uint64_t v){
+    return v == 0 ? 0 : 64 - __builtin_clzll(v);
+}
+
+inline int packed_size(int n, int width){
+    return (n * width + 7) >> 3;
+}
+
+inline uint64_t get_uint64_little_endian(const uint8_t * p){
+    uint64_t v = 0;
+    for(int i = 7; i >= 0; -- i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+// pack appends n values of width bits, the lowest bit of every value first.
+void pack(std::vector<uint8_t> & b, const uint64_t * values, int n, int width){
+    if(width == 0)
+        return;
+    size_t start = b.size();
+    // One spare word behind the values to write whole words.
+    b.resize(start + packed_size(n, width) + 9, 0);
+    uint8_t * p = b.data() + start;
+    for(int i = 0; i < n; ++ i){
+        uint64_t bit = static_cast<uint64_t>(i) * width;
+        uint8_t * q = p + (bit >> 3);
+        int shift = bit & 7;
+        uint64_t v = values[i] << shift;
+        for(int j = 0; j < 8; ++ j)
+            q[j] |= static_cast<uint8_t>(v >> (8 * j));
+        if(shift + width > 64)
+            q[8] |= static_cast<uint8_t>(values[i] >> (64 - shift));
+    }
+    b.resize(start + packed_size(n, width));
+}
+
+// unpack reads n values of width bits and decodes them from zigzag. p must be
+// followed by 9 readable bytes behind the packed values.
+void unpack(const uint8_t * p, int n, int width, int64_t * values){
+    if(width == 0){
+        std::fill(values, values + n, 0);
+        return;
+    }
+    uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+    for(int i = 0; i < n; ++ i){
+        uint64_t bit = static_cast<uint64_t>(i) * width;
+        const uint8_t * q = p + (bit >> 3);
+        int shift = bit & 7;
+        uint64_t v = get_uint64_little_endian(q) >> shift;
+        if(shift + width > 64)
+            v |= static_cast<uint64_t>(q[8]) << (64 - shift);
+        values[i] = unzigzag(v & mask);
+    }
+}
+
+// Bytes behind packed values unpack() reads.
+const int UNPACK_PADDING = 9;
+
+// pack_block appends the block of the n zigzag delta of deltas in ts and vs.
+void pack_block(std::vector<uint8_t> & b, const uint64_t * ts, const uint64_t * vs, int n){
+    uint64_t ts_bits = 0;
+    uint64_t vs_bits = 0;
+    for(int i = 0; i < n; ++ i){
+        ts_bits |= ts[i];
+        vs_bits |= vs[i];
+    }
+    int ts_width = bit_width(ts_bits);
+    int vs_width = bit_width(vs_bits);
+    b.push_back(static_cast<uint8_t>(ts_width));
+    b.push_back(static_cast<uint8_t>(vs_width));
+    pack(b, ts, n, ts_width);
+    pack(b, vs, n, vs_width);
+}
+
+// read_uvarints decodes n pairs of uvarints from p into ts and vs.
+const uint8_t * read_uvarints(const uint8_t * p, const uint8_t * end, int n, uint64_t * ts, uint64_t * vs){
+    for(int i = 0; i < n; ++ i){
+        int decoded = 0;
+        ts[i] = base::decode_unsigned_varint(p, decoded, end - p);
+        p += decoded;
+        vs[i] = base::decode_unsigned_varint(p, decoded, end - p);
+        p += decoded;
+    }
+    return p;
+}
+
+}
+
+IntChunk::IntChunk():
+        read_mode(false),
+        num_samples_(0),
+        first_timestamp(0),
+        first_value(0),
+        timestamp(0),
+        value(0),
+        delta_timestamp(0),
+        delta_value(0),
+        second_delta_timestamp(0),
+        second_delta_value(0),
+        tail_len(0),
+        dirty(true),
+        ptr(nullptr),
+        size_(0)
+{}
+
+IntChunk::IntChunk(const uint8_t * stream_ptr, uint64_t size):
+        read_mode(true),
+        num_samples_(0),
+        tail_len(0),
+        dirty(false),
+        ptr(stream_ptr),
+        size_(size)
+{}
+
+bool IntChunk::is_integral(double value){
+    // -0 would come back as 0.
+    return value >= -9223372036854775808.0 && value < 9223372036854775808.0 &&
+           value == static_cast<double>(static_cast<int64_t>(value)) &&
+           !(value == 0 && signbit(value));
+}
+
+// The first two bytes store the num of samples using big endian, followed
+// by the first sample, the deltas of the second one and the blocks. Only the
+// tail is packed here, the full blocks are copied.
+void IntChunk::encode(){
+    std::shared_ptr<std::vector<uint8_t>> b(new std::vector<uint8_t>(2));
+    base::put_uint16_big_endian(b->data(), num_samples_);
+    if(num_samples_ > 0){
+        put_varint(*b, first_timestamp);
+        put_varint(*b, first_value);
+    }
+    if(num_samples_ > 1){
+        put_varint(*b, second_delta_timestamp);
+        put_varint(*b, second_delta_value);
+    }
+    for(const std::shared_ptr<std::vector<uint8_t>> & block: blocks)
+        b->insert(b->end(), block->begin(), block->end() - UNPACK_PADDING);
+    if(tail_len > 0){
+        uint64_t ts[INT_CHUNK_BLOCK];
+        uint64_t vs[INT_CHUNK_BLOCK];
+        read_uvarints(tail->data(), tail->data() + tail->size(), tail_len, ts, vs);
+        pack_block(*b, ts, vs, tail_len);
+    }
+    buf = b;
+    dirty = false;
+}
+
+const uint8_t * IntChunk::bytes(){
+    if(read_mode)
+        return ptr;
+    if(dirty)
+        encode();
+    return buf->data();
+}
+
+uint8_t IntChunk::encoding(){
+    return static_cast<uint8_t>(EncInt);
+}
+
+std::unique_ptr<ChunkAppenderInterface> IntChunk::appender(){
+    if(read_mode)
+        return std::unique_ptr<ChunkAppenderInterface>(new EmptyAppender());
+    return std::unique_ptr<ChunkAppenderInterface>(new IntAppender(*this));
+}
+
+std::unique_ptr<ChunkIteratorInterface> IntChunk::iterator(){
+    if(read_mode)
+        return std::unique_ptr<ChunkIteratorInterface>(new IntIterator(ptr, size_));
+    return std::unique_ptr<ChunkIteratorInterface>(new IntIterator(*this));
+}
+
+int IntChunk::num_samples(){
+    if(read_mode)
+        return base::get_uint16_big_endian(ptr);
+    return num_samples_;
+}
+
+uint64_t IntChunk::size(){
+    if(read_mode)
+        return size_;
+    if(dirty)
+        encode();
+    return buf->size();
+}
+
+IntAppender::IntAppender(IntChunk & c): c(c){}
+
+void IntAppender::append(int64_t timestamp, double value){
+    int64_t v = static_cast<int64_t>(value);
+    if(c.num_samples_ == 0){
+        c.first_timestamp = timestamp;
+        c.first_value = v;
+    }
+    else{
+        // Wrapping arithmetic, the decoder wraps the same way.
+        uint64_t dt = static_cast<uint64_t>(timestamp) - static_cast<uint64_t>(c.timestamp);
+        uint64_t dv = static_cast<uint64_t>(v) - static_cast<uint64_t>(c.value);
+        if(c.num_samples_ == 1){
+            c.second_delta_timestamp = static_cast<int64_t>(dt);
+            c.second_delta_value = static_cast<int64_t>(dv);
+        }
+        else{
+            // The tail never reallocates in place, iterators may be reading
+            // the bytes before its end.
+            if(!c.tail || c.tail->size() + 2 * base::MAX_VARINT_LEN_64 > c.tail->capacity()){
+                std::shared_ptr<std::vector<uint8_t>> t(new std::vector<uint8_t>());
+                t->reserve(c.tail ? 2 * c.tail->capacity() : 64);
+                if(c.tail)
+                    t->assign(c.tail->begin(), c.tail->end());
+                c.tail = t;
+            }
+            put_uvarint(*c.tail, zigzag(dt - c.delta_timestamp));
+            put_uvarint(*c.tail, zigzag(dv - c.delta_value));
+            if(++ c.tail_len == INT_CHUNK_BLOCK){
+                uint64_t ts[INT_CHUNK_BLOCK];
+                uint64_t vs[INT_CHUNK_BLOCK];
+                read_uvarints(c.tail->data(), c.tail->data() + c.tail->size(), INT_CHUNK_BLOCK, ts, vs);
+                std::shared_ptr<std::vector<uint8_t>> block(new std::vector<uint8_t>());
+                pack_block(*block, ts, vs, INT_CHUNK_BLOCK);
+                block->resize(block->size() + UNPACK_PADDING, 0);
+                c.blocks.push_back(block);
+                c.tail.reset();
+                c.tail_len = 0;
+            }
+        }
+        c.delta_timestamp = dt;
+        c.delta_value = dv;
+    }
+    c.timestamp = timestamp;
+    c.value = v;
+    ++ c.num_samples_;
+    c.dirty = true;
+}
+
+IntIterator::IntIterator(const uint8_t * stream_ptr, int size):
+        ptr(stream_ptr + 2),
+        end(stream_ptr + size),
+        num_total(0),
+        num_read(0),
+        timestamp(0),
+        value(0),
+        delta_timestamp(0),
+        delta_value(0),
+        err_(false),
+        first_timestamp(0),
+        first_value(0),
+        second_delta_timestamp(0),
+        second_delta_value(0),
+        next_block(0),
+        timestamp_dods(new int64_t[INT_CHUNK_BLOCK]),
+        value_dods(new int64_t[INT_CHUNK_BLOCK]),
+        block_len(0),
+        block_pos(0)
+{
+    if(size < 2){
+        err_ = true;
+        return;
+    }
+    num_total = base::get_uint16_big_endian(stream_ptr);
+    try{
+        int decoded = 0;
+        if(num_total > 0){
+            first_timestamp = base::decode_signed_varint(ptr, decoded, end - ptr);
+            ptr += decoded;
+            first_value = base::decode_signed_varint(ptr, decoded, end - ptr);
+            ptr += decoded;
+        }
+        if(num_total > 1){
+            second_delta_timestamp = base::decode_signed_varint(ptr, decoded, end - ptr);
+            ptr += decoded;
+            second_delta_value = base::decode_signed_varint(ptr, decoded, end - ptr);
+            ptr += decoded;
+        }
+    }
+    catch(const base::TSDBException & e){
+        err_ = true;
+    }
+}
+
+IntIterator::IntIterator(const IntChunk & c):
+        ptr(c.tail ? c.tail->data() : nullptr),
+        end(c.tail ? c.tail->data() + c.tail->size() : nullptr),
+        num_total(c.num_samples_),
+        num_read(0),
+        timestamp(0),
+        value(0),
+        delta_timestamp(0),
+        delta_value(0),
+        err_(false),
+        first_timestamp(c.first_timestamp),
+        first_value(c.first_value),
+        second_delta_timestamp(c.second_delta_timestamp),
+        second_delta_value(c.second_delta_value),
+        blocks(c.blocks),
+        next_block(0),
+        tail(c.tail),
+        timestamp_dods(new int64_t[INT_CHUNK_BLOCK]),
+        value_dods(new int64_t[INT_CHUNK_BLOCK]),
+        block_len(0),
+        block_pos(0)
+{}
+
+const uint8_t * IntIterator::unpack_block(const uint8_t * p, const uint8_t * end, int n) const{
+    if(end - p < 2)
+        return nullptr;
+    int ts_width = p[0];
+    int vs_width = p[1];
+    p += 2;
+    if(ts_width > 64 || vs_width > 64)
+        return nullptr;
+    int ts_len = packed_size(n, ts_width);
+    int vs_len = packed_size(n, vs_width);
+    if(end - p < ts_len + vs_len)
+        return nullptr;
+
+    if(end - p >= ts_len + vs_len + UNPACK_PADDING){
+        // Unpacking reads whole words, which lie within the chunk.
+        unpack(p, n, ts_width, timestamp_dods.get());
+        unpack(p + ts_len, n, vs_width, value_dods.get());
+    }
+    else{
+        // The last block of a chunk is copied behind enough padding.
+        uint8_t padded[INT_CHUNK_BLOCK * 8 + UNPACK_PADDING];
+        memcpy(padded, p, ts_len);
+        memset(padded + ts_len, 0, UNPACK_PADDING);
+        unpack(padded, n, ts_width, timestamp_dods.get());
+        memcpy(padded, p + ts_len, vs_len);
+        memset(padded + vs_len, 0, UNPACK_PADDING);
+        unpack(padded, n, vs_width, value_dods.get());
+    }
+    return p + ts_len + vs_len;
+}
+
+bool IntIterator::read_block() const{
+    int n = std::min(num_total - num_read, INT_CHUNK_BLOCK);
+    if(next_block < blocks.size()){
+        const std::vector<uint8_t> & block = *blocks[next_block ++];
+        if(!unpack_block(block.data(), block.data() + block.size(), n))
+            return false;
+    }
+    else if(tail){
+        // The open tail of a write mode chunk.
+        uint64_t ts[INT_CHUNK_BLOCK];
+        uint64_t vs[INT_CHUNK_BLOCK];
+        try{
+            ptr = read_uvarints(ptr, end, n, ts, vs);
+        }
+        catch(const base::TSDBException & e){
+            return false;
+        }
+        for(int i = 0; i < n; ++ i){
+            timestamp_dods[i] = unzigzag(ts[i]);
+            value_dods[i] = unzigzag(vs[i]);
+        }
+    }
+    else{
+        ptr = unpack_block(ptr, end, n);
+        if(!ptr)
+            return false;
+    }
+    block_len = n;
+    block_pos = 0;
+    return true;
+}
+
+std::pair<int64_t, double> IntIterator::at() const{
+    return std::make_pair(timestamp, static_cast<double>(value));
+}
+
+bool IntIterator::next() const{
+    if(err_ || num_read == num_total)
+        return false;
+
+    if(num_read == 0){
+        timestamp = first_timestamp;
+        value = first_value;
+        ++ num_read;
+        return true;
+    }
+    if(num_read == 1){
+        delta_timestamp = static_cast<uint64_t>(second_delta_timestamp);
+        delta_value = static_cast<uint64_t>(second_delta_value);
+        timestamp += delta_timestamp;
+        value += delta_value;
+        ++ num_read;
+        return true;
+    }
+
+    if(block_pos == block_len && !read_block()){
+        err_ = true;
+        return false;
+    }
+    delta_timestamp += timestamp_dods[block_pos];
+    delta_value += value_dods[block_pos];
+    timestamp += delta_timestamp;
+    value += delta_value;
+    ++ block_pos;
+    ++ num_read;
+    return true;
+}
+
+int IntIterator::next_batch(int64_t * ts, double * vs, int max) const{
+    int n = 0;
+    // The first two samples are encoded differently.
+    while(n < max && num_read < 2 && IntIterator::next()){
+        ts[n] = timestamp;
+        vs[n] = static_cast<double>(value);
+        ++ n;
+    }
+    while(n < max && !err_ && num_read < num_total){
+        if(block_pos == block_len && !read_block()){
+            err_ = true;
+            break;
+        }
+        int k = std::min(block_len - block_pos, max - n);
+        const int64_t * tdod = timestamp_dods.get() + block_pos;
+        const int64_t * vdod = value_dods.get() + block_pos;
+        uint64_t dt = delta_timestamp;
+        uint64_t dv = delta_value;
+        uint64_t t = timestamp;
+        uint64_t v = value;
+        for(int i = 0; i < k; ++ i){
+            dt += tdod[i];
+            dv += vdod[i];
+            t += dt;
+            v += dv;
+            ts[n + i] = static_cast<int64_t>(t);
+            vs[n + i] = static_cast<double>(static_cast<int64_t>(v));
+        }
+        delta_timestamp = dt;
+        delta_value = dv;
+        timestamp = t;
+        value = v;
+        block_pos += k;
+        num_read += k;
+        n += k;
+    }
+    return n;
+}
+
+bool IntIterator::error() const{
+    return err_;
+}
+
+}}
@@ -0,0 +1,146 @@
+#ifndef INTCHUNK_H
+#define INTCHUNK_H
+
+#include <memory>
+#include <vector>
+
+#include "chunk/ChunkAppenderInterface.hpp"
+#include "chunk/ChunkInterface.hpp"
+#include "chunk/ChunkIteratorInterface.hpp"
+
+namespace tsdb{
+namespace chunk{
+
+// Samples from the third one on are packed in blocks of this many.
+extern const int INT_CHUNK_BLOCK;
+
+// IntChunk holds samples with integral values, see docs/format/int_chunk.md.
+// Timestamps and values are both stored as zigzag encoded delta of deltas,
+// bit-packed with a fixed width per block of INT_CHUNK_BLOCK samples, so that
+// a block is unpacked in a loop without dependencies between the samples.
+//
+// A write mode IntChunk packs every block once when it is full and keeps only
+// the delta of deltas of the open tail as varints. Appends never modify bytes
+// an iterator may read, so iterators read the packed blocks and the tail in
+// place. Only bytes() puts the whole chunk together.
+class IntChunk: public ChunkInterface{
+    private:
+        friend class IntAppender;
+        friend class IntIterator;
+
+        bool read_mode;
+
+        // Write mode.
+        int num_samples_;
+        int64_t first_timestamp;
+        int64_t first_value;
+        int64_t timestamp;
+        int64_t value;
+        uint64_t delta_timestamp;
+        uint64_t delta_value;
+        int64_t second_delta_timestamp;  // Deltas of the second sample.
+        int64_t second_delta_value;
+        // Full blocks, each packed followed by the padding unpacking needs.
+        std::vector<std::shared_ptr<std::vector<uint8_t>>> blocks;
+        // Zigzag delta of deltas as uvarints, timestamp and value of every
+        // sample after the full blocks. It is copied into a larger buffer
+        // instead of growing in place, iterators may still read the old one.
+        std::shared_ptr<std::vector<uint8_t>> tail;
+        int tail_len;
+        std::shared_ptr<std::vector<uint8_t>> buf;  // Whole chunk, valid if !dirty.
+        bool dirty;
+
+        // Read mode.
+        const uint8_t * ptr;
+        uint64_t size_;
+
+        void encode();
+
+    public:
+        IntChunk();
+
+        IntChunk(const uint8_t * stream_ptr, uint64_t size);
+
+        // is_integral returns if value can be appended to an IntChunk and be
+        // read back unchanged.
+        static bool is_integral(double value);
+
+        const uint8_t * bytes();
+
+        uint8_t encoding();
+
+        // The values appended must be integral.
+        std::unique_ptr<ChunkAppenderInterface> appender();
+
+        std::unique_ptr<ChunkIteratorInterface> iterator();
+
+        int num_samples();
+
+        uint64_t size();
+};
+
+class IntAppender: public ChunkAppenderInterface{
+    private:
+        IntChunk & c;
+
+    public:
+        IntAppender(IntChunk & c);
+
+        void append(int64_t timestamp, double value);
+};
+
+class IntIterator: public ChunkIteratorInterface{
+    private:
+        mutable const uint8_t * ptr;
+        const uint8_t * end;
+        int num_total;
+        mutable int num_read;
+        mutable int64_t timestamp;
+        mutable int64_t value;
+        mutable uint64_t delta_timestamp;
+        mutable uint64_t delta_value;
+        mutable bool err_;
+
+        // The first sample and the deltas of the second one.
+        int64_t first_timestamp;
+        int64_t first_value;
+        int64_t second_delta_timestamp;
+        int64_t second_delta_value;
+
+        // Blocks and tail of a write mode chunk, ptr reads the tail.
+        std::vector<std::shared_ptr<std::vector<uint8_t>>> blocks;
+        mutable size_t next_block;
+        std::shared_ptr<std::vector<uint8_t>> tail;
+
+        // Delta of deltas of the current block.
+        mutable std::unique_ptr<int64_t[]> timestamp_dods;
+        mutable std::unique_ptr<int64_t[]> value_dods;
+        mutable int block_len;
+        mutable int block_pos;
+
+        bool read_block() const;
+
+        // unpack_block unpacks the block of n samples at p, the chunk ends
+        // at end. It returns the position behind the block, nullptr if the
+        // block is corrupted.
+        const uint8_t * unpack_block(const uint8_t * p, const uint8_t * end, int n) const;
+
+    public:
+        IntIterator(const uint8_t * stream_ptr, int size);
+
+        // Reads the samples appended to c so far, later appends are not
+        // seen. c must not be appended to while the iterator is created.
+        IntIterator(const IntChunk & c);
+
+        std::pair<int64_t, double> at() const;
+
+        bool next() const;
+
+        int next_batch(int64_t * ts, double * vs, int max) const;
+
+        bool error() const;
+};
+
+}}
+
+#endif
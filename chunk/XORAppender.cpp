@@ -1,12 +1,13 @@
 #include "base/Endian.hpp"
+#include "chunk/DeltaOfDelta.hpp"
 #include "chunk/XORAppender.hpp"
 
 namespace tsdb{
 namespace chunk{
 
-// Must be vector mode BitStream
-XORAppender::XORAppender(BitStream & bstream, int64_t timestamp, double value, uint64_t delta_timestamp, uint8_t leading_zero, uint8_t trailing_zero):
+XORAppender::XORAppender(BitWriter & bstream, int & num_samples, int64_t timestamp, double value, uint64_t delta_timestamp, uint8_t leading_zero, uint8_t trailing_zero):
     bstream(bstream),
+    num_samples(num_samples),
     timestamp(timestamp),
     value(value),
     delta_timestamp(delta_timestamp),
@@ -62,7 +63,6 @@ void XORAppender::write_delta_value(double value){
 
 void XORAppender::append(int64_t timestamp, double value){
     uint64_t current_delta_timestamp = 0;
-    int num_samples = base::get_uint16_big_endian(*bstream.bytes());
 
     if(num_samples == 0){
         uint8_t temp[base::MAX_VARINT_LEN_64];
@@ -85,39 +85,19 @@ void XORAppender::append(int64_t timestamp, double value){
     else{
         current_delta_timestamp = timestamp - this->timestamp;
         int64_t delta_delta_timestamp = current_delta_timestamp - this->delta_timestamp;
-
-        if(delta_delta_timestamp == 0){
-            bstream.write_bit(ZERO);
-        }
-        else if(bit_range(delta_delta_timestamp, 14)){
-            bstream.write_bits(0x02, 2);   // 10
-            bstream.write_bits(static_cast<uint64_t>(delta_delta_timestamp), 14);
-        }
-        else if(bit_range(delta_delta_timestamp, 17)){
-            bstream.write_bits(0x06, 3);   // 110
-            bstream.write_bits(static_cast<uint64_t>(delta_delta_timestamp), 17);
-        }
-        else if(bit_range(delta_delta_timestamp, 20)){
-            bstream.write_bits(0x0e, 4);   // 1110
-            bstream.write_bits(static_cast<uint64_t>(delta_delta_timestamp), 20);
-        }
-        // The above 3 cases need to consider the sign when decoding
-        else{
-            bstream.write_bits(0x0f, 4);   // 1111
-            bstream.write_bits(static_cast<uint64_t>(delta_delta_timestamp), 64);
-        }
+        write_delta_delta(bstream, delta_delta_timestamp);
 
         write_delta_value(value);
     }
 
     this->timestamp = timestamp;
     this->value = value;
-    base::put_uint16_big_endian(*bstream.bytes(), num_samples + 1);
+    ++ num_samples;
     this->delta_timestamp = current_delta_timestamp;
 }
 
 bool XORAppender::bit_range(int64_t delta_delta_timestamp, int num){
-    return ((-((1<<(num-1))-1) <= delta_delta_timestamp) && (delta_delta_timestamp <= 1<<(num-1)));
+    return dod_bit_range(delta_delta_timestamp, num);
 }
 
 }}
\ No newline at end of file
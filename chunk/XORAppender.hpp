@@ -2,6 +2,7 @@
 #define XORAPPENDER_H
 
 #include "chunk/BitStream.hpp"
+#include "chunk/BitWriter.hpp"
 #include "chunk/ChunkAppenderInterface.hpp"
 
 namespace tsdb{
@@ -9,7 +10,8 @@ namespace chunk{
 
 class XORAppender: public ChunkAppenderInterface{
     private:
-        BitStream & bstream;
+        BitWriter & bstream;
+        int & num_samples;
         int64_t timestamp;  // Millisecond
         double value;
         uint64_t delta_timestamp;
@@ -17,8 +19,9 @@ class XORAppender: public ChunkAppenderInterface{
         uint8_t trailing_zero;
 
     public:
-        // Must be vector mode BitStream
-        XORAppender(BitStream & bstream, int64_t timestamp, double value, uint64_t delta_timestamp, uint8_t leading_zero, uint8_t trailing_zero);
+        // num_samples is the sample count of the chunk, kept up to date
+        // instead of in the stream.
+        XORAppender(BitWriter & bstream, int & num_samples, int64_t timestamp, double value, uint64_t delta_timestamp, uint8_t leading_zero, uint8_t trailing_zero);
 
         void set_leading_zero(uint8_t lz);
 
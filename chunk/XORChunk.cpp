@@ -8,15 +8,22 @@ namespace tsdb{
 namespace chunk{
 
 // The first two bytes store the num of samples using big endian
-XORChunk::XORChunk(): bstream(2), read_mode(false){}
+XORChunk::XORChunk(): writer(2), num_samples_(0), read_mode(false){}
 
-XORChunk::XORChunk(const uint8_t * stream_ptr, uint64_t size): bstream(stream_ptr, size), read_mode(true), size_(size){}
+XORChunk::XORChunk(const uint8_t * stream_ptr, uint64_t size): bstream(stream_ptr, size), num_samples_(0), read_mode(true), size_(size){}
+
+// The appender keeps the last bits and the number of samples to itself, they
+// are only written out when the chunk is read.
+void XORChunk::flush(){
+    writer.flush();
+    base::put_uint16_big_endian(writer.bytes(), num_samples_);
+}
 
 const uint8_t * XORChunk::bytes(){
     if(read_mode)
         return bstream.stream_ptr;
-    else
-        return bstream.bytes_ptr();
+    flush();
+    return writer.bytes();
 }
 
 uint8_t XORChunk::encoding(){
@@ -33,10 +40,11 @@ std::unique_ptr<ChunkAppenderInterface> XORChunk::appender(){
         throw base::TSDBException("Broken BitStream in XORChunk");
     }
 
-    uint8_t lz = base::get_uint16_big_endian(*bstream.bytes()) == 0 ? 0xff : it->leading_zero;
+    uint8_t lz = num_samples_ == 0 ? 0xff : it->leading_zero;
     return std::unique_ptr<ChunkAppenderInterface>(
         new XORAppender(
-            bstream,
+            writer,
+            num_samples_,
             it->timestamp,
             it->value,
             it->delta_timestamp,
@@ -47,23 +55,33 @@ std::unique_ptr<ChunkAppenderInterface> XORChunk::appender(){
 }
 
 std::unique_ptr<ChunkIteratorInterface> XORChunk::iterator(){
-    return std::unique_ptr<ChunkIteratorInterface>(new XORIterator(bstream, !read_mode));
+    if(read_mode)
+        return std::unique_ptr<ChunkIteratorInterface>(new XORIterator(bstream.stream_ptr, size_, nullptr));
+    // Hold the buffer of a chunk not created in read mode, so that it stays
+    // valid when growing during appending new data.
+    flush();
+    return std::unique_ptr<ChunkIteratorInterface>(new XORIterator(writer.bytes(), writer.size(), writer.get_stream().share()));
 }
 
 std::unique_ptr<XORIterator> XORChunk::xor_iterator(){
     // No need to use safe mode here because there can be only one appender at the same time.
-    return std::unique_ptr<XORIterator>(new XORIterator(bstream, false));
+    if(read_mode)
+        return std::unique_ptr<XORIterator>(new XORIterator(bstream.stream_ptr, size_, nullptr));
+    flush();
+    return std::unique_ptr<XORIterator>(new XORIterator(writer.bytes(), writer.size(), nullptr));
 }
 
 int XORChunk::num_samples(){
-    return base::get_uint16_big_endian(bytes());
+    if(read_mode)
+        return base::get_uint16_big_endian(bstream.stream_ptr);
+    return num_samples_;
 }
 
 uint64_t XORChunk::size(){
     if(read_mode)
         return size_;
-    else
-        return bstream.bytes()->size();
+    flush();
+    return writer.size();
 }
 
 }}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define XORCHUNK_H
 
 #include "chunk/BitStream.hpp"
+#include "chunk/BitWriter.hpp"
 #include "chunk/ChunkInterface.hpp"
 #include "chunk/ChunkAppenderInterface.hpp"
 #include "chunk/ChunkIteratorInterface.hpp"
@@ -12,10 +13,14 @@ namespace chunk{
 
 class XORChunk: public ChunkInterface{
     private:
-        BitStream bstream;
+        BitStream bstream;  // Read mode
+        BitWriter writer;   // Write mode
+        int num_samples_;   // Write mode, stored in the first two bytes by flush()
         bool read_mode;
         uint64_t size_;
 
+        void flush();
+
     public:
         // The first two bytes store the num of samples using big endian
         XORChunk();
@@ -1,14 +1,59 @@
+#include <algorithm>
 #include <string.h>
 
 #include "base/Endian.hpp"
+#include "chunk/DeltaOfDelta.hpp"
 #include "chunk/XORIterator.hpp"
 
 namespace tsdb{
 namespace chunk{
 
-// Read mode BitStream
-XORIterator::XORIterator(BitStream & bstream, bool safe_mode): 
-        safe_mode(safe_mode),
+namespace{
+
+inline bool read_xor_value(BitReader & reader, double & value, uint8_t & leading_zero, uint8_t & trailing_zero){
+    uint64_t w = reader.peek();
+    if(reader.available() < 1)
+        return false;
+
+    // First control bit
+    if((w >> 63) == 0){
+        // it.val = it.val
+        reader.consume(1);
+        return true;
+    }
+    if(reader.available() < 2)
+        return false;
+    reader.consume(2);
+
+    // Second control bit
+    if(((w >> 62) & 1) != 0){
+        uint64_t bits = reader.read_bits(11);
+        if(reader.error())
+            return false;
+        leading_zero = static_cast<uint8_t>(bits >> 6);
+        int sigbits = static_cast<int>(bits & 0x3f);
+        // 0 significant bits here means we overflowed and we actually need 64; see comment in encoder
+        if(sigbits == 0)
+            sigbits = 64;
+        if(leading_zero + sigbits > 64)
+            return false;
+        trailing_zero = static_cast<uint8_t>(64 - leading_zero - sigbits);
+    }
+
+    uint64_t bits = reader.read_bits(static_cast<int>(64 - leading_zero - trailing_zero));
+    if(reader.error())
+        return false;
+    uint64_t vbits = base::encode_double(value);
+    vbits ^= (bits << trailing_zero);
+    value = base::decode_double(vbits);
+    return true;
+}
+
+}
+
+XORIterator::XORIterator(const uint8_t * stream_ptr, int size, const std::shared_ptr<const uint8_t> & region): 
+        safe_mode(region != nullptr),
+        region(region),
         timestamp(0),
         value(0),
         delta_timestamp(0),
@@ -17,20 +62,9 @@ XORIterator::XORIterator(BitStream & bstream, bool safe_mode):
         num_read(0),
         err_(false)
 {
-    // This is to prevent pointer invalidation when vector resizes during appending new data.
-    // For those XORChunk not created in read mode.
-    if(safe_mode){
-        std::vector<uint8_t> stream(bstream.size(), 0);
-        memcpy(&(stream.front()), bstream.bytes_ptr(), bstream.size());
-        this->bstream = BitStream(stream);
-    }
-    else
-        this->bstream = BitStream(bstream.bytes_ptr(), bstream.size());
-
-    num_total = base::get_uint16_big_endian(bstream.bytes_ptr());
-    // Pop the first two bytes
-    this->bstream.pop_front();
-    this->bstream.pop_front();
+    num_total = base::get_uint16_big_endian(stream_ptr);
+    // Skip the first two bytes
+    reader = BitReader(stream_ptr + 2, size - 2);
 }
 
 std::pair<int64_t, double> XORIterator::at() const{
@@ -42,163 +76,99 @@ bool XORIterator::next() const{
         return false;
 
     if(num_read == 0){
-        int64_t current_t;
-        try{
-            current_t = bstream.read_signed_varint();
-            // std::cout << "current_t: " << current_t << std::endl; 
-        }
-        catch(const base::TSDBException & e){
-            err_ = true;
-            return false;
-        }
-
-        uint64_t current_v;
-        try{
-            current_v = bstream.read_bits(64);
-        }
-        catch(const base::TSDBException & e){
+        int64_t current_t = reader.read_signed_varint();
+        uint64_t current_v = reader.read_bits(64);
+        if(reader.error()){
             err_ = true;
             return false;
         }
 
         timestamp = current_t;
         value = base::decode_double(current_v);
-        // std::cout << "first value " << current_v << " " << value << std::endl;
         ++num_read; 
         return true;
     }
     else if(num_read == 1){
-        int64_t delta_t;
-        try{
-            delta_t = bstream.read_signed_varint();
-        }
-        catch(const base::TSDBException & e){
+        int64_t delta_t = reader.read_signed_varint();
+        if(reader.error()){
             err_ = true;
             return false;
         }
 
         delta_timestamp = delta_t;
         timestamp += delta_t;
-
-        return read_value();
     }
-    
-    // Read timestamp delta-delta
-    uint8_t type = 0;
-    int64_t delta_delta = 0;
-    for(int i = 0; i < 4; i ++){
-        try{
-            bool bit = bstream.read_bit();
-            type <<= 1;
-            if(!bit)
-                break;
-            type |= 1;
-        }
-        catch(const base::TSDBException & e){
+    else{
+        int64_t delta_delta;
+        if(!read_delta_delta(reader, delta_delta)){
             err_ = true;
             return false;
         }
-    }
 
-    int size = 0;
-    switch(type){
-        case 0x02:
-            size = 14;
-            break;
-        case 0x06:
-            size = 17;
-            break;
-        case 0x0e:
-            size = 20;
-            break;
-        case 0x0f:
-            try{
-                delta_delta = static_cast<int64_t>(bstream.read_bits(64));
-            }
-            catch(const base::TSDBException & e){
-                err_ = true;
-                return false;
-            }
-    }
-    if(size != 0){
-        try{
-            delta_delta = static_cast<int64_t>(bstream.read_bits(size));
-            if(delta_delta > (1 << (size - 1))){
-                delta_delta -= (1 << size);
-            }
-        }
-        catch(const base::TSDBException & e){
-            err_ = true;
-            return false;
-        }
+        // Possible overflow
+        delta_timestamp = static_cast<uint64_t>(delta_delta + static_cast<int64_t>(delta_timestamp));
+        timestamp += static_cast<int64_t>(delta_timestamp);
     }
 
-    // Possible overflow
-    delta_timestamp = static_cast<uint64_t>(delta_delta + static_cast<int64_t>(delta_timestamp));
-    timestamp += static_cast<int64_t>(delta_timestamp);
-    return read_value();
+    if(!read_value()){
+        err_ = true;
+        return false;
+    }
+    return true;
 }
 
 bool XORIterator::read_value() const{
-    bool control_bit;
-    try{
-        control_bit = bstream.read_bit();   // First control bit
-    }
-    catch(const base::TSDBException & e){
+    if(!read_xor_value(reader, value, leading_zero, trailing_zero))
         return false;
-    }
-
-    if(control_bit == ZERO){
-        // it.val = it.val
-    } else {
-        try{
-            control_bit = bstream.read_bit();   // Second control bit
-        }
-        catch(const base::TSDBException & e){
-            return false;
-        }
-
-        if(control_bit != ZERO){
-            uint8_t bits;
-            try{
-                bits = static_cast<uint8_t>(bstream.read_bits(5));
-            }
-            catch(const base::TSDBException & e){
-                return false;
-            }
-            leading_zero = bits;
-
-            try{
-                bits = static_cast<uint8_t>(bstream.read_bits(6));
-            }
-            catch(const base::TSDBException & e){
-                return false;
-            }
-            // 0 significant bits here means we overflowed and we actually need 64; see comment in encoder
-            if(bits == 0){
-                bits = 64;
-            }
-            trailing_zero = static_cast<uint8_t>(64 - leading_zero - bits);
-        }
+    ++num_read;
+    return true;
+}
 
-        uint64_t bits;
-        try{
-            bits = bstream.read_bits(static_cast<int>(64 - leading_zero - trailing_zero));
-        }
-        catch(const base::TSDBException & e){
-            return false;
+int XORIterator::next_batch(int64_t * ts, double * vs, int max) const{
+    int n = 0;
+    // The first two samples are encoded differently.
+    while(n < max && num_read < 2 && XORIterator::next()){
+        ts[n] = timestamp;
+        vs[n] = value;
+        ++ n;
+    }
+    if(err_ || num_read < 2)
+        return n;
+
+    // The state is kept in locals while decoding the rest.
+    BitReader r = reader;
+    int64_t t = timestamp;
+    uint64_t dt = delta_timestamp;
+    double v = value;
+    uint8_t lz = leading_zero;
+    uint8_t tz = trailing_zero;
+    int left = std::min(max - n, static_cast<int>(num_total) - static_cast<int>(num_read));
+    int i = 0;
+    for(; i < left; ++ i){
+        int64_t delta_delta;
+        if(!read_delta_delta(r, delta_delta) || !read_xor_value(r, v, lz, tz)){
+            err_ = true;
+            break;
         }
-        uint64_t vbits = base::encode_double(value);
-        vbits ^= (bits << trailing_zero);
-        value = base::decode_double(vbits);
+        dt = static_cast<uint64_t>(delta_delta + static_cast<int64_t>(dt));
+        t += static_cast<int64_t>(dt);
+        ts[n] = t;
+        vs[n] = v;
+        ++ n;
     }
 
-    ++num_read;
-    return true;
+    reader = r;
+    timestamp = t;
+    delta_timestamp = dt;
+    value = v;
+    leading_zero = lz;
+    trailing_zero = tz;
+    num_read += i;
+    return n;
 }
 
 bool XORIterator::error() const{
     return err_;
 }
 
-}}
\ No newline at end of file
+}}
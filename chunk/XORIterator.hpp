@@ -1,8 +1,10 @@
 #ifndef XORIterator_H
 #define XORIterator_H
 
+#include <memory>
+
+#include "chunk/BitReader.hpp"
 #include "chunk/ChunkIteratorInterface.hpp"
-#include "chunk/BitStream.hpp"
 // #include <iostream>
 
 namespace tsdb{
@@ -10,7 +12,10 @@ namespace chunk{
 
 class XORIterator: public ChunkIteratorInterface{
     public:
-        mutable BitStream bstream;
+        mutable BitReader reader;
+        bool safe_mode;
+        // Region of the chunk being appended to which is read in place.
+        std::shared_ptr<const uint8_t> region;
         mutable int64_t timestamp;  // Millisecond
         mutable double value;
         mutable uint64_t delta_timestamp;
@@ -19,11 +24,14 @@ class XORIterator: public ChunkIteratorInterface{
         mutable uint16_t num_total;
         mutable uint16_t num_read;
         mutable bool err_;
-        bool safe_mode;
 
     public:
-        // Read mode BitStream
-        XORIterator(BitStream & bstream, bool safe_mode);
+        // Reads the size bytes at stream_ptr.
+        //
+        // In safe mode the stream may be appended to while iterating. The
+        // iterator holds the region of the buffer and only reads the samples
+        // written so far, which the appender never modifies.
+        XORIterator(const uint8_t * stream_ptr, int size, const std::shared_ptr<const uint8_t> & region);
 
         std::pair<int64_t, double> at() const;
 
@@ -31,6 +39,8 @@ class XORIterator: public ChunkIteratorInterface{
 
         bool read_value() const;
 
+        int next_batch(int64_t * ts, double * vs, int max) const;
+
         bool error() const;
 };
 
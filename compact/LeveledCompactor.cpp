@@ -4,43 +4,75 @@
 #include "block/Block.hpp"      // Block, Blocks
 #include "chunk/ChunkUtils.hpp" // merge_overlapping_chunks.
 #include "chunk/ChunkWriter.hpp"
+#include "chunk/GroupChunkWriter.hpp"
 #include "chunk/DeleteIterator.hpp"
 #include "chunk/XORChunk.hpp"
 #include "compact/CompactionChunkSeriesSet.hpp"
 #include "compact/MergedChunkSeriesSet.hpp"
 #include "db/DBUtils.hpp"
+#include "index/GroupIndexWriter.hpp"
 #include "index/IndexWriter.hpp"
 #include "index/MemPostings.hpp"
+#include "index/PostingSet.hpp"
 #include "querier/ChunkSeriesSetInterface.hpp"
 #include "tombstone/TombstoneUtils.hpp"
 
 #include <limits>
+#include <map>
+#include <set>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
 namespace tsdb {
 namespace compact {
 
+namespace {
+
+// Compaction rewrites float chunks into float encodings only. Chimp chunks
+// are opted into for their size, they decode slower than XOR chunks.
+const char* check_chunk_encoding(uint8_t encoding)
+{
+    if (encoding == chunk::EncNone || encoding == chunk::EncXOR ||
+        encoding == chunk::EncChimp)
+        return nullptr;
+    return "compaction can not rewrite chunks into this encoding";
+}
+
+} // namespace
+
 LeveledCompactor::LeveledCompactor(
     const std::deque<int64_t>& ranges,
-    const std::shared_ptr<base::Channel<char>>& cancel)
-    : ranges(ranges), cancel(cancel)
+    const std::shared_ptr<base::Channel<char>>& cancel, uint8_t block_type,
+    uint8_t chunk_encoding)
+    : ranges(ranges), cancel(cancel), block_type(block_type),
+      chunk_encoding(chunk_encoding)
 {
     if (ranges.empty()) err_.set("at least one range must be provided");
+    else if (const char* e = check_chunk_encoding(chunk_encoding))
+        err_.set(e);
 }
 LeveledCompactor::LeveledCompactor(
     const std::vector<int64_t>& ranges,
-    const std::shared_ptr<base::Channel<char>>& cancel)
-    : ranges(ranges.begin(), ranges.end()), cancel(cancel)
+    const std::shared_ptr<base::Channel<char>>& cancel, uint8_t block_type,
+    uint8_t chunk_encoding)
+    : ranges(ranges.begin(), ranges.end()), cancel(cancel),
+      block_type(block_type), chunk_encoding(chunk_encoding)
 {
     if (this->ranges.empty()) err_.set("at least one range must be provided");
+    else if (const char* e = check_chunk_encoding(chunk_encoding))
+        err_.set(e);
 }
 LeveledCompactor::LeveledCompactor(
     const std::initializer_list<int64_t>& ranges,
-    const std::shared_ptr<base::Channel<char>>& cancel)
-    : ranges(ranges.begin(), ranges.end()), cancel(cancel)
+    const std::shared_ptr<base::Channel<char>>& cancel, uint8_t block_type,
+    uint8_t chunk_encoding)
+    : ranges(ranges.begin(), ranges.end()), cancel(cancel),
+      block_type(block_type), chunk_encoding(chunk_encoding)
 {
     if (this->ranges.empty()) err_.set("at least one range must be provided");
+    else if (const char* e = check_chunk_encoding(chunk_encoding))
+        err_.set(e);
 }
 
 std::pair<std::deque<std::string>, error::Error>
@@ -252,7 +284,8 @@ LeveledCompactor::compact(const std::string& dest,
             }
         }
         if (!b) {
-            b = std::shared_ptr<block::BlockInterface>(new block::Block(d));
+            b = std::shared_ptr<block::BlockInterface>(
+                new block::Block(d, block_type));
             if (b->error())
                 return {ulid::ULID(),
                         error::Error("Error opening block: " + d)};
@@ -379,15 +412,8 @@ error::Error LeveledCompactor::populate_blocks(
     bool overlapping = false;
     int err;
 
-    // Create ChunkSeriesSets.
-    std::shared_ptr<querier::ChunkSeriesSets> sets(
-        new querier::ChunkSeriesSets());
-
     int64_t max_time = blocks->front()->MaxTime();
     for (int i = 0; i < blocks->size(); i++) {
-        // Check if receiving cancel signal.
-        if (!cancel->empty()) return error::Error("cancel");
-
         if (!overlapping) {
             if (i > 0 && blocks->at(i)->MinTime() < max_time) {
                 overlapping = true;
@@ -398,6 +424,79 @@ error::Error LeveledCompactor::populate_blocks(
             if (blocks->at(i)->MaxTime() > max_time)
                 max_time = blocks->at(i)->MaxTime();
         }
+    }
+
+    if (block_type == static_cast<uint8_t>(block::GroupBlock))
+        return write_groups(blocks, bm, overlapping, indexw, chunkw);
+
+    // Create ChunkSeriesSets.
+    std::shared_ptr<querier::ChunkSeriesSets> sets;
+    error::Error serr = series_sets(blocks, nullptr, &sets);
+    if (serr) return serr;
+
+    // Create MergedChunkSeriesSet.
+    MergedChunkSeriesSet mcss(sets);
+
+    index::MemPostings postings;
+
+    // STEP 1 in index writer.
+    while (mcss.next()) {
+        // Check if receiving cancel signal.
+        if (!cancel->empty()) return error::Error("cancel");
+
+        std::shared_ptr<querier::ChunkSeriesMeta> csm = mcss.at();
+        serr = prepare_series(csm.get(), bm, overlapping);
+        if (serr) return serr;
+        // Skip the series with all deleted chunks.
+        if (csm->chunks.empty()) continue;
+
+        // Compacted blocks hold older data which is rarely read, their
+        // float chunks are rewritten into the configured encoding if it
+        // makes them smaller. Integral chunks are left as they are.
+        if (chunk_encoding != chunk::EncNone && bm->compaction.level > 1) {
+            for (std::shared_ptr<chunk::ChunkMeta>& c : csm->chunks) {
+                uint8_t enc = c->chunk->encoding();
+                if (enc == chunk_encoding || enc == chunk::EncInt) continue;
+                auto recoded = chunk::recode_chunk(c->chunk, chunk_encoding);
+                if (recoded.second)
+                    return error::wrap(recoded.second, "recode chunk");
+                if (recoded.first->size() < c->chunk->size())
+                    c->chunk = recoded.first;
+            }
+        }
+
+        // write_chunks will update ref in ChunkMeta.
+        chunkw->write_chunks(csm->chunks);
+
+        // STEP 2 in index writer.
+        // Monotonically increasing ID.
+        if ((err = indexw->add_series(csm->tsid, csm->chunks)) !=
+            index::SUCCEED)
+            return error::wrap(error::Error(index::error_string(err)),
+                               "add_series");
+
+        bm->stats.num_chunks += csm->chunks.size();
+        ++bm->stats.num_series;
+        for (auto const& chk : csm->chunks)
+            bm->stats.num_samples += chk->chunk->num_samples();
+
+        // Add postings to MemPostings.
+        postings.add(csm->tsid);
+    }
+    if (mcss.error())
+        return error::wrap(mcss.error_detail(), "iterate MergedChunkSeriesSet");
+    return error::Error();
+}
+
+error::Error LeveledCompactor::series_sets(
+    const std::shared_ptr<block::Blocks>& blocks,
+    const std::set<tagtree::TSID>* tsids,
+    std::shared_ptr<querier::ChunkSeriesSets>* sets)
+{
+    sets->reset(new querier::ChunkSeriesSets());
+    for (int i = 0; i < blocks->size(); i++) {
+        // Check if receiving cancel signal.
+        if (!cancel->empty()) return error::Error("cancel");
 
         std::pair<std::shared_ptr<block::IndexReaderInterface>, bool>
             index_pair = blocks->at(i)->index();
@@ -417,96 +516,244 @@ error::Error LeveledCompactor::populate_blocks(
             return error::Error("Error open tombstone reader for block " +
                                 ulid::Marshal(blocks->at(i)->meta().ulid_));
 
-        std::pair<std::unique_ptr<index::PostingsInterface>, bool>
-            all_postings_pair = index_pair.first->get_all_postings();
-        if (!all_postings_pair.second)
-            return error::Error("Error get postings of ALL_POSTINGS_KEYS " +
-                                ulid::Marshal(blocks->at(i)->meta().ulid_));
+        std::unique_ptr<index::PostingsInterface> p;
+        if (tsids) {
+            p.reset(new index::PostingSet(*tsids));
+        } else {
+            std::pair<std::unique_ptr<index::PostingsInterface>, bool>
+                all_postings_pair = index_pair.first->get_all_postings();
+            if (!all_postings_pair.second)
+                return error::Error(
+                    "Error get postings of ALL_POSTINGS_KEYS " +
+                    ulid::Marshal(blocks->at(i)->meta().ulid_));
+            p = std::move(all_postings_pair.first);
+        }
 
         // Append block to ChunkSeriesSets.
-        sets->push_back(std::shared_ptr<querier::ChunkSeriesSetInterface>(
+        (*sets)->push_back(std::shared_ptr<querier::ChunkSeriesSetInterface>(
             new CompactionChunkSeriesSet(index_pair.first, chunks_pair.first,
                                          tombstones_pair.first,
-                                         std::move(all_postings_pair.first))));
+                                         std::move(p))));
     }
+    return error::Error();
+}
 
-    // Create MergedChunkSeriesSet.
-    MergedChunkSeriesSet mcss(sets);
+error::Error LeveledCompactor::prepare_series(querier::ChunkSeriesMeta* csm,
+                                              block::BlockMeta* bm,
+                                              bool overlapping)
+{
+    if (overlapping) {
+        // If blocks are overlapping, it is possible to have unsorted
+        // chunks.
+        std::sort(csm->chunks.begin(), csm->chunks.end(),
+                  [](const std::shared_ptr<chunk::ChunkMeta>& lhs,
+                     const std::shared_ptr<chunk::ChunkMeta>& rhs) {
+                      return lhs->min_time < rhs->min_time;
+                  });
+    }
+    if (csm->chunks.empty()) return error::Error();
+
+    for (int i = 0; i < csm->chunks.size(); ++i) {
+        if (csm->chunks[i]->min_time < bm->min_time ||
+            csm->chunks[i]->max_time > bm->max_time)
+            return error::Error(
+                "found chunk with minTime: " +
+                std::to_string(csm->chunks[i]->min_time) +
+                " maxTime: " + std::to_string(csm->chunks[i]->max_time) +
+                " outside of compacted minTime: " +
+                std::to_string(bm->min_time) +
+                " maxTime: " + std::to_string(bm->max_time));
+        // Re-encode the chunk to not have deleted values.
+        if (!csm->intervals.empty()) {
+            if (!csm->chunks[i]->overlap_closed(
+                    csm->intervals.front().min_time,
+                    csm->intervals.back().max_time))
+                continue;
+
+            // Keep the encoding, deleting samples does not make the
+            // remaining ones less integral.
+            std::shared_ptr<chunk::ChunkInterface> new_chunk =
+                chunk::new_chunk(csm->chunks[i]->chunk->encoding());
+            if (!new_chunk) new_chunk = chunk::new_chunk(chunk::EncXOR);
+            std::unique_ptr<chunk::ChunkAppenderInterface> app;
+            try {
+                app = new_chunk->appender();
+            } catch (const base::TSDBException& e) {
+                return error::Error(e.what());
+            }
 
-    index::MemPostings postings;
+            chunk::DeleteIterator it(
+                std::move(csm->chunks[i]->chunk->iterator()),
+                csm->intervals.cbegin(), csm->intervals.cend());
+            while (it.next()) {
+                std::pair<int64_t, double> p = it.at();
+                app->append(p.first, p.second);
+            }
+            csm->chunks[i]->chunk = new_chunk;
+        }
+    }
 
-    // STEP 1 in index writer.
-    while (mcss.next()) {
-        // Check if receiving cancel signal.
-        if (!cancel->empty()) return error::Error("cancel");
+    if (overlapping) {
+        auto merged_chunks = chunk::merge_overlapping_chunks(csm->chunks);
+        if (merged_chunks.second)
+            return error::wrap(merged_chunks.second,
+                               "merge overlapping chunks");
+        csm->chunks = merged_chunks.first;
+    }
+    return error::Error();
+}
 
-        std::shared_ptr<querier::ChunkSeriesMeta> csm = mcss.at();
-        if (overlapping) {
-            // If blocks are overlapping, it is possible to have unsorted
-            // chunks.
-            std::sort(csm->chunks.begin(), csm->chunks.end(),
-                      [](const std::shared_ptr<chunk::ChunkMeta>& lhs,
-                         const std::shared_ptr<chunk::ChunkMeta>& rhs) {
-                          return lhs->min_time < rhs->min_time;
-                      });
+error::Error LeveledCompactor::write_groups(
+    const std::shared_ptr<block::Blocks>& blocks, block::BlockMeta* bm,
+    bool overlapping,
+    const std::shared_ptr<block::IndexWriterInterface>& indexw,
+    const std::shared_ptr<block::ChunkWriterInterface>& chunkw)
+{
+    std::shared_ptr<chunk::GroupChunkWriter> group_chunkw =
+        std::dynamic_pointer_cast<chunk::GroupChunkWriter>(chunkw);
+    std::shared_ptr<index::GroupIndexWriter> group_indexw =
+        std::dynamic_pointer_cast<index::GroupIndexWriter>(indexw);
+    if (!group_chunkw || !group_indexw)
+        return error::Error("write_groups: not group writers");
+
+    // <tsid, chunk>.
+    typedef std::pair<tagtree::TSID, int> ChunkPos;
+    std::shared_ptr<querier::ChunkSeriesSets> sets;
+    error::Error serr;
+    int err;
+
+    // Pass 1, candidates are bucketed by <min_time, max_time, #samples, hash
+    // of the timestamps>. Only the buckets are kept, not the samples.
+    std::map<std::tuple<int64_t, int64_t, int, uint64_t>, std::vector<ChunkPos>>
+        buckets;
+    {
+        if ((serr = series_sets(blocks, nullptr, &sets))) return serr;
+        MergedChunkSeriesSet mcss(sets);
+        while (mcss.next()) {
+            if (!cancel->empty()) return error::Error("cancel");
+
+            std::shared_ptr<querier::ChunkSeriesMeta> csm = mcss.at();
+            if ((serr = prepare_series(csm.get(), bm, overlapping)))
+                return serr;
+            for (int j = 0; j < csm->chunks.size(); ++j) {
+                const std::shared_ptr<chunk::ChunkMeta>& c = csm->chunks[j];
+                uint64_t h = 14695981039346656037ULL;
+                std::unique_ptr<chunk::ChunkIteratorInterface> it =
+                    c->chunk->iterator();
+                while (it->next()) {
+                    h ^= static_cast<uint64_t>(it->at().first);
+                    h *= 1099511628211ULL;
+                }
+                buckets[std::make_tuple(c->min_time, c->max_time,
+                                        c->chunk->num_samples(), h)]
+                    .emplace_back(csm->tsid, j);
+            }
         }
-        // Skip the series with all deleted chunks.
-        // LOG_DEBUG << csm->chunks.size();
-        if (csm->chunks.empty()) continue;
+        if (mcss.error())
+            return error::wrap(mcss.error_detail(),
+                               "iterate MergedChunkSeriesSet");
+    }
 
-        for (int i = 0; i < csm->chunks.size(); ++i) {
-            // LOG_DEBUG << csm->chunks[i]->min_time << " " <<
-            // csm->chunks[i]->max_time;
-            if (csm->chunks[i]->min_time < bm->min_time ||
-                csm->chunks[i]->max_time > bm->max_time)
-                return error::Error(
-                    "found chunk with minTime: " +
-                    std::to_string(csm->chunks[i]->min_time) +
-                    " maxTime: " + std::to_string(csm->chunks[i]->max_time) +
-                    " outside of compacted minTime: " +
-                    std::to_string(bm->min_time) +
-                    " maxTime: " + std::to_string(bm->max_time));
-            // Re-encode the chunk to not have deleted values.
-            if (!csm->intervals.empty()) {
-                if (!csm->chunks[i]->overlap_closed(
-                        csm->intervals.front().min_time,
-                        csm->intervals.back().max_time))
-                    continue;
-
-                // TODO(alec), different types of chunk.
-                std::shared_ptr<chunk::ChunkInterface> new_chunk =
-                    std::shared_ptr<chunk::XORChunk>(new chunk::XORChunk());
-                std::unique_ptr<chunk::ChunkAppenderInterface> app;
-                try {
-                    app = new_chunk->appender();
-                } catch (const base::TSDBException& e) {
-                    return error::Error(e.what());
+    // Buckets of the same series are loaded together, candidates[tsids][k][m]
+    // is the chunk of tsids[m] in the k-th such bucket. Series come in tsid
+    // order, so do the members of a bucket.
+    std::map<std::vector<tagtree::TSID>, std::vector<std::vector<int>>>
+        candidates;
+    for (auto& bucket : buckets) {
+        if (bucket.second.size() < 2) continue;
+        std::vector<tagtree::TSID> tsids;
+        std::vector<int> chunks;
+        for (const ChunkPos& cp : bucket.second) {
+            tsids.push_back(cp.first);
+            chunks.push_back(cp.second);
+        }
+        candidates[tsids].push_back(std::move(chunks));
+    }
+    buckets.clear();
+
+    // Pass 2, one candidate group of series is held at a time. Its buckets
+    // are split by the actual timestamps, as hashes may collide.
+    std::map<ChunkPos, uint64_t> refs;
+    std::set<std::vector<tagtree::TSID>> groups;
+    for (auto& cand : candidates) {
+        std::set<tagtree::TSID> ids(cand.first.begin(), cand.first.end());
+        if ((serr = series_sets(blocks, &ids, &sets))) return serr;
+        MergedChunkSeriesSet mcss(sets);
+        std::vector<std::shared_ptr<querier::ChunkSeriesMeta>> series;
+        while (mcss.next()) {
+            if (!cancel->empty()) return error::Error("cancel");
+
+            // The set reuses its ChunkSeriesMeta.
+            series.emplace_back(new querier::ChunkSeriesMeta(*mcss.at()));
+            if ((serr = prepare_series(series.back().get(), bm, overlapping)))
+                return serr;
+        }
+        if (mcss.error())
+            return error::wrap(mcss.error_detail(),
+                               "iterate MergedChunkSeriesSet");
+        if (series.size() != cand.first.size())
+            return error::Error("write_groups: series changed between passes");
+
+        for (const std::vector<int>& chunks : cand.second) {
+            std::map<std::vector<int64_t>, std::vector<int>> by_timestamps;
+            std::vector<std::vector<double>> values(series.size());
+            for (int m = 0; m < series.size(); ++m) {
+                std::vector<int64_t> timestamps;
+                std::unique_ptr<chunk::ChunkIteratorInterface> it =
+                    series[m]->chunks[chunks[m]]->chunk->iterator();
+                while (it->next()) {
+                    std::pair<int64_t, double> p = it->at();
+                    timestamps.push_back(p.first);
+                    values[m].push_back(p.second);
                 }
+                by_timestamps[timestamps].push_back(m);
+            }
 
-                chunk::DeleteIterator it(
-                    std::move(csm->chunks[i]->chunk->iterator()),
-                    csm->intervals.cbegin(), csm->intervals.cend());
-                while (it.next()) {
-                    std::pair<int64_t, double> p = it.at();
-                    app->append(p.first, p.second);
+            for (auto& members : by_timestamps) {
+                if (members.second.size() < 2) continue;
+
+                std::vector<tagtree::TSID> tsids;
+                for (int m : members.second)
+                    tsids.push_back(series[m]->tsid);
+
+                chunk::GroupChunk group(tsids);
+                std::vector<double> row(tsids.size());
+                for (int r = 0; r < members.first.size(); ++r) {
+                    for (int k = 0; k < members.second.size(); ++k)
+                        row[k] = values[members.second[k]][r];
+                    group.append(members.first[r], row.data());
                 }
-                csm->chunks[i]->chunk = new_chunk;
+
+                uint64_t ref = group_chunkw->write_group(&group);
+                for (int m : members.second)
+                    refs[ChunkPos(series[m]->tsid, chunks[m])] = ref;
+                groups.insert(tsids);
             }
         }
+    }
+    candidates.clear();
 
-        if (overlapping) {
-            auto merged_chunks = chunk::merge_overlapping_chunks(csm->chunks);
-            if (merged_chunks.second)
-                return error::wrap(merged_chunks.second,
-                                   "merge overlapping chunks");
-            csm->chunks = merged_chunks.first;
-        }
+    // Pass 3 writes the remaining chunks and the index in tsid order.
+    if ((serr = series_sets(blocks, nullptr, &sets))) return serr;
+    MergedChunkSeriesSet mcss(sets);
+    while (mcss.next()) {
+        if (!cancel->empty()) return error::Error("cancel");
+
+        std::shared_ptr<querier::ChunkSeriesMeta> csm = mcss.at();
+        if ((serr = prepare_series(csm.get(), bm, overlapping))) return serr;
+        if (csm->chunks.empty()) continue;
 
         // write_chunks will update ref in ChunkMeta.
-        chunkw->write_chunks(csm->chunks);
+        std::vector<std::shared_ptr<chunk::ChunkMeta>> singles;
+        for (int j = 0; j < csm->chunks.size(); ++j) {
+            auto it = refs.find(ChunkPos(csm->tsid, j));
+            if (it != refs.end())
+                csm->chunks[j]->ref = it->second;
+            else
+                singles.push_back(csm->chunks[j]);
+        }
+        if (!singles.empty()) chunkw->write_chunks(singles);
 
-        // STEP 2 in index writer.
-        // Monotonically increasing ID.
         if ((err = indexw->add_series(csm->tsid, csm->chunks)) !=
             index::SUCCEED)
             return error::wrap(error::Error(index::error_string(err)),
@@ -516,13 +763,16 @@ error::Error LeveledCompactor::populate_blocks(
         ++bm->stats.num_series;
         for (auto const& chk : csm->chunks)
             bm->stats.num_samples += chk->chunk->num_samples();
-
-        // Add postings to MemPostings.
-        postings.add(csm->tsid);
     }
     if (mcss.error())
         return error::wrap(mcss.error_detail(), "iterate MergedChunkSeriesSet");
 
+    // The set orders the groups by their first series.
+    for (const std::vector<tagtree::TSID>& tsids : groups) {
+        if ((err = group_indexw->add_group(tsids).second) != index::SUCCEED)
+            return error::wrap(error::Error(index::error_string(err)),
+                               "add_group");
+    }
     return error::Error();
 }
 
@@ -549,13 +799,19 @@ LeveledCompactor::write_helper(const std::string& dest, block::BlockMeta* bm,
         {
             // Populate chunk and index files into temporary directory with data
             // of all blocks.
-            std::shared_ptr<block::ChunkWriterInterface> chunkw =
-                std::shared_ptr<chunk::ChunkWriter>(
+            std::shared_ptr<block::ChunkWriterInterface> chunkw;
+            std::shared_ptr<block::IndexWriterInterface> indexw;
+            if (block_type == static_cast<uint8_t>(block::GroupBlock)) {
+                chunkw = std::shared_ptr<chunk::GroupChunkWriter>(
+                    new chunk::GroupChunkWriter(tmp.string() + "/chunks"));
+                indexw = std::shared_ptr<index::GroupIndexWriter>(
+                    new index::GroupIndexWriter(tmp.string() + "/index"));
+            } else {
+                chunkw = std::shared_ptr<chunk::ChunkWriter>(
                     new chunk::ChunkWriter(tmp.string() + "/chunks"));
-
-            std::shared_ptr<block::IndexWriterInterface> indexw =
-                std::shared_ptr<index::IndexWriter>(
+                indexw = std::shared_ptr<index::IndexWriter>(
                     new index::IndexWriter(tmp.string() + "/index"));
+            }
 
             err = populate_blocks(blocks, bm, indexw, chunkw);
         }
@@ -1,15 +1,22 @@
 #ifndef LEVELEDCOMPACTOR_H
 #define LEVELEDCOMPACTOR_H
 
+#include <set>
 #include <vector>
 
 #include "base/Channel.hpp"
+#include "block/Block.hpp"
 #include "block/BlockUtils.hpp"
 #include "block/ChunkWriterInterface.hpp"
 #include "block/IndexWriterInterface.hpp"
+#include "chunk/ChunkInterface.hpp"
 #include "compact/CompactorInterface.hpp"
+#include "querier/ChunkSeriesMeta.hpp"
 
 namespace tsdb{
+namespace querier{
+class ChunkSeriesSets;
+}
 namespace compact{
 
 class LeveledCompactor: public CompactorInterface{
@@ -17,6 +24,8 @@ class LeveledCompactor: public CompactorInterface{
         std::deque<int64_t> ranges;
         std::shared_ptr<base::Channel<char>> cancel;
         error::Error err_;
+        uint8_t block_type;     // Type of the written blocks, see block::BlockType.
+        uint8_t chunk_encoding; // Encoding float chunks are rewritten into when compacting blocks, chunk::EncNone keeps them, chunk::EncXOR or chunk::EncChimp are the others accepted.
 
     public:
         std::deque<std::string> overlapping_dirs(const std::shared_ptr<block::DirMetas> & dms);
@@ -63,12 +72,31 @@ class LeveledCompactor: public CompactorInterface{
         // TODO(Alec), add metrics tracking the number of populated blocks.
         error::Error populate_blocks(const std::shared_ptr<block::Blocks> & blocks, block::BlockMeta * bm, const std::shared_ptr<block::IndexWriterInterface> & indexw, const std::shared_ptr<block::ChunkWriterInterface> & chunkw);
 
+        // series_sets opens a ChunkSeriesSet per block over the series in tsids, all
+        // of them if tsids is null.
+        error::Error series_sets(const std::shared_ptr<block::Blocks> & blocks, const std::set<tagtree::TSID> * tsids, std::shared_ptr<querier::ChunkSeriesSets> * sets);
+
+        // prepare_series sorts, checks, rewrites and merges the chunks of a series
+        // read from the blocks, steps 2.1 to 2.3 of populate_blocks().
+        error::Error prepare_series(querier::ChunkSeriesMeta * csm, block::BlockMeta * bm, bool overlapping);
+
+        // write_groups populates a GroupBlock. Chunks of different series with exactly
+        // the same timestamps, i.e. series scraped together, are stored as one
+        // GroupChunk, the others as usual. The series sharing group chunks are added to
+        // the group postings of the index.
+        //
+        // The blocks are read three times so that the samples of one group at a time
+        // are held: once to find the candidate groups by hashes of their chunks'
+        // timestamps, once per candidate group to write its group chunks and once to
+        // write the other chunks and the index.
+        error::Error write_groups(const std::shared_ptr<block::Blocks> & blocks, block::BlockMeta * bm, bool overlapping, const std::shared_ptr<block::IndexWriterInterface> & indexw, const std::shared_ptr<block::ChunkWriterInterface> & chunkw);
+
         std::pair<std::deque<std::string>, error::Error> plan_helper(const std::shared_ptr<block::DirMetas> & dms);
 
-        LeveledCompactor()=default;
-        LeveledCompactor(const std::deque<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel);
-        LeveledCompactor(const std::vector<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel);
-        LeveledCompactor(const std::initializer_list<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel);
+        LeveledCompactor(): block_type(static_cast<uint8_t>(block::OriginalBlock)), chunk_encoding(static_cast<uint8_t>(chunk::EncNone)){}
+        LeveledCompactor(const std::deque<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel, uint8_t block_type=static_cast<uint8_t>(block::OriginalBlock), uint8_t chunk_encoding=static_cast<uint8_t>(chunk::EncNone));
+        LeveledCompactor(const std::vector<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel, uint8_t block_type=static_cast<uint8_t>(block::OriginalBlock), uint8_t chunk_encoding=static_cast<uint8_t>(chunk::EncNone));
+        LeveledCompactor(const std::initializer_list<int64_t> & ranges, const std::shared_ptr<base::Channel<char>> & cancel, uint8_t block_type=static_cast<uint8_t>(block::OriginalBlock), uint8_t chunk_encoding=static_cast<uint8_t>(chunk::EncNone));
 
         std::pair<std::deque<std::string>, error::Error> plan(const std::string & dir);
 
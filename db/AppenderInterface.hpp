@@ -20,14 +20,46 @@ public:
     // returned which can be used to add further samples in the same or later
     // transactions.
     // Returned reference numbers are ephemeral and may be rejected in calls
-    // to AddFast() at any point. Adding the sample via add() returns a new
+    // to add_fast() at any point. Adding the sample via add() returns a new
     // reference number.
     // If the reference is 0 it must not be used for caching.
-    virtual error::Error add(tagtree::TSID tsid, int64_t t, double v) = 0;
-    // Return a gorup id.
+    virtual std::pair<uint64_t, error::Error> add(tagtree::TSID tsid,
+                                                  int64_t t, double v) = 0;
+
+    // add_fast adds a sample pair for the referenced series. It is generally
+    // faster than adding a sample by providing its TSID. It fails with
+    // ErrNotFound once the reference became stale, the caller should then
+    // fall back to add().
+    virtual error::Error add_fast(uint64_t ref, int64_t t, double v) = 0;
+    // add_group adds a row of samples of series scraped together, vs[i]
+    // belonging to tsids[i]. Implementations may store the timestamps of the
+    // group once, the default one falls back to add() for each sample.
     virtual error::Error add_group(const std::vector<tagtree::TSID>& tsids,
-                                   int64_t t, const std::vector<double>& v)
+                                   int64_t t, const std::vector<double>& vs)
+    {
+        if (tsids.size() != vs.size())
+            return error::Error("mismatched group columns");
+        for (size_t i = 0; i < tsids.size(); ++i) {
+            error::Error err = add(tsids[i], t, vs[i]).second;
+            if (err) return err;
+        }
+        return error::Error();
+    }
+
+    // add_batch adds a column of samples, the i-th sample belonging to
+    // tsids[i] at ts[i] with value vs[i]. Implementations may resolve the
+    // series and encode the WAL record straight from the columns, the default
+    // one falls back to add() for each sample.
+    virtual error::Error add_batch(const std::vector<tagtree::TSID>& tsids,
+                                   const std::vector<int64_t>& ts,
+                                   const std::vector<double>& vs)
     {
+        if (tsids.size() != ts.size() || tsids.size() != vs.size())
+            return error::Error("mismatched batch columns");
+        for (size_t i = 0; i < tsids.size(); ++i) {
+            error::Error err = add(tsids[i], ts[i], vs[i]).second;
+            if (err) return err;
+        }
         return error::Error();
     }
 
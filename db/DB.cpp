@@ -25,7 +25,7 @@ DB::DB(const std::string& dir_, const Options& options)
     : dir_(dir_), opts(options), compactc(new base::Channel<char>()),
       donec(new base::Channel<char>()), stopc(new base::Channel<char>()),
       compact_cancel(new base::Channel<char>()), auto_compact(true),
-      pool_(new base::ThreadPool("DB ThreadPool"))
+      snapshotted(false), pool_(new base::ThreadPool("DB ThreadPool"))
 {
     boost::filesystem::create_directories(dir_);
 
@@ -38,7 +38,9 @@ DB::DB(const std::string& dir_, const Options& options)
     }
 
     compactor = std::unique_ptr<compact::CompactorInterface>(
-        new compact::LeveledCompactor(opts.block_ranges, compact_cancel));
+        new compact::LeveledCompactor(opts.block_ranges, compact_cancel,
+                                      opts.block_type,
+                                      opts.compaction_chunk_encoding));
     if (compactor->error()) {
         err_.set(error::wrap(compactor->error(), "create LeveledCompactor"));
         return;
@@ -47,28 +49,24 @@ DB::DB(const std::string& dir_, const Options& options)
     // TODO(Alec), thread number optimization.
     pool_->start(8);
 
-    std::unique_ptr<wal::WAL> wal;
-    // Wal is enabled.
+    std::vector<std::unique_ptr<wal::WAL>> wals;
     if (opts.wal_segment_size >= 0) {
-        if (opts.wal_segment_size > 0)
-            wal = std::unique_ptr<wal::WAL>(
-                new wal::WAL(tsdbutil::filepath_join(dir_, "wal"), pool_,
-                             opts.wal_segment_size));
-        else
-            wal = std::unique_ptr<wal::WAL>(
-                new wal::WAL(tsdbutil::filepath_join(dir_, "wal"), pool_));
-        if (wal->error()) {
-            err_.set(error::wrap(wal->error(), "create WAL"));
+        error::Error err = open_wals(&wals);
+        if (err) {
+            err_.set(err);
             return;
         }
     }
 
     head_ = std::shared_ptr<head::Head>(
-        new head::Head(opts.block_ranges[0], std::move(wal), pool_));
+        new head::Head(opts.block_ranges[0], std::move(wals), pool_,
+                       opts.ooo_window,
+                       tsdbutil::filepath_join(dir_, head::HEAD_CHUNKS_DIR)));
     if (head_->error()) {
         err_.set(error::wrap(head_->error(), "create Head"));
         return;
     }
+    head_->checkpoint_bytes_per_sec = opts.wal_checkpoint_bytes_per_sec;
 
     error::Error err = reload();
     if (err) {
@@ -87,6 +85,49 @@ DB::DB(const std::string& dir_, const Options& options)
     // run();
 }
 
+error::Error DB::open_wals(std::vector<std::unique_ptr<wal::WAL>>* wals)
+{
+    std::string wal_dir = tsdbutil::filepath_join(dir_, "wal");
+    int segment_size =
+        opts.wal_segment_size > 0 ? opts.wal_segment_size : wal::SEGMENT_SIZE;
+    int n = opts.wal_shards > 1 ? opts.wal_shards : 1;
+
+    // Replaying a WAL written with another number of shards would put series
+    // into the wrong shard, refuse to open it instead.
+    std::deque<std::string> shard_dirs;
+    for (const std::string& d : dirs(wal_dir)) {
+        if (boost::filesystem::path(d).filename().string().compare(
+                0, 6, "shard-") == 0)
+            shard_dirs.push_back(d);
+    }
+    if (n == 1 && !shard_dirs.empty())
+        return error::Error("WAL is sharded, set wal_shards to " +
+                            std::to_string(shard_dirs.size()));
+    if (n > 1) {
+        std::pair<std::vector<wal::SegmentRef>, error::Error> segs =
+            wal::list_segments(wal_dir);
+        if (segs.second) return error::wrap(segs.second, "list WAL segments");
+        if (!segs.first.empty())
+            return error::Error("WAL is not sharded, unset wal_shards");
+        if (!shard_dirs.empty() && shard_dirs.size() != static_cast<size_t>(n))
+            return error::Error("WAL has " + std::to_string(shard_dirs.size()) +
+                                " shards, wal_shards is " + std::to_string(n));
+    }
+
+    for (int i = 0; i < n; ++i) {
+        std::string d = n == 1 ? wal_dir
+                               : tsdbutil::filepath_join(
+                                     wal_dir, "shard-" + std::to_string(i));
+        wals->emplace_back(new wal::WAL(d, pool_, segment_size,
+                                        opts.wal_sync_policy,
+                                        opts.wal_sync_interval,
+                                        opts.wal_compression));
+        if (wals->back()->error())
+            return error::wrap(wals->back()->error(), "create WAL");
+    }
+    return error::Error();
+}
+
 std::unique_ptr<db::AppenderInterface> DB::appender()
 {
     return std::unique_ptr<db::AppenderInterface>(
@@ -173,7 +214,8 @@ DB::open_blocks(std::deque<std::shared_ptr<block::BlockInterface>>& blocks)
         std::shared_ptr<block::BlockInterface> b =
             get_block(meta_pair.first.ulid_);
         if (b == nullptr) {
-            b = std::shared_ptr<block::BlockInterface>(new block::Block(dir));
+            b = std::shared_ptr<block::BlockInterface>(
+                new block::Block(dir, opts.block_type));
             if (b->error()) {
                 corrupted[meta_pair.first.ulid_] = b->error();
                 continue;
@@ -556,6 +598,14 @@ void DB::close()
     }
 
     base::RWLockGuard lock(mutex_, 1);
+    // A head that failed to load must not be snapshotted, the snapshot would
+    // hide the WAL it did not replay.
+    if (opts.head_snapshot_on_close && !snapshotted && head_ && !err_) {
+        error::Error err = head_->snapshot();
+        if (err)
+            LOG_ERROR << "msg=\"snapshot head\" err=" << err.error();
+        snapshotted = true;
+    }
     for (auto b : blocks_)
         b->close();
     // lockf.release();
@@ -47,6 +47,9 @@ private:
     base::MutexLock auto_compact_mutex_;
     bool auto_compact;
 
+    // Set once close() took the head snapshot.
+    bool snapshotted;
+
     std::shared_ptr<base::ThreadPool> pool_;
     error::Error err_;
 
@@ -92,6 +95,9 @@ public:
     error::Error validate_block_sequence(
         const std::deque<std::shared_ptr<block::BlockInterface>>& blocks_);
 
+    // open_wals opens the WAL shards configured by opts.wal_shards.
+    error::Error open_wals(std::vector<std::unique_ptr<wal::WAL>>* wals);
+
     // reload blocks and trigger head truncation if new blocks appeared.
     // Blocks that are obsolete due to replacement or retention will be deleted.
     error::Error reload();
@@ -19,11 +19,30 @@ public:
         : app(std::move(app)), db(db)
     {}
 
-    error::Error add(tagtree::TSID tsid, int64_t t, double v)
+    std::pair<uint64_t, error::Error> add(tagtree::TSID tsid, int64_t t,
+                                          double v)
     {
         return app->add(tsid, t, v);
     }
 
+    error::Error add_fast(uint64_t ref, int64_t t, double v)
+    {
+        return app->add_fast(ref, t, v);
+    }
+
+    error::Error add_batch(const std::vector<tagtree::TSID>& tsids,
+                           const std::vector<int64_t>& ts,
+                           const std::vector<double>& vs)
+    {
+        return app->add_batch(tsids, ts, vs);
+    }
+
+    error::Error add_group(const std::vector<tagtree::TSID>& tsids, int64_t t,
+                           const std::vector<double>& vs)
+    {
+        return app->add_group(tsids, t, vs);
+    }
+
     error::Error commit()
     {
         error::Error err = app->commit();
@@ -64,7 +64,8 @@ const Options DefaultOptions = Options(
     15 * 24 * 60 * 60 * 1000, // 15 days in milliseconds
     0,
     exponential_block_ranges(2 * 3600 * 1000, 3, 5), // 2 hours in milliseconds
-    false, false);
+    false, false, 0, 0,
+    wal::SYNC_INTERVAL, wal::DEFAULT_SYNC_INTERVAL);
 
 // overlapping_blocks returns all overlapping blocks from given meta files.
 // blocks are sorted by min_time.
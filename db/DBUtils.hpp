@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "block/BlockUtils.hpp"
+#include "wal/WALUtils.hpp"
 
 namespace tsdb{
 namespace db{
@@ -50,14 +51,69 @@ class Options{
         // This in-turn enables vertical compaction and vertical query merge.
         bool allow_overlapping_blocks;
 
-        Options(): wal_segment_size(0), retention_duration(0), max_bytes(0), no_lock_file(false), allow_overlapping_blocks(false){}
-        Options(int wal_segment_size, uint64_t retention_duration, int64_t max_bytes, const std::vector<int64_t> & block_ranges, bool no_lock_file, bool allow_overlapping_blocks):
+        // Samples up to ooo_window older than the newest sample of their
+        // series are still ingested into the head. 0 rejects all samples
+        // arriving out of order. Appenders never accept samples older than
+        // half a head chunk range anyway, which bounds the window.
+        int64_t ooo_window;
+
+        // Type of the persisted blocks, see block::BlockType. GroupBlock stores
+        // the chunks of series scraped together with one shared timestamp column.
+        uint8_t block_type;
+
+        // When committed samples are synced to disk, see wal::SyncPolicy.
+        // wal_sync_interval is in milliseconds and only used by SYNC_INTERVAL.
+        wal::SyncPolicy wal_sync_policy;
+        int wal_sync_interval;
+
+        // Number of WAL shards. Series are spread over the shards by TSID so
+        // that commits and replay use several writer threads. 0 or 1 keeps a
+        // single WAL in dir/wal, more shards live in dir/wal/shard-K. The
+        // number cannot change for an existing WAL.
+        int wal_shards;
+
+        // Compress large WAL records, see wal::COMPRESS_MIN_RECORD_SIZE. WALs
+        // with and without compressed records are read either way.
+        bool wal_compression;
+
+        // WAL checkpoints run in the background after the head is truncated
+        // and read the WAL at no more than this many bytes per second, 0 for
+        // no limit.
+        int64_t wal_checkpoint_bytes_per_sec;
+
+        // DB::close() snapshots the head, so that the next start loads the
+        // snapshot instead of replaying the whole WAL.
+        bool head_snapshot_on_close;
+
+        // Float chunks of blocks made by compacting blocks are rewritten into
+        // this encoding when that makes them smaller. chunk::EncNone (0)
+        // keeps them as they are, chunk::EncXOR and chunk::EncChimp are the
+        // others accepted. chunk::EncChimp trades decoding speed for size:
+        // gauges with decimals shrink by about a fifth to two fifths, but
+        // queries over these blocks decode their values slower than from XOR
+        // chunks, see docs/format/chimp_chunk.md.
+        uint8_t compaction_chunk_encoding;
+
+        Options(): wal_segment_size(0), retention_duration(0), max_bytes(0), no_lock_file(false), allow_overlapping_blocks(false), ooo_window(0), block_type(0), wal_sync_policy(wal::SYNC_NONE), wal_sync_interval(wal::DEFAULT_SYNC_INTERVAL), wal_shards(0), wal_compression(false), wal_checkpoint_bytes_per_sec(0), head_snapshot_on_close(false), compaction_chunk_encoding(0){}
+        Options(int wal_segment_size, uint64_t retention_duration, int64_t max_bytes, const std::vector<int64_t> & block_ranges, bool no_lock_file, bool allow_overlapping_blocks, int64_t ooo_window = 0, uint8_t block_type = 0,
+            wal::SyncPolicy wal_sync_policy = wal::SYNC_NONE, int wal_sync_interval = wal::DEFAULT_SYNC_INTERVAL, int wal_shards = 0,
+            bool wal_compression = false, int64_t wal_checkpoint_bytes_per_sec = 0,
+            bool head_snapshot_on_close = false, uint8_t compaction_chunk_encoding = 0):
             wal_segment_size(wal_segment_size),
             retention_duration(retention_duration),
             max_bytes(max_bytes),
             block_ranges(block_ranges),
             no_lock_file(no_lock_file),
-            allow_overlapping_blocks(allow_overlapping_blocks){}
+            allow_overlapping_blocks(allow_overlapping_blocks),
+            ooo_window(ooo_window),
+            block_type(block_type),
+            wal_sync_policy(wal_sync_policy),
+            wal_sync_interval(wal_sync_interval),
+            wal_shards(wal_shards),
+            wal_compression(wal_compression),
+            wal_checkpoint_bytes_per_sec(wal_checkpoint_bytes_per_sec),
+            head_snapshot_on_close(head_snapshot_on_close),
+            compaction_chunk_encoding(compaction_chunk_encoding){}
 };
 
 extern const Options DefaultOptions;
@@ -0,0 +1,251 @@
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <limits>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/Checksum.hpp"
+#include "base/Endian.hpp"
+#include "base/Logging.hpp"
+#include "chunk/ChunkUtils.hpp"
+#include "head/ChunkDiskMapper.hpp"
+
+namespace tsdb {
+namespace head {
+
+const std::string HEAD_CHUNKS_DIR = "head_chunks";
+
+const uint32_t MAGIC_HEAD_CHUNK = 0x0130BC91;
+const size_t HEAD_CHUNK_FILE_SIZE = 128 * 1024 * 1024;
+
+namespace {
+
+const int HEAD_CHUNK_FORMAT_V1 = 1;
+const int HEADER_SIZE = 8;
+const int RECORD_META_SIZE = 25; // tsid, mint, maxt and encoding.
+
+std::string head_chunk_file_name(const std::string& dir, int seq)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "%06d", seq);
+    return (boost::filesystem::path(dir) / name).string();
+}
+
+// scan_file calls f with every valid record of file and returns the offset
+// behind the last one.
+size_t scan_file(const std::shared_ptr<HeadChunkFile>& file,
+                 const std::function<void(
+                     tagtree::TSID, int64_t, int64_t,
+                     const std::shared_ptr<chunk::ChunkInterface>&)>& f)
+{
+    size_t pos = HEADER_SIZE;
+    while (pos + RECORD_META_SIZE + 1 + 4 <= file->size) {
+        const uint8_t* p = file->data + pos;
+        int decoded = 0;
+        uint64_t len = base::decode_unsigned_varint(
+            p + RECORD_META_SIZE, decoded,
+            std::min<size_t>(base::MAX_VARINT_LEN_64,
+                             file->size - pos - RECORD_META_SIZE));
+        if (decoded <= 0 || len == 0) break;
+        size_t body = RECORD_META_SIZE + decoded + len;
+        if (len > file->size || pos + body + 4 > file->size) break;
+        if (base::GetCrc32(p, body) != base::get_uint32_big_endian(p + body))
+            break;
+
+        if (p[24] == chunk::EncXOR || p[24] == chunk::EncInt) {
+            f(base::get_uint64_big_endian(p),
+              static_cast<int64_t>(base::get_uint64_big_endian(p + 8)),
+              static_cast<int64_t>(base::get_uint64_big_endian(p + 16)),
+              std::shared_ptr<chunk::ChunkInterface>(new MappedChunk(
+                  file, p[24], p + RECORD_META_SIZE + decoded, len)));
+        }
+        pos += body + 4;
+    }
+    return pos;
+}
+
+} // namespace
+
+HeadChunkFile::HeadChunkFile(int seq, uint8_t* data, size_t size)
+    : seq(seq), data(data), size(size),
+      max_time(std::numeric_limits<int64_t>::min())
+{}
+
+HeadChunkFile::~HeadChunkFile()
+{
+    if (data) munmap(data, size);
+}
+
+MappedChunk::MappedChunk(const std::shared_ptr<HeadChunkFile>& file,
+                         uint8_t encoding, const uint8_t* bytes, uint64_t size)
+    : file(file), c(chunk::from_data(encoding, bytes, size))
+{}
+
+ChunkDiskMapper::ChunkDiskMapper(const std::string& dir) : dir(dir), pos(0)
+{
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(dir, ec);
+    if (ec) {
+        err_.set("create " + dir + ": " + ec.message());
+        return;
+    }
+
+    for (const std::string& name : chunk::sequence_files(dir)) {
+        int seq = std::stoi(boost::filesystem::path(name).filename().string());
+        int fd = ::open(name.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0) ::close(fd);
+            err_.set("open head chunk file " + name);
+            return;
+        }
+        void* data = nullptr;
+        if (st.st_size >= HEADER_SIZE)
+            data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            err_.set("mmap head chunk file " + name);
+            return;
+        }
+
+        std::shared_ptr<HeadChunkFile> file(new HeadChunkFile(
+            seq, reinterpret_cast<uint8_t*>(data), data ? st.st_size : 0));
+        if (!data || base::get_uint32_big_endian(file->data) !=
+                         MAGIC_HEAD_CHUNK) {
+            // Left over from a crash while creating the file, truncate()
+            // removes it as it holds no chunks.
+            LOG_WARN << "msg=\"invalid head chunk file\" file=" << name;
+        } else {
+            scan_file(file,
+                      [&file](tagtree::TSID, int64_t, int64_t maxt,
+                              const std::shared_ptr<chunk::ChunkInterface>&) {
+                          if (maxt > file->max_time) file->max_time = maxt;
+                      });
+        }
+        files[seq] = file;
+    }
+}
+
+error::Error ChunkDiskMapper::cut()
+{
+    int seq = files.empty() ? 0 : files.rbegin()->first + 1;
+    std::string name = head_chunk_file_name(dir, seq);
+    int fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return error::Error("create head chunk file " + name + ": " +
+                            strerror(errno));
+    if (ftruncate(fd, HEAD_CHUNK_FILE_SIZE) < 0) {
+        error::Error err("preallocate head chunk file " + name + ": " +
+                         strerror(errno));
+        ::close(fd);
+        return err;
+    }
+    void* data = mmap(nullptr, HEAD_CHUNK_FILE_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return error::Error("mmap head chunk file " + name + ": " +
+                            strerror(errno));
+
+    if (head_file) {
+        // Full files are written back in the background.
+        msync(head_file->data, head_file->size, MS_ASYNC);
+    }
+    head_file.reset(new HeadChunkFile(seq, reinterpret_cast<uint8_t*>(data),
+                                      HEAD_CHUNK_FILE_SIZE));
+    base::put_uint32_big_endian(head_file->data, MAGIC_HEAD_CHUNK);
+    head_file->data[4] = HEAD_CHUNK_FORMAT_V1;
+    files[seq] = head_file;
+    pos = HEADER_SIZE;
+    return error::Error();
+}
+
+std::pair<std::shared_ptr<chunk::ChunkInterface>, error::Error>
+ChunkDiskMapper::write_chunk(tagtree::TSID tsid, int64_t mint, int64_t maxt,
+                             chunk::ChunkInterface* c)
+{
+    uint64_t len = c->size();
+    size_t max_size =
+        RECORD_META_SIZE + base::MAX_VARINT_LEN_64 + len + 4;
+    if (max_size > HEAD_CHUNK_FILE_SIZE - HEADER_SIZE)
+        return {nullptr, error::Error("chunk too large")};
+
+    base::MutexLockGuard lock(mutex_);
+    if (!head_file || pos + max_size > head_file->size) {
+        error::Error err = cut();
+        if (err) return {nullptr, err};
+    }
+
+    uint8_t* p = head_file->data + pos;
+    base::put_uint64_big_endian(p, tsid);
+    base::put_uint64_big_endian(p + 8, static_cast<uint64_t>(mint));
+    base::put_uint64_big_endian(p + 16, static_cast<uint64_t>(maxt));
+    p[24] = c->encoding();
+    int n = base::encode_unsigned_varint(p + RECORD_META_SIZE, len);
+    uint8_t* bytes = p + RECORD_META_SIZE + n;
+    memcpy(bytes, c->bytes(), len);
+    size_t body = RECORD_META_SIZE + n + len;
+    base::put_uint32_big_endian(p + body, base::GetCrc32(p, body));
+    pos += body + 4;
+
+    if (maxt > head_file->max_time) head_file->max_time = maxt;
+    return {std::shared_ptr<chunk::ChunkInterface>(
+                new MappedChunk(head_file, p[24], bytes, len)),
+            error::Error()};
+}
+
+error::Error ChunkDiskMapper::iterate(
+    const std::function<void(tagtree::TSID, int64_t, int64_t,
+                             const std::shared_ptr<chunk::ChunkInterface>&)>&
+        f)
+{
+    std::map<int, std::shared_ptr<HeadChunkFile>> snapshot;
+    {
+        base::MutexLockGuard lock(mutex_);
+        snapshot = files;
+    }
+    for (auto& p : snapshot) {
+        if (p.second == head_file || !p.second->data) continue;
+        if (base::get_uint32_big_endian(p.second->data) != MAGIC_HEAD_CHUNK)
+            continue;
+        scan_file(p.second, f);
+    }
+    return error::Error();
+}
+
+error::Error ChunkDiskMapper::truncate(int64_t mint)
+{
+    base::MutexLockGuard lock(mutex_);
+    for (auto it = files.begin(); it != files.end();) {
+        if (it->second == head_file || it->second->max_time >= mint) {
+            ++it;
+            continue;
+        }
+        std::string name = head_chunk_file_name(dir, it->first);
+        if (::unlink(name.c_str()) < 0)
+            return error::Error("delete head chunk file " + name + ": " +
+                                strerror(errno));
+        it = files.erase(it);
+    }
+    return error::Error();
+}
+
+int ChunkDiskMapper::num_files()
+{
+    base::MutexLockGuard lock(mutex_);
+    return files.size();
+}
+
+size_t ChunkDiskMapper::size()
+{
+    base::MutexLockGuard lock(mutex_);
+    size_t s = 0;
+    for (auto& p : files)
+        s += p.second->size;
+    return s;
+}
+
+} // namespace head
+} // namespace tsdb
@@ -0,0 +1,121 @@
+#ifndef CHUNKDISKMAPPER_H
+#define CHUNKDISKMAPPER_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+#include "base/Error.hpp"
+#include "base/Mutex.hpp"
+#include "chunk/ChunkInterface.hpp"
+#include "tagtree/tsid.h"
+
+namespace tsdb {
+namespace head {
+
+// Name of the directory holding the head chunk files, next to the WAL.
+extern const std::string HEAD_CHUNKS_DIR;
+
+extern const uint32_t MAGIC_HEAD_CHUNK;
+extern const size_t HEAD_CHUNK_FILE_SIZE;
+
+// HeadChunkFile is a head chunk file mapped into memory. The mapping is kept
+// as long as a chunk reads from it, even after the file has been deleted.
+class HeadChunkFile {
+public:
+    int seq;
+    uint8_t* data;
+    size_t size;
+    int64_t max_time; // Of all chunks in the file, guarded by the mapper.
+
+    HeadChunkFile(int seq, uint8_t* data, size_t size);
+    ~HeadChunkFile();
+};
+
+// MappedChunk reads a chunk in place from a HeadChunkFile. The encoding must
+// be one known to chunk::from_data().
+class MappedChunk : public chunk::ChunkInterface {
+private:
+    std::shared_ptr<HeadChunkFile> file;
+    std::shared_ptr<chunk::ChunkInterface> c;
+
+public:
+    MappedChunk(const std::shared_ptr<HeadChunkFile>& file, uint8_t encoding,
+                const uint8_t* bytes, uint64_t size);
+
+    const uint8_t* bytes() { return c->bytes(); }
+    uint8_t encoding() { return c->encoding(); }
+
+    // Mapped chunks are full, the returned appender drops all samples.
+    std::unique_ptr<chunk::ChunkAppenderInterface> appender()
+    {
+        return c->appender();
+    }
+
+    std::unique_ptr<chunk::ChunkIteratorInterface> iterator()
+    {
+        return c->iterator();
+    }
+
+    int num_samples() { return c->num_samples(); }
+    uint64_t size() { return c->size(); }
+};
+
+// ChunkDiskMapper spills the full chunks of the head into append-only files
+// and serves them back from memory mappings, so that only the open chunk of a
+// series stays on the heap.
+//
+// Files are preallocated to HEAD_CHUNK_FILE_SIZE and start with
+//   magic(4) | version(1) | padding(3)
+// followed by one record per chunk
+//   tsid(8) | mint(8) | maxt(8) | encoding(1) | len(uvarint) | data(len) | crc32(4)
+// whose CRC covers everything from tsid up to the data. Unwritten space is
+// zero, so the first record not matching its CRC ends a file. The WAL stays
+// authoritative, a lost file tail only means replaying more of it.
+//
+// Writes always go to files created by this mapper, files found on startup
+// are only read.
+class ChunkDiskMapper {
+private:
+    base::MutexLock mutex_;
+    std::string dir;
+    std::map<int, std::shared_ptr<HeadChunkFile>> files;
+    std::shared_ptr<HeadChunkFile> head_file; // Currently written file.
+    size_t pos;                               // Write offset in head_file.
+    error::Error err_;
+
+    error::Error cut();
+
+public:
+    // Opens the files in dir, which is created if needed.
+    ChunkDiskMapper(const std::string& dir);
+
+    // write_chunk persists a full chunk and returns a chunk reading it from
+    // the mapped file.
+    std::pair<std::shared_ptr<chunk::ChunkInterface>, error::Error>
+    write_chunk(tagtree::TSID tsid, int64_t mint, int64_t maxt,
+                chunk::ChunkInterface* c);
+
+    // iterate calls f for every chunk in the files in the order they were
+    // written.
+    error::Error
+    iterate(const std::function<void(
+                tagtree::TSID, int64_t, int64_t,
+                const std::shared_ptr<chunk::ChunkInterface>&)>& f);
+
+    // truncate deletes the files only holding chunks before mint.
+    error::Error truncate(int64_t mint);
+
+    // Number of files and bytes they take on disk.
+    int num_files();
+    size_t size();
+
+    error::Error error() const { return err_; }
+};
+
+} // namespace head
+} // namespace tsdb
+
+#endif
@@ -1,13 +1,18 @@
 #include <algorithm>
 #include <boost/bind.hpp>
+#include <chrono>
 #include <iostream>
 #include <limits>
+#include <thread>
 
 #include "head/Head.hpp"
 #include "head/HeadAppender.hpp"
 #include "head/HeadChunkReader.hpp"
 #include "head/HeadIndexReader.hpp"
+#include "head/HeadSnapshot.hpp"
 #include "head/InitAppender.hpp"
+#include "head/MemGroup.hpp"
+#include "head/WALReplay.hpp"
 #include "querier/ChunkSeriesIterator.hpp"
 #include "querier/QuerierUtils.hpp"
 #include "tombstone/MemTombstones.hpp"
@@ -18,9 +23,31 @@
 namespace tsdb {
 namespace head {
 
+namespace {
+
+std::vector<std::unique_ptr<wal::WAL>> single_shard(
+    std::unique_ptr<wal::WAL>&& wal)
+{
+    std::vector<std::unique_ptr<wal::WAL>> wals;
+    if (wal) wals.push_back(std::move(wal));
+    return wals;
+}
+
+} // namespace
+
 Head::Head(int64_t chunk_range, std::unique_ptr<wal::WAL>&& wal,
-           const std::shared_ptr<base::ThreadPool>& pool_)
-    : chunk_range(chunk_range), wal(std::move(wal)), pool_(pool_)
+           const std::shared_ptr<base::ThreadPool>& pool_, int64_t ooo_window,
+           const std::string& chunks_dir)
+    : Head(chunk_range, single_shard(std::move(wal)), pool_, ooo_window,
+           chunks_dir)
+{}
+
+Head::Head(int64_t chunk_range, std::vector<std::unique_ptr<wal::WAL>>&& wals,
+           const std::shared_ptr<base::ThreadPool>& pool_, int64_t ooo_window,
+           const std::string& chunks_dir)
+    : gc_task(new GCTask(this)), chunk_range(chunk_range),
+      ooo_window(ooo_window), wals(std::move(wals)), pool_(pool_),
+      checkpoint_bytes_per_sec(0)
 {
     if (chunk_range < 1) {
         err_.set("invalid chunk range " + std::to_string(chunk_range));
@@ -28,9 +55,15 @@ Head::Head(int64_t chunk_range, std::unique_ptr<wal::WAL>&& wal,
     }
     min_time.getAndSet(std::numeric_limits<int64_t>::max());
     max_time.getAndSet(std::numeric_limits<int64_t>::min());
+    gc_max_pause.getAndSet(0);
     series = std::unique_ptr<StripeSeries>(new StripeSeries());
     posting_list =
         std::unique_ptr<index::MemPostings>(new index::MemPostings());
+    if (!chunks_dir.empty()) {
+        chunk_mapper.reset(new ChunkDiskMapper(chunks_dir));
+        if (chunk_mapper->error())
+            err_.set(error::wrap(chunk_mapper->error(), "open chunk mapper"));
+    }
 }
 
 // init loads data from the write ahead log and prepares the head for writes.
@@ -39,14 +72,70 @@ Head::Head(int64_t chunk_range, std::unique_ptr<wal::WAL>&& wal,
 error::Error Head::init(int64_t min_valid_time)
 {
     valid_time.getAndSet(min_valid_time);
-    if (!wal) return error::Error();
+    if (wals.empty()) return error::Error();
+
+    if (chunk_mapper) {
+        error::Error err = load_mapped_chunks();
+        if (err) return error::wrap(err, "load mapped chunks");
+    }
+
+    std::vector<error::Error> errs(wals.size());
+    if (wals.size() == 1)
+        errs[0] = init_wal(wals[0].get());
+    else {
+        // Shards hold disjoint series, they are replayed side by side. The
+        // replay itself waits on pool_, so it does not run there.
+        std::vector<std::thread> replays;
+        for (size_t i = 0; i < wals.size(); ++i)
+            replays.emplace_back(
+                [this, &errs, i]() { errs[i] = init_wal(wals[i].get()); });
+        for (std::thread& t : replays)
+            t.join();
+    }
 
-    // Backfill the checkpoint first if it exists.
+    mapped_chunks.clear();
+    for (size_t i = 0; i < errs.size(); ++i) {
+        if (errs[i])
+            return error::wrap(errs[i], "replay WAL shard " + std::to_string(i));
+    }
+    posting_list->ensure_order(pool_);
+    gc();
+    return error::Error();
+}
+
+error::Error Head::init_wal(wal::WAL* w)
+{
     std::pair<std::pair<std::string, int>, error::Error> lp =
-        wal::last_checkpoint(wal->dir());
+        wal::last_checkpoint(w->dir());
     if (lp.second && lp.second != "not found")
         return error::wrap(lp.second, "find last checkpoint");
-    if (!lp.second) {
+
+    // A snapshot covers the checkpoint and all segments before its index. It
+    // is stale if a checkpoint was taken after it.
+    int first = -1;
+    std::pair<std::pair<std::string, int>, error::Error> sp =
+        last_snapshot(w->dir());
+    if (!sp.second && !lp.second && lp.first.second >= sp.first.second) {
+        LOG_WARN << "msg=\"dropping stale head snapshot\" snapshot="
+                 << sp.first.first;
+    } else if (!sp.second) {
+        SnapshotReader reader(sp.first.first);
+        if (reader.error()) {
+            LOG_WARN << "msg=\"dropping invalid head snapshot\" err="
+                     << reader.error().error();
+        } else {
+            error::Error err = load_snapshot(&reader);
+            if (err)
+                LOG_WARN << "msg=\"dropping head snapshot that failed to "
+                            "load\" err="
+                         << err.error();
+            else
+                first = sp.first.second;
+        }
+    }
+
+    if (first < 0 && !lp.second) {
+        // Backfill the checkpoint first if it exists.
         wal::SegmentReader reader({wal::SegmentRange(
             lp.first.first, 0, std::numeric_limits<int>::max())});
         if (reader.error())
@@ -57,31 +146,149 @@ error::Error Head::init(int64_t min_valid_time)
         // anyway.
         wal::CorruptionError cerr = load_wal(&reader);
         if (cerr) return error::wrap(cerr.err_, "backfill checkpoint");
-        ++lp.first.second;
+        first = lp.first.second + 1;
     }
+    if (first < 0) first = 0;
 
     wal::CorruptionError cerr;
     {
-        // Backfill segments from the last checkpoint onwards
-        wal::SegmentReader reader(
-            {wal::SegmentRange(wal->dir(), lp.first.second, -1)});
+        // Backfill segments from the last checkpoint or snapshot onwards
+        wal::SegmentReader reader({wal::SegmentRange(w->dir(), first, -1)});
         if (reader.error())
             return error::wrap(reader.error(), "open WAL segments");
 
         cerr = load_wal(&reader);
     }
-    if (!cerr) {
-        posting_list->ensure_order(pool_);
-        gc();
-        return error::Error();
+    if (cerr) {
+        LOG_WARN << "msg=\"encountered WAL error, attempting repair\" dir="
+                 << w->dir() << " err=" << cerr.error().error();
+        error::Error err = w->repair(cerr);
+        if (err) return error::wrap(err, "repair corrupted WAL");
     }
-    LOG_WARN << "msg=\"encountered WAL error, attempting repair\" err="
-             << cerr.error().error();
-    error::Error err = wal->repair(cerr);
-    if (err) return error::wrap(err, "repair corrupted WAL");
 
-    posting_list->ensure_order(pool_);
-    gc();
+    // The WAL is written on from now on, which makes any snapshot stale.
+    error::Error err = delete_snapshots(w->dir());
+    if (err) return error::wrap(err, "delete head snapshots");
+    return error::Error();
+}
+
+error::Error Head::load_snapshot(SnapshotReader* reader)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    int64_t min_valid_time = valid_time.get();
+    std::atomic<int> num_series(0);
+    std::vector<error::Error> errs(reader->num_sections());
+    // The series and time range of each section, the head only takes them
+    // once every section loaded.
+    std::vector<std::vector<MemSeriesPtr>> loaded(errs.size());
+    std::vector<int64_t> mints(errs.size(),
+                               std::numeric_limits<int64_t>::max());
+    std::vector<int64_t> maxts(errs.size(),
+                               std::numeric_limits<int64_t>::min());
+    auto load = [&](int i) {
+        int64_t& mint = mints[i];
+        int64_t& maxt = maxts[i];
+        errs[i] = reader->read_section(i, [&](SnapshotSeries& ss) {
+            // Chunks before the valid time belong to blocks already.
+            size_t drop = 0;
+            while (drop < ss.chunks.size() &&
+                   ss.chunks[drop]->max_time < min_valid_time)
+                ++drop;
+            if (drop == ss.chunks.size()) return;
+
+            MemSeriesPtr s = get_or_create(ss.tsid).first;
+            base::MutexLockGuard lock(s->mutex_);
+            s->chunks.assign(ss.chunks.begin() + drop, ss.chunks.end());
+            s->first_chunk = ss.first_chunk + drop;
+            s->next_at = ss.next_at;
+            if (ss.open) s->reopen();
+            mint = std::min(mint, s->chunks.front()->min_time);
+            maxt = std::max(maxt, s->chunks.back()->max_time);
+            loaded[i].push_back(s);
+            ++num_series;
+        });
+    };
+
+    if (!pool_ || pool_->numThreads() == 0 || errs.size() < 2) {
+        for (size_t i = 0; i < errs.size(); ++i)
+            load(i);
+    } else {
+        base::WaitGroup wg;
+        wg.add(errs.size());
+        for (size_t i = 0; i < errs.size(); ++i) {
+            pool_->run([&load, &wg, i]() {
+                load(i);
+                wg.done();
+            });
+        }
+        wg.wait();
+    }
+    for (error::Error& err : errs) {
+        if (!err) continue;
+        // Undo the sections already loaded so that the WAL is replayed onto
+        // the series as they were before. Series left empty are removed by
+        // the gc at the end of init(). Other WAL shards may be loading at the
+        // same time, only the series of this snapshot are touched.
+        for (std::vector<MemSeriesPtr>& series : loaded) {
+            for (const MemSeriesPtr& s : series) {
+                {
+                    base::MutexLockGuard lock(s->mutex_);
+                    s->reset();
+                }
+                attach_mapped_chunks(s);
+            }
+        }
+        return err;
+    }
+    for (size_t i = 0; i < errs.size(); ++i) {
+        if (mints[i] <= maxts[i]) update_min_max_time(mints[i], maxts[i]);
+    }
+
+    LOG_INFO << "msg=\"loaded head snapshot\" series=" << num_series.load()
+             << " sections=" << static_cast<int>(errs.size()) << " duration="
+             << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count()
+             << "ms";
+    return error::Error();
+}
+
+error::Error Head::snapshot()
+{
+    if (wals.empty()) return error::Error();
+    auto t0 = std::chrono::steady_clock::now();
+
+    // Records logged from now on go to the segments after the snapshot.
+    std::vector<std::unique_ptr<SnapshotWriter>> writers;
+    for (std::unique_ptr<wal::WAL>& w : wals) {
+        std::pair<int, error::Error> seg = w->cut_segment();
+        if (seg.second) return error::wrap(seg.second, "cut WAL segment");
+        writers.emplace_back(new SnapshotWriter(w->dir(), seg.first));
+        if (writers.back()->error())
+            return error::wrap(writers.back()->error(), "create snapshot");
+    }
+
+    for (int i = 0; i < STRIPE_SIZE; ++i) {
+        series->for_each(i, [this, &writers](MemSeries* s) {
+            base::MutexLockGuard lock(s->mutex_);
+            // Out-of-order samples are not part of the chunks.
+            s->flush_ooo();
+            writers[wal_shard(s->tsid)]->add(s);
+        });
+    }
+
+    int num_series = 0;
+    for (std::unique_ptr<SnapshotWriter>& writer : writers) {
+        error::Error err = writer->close();
+        if (err) return error::wrap(err, "write snapshot");
+        num_series += writer->series();
+    }
+    LOG_INFO << "msg=\"head snapshot complete\" series=" << num_series
+             << " duration="
+             << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count()
+             << "ms";
     return error::Error();
 }
 
@@ -101,152 +308,63 @@ void Head::update_min_max_time(int64_t mint, int64_t maxt)
 
 // The samples before valid_time will be appended.
 // The samples will be destructed automatically after this function finishes.
-void Head::process_wal_samples(const std::vector<tsdbutil::RefSample>& samples,
-                               base::AtomicUInt64* unknown_refs,
-                               base::WaitGroup* wg)
+error::Error Head::load_mapped_chunks()
 {
-    // Mitigate lock contention in StripeSeries::get_by_id().
-    std::unordered_map<tagtree::TSID, std::shared_ptr<MemSeries>> series_map;
-
-    int64_t mint = std::numeric_limits<int64_t>::max();
-    int64_t maxt = std::numeric_limits<int64_t>::min();
-
     int64_t min_valid_time = valid_time.get();
-    for (const tsdbutil::RefSample& s : samples) {
-        if (s.t < min_valid_time) continue;
-        std::shared_ptr<MemSeries> ms;
-        if (series_map.find(s.tsid) == series_map.end()) {
-            ms = series->get_by_id(s.tsid);
-            if (!ms) {
-                unknown_refs->increment();
+    int num_chunks = 0;
+    error::Error err = chunk_mapper->iterate(
+        [&](tagtree::TSID tsid, int64_t mint, int64_t maxt,
+            const std::shared_ptr<chunk::ChunkInterface>& c) {
+            if (maxt < min_valid_time) return;
+            mapped_chunks[tsid].emplace_back(
+                new MemChunk(std::hash<tagtree::TSID>()(tsid), c, mint, maxt));
+            ++num_chunks;
+        });
+    if (err) return err;
+
+    // A series removed by gc and created again starts over with later
+    // chunks, keep each series' chunks sorted and disjoint.
+    for (auto& p : mapped_chunks) {
+        std::vector<std::shared_ptr<MemChunk>>& chks = p.second;
+        std::stable_sort(chks.begin(), chks.end(),
+                         [](const std::shared_ptr<MemChunk>& lhs,
+                            const std::shared_ptr<MemChunk>& rhs) {
+                             return lhs->min_time < rhs->min_time;
+                         });
+        size_t kept = 0;
+        for (size_t i = 0; i < chks.size(); ++i) {
+            if (kept > 0 && chks[i]->min_time <= chks[kept - 1]->max_time)
                 continue;
-            }
-            series_map[s.tsid] = ms;
-        } else
-            ms = series_map[s.tsid];
-        ms->append(s.t, s.v);
-        if (s.t > maxt) maxt = s.t;
-        if (s.t < mint) mint = s.t;
-    }
-    update_min_max_time(mint, maxt);
-    wg->done();
+            chks[kept++] = chks[i];
+        }
+        chks.resize(kept);
+    }
+    LOG_INFO << "msg=\"loaded mapped head chunks\" series="
+             << mapped_chunks.size() << " chunks=" << num_chunks;
+    return error::Error();
+}
+
+void Head::attach_mapped_chunks(const MemSeriesPtr& s)
+{
+    base::MutexLockGuard mapped_lock(mapped_mutex_);
+    auto it = mapped_chunks.find(s->tsid);
+    if (it == mapped_chunks.end()) return;
+    // The series stays without an appender, its next sample cuts a new chunk.
+    base::MutexLockGuard lock(s->mutex_);
+    s->chunks.assign(it->second.begin(), it->second.end());
+    mapped_chunks.erase(it);
 }
 
 // NOTICE(Alec), when loading RefSeries, RecordDecoder will sort the lset of
 // each RefSeries.
 wal::CorruptionError Head::load_wal(wal::SegmentReader* reader)
 {
-    // Track number of samples that referenced a series we don't know about
-    // for error reporting.
-    base::AtomicUInt64 unknown_refs;
-
-    // Count total tasks sent to pool_.
-    base::WaitGroup wg;
-
-    // Store all Stone for chunk_rewrite.
-    tombstone::MemTombstones all_stones;
-
-    // Partition samples by ref % partition_num.
-    int partition_num = 8;
-
-    std::vector<tsdbutil::RefSeries> rseries;
-    std::vector<tsdbutil::RefSample> rsamples;
-    std::vector<tsdbutil::Stone> rstones;
-
-    std::vector<std::vector<tsdbutil::RefSample>> shards;
-    shards.resize(partition_num);
-
-    while (reader->next()) {
-        std::pair<uint8_t*, int> rec_pair = reader->record();
-
-        if (rec_pair.second < 1)
-            return wal::CorruptionError(reader->segment(), reader->offset(),
-                                        error::Error("record length < 1"));
-        tsdbutil::RECORD_ENTRY_TYPE type = rec_pair.first[0];
-        if (type == tsdbutil::RECORD_SERIES) {
-            // LOG_DEBUG << "RECORD_SERIES start";
-            rseries.clear();
-            error::Error err = tsdbutil::RecordDecoder::series(
-                rec_pair.first, rec_pair.second, rseries);
-            if (err)
-                return wal::CorruptionError(reader->segment(), reader->offset(),
-                                            error::Error("decode series"));
-
-            for (tsdbutil::RefSeries& s : rseries) {
-                // LOG_DEBUG << s.lset.front().label << " " <<
-                // s.lset.front().value << " " << s.lset.back().label << " " <<
-                // s.lset.back().value;
-                get_or_create(s.tsid);
-            }
-            // LOG_DEBUG << "RECORD_SERIES finished";
-        } else if (type == tsdbutil::RECORD_SAMPLES) {
-            // LOG_DEBUG << "RECORD_SAMPLES start";
-            rsamples.clear();
-            error::Error err = tsdbutil::RecordDecoder::samples(
-                rec_pair.first, rec_pair.second, rsamples);
-            if (err)
-                return wal::CorruptionError(reader->segment(), reader->offset(),
-                                            error::Error("decode samples"));
-
-            for (int i = 0; i < partition_num; ++i)
-                shards[i].clear();
-
-            for (tsdbutil::RefSample& s : rsamples)
-                shards[std::hash<tagtree::TSID>()(s.tsid) % partition_num]
-                    .push_back(s);
-
-            for (int i = 0; i < partition_num; ++i) {
-                if (!shards[i].empty()) {
-                    wg.add(1);
-                    pool_->run(boost::bind(&Head::process_wal_samples, this,
-                                           shards[i], &unknown_refs, &wg));
-                }
-            }
-            // LOG_DEBUG << "RECORD_SAMPLES finished";
-        } else if (type == tsdbutil::RECORD_TOMBSTONES) {
-            // LOG_DEBUG << "RECORD_TOMBSTONES start";
-            rstones.clear();
-            error::Error err = tsdbutil::RecordDecoder::tombstones(
-                rec_pair.first, rec_pair.second, rstones);
-            if (err)
-                return wal::CorruptionError(reader->segment(), reader->offset(),
-                                            error::Error("decode tombstones"));
-
-            for (tsdbutil::Stone& s : rstones) {
-                for (tombstone::Interval& itvl : s.itvls) {
-                    // if(s.ref == 2)
-                    // LOG_DEBUG << s.ref << " " << itvl.min_time << " " <<
-                    // itvl.max_time;
-                    if (itvl.max_time < valid_time.get()) continue;
-                    all_stones.add_interval(s.tsid, itvl);
-                }
-            }
-
-        } else
-            return wal::CorruptionError(
-                reader->segment(), reader->offset(),
-                error::Error("invalid record type " + std::to_string(type)));
-
-        // Wait till all task finished.
-        wg.wait();
-    }
-    if (reader->error()) return reader->cerror();
-
-    error::Error err = all_stones.iter(
-        static_cast<std::function<error::Error(tagtree::TSID,
-                                               const tombstone::Intervals&)>>(
-            [this](tagtree::TSID tsid, const tombstone::Intervals& itv) {
-                return this->chunk_rewrite(tsid, itv);
-            }));
-
-    if (err)
-        return wal::CorruptionError(
-            -1, 0, error::Error("deleting samples from tombstones"));
-
-    if (unknown_refs.get() > 0)
-        LOG_WARN << "msg=\"unknown series references count="
-                 << unknown_refs.get();
-    return wal::CorruptionError();
+    // The WAL shards are replayed at the same time, share the cores among
+    // them.
+    int cores = std::thread::hardware_concurrency();
+    int num_partitions = std::max(1, cores / std::max<int>(1, wals.size()));
+    WALReplay replay(this, num_partitions);
+    return replay.run(reader);
 }
 
 std::unique_ptr<db::AppenderInterface> Head::head_appender()
@@ -317,20 +435,21 @@ bool Head::init_time(int64_t t)
 // If there are 2 threads calling this function at the same time,
 // it can be the situation that the 2 threads both generate an id.
 // But only one will be finally push into StripeSeries, and the other id
-// and its corresponding std::shared_ptr<MemSeries> will be abandoned.
+// and its corresponding MemSeriesPtr will be abandoned.
 //
 // In a word, this function is thread-safe.
-std::pair<std::shared_ptr<MemSeries>, bool>
-Head::get_or_create(tagtree::TSID tsid)
+std::pair<MemSeriesPtr, bool> Head::get_or_create(tagtree::TSID tsid,
+                                                  bool pin)
 {
-    std::shared_ptr<MemSeries> s = series->get_by_id(tsid);
+    // A pin has to be taken under the stripe lock, the lock-free lookup could
+    // return a series gc() is removing.
+    MemSeriesPtr s = pin ? series->get_pinned(tsid) : series->get_by_id(tsid);
     if (s) return {s, false};
     // Optimistically assume that we are the first one to create the series.
 
-    std::shared_ptr<MemSeries> s1(new MemSeries(tsid, chunk_range));
+    MemSeriesPtr s1(new MemSeries(tsid, chunk_range));
 
-    std::pair<std::shared_ptr<MemSeries>, bool> s2 =
-        series->get_or_set(tsid, s1);
+    std::pair<MemSeriesPtr, bool> s2 = series->get_or_set(tsid, s1, pin);
     if (!s2.second) return {s2.first, false};
 
     posting_list->add(tsid);
@@ -338,6 +457,43 @@ Head::get_or_create(tagtree::TSID tsid)
     return {s2.first, true};
 }
 
+std::shared_ptr<MemGroup>
+Head::get_or_create_group(const std::vector<tagtree::TSID>& tsids,
+                          const std::vector<MemSeriesPtr>& members)
+{
+    base::MutexLockGuard lock(groups_mutex_);
+    // A released group is replaced, e.g. once one of its members left it.
+    auto it = groups.find(tsids);
+    if (it != groups.end() && !it->second->released()) return it->second;
+
+    std::vector<std::shared_ptr<MemGroup>> old;
+    for (const MemSeriesPtr& s : members) {
+        base::MutexLockGuard series_lock(s->mutex_);
+        if (s->group) old.push_back(s->group);
+    }
+    for (const std::shared_ptr<MemGroup>& g : old) {
+        auto oit = groups.find(g->tsids);
+        if (oit != groups.end() && oit->second == g) groups.erase(oit);
+        g->release();
+    }
+
+    std::shared_ptr<MemGroup> g(new MemGroup(tsids, members, chunk_range));
+    for (const MemSeriesPtr& s : members) {
+        base::MutexLockGuard series_lock(s->mutex_);
+        s->group = g;
+    }
+    groups[tsids] = g;
+    return g;
+}
+
+void Head::release_group(const std::shared_ptr<MemGroup>& g)
+{
+    base::MutexLockGuard lock(groups_mutex_);
+    auto it = groups.find(g->tsids);
+    if (it != groups.end() && it->second == g) groups.erase(it);
+    g->release();
+}
+
 // chunkRewrite re-writes the chunks which overlaps with deleted ranges
 // and removes the samples in the deleted ranges.
 // Chunks is deleted if no samples are left at the end.
@@ -348,16 +504,26 @@ error::Error Head::chunk_rewrite(tagtree::TSID tsid,
         return error::Error();
     }
 
-    std::shared_ptr<MemSeries> ms = series->get_by_id(tsid);
+    MemSeriesPtr ms = series->get_by_id(tsid);
     if (!ms) {
         return error::Error();
     }
 
+    // The rewritten chunks are the series' own, its group lets go of it.
+    std::shared_ptr<MemGroup> g;
+    {
+        base::MutexLockGuard lock(ms->mutex_);
+        g = ms->group;
+    }
+    if (g) release_group(g);
+
     base::MutexLockGuard lock(ms->mutex_);
     if (ms->chunks.empty()) {
         return error::Error();
     }
 
+    // The series is rebuilt from its chunks.
+    ms->flush_ooo();
     std::vector<std::shared_ptr<MemChunk>> chks;
     for (auto chk : ms->chunks) {
         chks.push_back(chk);
@@ -405,7 +571,7 @@ error::Error Head::del(int64_t mint, int64_t maxt,
     // LOG_DEBUG << "tp1: " << tp.first << " " << tp.second;
     for (auto&& p : tsids) {
         // LOG_DEBUG << "next() " << tp.first << " " << tp.second;
-        std::shared_ptr<MemSeries> s = series->get_by_id(p);
+        MemSeriesPtr s = series->get_by_id(p);
         if (!s)
             return error::Error("error StripeSeries::get_by_id " +
                                 std::to_string(p));
@@ -418,7 +584,7 @@ error::Error Head::del(int64_t mint, int64_t maxt,
         // Delete only until the current values and not beyond.
         tp = tsdbutil::clamp_interval(mint, maxt, t0, t1);
         if (tp.first > tp.second) continue;
-        if (wal)
+        if (!wals.empty())
             stones.emplace_back(p,
                                 tombstone::Intervals({{tp.first, tp.second}}));
         // LOG_DEBUG << "tp: " << tp.first << " " << tp.second;
@@ -426,42 +592,126 @@ error::Error Head::del(int64_t mint, int64_t maxt,
         if (err) return error::Error("error delete samples");
         dirty = true;
     }
-    if (wal) {
+    if (!wals.empty()) {
         // Although we don't store the stones in the head
         // we need to write them to the WAL to mark these as deleted
-        // after a restart while loading the WAL.
-        // for(auto & s: stones){
-        //     for(auto &i: s.itvls)
-        //         LOG_DEBUG << s.ref << " " << i.min_time << " " << i.max_time;
-        // }
-        std::vector<uint8_t> rec;
-        tsdbutil::RecordEncoder::tombstones(stones, rec);
-        error::Error err = wal->log(rec);
-        if (err) return error::wrap(err, "error wal::log");
+        // after a restart while loading the WAL. Each stone goes to the shard
+        // of its series.
+        std::vector<std::vector<tsdbutil::Stone>> shard_stones(wals.size());
+        for (tsdbutil::Stone& stone : stones)
+            shard_stones[wal_shard(stone.tsid)].push_back(stone);
+        for (size_t i = 0; i < wals.size(); ++i) {
+            if (shard_stones[i].empty()) continue;
+            std::vector<uint8_t> rec;
+            tsdbutil::RecordEncoder::tombstones(shard_stones[i], rec);
+            error::Error err = wals[i]->log(rec);
+            if (err) return error::wrap(err, "error wal::log");
+        }
     }
     if (dirty) gc();
     return error::Error();
 }
 
+Head::~Head()
+{
+    // Wait for a running GC and checkpoint and keep queued ones from
+    // touching the head. A running checkpoint gives up early, the next one
+    // starts over.
+    gc_task->cancel = true;
+    {
+        base::MutexLockGuard lock(gc_task->mutex_);
+        gc_task->head = nullptr;
+    }
+
+    // Groups and their members hold each other.
+    base::MutexLockGuard lock(groups_mutex_);
+    for (auto& p : groups)
+        p.second->release();
+    groups.clear();
+}
+
 void Head::gc()
 {
+    auto t0 = std::chrono::steady_clock::now();
     // Only data strictly lower than this timestamp must be deleted.
     int64_t mint = MinTime();
-    // LOG_DEBUG << mint;
-    // Drop old chunks and remember series IDs and hashes if they can be
-    // deleted entirely.
-    std::pair<std::unordered_set<tagtree::TSID>, int> rm_pair =
-        series->gc(mint);
-    if (rm_pair.first.size() == 0) {
+    int stripe = 0;
+    int64_t max_pause = 0;
+    int rm_series = 0;
+    int rm_chunks = 0;
+
+    // Groups without samples left in the head let go of their members, so
+    // that these can be removed below. Released groups are forgotten.
+    {
+        base::MutexLockGuard lock(groups_mutex_);
+        for (auto it = groups.begin(); it != groups.end();) {
+            if (it->second->max_time() >= mint && !it->second->released()) {
+                ++it;
+                continue;
+            }
+            it->second->release();
+            it = groups.erase(it);
+        }
+    }
+
+    while (stripe < STRIPE_SIZE) {
+        // Drop old chunks and remember series IDs if they can be deleted
+        // entirely.
+        std::pair<std::unordered_set<tagtree::TSID>, int> rm_pair =
+            series->gc_step(mint, &stripe, GC_STEP_SERIES, &max_pause);
+        rm_chunks += rm_pair.second;
+        if (!rm_pair.first.empty()) {
+            rm_series += rm_pair.first.size();
+            // Remove deleted series IDs from the postings lists. A series
+            // created again by get_or_create() in the meantime may have been
+            // added before, add it back.
+            posting_list->del(rm_pair.first);
+            for (tagtree::TSID tsid : rm_pair.first)
+                if (series->get_by_id(tsid)) posting_list->add(tsid);
+        }
+        std::this_thread::yield();
+    }
+
+    while (true) {
+        int64_t p = gc_max_pause.get();
+        if (max_pause <= p || gc_max_pause.cas(p, max_pause)) break;
+    }
+
+    if (rm_series == 0 && rm_chunks == 0) {
         LOG_DEBUG << "head::gc() nothing to gc";
         return;
     }
-    // for(auto i: rm_pair.first)
-    //     LOG_DEBUG << i;
-    // LOG_DEBUG << posting_list->size();
-    // Remove deleted series IDs from the postings lists.
-    posting_list->del(rm_pair.first);
-    // LOG_DEBUG << posting_list->size();
+    int num_series = series->size();
+    LOG_INFO << "msg=\"head GC completed\" MinTime=" << mint << " duration="
+             << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count()
+             << "ms max_pause="
+             << std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::nanoseconds(max_pause))
+                    .count()
+             << "us removed_series=" << rm_series
+             << " removed_chunks=" << rm_chunks << " series=" << num_series
+             << " bytes_per_series="
+             << (num_series ? series->bytes() / num_series : 0);
+}
+
+void Head::gc_background()
+{
+    if (!pool_ || pool_->numThreads() == 0) {
+        gc();
+        if (gc_task->checkpoint.exchange(false)) checkpoint();
+        return;
+    }
+    if (gc_task->queued.exchange(true)) return;
+    std::shared_ptr<GCTask> task = gc_task;
+    pool_->run([task]() {
+        base::MutexLockGuard lock(task->mutex_);
+        task->queued = false;
+        if (!task->head) return;
+        task->head->gc();
+        if (task->checkpoint.exchange(false)) task->head->checkpoint();
+    });
 }
 
 error::Error Head::truncate(int64_t mint)
@@ -479,19 +729,34 @@ error::Error Head::truncate(int64_t mint)
     // We haven't read back the WAL yet, so do not attempt to truncate it.
     if (initialized) return error::Error();
 
-    auto t0 = std::chrono::high_resolution_clock::now();
-    gc();
-    LOG_INFO << "msg=\"head GC completed\" MinTime=" << MinTime()
-             << " duration="
-             << std::chrono::duration_cast<std::chrono::milliseconds>(
-                    std::chrono::high_resolution_clock::now() - t0)
-                    .count()
-             << "ms";
+    if (chunk_mapper) {
+        error::Error err = chunk_mapper->truncate(mint);
+        if (err)
+            LOG_ERROR << "msg=\"truncate chunk mapper\" err=" << err.error();
+    }
+
+    if (!wals.empty()) gc_task->checkpoint = true;
+    gc_background();
+    return error::Error();
+}
 
-    if (!wal) return error::Error();
-    t0 = std::chrono::high_resolution_clock::now();
+void Head::checkpoint()
+{
+    int64_t mint = MinTime();
+    for (std::unique_ptr<wal::WAL>& w : wals) {
+        error::Error err = truncate_wal(w.get(), mint);
+        if (gc_task->cancel) return;
+        if (err)
+            LOG_ERROR << "msg=\"WAL checkpoint\" dir=" << w->dir()
+                      << " err=" << err.error();
+    }
+}
+
+error::Error Head::truncate_wal(wal::WAL* w, int64_t mint)
+{
+    auto t0 = std::chrono::high_resolution_clock::now();
     std::pair<std::pair<int, int>, error::Error> segs =
-        wal->segments(wal->dir());
+        w->segments(w->dir());
     if (segs.second) return error::wrap(segs.second, "get segment range");
     --segs.first.second; // Never consider last segment for checkpoint.
     if (segs.first.second < 0) return error::Error();
@@ -501,30 +766,30 @@ error::Error Head::truncate(int64_t mint)
         segs.first.first + (segs.first.second - segs.first.first) / 3;
     if (segs.first.second <= segs.first.first) return error::Error();
     std::pair<wal::CheckpointStats, error::Error> ckp = wal::checkpoint(
-        wal.get(), segs.first.first, segs.first.second,
+        w, segs.first.first, segs.first.second,
         [this](tagtree::TSID tsid) -> bool {
             if (this->series->get_by_id(tsid))
                 return true;
             else
                 return false;
         },
-        mint);
+        mint, checkpoint_bytes_per_sec, &gc_task->cancel);
     if (ckp.second) return error::wrap(ckp.second, "create checkpoint");
-    error::Error err = wal->truncate(segs.first.second + 1);
+    error::Error err = w->truncate(segs.first.second + 1);
     if (err) {
         // If truncating fails, we'll just try again at the next checkpoint.
         // Leftover segments will just be ignored in the future if there's a
         // checkpoint that supersedes them.
         LOG_ERROR << "msg=\"truncating segments failed\" err=" << err.error();
     }
-    err = wal::delete_checkpoints(wal->dir(), segs.first.second);
+    err = wal::delete_checkpoints(w->dir(), segs.first.second);
     if (err) {
         // Leftover old checkpoints do not cause problems down the line beyond
         // occupying disk space.
         // They will just be ignored since a higher checkpoint exists.
         LOG_ERROR << "msg=\"delete old checkpoints\" err=" << err.error();
     }
-    LOG_INFO << "msg=\"WAL checkpoint complete\" first=" << segs.first.first
+    LOG_INFO << "msg=\"WAL checkpoint complete\" dir=" << w->dir() << " first=" << segs.first.first
              << " last=" << segs.first.second << " duration="
              << std::chrono::duration_cast<std::chrono::milliseconds>(
                     std::chrono::high_resolution_clock::now() - t0)
@@ -1,9 +1,12 @@
 #ifndef HEAD_HPP
 #define HEAD_HPP
 
+#include <atomic>
+#include <map>
 #include <stdint.h>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "base/Atomic.hpp"
 #include "base/Error.hpp"
@@ -12,6 +15,7 @@
 #include "base/WaitGroup.hpp"
 #include "block/BlockInterface.hpp"
 #include "db/AppenderInterface.hpp"
+#include "head/ChunkDiskMapper.hpp"
 #include "head/StripeSeries.hpp"
 #include "index/MemPostings.hpp"
 #include "tsdbutil/tsdbutils.hpp"
@@ -20,12 +24,67 @@
 namespace tsdb {
 namespace head {
 
+class MemGroup;
+class SnapshotReader;
+
 // Head handles reads and writes of time series data within a time window.
 // TODO(Alec), add metrics to monitor Head.
 class Head : public block::BlockInterface {
+private:
+    // GCTask is shared with the GC queued on pool_ by gc_background(), which
+    // may run after the head is gone or never if the pool is stopped.
+    struct GCTask {
+        base::MutexLock mutex_; // Held while the task runs.
+        Head* head;             // Reset by ~Head() under mutex_.
+        std::atomic<bool> queued;
+        // Set by truncate(), the task then checkpoints the WAL after the GC,
+        // so that the checkpoint drops the series the GC just removed.
+        std::atomic<bool> checkpoint;
+        std::atomic<bool> cancel; // Set by ~Head() to cut a checkpoint short.
+
+        GCTask(Head* head)
+            : head(head), queued(false), checkpoint(false), cancel(false)
+        {}
+    };
+    std::shared_ptr<GCTask> gc_task;
+
+    // Guards mapped_chunks while the WAL shards are replayed in parallel.
+    base::MutexLock mapped_mutex_;
+
+    // init_wal replays one WAL shard and repairs it if it is corrupted. If
+    // the shard has a valid snapshot, it is loaded instead of the checkpoint
+    // and the segments it covers.
+    error::Error init_wal(wal::WAL* w);
+
+    // load_snapshot loads the sections of a snapshot in parallel on pool_.
+    // On error the series it loaded are cleared again, the caller falls back
+    // to replaying the checkpoint and the WAL.
+    error::Error load_snapshot(SnapshotReader* reader);
+
+    // attach_mapped_chunks hands the chunks found by the chunk mapper to the
+    // series just created by the WAL replay.
+    void attach_mapped_chunks(const MemSeriesPtr& s);
+    friend class WALReplay;
+
+    // truncate_wal checkpoints the lower third of the segments of one WAL
+    // shard and drops them.
+    error::Error truncate_wal(wal::WAL* w, int64_t mint);
+
+    // checkpoint truncates every WAL shard in turn, dropping the samples
+    // before MinTime().
+    void checkpoint();
+
 public:
     int64_t chunk_range;
-    std::unique_ptr<wal::WAL> wal;
+    // Samples at most this much older than the newest sample of their series
+    // are still accepted, 0 disables out-of-order ingestion.
+    int64_t ooo_window;
+    // WAL shards, empty if the WAL is disabled. All the records of a series
+    // go to wals[wal_shard(tsid)], so that they replay in order whichever
+    // shard is read first.
+    std::vector<std::unique_ptr<wal::WAL>> wals;
+    // Full chunks are spilled to disk if set.
+    std::unique_ptr<ChunkDiskMapper> chunk_mapper;
 
     base::AtomicInt64 min_time;
     base::AtomicInt64 max_time;
@@ -45,28 +104,54 @@ public:
 
     std::shared_ptr<base::ThreadPool> pool_;
 
+    // Chunks found by the chunk mapper during init, attached to their series
+    // when the WAL creates them.
+    std::unordered_map<tagtree::TSID, std::vector<std::shared_ptr<MemChunk>>>
+        mapped_chunks;
+
+    // Groups of series added through HeadAppender::add_group(), by their
+    // sorted tsids.
+    base::MutexLock groups_mutex_;
+    std::map<std::vector<tagtree::TSID>, std::shared_ptr<MemGroup>> groups;
+
+    // Longest time in nanoseconds gc() held up appends and lookups on a
+    // stripe.
+    base::AtomicInt64 gc_max_pause;
+
+    // Background checkpoints read the WAL at no more than this many bytes per
+    // second, 0 for no limit.
+    int64_t checkpoint_bytes_per_sec;
+
     error::Error err_;
 
     Head(int64_t chunk_range, std::unique_ptr<wal::WAL>&& wal,
-         const std::shared_ptr<base::ThreadPool>& pool_);
+         const std::shared_ptr<base::ThreadPool>& pool_,
+         int64_t ooo_window = 0, const std::string& chunks_dir = "");
+    Head(int64_t chunk_range, std::vector<std::unique_ptr<wal::WAL>>&& wals,
+         const std::shared_ptr<base::ThreadPool>& pool_,
+         int64_t ooo_window = 0, const std::string& chunks_dir = "");
+
+    int wal_shard(tagtree::TSID tsid) const
+    {
+        return std::hash<tagtree::TSID>()(tsid) % wals.size();
+    }
 
     // The samples before valid_time will be appended.
     //
     // init loads data from the write ahead log and prepares the head for
-    // writes. It should be called before using an appender so that limits the
+    // writes. The WAL shards are replayed in parallel. It should be called before using an appender so that limits the
     // ingested samples to the head min valid time.
     error::Error init(int64_t min_valid_time);
 
     void update_min_max_time(int64_t mint, int64_t maxt);
 
-    // The samples will be destructed automatically after this function
-    // finishes.
-    void process_wal_samples(const std::vector<tsdbutil::RefSample>& samples,
-                             base::AtomicUInt64* unknown_refs,
-                             base::WaitGroup* wg);
-
+    // load_wal replays the records of reader, see WALReplay.
     wal::CorruptionError load_wal(wal::SegmentReader* reader);
 
+    // load_mapped_chunks reads the chunks spilled by the chunk mapper into
+    // mapped_chunks. Samples covered by them are skipped by the WAL replay.
+    error::Error load_mapped_chunks();
+
     std::unique_ptr<db::AppenderInterface> head_appender();
 
     std::unique_ptr<db::AppenderInterface> appender();
@@ -106,11 +191,24 @@ public:
     // If there are 2 threads calling this function at the same time,
     // it can be the situation that the 2 threads both generate an id.
     // But only one will be finally push into StripeSeries, and the other id
-    // and its corresponding std::shared_ptr<MemSeries> will be abandoned.
+    // and its corresponding MemSeriesPtr will be abandoned.
     //
     // In a word, this function is thread-safe.
-    std::pair<std::shared_ptr<MemSeries>, bool>
-    get_or_create(tagtree::TSID tsid);
+    //
+    // If pin is set, the series returned gets one pending sample, see
+    // MemSeries::pending_samples.
+    std::pair<MemSeriesPtr, bool> get_or_create(tagtree::TSID tsid,
+                                                bool pin = false);
+
+    // get_or_create_group returns the group of the sorted tsids, members[i]
+    // being the series of tsids[i]. Groups any of the members belong to are
+    // released first, a series is a member of one group at a time.
+    std::shared_ptr<MemGroup>
+    get_or_create_group(const std::vector<tagtree::TSID>& tsids,
+                        const std::vector<MemSeriesPtr>& members);
+
+    // release_group releases g and forgets it.
+    void release_group(const std::shared_ptr<MemGroup>& g);
 
     // chunkRewrite re-writes the chunks which overlaps with deleted ranges
     // and removes the samples in the deleted ranges.
@@ -126,8 +224,25 @@ public:
     error::Error del(int64_t mint, int64_t maxt,
                      const std::unordered_set<tagtree::TSID>& tsids);
 
+    // gc removes the chunks before MinTime() and the series left without
+    // chunks. It walks the series in steps of GC_STEP_SERIES and yields in
+    // between, each stripe is only locked while its own series are collected.
     void gc();
 
+    // gc_background runs gc() on pool_, followed by checkpoint() if
+    // gc_task->checkpoint is set. A call while a GC is still queued is a
+    // no-op, the queued one collects up to the MinTime() current when it
+    // starts.
+    void gc_background();
+
+    // snapshot writes the series of every WAL shard into a snapshot next to
+    // it, see SnapshotWriter. The next init() loads it and only replays the
+    // WAL written after it. Appends must have stopped.
+    error::Error snapshot();
+
+    // truncate removes all data before mint from the head. The series are
+    // garbage collected and then the WAL shards are checkpointed and
+    // truncated by one background task, the caller waits on neither.
     error::Error truncate(int64_t mint);
 
     // void close() const{
@@ -137,10 +252,7 @@ public:
 
     error::Error error() const { return err_; }
 
-    ~Head()
-    {
-        // LOG_DEBUG << "~Head";
-    }
+    ~Head();
 };
 
 } // namespace head
@@ -1,14 +1,21 @@
 #ifndef HEADAPPENDER_H
 #define HEADAPPENDER_H
 
+#include <algorithm>
+#include <atomic>
+#include <boost/bind.hpp>
 #include <deque>
 #include <iostream>
+#include <limits>
+#include <unordered_map>
 #include <vector>
 
 #include "base/TimeStamp.hpp"
+#include "base/WaitGroup.hpp"
 #include "db/AppenderInterface.hpp"
 #include "head/Head.hpp"
 #include "head/HeadUtils.hpp"
+#include "head/MemGroup.hpp"
 #include "tsdbutil/RecordEncoder.hpp"
 #include "tsdbutil/tsdbutils.hpp"
 
@@ -26,6 +33,58 @@ private:
     std::vector<tsdbutil::RefSeries> series;
     std::vector<tsdbutil::RefSample> samples;
 
+    // Samples added by add_batch() are kept in columns. batch_series holds
+    // raw handles, they stay valid because every sample is counted in the
+    // pending_samples of its series until it is committed or rolled back.
+    std::vector<tagtree::TSID> batch_tsids;
+    std::vector<int64_t> batch_ts;
+    std::vector<double> batch_vs;
+    std::vector<MemSeries*> batch_series;
+
+    // The samples of add() and add_batch() grouped by series, see
+    // group_runs(). Kept across commits like the columns, so that commits
+    // do not allocate them again.
+    struct PendingSample {
+        MemSeries* series;
+        size_t pos; // Order in which the sample was added.
+        int64_t t;
+        double v;
+
+        bool operator<(const PendingSample& rhs) const
+        {
+            return series < rhs.series ||
+                   (series == rhs.series && pos < rhs.pos);
+        }
+    };
+    std::vector<PendingSample> sample_order;
+    // A run of the samples of one series, sample_order[begin, end).
+    struct Run {
+        MemSeries* series;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Run> runs;
+
+    // Rows added by add_group(). Their samples are kept in columns like those
+    // of add_batch(), in the order of the group's sorted tsids, and their
+    // series are pinned the same way. The groups are only looked up at
+    // commit, see append_groups().
+    struct GroupRow {
+        int64_t t;
+        size_t begin; // Offset of the row in the group columns.
+        size_t n;
+    };
+    std::vector<GroupRow> group_rows;
+    std::vector<tagtree::TSID> group_tsids;
+    std::vector<int64_t> group_ts;
+    std::vector<double> group_vs;
+    std::vector<MemSeries*> group_series;
+    // Timestamp of the last pending row of each member.
+    std::unordered_map<MemSeries*, int64_t> group_max_time;
+    // Key and members of the group looked up by append_groups().
+    std::vector<tagtree::TSID> group_key;
+    std::vector<MemSeriesPtr> group_members;
+
 public:
     HeadAppender(Head* head, int64_t min_valid_time, int64_t min_time,
                  int64_t max_time)
@@ -33,16 +92,14 @@ public:
           max_time(max_time)
     {}
 
-    error::Error add(tagtree::TSID tsid, int64_t t, double v)
+    std::pair<uint64_t, error::Error> add(tagtree::TSID tsid, int64_t t,
+                                          double v)
     {
-        if (t < min_valid_time) return ErrOutOfBounds;
+        if (t < min_valid_time) return {0, ErrOutOfBounds};
 
-        std::pair<std::shared_ptr<MemSeries>, bool> s =
-            head->get_or_create(tsid);
+        std::pair<MemSeriesPtr, bool> s = head->get_or_create(tsid, true);
         if (s.second) series.emplace_back(tsid);
 
-        if (t < min_valid_time) return ErrOutOfBounds;
-
         {
             // TODO(Alec), figure out if lock here.
             // It's meaningless to have multiple appenders on the same Memseries
@@ -53,7 +110,6 @@ public:
             // error::Error err = s->appendable(t, v);
             // if(err)
             //     return err;
-            s.first->pending_commit = true;
         }
 
         // if(t < min_time)
@@ -62,6 +118,111 @@ public:
         //     max_time = t;
 
         samples.emplace_back(tsid, t, v, s.first);
+        return {s.first->ref(), error::Error()};
+    }
+
+    error::Error add_fast(uint64_t ref, int64_t t, double v)
+    {
+        if (t < min_valid_time) return ErrOutOfBounds;
+
+        MemSeriesPtr s = MemSeries::from_ref(ref);
+        if (!s) return ErrNotFound;
+        {
+            // gc() invalidates the reference under the series lock, check it
+            // again before pinning the series for this commit.
+            base::MutexLockGuard lock(s->mutex_);
+            if (s->ref() != ref) return ErrNotFound;
+            s->pending_samples.fetch_add(1);
+        }
+
+        samples.emplace_back(s->tsid, t, v, s);
+        return error::Error();
+    }
+
+    error::Error add_batch(const std::vector<tagtree::TSID>& tsids,
+                           const std::vector<int64_t>& ts,
+                           const std::vector<double>& vs)
+    {
+        if (tsids.size() != ts.size() || tsids.size() != vs.size())
+            return error::Error("mismatched batch columns");
+        for (int64_t t : ts) {
+            if (t < min_valid_time) return ErrOutOfBounds;
+        }
+
+        int offset = batch_tsids.size();
+        int n = tsids.size();
+        batch_tsids.insert(batch_tsids.end(), tsids.begin(), tsids.end());
+        batch_ts.insert(batch_ts.end(), ts.begin(), ts.end());
+        batch_vs.insert(batch_vs.end(), vs.begin(), vs.end());
+        batch_series.resize(offset + n);
+
+        head->series->get_batch(&batch_tsids[offset], n, &batch_series[offset]);
+        for (int i = offset; i < offset + n; ++i) {
+            if (batch_series[i]) continue;
+            std::pair<MemSeriesPtr, bool> s =
+                head->get_or_create(batch_tsids[i], true);
+            if (s.second) series.emplace_back(batch_tsids[i]);
+            batch_series[i] = s.first.get();
+        }
+        return error::Error();
+    }
+
+    error::Error add_group(const std::vector<tagtree::TSID>& tsids, int64_t t,
+                           const std::vector<double>& vs)
+    {
+        if (tsids.size() != vs.size())
+            return error::Error("mismatched group columns");
+        if (tsids.empty()) return error::Error();
+        if (t < min_valid_time) return ErrOutOfBounds;
+
+        // Groups are keyed by their sorted tsids.
+        std::vector<size_t> order(tsids.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&tsids](size_t lhs, size_t rhs) {
+            return tsids[lhs] < tsids[rhs];
+        });
+        std::vector<tagtree::TSID> sorted(tsids.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            sorted[i] = tsids[order[i]];
+        if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+            return error::Error("duplicate series in group");
+
+        size_t begin = group_tsids.size();
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            std::pair<MemSeriesPtr, bool> s = head->get_or_create(sorted[i], true);
+            if (s.second) series.emplace_back(sorted[i]);
+            group_tsids.push_back(sorted[i]);
+            group_ts.push_back(t);
+            group_vs.push_back(vs[order[i]]);
+            group_series.push_back(s.first.get());
+        }
+
+        // Group chunks take no out-of-order samples, the row must be newer
+        // than what its members hold in the head and in this appender.
+        for (size_t i = begin; i < group_series.size(); ++i) {
+            MemSeries* s = group_series[i];
+            int64_t last;
+            {
+                base::MutexLockGuard lock(s->mutex_);
+                last = s->max_time();
+            }
+            auto it = group_max_time.find(s);
+            if (it != group_max_time.end() && it->second > last)
+                last = it->second;
+            if (t > last) continue;
+
+            for (size_t j = begin; j < group_series.size(); ++j)
+                group_series[j]->pending_samples.fetch_sub(1);
+            group_tsids.resize(begin);
+            group_ts.resize(begin);
+            group_vs.resize(begin);
+            group_series.resize(begin);
+            return ErrOutOfOrderSample;
+        }
+        for (size_t i = begin; i < group_series.size(); ++i)
+            group_max_time[group_series[i]] = t;
+        group_rows.push_back({t, begin, sorted.size()});
         return error::Error();
     }
 
@@ -73,54 +234,359 @@ public:
         // LOG_DEBUG << "log duration=" <<
         // base::timeDifference(base::TimeStamp::now(), start); LOG_DEBUG <<
         // "before append"; auto start = base::TimeStamp::now();
-        for (tsdbutil::RefSample& s : samples) {
-            base::MutexLockGuard lock(s.series->mutex_);
-            if (s.series->append(s.t, s.v).first) {
-                if (s.t < min_time) min_time = s.t;
-                if (s.t > max_time) max_time = s.t;
-            }
-            s.series->pending_commit = false;
-        }
+        group_runs();
+        if (sample_order.size() >= PARALLEL_COMMIT_SAMPLES &&
+            head->pool_ && head->pool_->numThreads() > 1)
+            append_runs_parallel();
+        else
+            append_runs(runs.data(), runs.size(), &min_time, &max_time);
+        size_t rejected = append_groups();
         // LOG_DEBUG << "append duration=" <<
         // base::timeDifference(base::TimeStamp::now(), start); LOG_DEBUG <<
         // "before clean";
         series.clear();
         samples.clear();
+        clear_batch();
+        clear_groups();
+        sample_order.clear();
+        runs.clear();
         head->update_min_max_time(min_time, max_time);
+        if (rejected > 0)
+            return error::wrap(ErrOutOfOrderSample,
+                               "append " + std::to_string(rejected) +
+                                   " group rows");
         return error::Error();
     }
 
     error::Error rollback()
     {
-        for (tsdbutil::RefSample& s : samples) {
-            base::MutexLockGuard lock(s.series->mutex_);
-            s.series->pending_commit = false;
-        }
+        for (tsdbutil::RefSample& s : samples)
+            s.series->pending_samples.fetch_sub(1);
+        for (MemSeries* s : batch_series)
+            s->pending_samples.fetch_sub(1);
+        for (MemSeries* s : group_series)
+            s->pending_samples.fetch_sub(1);
 
         // Series are created in the head memory regardless of rollback. Thus we
         // have to log them to the WAL in any case.
         samples.clear();
+        clear_batch();
+        clear_groups();
         return log();
     }
 
+private:
+    // Commits with at least this many samples spread their runs over the
+    // head's thread pool.
+    static const size_t PARALLEL_COMMIT_SAMPLES = 1 << 16;
+
+    // Room reserved for a compact sample record of a scrape, the encoder
+    // writes in place up to its worst case and cuts the record to size.
+    static const size_t RECORD_BYTES_PER_SAMPLE = 24;
+
+    // group_runs groups the pending samples by series so that each series is
+    // locked once per commit. Samples of a series are appended in the order
+    // they were added, those added by add() before those added by
+    // add_batch().
+    void group_runs()
+    {
+        // Sorting by position as well keeps the order without the buffer of
+        // a stable sort, and the values are sorted along so that they are
+        // read in order when appended.
+        sample_order.resize(samples.size() + batch_series.size());
+        size_t n = samples.size();
+        for (size_t i = 0; i < n; ++i)
+            sample_order[i] = {samples[i].series.get(), i, samples[i].t,
+                               samples[i].v};
+        for (size_t i = 0; i < batch_series.size(); ++i)
+            sample_order[n + i] = {batch_series[i], n + i, batch_ts[i],
+                                   batch_vs[i]};
+        std::sort(sample_order.begin(), sample_order.end());
+        for (size_t i = 0, j; i < sample_order.size(); i = j) {
+            MemSeries* s = sample_order[i].series;
+            for (j = i + 1;
+                 j < sample_order.size() && sample_order[j].series == s; ++j)
+                ;
+            runs.push_back({s, i, j});
+        }
+    }
+
+    void append_runs(const Run* runs, size_t n, int64_t* mint, int64_t* maxt)
+    {
+        ChunkDiskMapper* chunk_mapper = head->chunk_mapper.get();
+        for (size_t i = 0; i < n; ++i) {
+            const Run& r = runs[i];
+            base::MutexLockGuard lock(r.series->mutex_);
+            if (r.series->group) {
+                // A sample of its own takes the series out of its group, it
+                // is appended to a chunk of the series' own.
+                r.series->group->leave();
+                r.series->group.reset();
+            }
+            for (size_t j = r.begin; j < r.end; ++j) {
+                int64_t t = sample_order[j].t;
+                double v = sample_order[j].v;
+                if (r.series->append(t, v, head->ooo_window, chunk_mapper)
+                        .first) {
+                    if (t < *mint) *mint = t;
+                    if (t > *maxt) *maxt = t;
+                }
+            }
+            // The series may be collected from now on, it must not be
+            // touched after its lock is released.
+            r.series->pending_samples.fetch_sub(r.end - r.begin);
+        }
+    }
+
+    // append_groups appends the rows added by add_group() to their groups,
+    // creating these as needed, and returns the number of rejected rows.
+    // add_group() checked the rows against the members, they can still be
+    // rejected if other appenders added samples to these since.
+    size_t append_groups()
+    {
+        size_t rejected = 0;
+        std::shared_ptr<MemGroup> g;
+        for (const GroupRow& r : group_rows) {
+            const tagtree::TSID* tsids = &group_tsids[r.begin];
+            const double* vs = &group_vs[r.begin];
+            // Consecutive rows of the same series go to the same group.
+            if (!g || g->tsids.size() != r.n ||
+                !std::equal(tsids, tsids + r.n, g->tsids.begin()))
+                g = get_or_create_group(r);
+            bool ok = g->append(r.t, vs);
+            if (!ok && g->released()) {
+                // The group was released, e.g. by gc() or because one of
+                // its members left, the row goes to a new group.
+                g = get_or_create_group(r);
+                ok = g->append(r.t, vs);
+            }
+            if (!ok) {
+                ++rejected;
+                continue;
+            }
+            if (r.t < min_time) min_time = r.t;
+            if (r.t > max_time) max_time = r.t;
+        }
+        for (MemSeries* s : group_series)
+            s->pending_samples.fetch_sub(1);
+        return rejected;
+    }
+
+    std::shared_ptr<MemGroup> get_or_create_group(const GroupRow& r)
+    {
+        group_key.assign(group_tsids.begin() + r.begin,
+                         group_tsids.begin() + r.begin + r.n);
+        group_members.assign(group_series.begin() + r.begin,
+                             group_series.begin() + r.begin + r.n);
+        std::shared_ptr<MemGroup> g =
+            head->get_or_create_group(group_key, group_members);
+        group_members.clear();
+        return g;
+    }
+
+    // Partitions of the runs of a parallel commit. Pool tasks outliving the
+    // commit find no partition left and return without touching the appender.
+    class CommitPartitions {
+    public:
+        std::vector<size_t> bounds; // Partition i is [bounds[i], bounds[i+1]).
+        std::atomic<int> next;
+        base::MutexLock mutex_;
+        int64_t min_time;
+        int64_t max_time;
+        base::WaitGroup wg;
+
+        CommitPartitions()
+            : next(0), min_time(std::numeric_limits<int64_t>::max()),
+              max_time(std::numeric_limits<int64_t>::min())
+        {}
+    };
+
+    void commit_partitions(const std::shared_ptr<CommitPartitions>& parts,
+                           const Run* runs)
+    {
+        int n = parts->bounds.size() - 1;
+        int i;
+        while ((i = parts->next.fetch_add(1)) < n) {
+            int64_t mint = std::numeric_limits<int64_t>::max();
+            int64_t maxt = std::numeric_limits<int64_t>::min();
+            append_runs(runs + parts->bounds[i],
+                        parts->bounds[i + 1] - parts->bounds[i], &mint, &maxt);
+            {
+                base::MutexLockGuard lock(parts->mutex_);
+                if (mint < parts->min_time) parts->min_time = mint;
+                if (maxt > parts->max_time) parts->max_time = maxt;
+            }
+            parts->wg.done();
+        }
+    }
+
+    void append_runs_parallel()
+    {
+        // Cut the runs into partitions of about the same number of samples.
+        // Runs of the same series stay in one partition to keep their order.
+        int num = head->pool_->numThreads() * 4;
+        size_t total = sample_order.size();
+        std::shared_ptr<CommitPartitions> parts(new CommitPartitions());
+        parts->bounds.push_back(0);
+        size_t acc = 0;
+        for (size_t i = 0; i < runs.size(); ++i) {
+            acc += runs[i].end - runs[i].begin;
+            if (acc * num >= total * parts->bounds.size() &&
+                (i + 1 == runs.size() || runs[i + 1].series != runs[i].series))
+                parts->bounds.push_back(i + 1);
+        }
+        if (parts->bounds.back() != runs.size())
+            parts->bounds.push_back(runs.size());
+
+        int n = parts->bounds.size() - 1;
+        parts->wg.add(n);
+        for (int i = 1; i < n; ++i)
+            head->pool_->run(boost::bind(&HeadAppender::commit_partitions,
+                                         this, parts, runs.data()));
+        // Work on the partitions here as well, so the commit completes even
+        // if all pool threads are busy.
+        commit_partitions(parts, runs.data());
+        parts->wg.wait();
+
+        if (parts->min_time < min_time) min_time = parts->min_time;
+        if (parts->max_time > max_time) max_time = parts->max_time;
+    }
+
+public:
+    void clear_batch()
+    {
+        batch_tsids.clear();
+        batch_ts.clear();
+        batch_vs.clear();
+        batch_series.clear();
+    }
+
+    void clear_groups()
+    {
+        group_rows.clear();
+        group_tsids.clear();
+        group_ts.clear();
+        group_vs.clear();
+        group_series.clear();
+        group_max_time.clear();
+    }
+
     error::Error log()
     {
-        if (!head->wal) return error::Error();
+        if (head->wals.empty()) return error::Error();
+        if (head->wals.size() > 1) return log_sharded();
 
-        std::vector<uint8_t> rec;
+        // All the records of a commit share one WAL ticket. They are encoded
+        // into buffers reserved from the WAL, which takes them back once they
+        // are written.
+        wal::WAL* w = head->wals[0].get();
+        std::vector<uint8_t> recs[4];
+        int n = 0;
         if (!series.empty()) {
-            tsdbutil::RecordEncoder::series(series, rec);
-            error::Error err = head->wal->log(rec);
-            if (err) return error::wrap(err, "log series");
+            recs[n] = w->reserve(1 + 8 * series.size());
+            tsdbutil::RecordEncoder::series(series, recs[n++]);
         }
         if (!samples.empty()) {
-            rec.clear();
-            tsdbutil::RecordEncoder::samples(samples, rec);
-            // LOG_DEBUG << "after RecordEncoder::samples()";
-            error::Error err = head->wal->log(rec);
-            // LOG_DEBUG << "after wal->log()";
-            if (err) return error::wrap(err, "log series");
+            recs[n] = w->reserve(RECORD_BYTES_PER_SAMPLE * samples.size());
+            tsdbutil::RecordEncoder::compact_samples(samples, recs[n++]);
+        }
+        if (!batch_tsids.empty()) {
+            recs[n] = w->reserve(RECORD_BYTES_PER_SAMPLE * batch_tsids.size());
+            tsdbutil::RecordEncoder::compact_samples(
+                &batch_tsids[0], &batch_ts[0], &batch_vs[0],
+                batch_tsids.size(), recs[n++]);
+        }
+        if (!group_tsids.empty()) {
+            recs[n] = w->reserve(RECORD_BYTES_PER_SAMPLE * group_tsids.size());
+            tsdbutil::RecordEncoder::compact_samples(
+                &group_tsids[0], &group_ts[0], &group_vs[0],
+                group_tsids.size(), recs[n++]);
+        }
+        if (n == 0) return error::Error();
+        uint64_t ticket;
+        error::Error err = w->submit(recs, n, &ticket);
+        if (!err) err = w->wait(ticket);
+        if (err) return error::wrap(err, "log records");
+        return error::Error();
+    }
+
+private:
+    // log_sharded splits the records of a commit by the WAL shard of their
+    // series. The shards are all submitted before waiting on any of them, so
+    // their writer threads flush in parallel.
+    error::Error log_sharded()
+    {
+        // Per shard columns, kept per thread so that commits do not allocate
+        // them again.
+        struct Shard {
+            std::vector<tsdbutil::RefSeries> series;
+            std::vector<tagtree::TSID> tsids;
+            std::vector<int64_t> ts;
+            std::vector<double> vs;
+            uint64_t ticket;
+        };
+        static thread_local std::vector<Shard> shards;
+
+        int n = head->wals.size();
+        if (shards.size() < static_cast<size_t>(n)) shards.resize(n);
+        for (int i = 0; i < n; ++i) {
+            shards[i].series.clear();
+            shards[i].tsids.clear();
+            shards[i].ts.clear();
+            shards[i].vs.clear();
+            shards[i].ticket = 0;
+        }
+        for (tsdbutil::RefSeries& s : series)
+            shards[head->wal_shard(s.tsid)].series.push_back(s);
+
+        // Samples of all kinds go into one column set per shard. The
+        // samples vector comes first like in log().
+        for (tsdbutil::RefSample& s : samples) {
+            Shard& sh = shards[head->wal_shard(s.tsid)];
+            sh.tsids.push_back(s.tsid);
+            sh.ts.push_back(s.t);
+            sh.vs.push_back(s.v);
+        }
+        for (size_t j = 0; j < batch_tsids.size(); ++j) {
+            Shard& sh = shards[head->wal_shard(batch_tsids[j])];
+            sh.tsids.push_back(batch_tsids[j]);
+            sh.ts.push_back(batch_ts[j]);
+            sh.vs.push_back(batch_vs[j]);
+        }
+        for (size_t j = 0; j < group_tsids.size(); ++j) {
+            Shard& sh = shards[head->wal_shard(group_tsids[j])];
+            sh.tsids.push_back(group_tsids[j]);
+            sh.ts.push_back(group_ts[j]);
+            sh.vs.push_back(group_vs[j]);
+        }
+
+        error::Error err;
+        for (int i = 0; i < n; ++i) {
+            Shard& sh = shards[i];
+            wal::WAL* w = head->wals[i].get();
+            std::vector<uint8_t> recs[2];
+            int m = 0;
+            if (!sh.series.empty()) {
+                recs[m] = w->reserve(1 + 8 * sh.series.size());
+                tsdbutil::RecordEncoder::series(sh.series, recs[m++]);
+            }
+            if (!sh.tsids.empty()) {
+                recs[m] = w->reserve(RECORD_BYTES_PER_SAMPLE * sh.tsids.size());
+                tsdbutil::RecordEncoder::compact_samples(
+                    &sh.tsids[0], &sh.ts[0], &sh.vs[0], sh.tsids.size(),
+                    recs[m++]);
+            }
+            if (m == 0) continue;
+            err = w->submit(recs, m, &sh.ticket);
+            if (err) break;
+        }
+        // Wait on whatever was submitted, even after an error.
+        for (int i = 0; i < n; ++i) {
+            if (shards[i].ticket == 0) continue;
+            error::Error e = head->wals[i]->wait(shards[i].ticket);
+            if (e && !err) err = e;
         }
+        if (err) return error::wrap(err, "log records");
         return error::Error();
     }
 };
@@ -8,18 +8,22 @@ namespace tsdb{
 namespace head{
 
 // This wrap chunk in MemSeries::chunks to provide iterator.
-// The reason of this class is to lock MemSeries when calling iterator().
+// The reason of this class is to lock MemSeries when calling iterator(), or
+// reading the bytes which the appender only writes out when asked for them.
 class HeadChunk: public chunk::ChunkInterface{
     // NOTE Can only have one appender at the same time.
     private:
-        std::shared_ptr<MemSeries> s;
+        MemSeriesPtr s;
         std::shared_ptr<chunk::ChunkInterface> c;
         int cid;
 
     public:
-        HeadChunk(const std::shared_ptr<MemSeries> & s, const std::shared_ptr<chunk::ChunkInterface> & c, int cid): s(s), c(c), cid(cid){}
+        HeadChunk(const MemSeriesPtr & s, const std::shared_ptr<chunk::ChunkInterface> & c, int cid): s(s), c(c), cid(cid){}
 
-        const uint8_t * bytes(){ return c->bytes(); }
+        const uint8_t * bytes(){
+            base::MutexLockGuard series_lock(s->mutex_);
+            return c->bytes();
+        }
         uint8_t encoding(){ return c->encoding(); }
 
         // (Alec): will not append data in this class (should be done in MemSeries).
@@ -30,8 +34,14 @@ class HeadChunk: public chunk::ChunkInterface{
             return s->iterator(cid);
         }
         
-        int num_samples(){ return c->num_samples(); }
-        uint64_t size(){ return c->size(); }
+        int num_samples(){
+            base::MutexLockGuard series_lock(s->mutex_);
+            return c->num_samples();
+        }
+        uint64_t size(){
+            base::MutexLockGuard series_lock(s->mutex_);
+            return c->size();
+        }
 };
 
 }
@@ -1,5 +1,6 @@
 #include "head/HeadChunkReader.hpp"
 #include "block/ChunkReaderInterface.hpp"
+#include "chunk/GroupChunk.hpp"
 #include "head/Head.hpp"
 #include "head/HeadChunk.hpp"
 #include "head/HeadUtils.hpp"
@@ -14,7 +15,7 @@ HeadChunkReader::HeadChunkReader(Head* head, int64_t min_time, int64_t max_time)
 std::pair<std::shared_ptr<chunk::ChunkInterface>, bool>
 HeadChunkReader::chunk(tagtree::TSID tsid, uint64_t ref)
 {
-    std::shared_ptr<MemSeries> s = head->series->get_by_id(tsid);
+    MemSeriesPtr s = head->series->get_by_id(tsid);
     if (!s) {
         // This means that the series has been garbage collected.
         return {nullptr, false};
@@ -29,6 +30,17 @@ HeadChunkReader::chunk(tagtree::TSID tsid, uint64_t ref)
         return {nullptr, false};
     }
 
+    // Out-of-order samples are merged into a copy which the series will not
+    // touch anymore.
+    std::shared_ptr<chunk::ChunkInterface> merged = s->merge_ooo(*c);
+    if (merged != c->chunk) return {merged, true};
+
+    // Rows are appended to group slots under the group's lock, not the
+    // series', they are read from a snapshot.
+    chunk::GroupSlotChunk* slot =
+        dynamic_cast<chunk::GroupSlotChunk*>(c->chunk.get());
+    if (slot) return {slot->snapshot(), true};
+
     return {
         std::shared_ptr<chunk::ChunkInterface>(new HeadChunk(s, c->chunk, ref)),
         true};
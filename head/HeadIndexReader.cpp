@@ -29,7 +29,7 @@ HeadIndexReader::get_all_postings()
 bool HeadIndexReader::series(
     tagtree::TSID tsid, std::vector<std::shared_ptr<chunk::ChunkMeta>>& chunks)
 {
-    std::shared_ptr<MemSeries> s = head->series->get_by_id(tsid);
+    MemSeriesPtr s = head->series->get_by_id(tsid);
     if (!s) {
         // LOG_ERROR << "not existed, series id: " << tsid;
         return false;
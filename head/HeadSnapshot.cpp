@@ -0,0 +1,346 @@
+#include <boost/filesystem.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <fcntl.h>
+#include <limits>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/Checksum.hpp"
+#include "base/Endian.hpp"
+#include "chunk/GroupChunk.hpp"
+#include "chunk/XORChunk.hpp"
+#include "head/HeadSnapshot.hpp"
+#include "tsdbutil/tsdbutils.hpp"
+
+namespace tsdb {
+namespace head {
+
+const std::string SNAPSHOT_PREFIX = "snapshot.";
+
+const uint32_t MAGIC_HEAD_SNAPSHOT = 0x5A3C91E7;
+const int SNAPSHOT_SECTION_SERIES = 4096;
+
+namespace {
+
+const int HEAD_SNAPSHOT_FORMAT_V1 = 1;
+const int HEADER_SIZE = 8;
+const int SECTION_ENTRY_SIZE = 20; // offset, length and crc32.
+
+const std::string SNAPSHOT_TMP_SUFFIX = ".tmp";
+
+std::string snapshot_name(const std::string& dir, int segment)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%s%08d", SNAPSHOT_PREFIX.c_str(), segment);
+    return tsdbutil::filepath_join(dir, name);
+}
+
+void put_uvarint(std::vector<uint8_t>& b, uint64_t v)
+{
+    uint8_t temp[base::MAX_VARINT_LEN_64];
+    int encoded = base::encode_unsigned_varint(temp, v);
+    b.insert(b.end(), temp, temp + encoded);
+}
+
+void put_varint(std::vector<uint8_t>& b, int64_t v)
+{
+    uint8_t temp[base::MAX_VARINT_LEN_64];
+    int encoded = base::encode_signed_varint(temp, v);
+    b.insert(b.end(), temp, temp + encoded);
+}
+
+void put_uint32(std::vector<uint8_t>& b, uint32_t v)
+{
+    uint8_t temp[4];
+    base::put_uint32_big_endian(temp, v);
+    b.insert(b.end(), temp, temp + 4);
+}
+
+void put_uint64(std::vector<uint8_t>& b, uint64_t v)
+{
+    uint8_t temp[8];
+    base::put_uint64_big_endian(temp, v);
+    b.insert(b.end(), temp, temp + 8);
+}
+
+} // namespace
+
+std::pair<std::pair<std::string, int>, error::Error>
+last_snapshot(const std::string& dir)
+{
+    std::string r;
+    int idx = -1;
+
+    boost::filesystem::path p(dir);
+    if (!boost::filesystem::is_directory(p))
+        return {{"", 0}, error::Error("dir not existed")};
+    for (auto const& entry : boost::make_iterator_range(
+             boost::filesystem::directory_iterator(p), {})) {
+        std::string name = entry.path().filename().string();
+        if (!boost::filesystem::is_regular_file(entry.path()) ||
+            name.compare(0, SNAPSHOT_PREFIX.length(), SNAPSHOT_PREFIX) != 0)
+            continue;
+        std::string temp = name.substr(SNAPSHOT_PREFIX.length());
+        if (tsdbutil::is_number(temp) && std::stoi(temp) > idx) {
+            idx = std::stoi(temp);
+            r = entry.path().string();
+        }
+    }
+    if (idx == -1) return {{"", 0}, error::Error("not found")};
+    return {{r, idx}, error::Error()};
+}
+
+error::Error delete_snapshots(const std::string& dir)
+{
+    boost::filesystem::path p(dir);
+    if (!boost::filesystem::is_directory(p)) return error::Error();
+    error::MultiError errs;
+    for (auto const& entry : boost::make_iterator_range(
+             boost::filesystem::directory_iterator(p), {})) {
+        if (entry.path().filename().string().compare(
+                0, SNAPSHOT_PREFIX.length(), SNAPSHOT_PREFIX) != 0)
+            continue;
+        boost::system::error_code ec;
+        boost::filesystem::remove(entry.path(), ec);
+        if (ec)
+            errs.add(error::Error("remove " + entry.path().string() + ": " +
+                                  ec.message()));
+    }
+    return error::Error(errs.error());
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& dir, int segment)
+    : name(snapshot_name(dir, segment)), fd(-1), pos(0), section_series(0),
+      num_sections(0), num_series(0)
+{
+    std::string tmp = name + SNAPSHOT_TMP_SUFFIX;
+    fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        err_.set("create " + tmp + ": " + strerror(errno));
+        return;
+    }
+    uint8_t header[HEADER_SIZE] = {0};
+    base::put_uint32_big_endian(header, MAGIC_HEAD_SNAPSHOT);
+    header[4] = HEAD_SNAPSHOT_FORMAT_V1;
+    write(header, HEADER_SIZE);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    if (fd < 0) return;
+    // Not closed, drop the unfinished file.
+    ::close(fd);
+    ::unlink((name + SNAPSHOT_TMP_SUFFIX).c_str());
+}
+
+void SnapshotWriter::write(const uint8_t* p, size_t len)
+{
+    while (!err_ && len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            err_.set("write " + name + SNAPSHOT_TMP_SUFFIX + ": " +
+                     strerror(errno));
+            return;
+        }
+        p += n;
+        len -= n;
+        pos += n;
+    }
+}
+
+void SnapshotWriter::flush_section()
+{
+    if (section_series == 0) return;
+    put_uint64(table, pos);
+    put_uint64(table, section.size());
+    put_uint32(table, base::GetCrc32(section.data(), section.size()));
+    write(section.data(), section.size());
+    section.clear();
+    section_series = 0;
+    ++num_sections;
+}
+
+void SnapshotWriter::add(MemSeries* s)
+{
+    if (err_ || s->chunks.empty()) return;
+
+    put_uint64(section, s->tsid);
+    section.push_back(s->appender ? 1 : 0);
+    put_varint(section, s->first_chunk);
+    put_varint(section, s->next_at);
+    put_uvarint(section, s->chunks.size());
+    for (const std::shared_ptr<MemChunk>& c : s->chunks) {
+        put_varint(section, c->min_time);
+        put_varint(section, c->max_time);
+        // Group slots are written from a snapshot, rows may be appended to
+        // them meanwhile.
+        std::shared_ptr<chunk::ChunkInterface> chk = c->chunk;
+        chunk::GroupSlotChunk* slot =
+            dynamic_cast<chunk::GroupSlotChunk*>(chk.get());
+        if (slot) chk = slot->snapshot();
+        section.push_back(chk->encoding());
+        put_uvarint(section, chk->size());
+        const uint8_t* b = chk->bytes();
+        section.insert(section.end(), b, b + chk->size());
+    }
+    ++num_series;
+    if (++section_series >= SNAPSHOT_SECTION_SERIES) flush_section();
+}
+
+error::Error SnapshotWriter::close()
+{
+    flush_section();
+    uint64_t table_offset = pos;
+    std::vector<uint8_t> t;
+    put_uint32(t, num_sections);
+    t.insert(t.end(), table.begin(), table.end());
+    put_uint32(t, base::GetCrc32(t.data(), t.size()));
+    put_uint64(t, table_offset);
+    write(t.data(), t.size());
+    if (err_) return err_;
+
+    std::string tmp = name + SNAPSHOT_TMP_SUFFIX;
+    if (fsync(fd) != 0) err_.set("fsync " + tmp + ": " + strerror(errno));
+    ::close(fd);
+    fd = -1;
+    if (!err_ && ::rename(tmp.c_str(), name.c_str()) != 0)
+        err_.set("rename " + tmp + ": " + strerror(errno));
+    if (err_) ::unlink(tmp.c_str());
+    return err_;
+}
+
+SnapshotReader::SnapshotReader(const std::string& name)
+{
+    int fd = ::open(name.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) ::close(fd);
+        err_.set("open snapshot " + name + ": " + strerror(errno));
+        return;
+    }
+    size_t size = st.st_size;
+    if (size < HEADER_SIZE + 4 + 4 + 8) {
+        ::close(fd);
+        err_.set("snapshot " + name + " too short");
+        return;
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        err_.set("mmap snapshot " + name);
+        return;
+    }
+    file.reset(new HeadChunkFile(-1, reinterpret_cast<uint8_t*>(data), size));
+    const uint8_t* p = file->data;
+
+    if (base::get_uint32_big_endian(p) != MAGIC_HEAD_SNAPSHOT ||
+        p[4] != HEAD_SNAPSHOT_FORMAT_V1) {
+        err_.set("invalid snapshot header " + name);
+        return;
+    }
+    uint64_t table_offset = base::get_uint64_big_endian(p + size - 8);
+    if (table_offset < HEADER_SIZE || table_offset > size - 8 - 4 - 4) {
+        err_.set("invalid snapshot table offset " + name);
+        return;
+    }
+    uint64_t n = base::get_uint32_big_endian(p + table_offset);
+    uint64_t table_len = 4 + n * SECTION_ENTRY_SIZE;
+    if (n > size / SECTION_ENTRY_SIZE ||
+        table_offset + table_len + 4 + 8 != size ||
+        base::GetCrc32(p + table_offset, table_len) !=
+            base::get_uint32_big_endian(p + table_offset + table_len)) {
+        err_.set("invalid snapshot table " + name);
+        return;
+    }
+
+    // All sections are checked up front, so that a broken snapshot is
+    // dropped before any of it has been loaded.
+    const uint8_t* entry = p + table_offset + 4;
+    for (uint64_t i = 0; i < n; ++i, entry += SECTION_ENTRY_SIZE) {
+        uint64_t off = base::get_uint64_big_endian(entry);
+        uint64_t len = base::get_uint64_big_endian(entry + 8);
+        if (off < HEADER_SIZE || off > table_offset ||
+            len > table_offset - off ||
+            base::GetCrc32(p + off, len) !=
+                base::get_uint32_big_endian(entry + 16)) {
+            err_.set("invalid snapshot section " + std::to_string(i) + " " +
+                     name);
+            return;
+        }
+        sections.emplace_back(off, len);
+    }
+}
+
+error::Error
+SnapshotReader::read_section(int i,
+                             const std::function<void(SnapshotSeries&)>& f)
+{
+    const uint8_t* p = file->data + sections[i].first;
+    const uint8_t* end = p + sections[i].second;
+    bool bad = false;
+    int decoded = 0;
+    auto uvarint = [&]() {
+        uint64_t v = base::decode_unsigned_varint(p, decoded, end - p);
+        if (decoded <= 0) {
+            bad = true;
+            return static_cast<uint64_t>(0);
+        }
+        p += decoded;
+        return v;
+    };
+    auto varint = [&]() {
+        int64_t v = base::decode_signed_varint(p, decoded, end - p);
+        if (decoded <= 0) {
+            bad = true;
+            return static_cast<int64_t>(0);
+        }
+        p += decoded;
+        return v;
+    };
+
+    SnapshotSeries s;
+    while (p < end) {
+        if (end - p < 9) break;
+        s.tsid = base::get_uint64_big_endian(p);
+        s.open = p[8] != 0;
+        p += 9;
+        s.first_chunk = varint();
+        s.next_at = varint();
+        uint64_t n = uvarint();
+        if (bad || n > static_cast<uint64_t>(end - p)) break;
+
+        s.chunks.clear();
+        for (uint64_t j = 0; j < n && !bad; ++j) {
+            int64_t mint = varint();
+            int64_t maxt = varint();
+            if (bad || p >= end ||
+                (*p != chunk::EncXOR && *p != chunk::EncInt)) {
+                bad = true;
+                break;
+            }
+            uint8_t encoding = *p++;
+            uint64_t len = uvarint();
+            if (bad || len > static_cast<uint64_t>(end - p)) {
+                bad = true;
+                break;
+            }
+            s.chunks.emplace_back(new MemChunk(
+                std::hash<tagtree::TSID>()(s.tsid),
+                std::shared_ptr<chunk::ChunkInterface>(
+                    new MappedChunk(file, encoding, p, len)),
+                mint, maxt));
+            p += len;
+        }
+        if (bad) break;
+        f(s);
+    }
+    if (bad || p != end)
+        return error::Error("corrupted snapshot section " + std::to_string(i));
+    return error::Error();
+}
+
+} // namespace head
+} // namespace tsdb
@@ -0,0 +1,113 @@
+#ifndef HEADSNAPSHOT_H
+#define HEADSNAPSHOT_H
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/Error.hpp"
+#include "head/ChunkDiskMapper.hpp"
+#include "head/MemSeries.hpp"
+#include "tagtree/tsid.h"
+
+namespace tsdb {
+namespace head {
+
+extern const std::string SNAPSHOT_PREFIX;
+
+extern const uint32_t MAGIC_HEAD_SNAPSHOT;
+
+// Series per section of a snapshot, the unit in which it is loaded in
+// parallel.
+extern const int SNAPSHOT_SECTION_SERIES;
+
+// last_snapshot returns the file name and WAL segment of the most recent
+// snapshot in dir. If there is none, "not found" is returned.
+std::pair<std::pair<std::string, int>, error::Error>
+last_snapshot(const std::string& dir);
+
+// delete_snapshots deletes all snapshots in dir, including unfinished ones.
+error::Error delete_snapshots(const std::string& dir);
+
+// A head snapshot holds the series of one WAL shard as they were when the
+// head was closed. It is named snapshot.N after the first WAL segment not
+// covered by it, only the segments from N on are replayed on top of it.
+//
+// The file starts with
+//   magic(4) | version(1) | padding(3)
+// followed by the sections, each holding up to SNAPSHOT_SECTION_SERIES series
+//   tsid(8) | open(1) | first_chunk(varint) | next_at(varint) |
+//   num_chunks(uvarint) | chunk*
+// with every chunk written as
+//   mint(varint) | maxt(varint) | encoding(1) | len(uvarint) | data(len)
+// open is 1 if samples were still appended to the last chunk. The sections
+// are followed by their table and its offset
+//   num_sections(4) | (offset(8) | len(8) | crc32(4))* | crc32(4) | offset(8)
+// where the last CRC covers the table up to it.
+class SnapshotWriter {
+private:
+    std::string name;
+    int fd;
+    uint64_t pos;
+    std::vector<uint8_t> section;
+    int section_series;
+    std::vector<uint8_t> table;
+    int num_sections;
+    int num_series;
+    error::Error err_;
+
+    void flush_section();
+    void write(const uint8_t* p, size_t len);
+
+public:
+    // Writes dir/snapshot.N. The file only gets its name once it is closed.
+    SnapshotWriter(const std::string& dir, int segment);
+    ~SnapshotWriter();
+
+    // add writes the series, its mutex must be held.
+    void add(MemSeries* s);
+
+    // close completes the snapshot and syncs it to disk.
+    error::Error close();
+
+    int series() const { return num_series; }
+
+    error::Error error() const { return err_; }
+};
+
+// SnapshotSeries is a series read from a snapshot. Its chunks read in place
+// from the mapped file, which stays mapped as long as any of them is in use.
+struct SnapshotSeries {
+    tagtree::TSID tsid;
+    bool open;
+    int64_t first_chunk;
+    int64_t next_at;
+    std::vector<std::shared_ptr<MemChunk>> chunks;
+};
+
+// SnapshotReader maps a snapshot and checks all its sections, which can then
+// be read concurrently.
+class SnapshotReader {
+private:
+    std::shared_ptr<HeadChunkFile> file;
+    std::vector<std::pair<uint64_t, uint64_t>> sections; // Offset and length.
+    error::Error err_;
+
+public:
+    SnapshotReader(const std::string& name);
+
+    int num_sections() const { return sections.size(); }
+
+    // read_section calls f with every series of section i.
+    error::Error read_section(int i,
+                              const std::function<void(SnapshotSeries&)>& f);
+
+    error::Error error() const { return err_; }
+};
+
+} // namespace head
+} // namespace tsdb
+
+#endif
@@ -13,9 +13,13 @@ const error::Error ErrOutOfBounds = error::Error("out of bounds");
 
 const int SAMPLES_PER_CHUNK = 120;
 
+const int OOO_CAPACITY = 32;
+
 const int STRIPE_SIZE = 1 << 14;
 const uint64_t STRIPE_MASK = STRIPE_SIZE - 1;
 
+const int GC_STEP_SERIES = 4096;
+
 // compute_chunk_end_time estimates the end timestamp based the beginning of a chunk,
 // its current timestamp and the upper bound up to which we insert data.
 // It assumes that the time range is 1/4 full.
@@ -25,9 +25,16 @@ extern const error::Error ErrOutOfBounds;
 
 extern const int SAMPLES_PER_CHUNK;
 
+// Number of out-of-order samples a series buffers before merging them into
+// its chunks.
+extern const int OOO_CAPACITY;
+
 extern const int STRIPE_SIZE;
 extern const uint64_t STRIPE_MASK;
 
+// Number of series head GC visits before yielding to other threads.
+extern const int GC_STEP_SERIES;
+
 class Sample{
     public:
         int64_t t;
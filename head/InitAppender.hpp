@@ -1,6 +1,8 @@
 #ifndef INITAPPENDER_H
 #define INITAPPENDER_H
 
+#include <algorithm>
+
 #include "db/AppenderInterface.hpp"
 #include "head/Head.hpp"
 #include "head/HeadUtils.hpp"
@@ -16,7 +18,8 @@ private:
 public:
     InitAppender(Head* head) : head(head) {}
 
-    error::Error add(tagtree::TSID tsid, int64_t t, double v)
+    std::pair<uint64_t, error::Error> add(tagtree::TSID tsid, int64_t t,
+                                          double v)
     {
         if (app) return app->add(tsid, t, v);
         head->init_time(t);
@@ -24,6 +27,33 @@ public:
         return app->add(tsid, t, v);
     }
 
+    error::Error add_fast(uint64_t ref, int64_t t, double v)
+    {
+        // References are only handed out by add(), which initializes app.
+        if (!app) return ErrNotFound;
+        return app->add_fast(ref, t, v);
+    }
+
+    error::Error add_batch(const std::vector<tagtree::TSID>& tsids,
+                           const std::vector<int64_t>& ts,
+                           const std::vector<double>& vs)
+    {
+        if (app) return app->add_batch(tsids, ts, vs);
+        if (ts.empty()) return error::Error();
+        head->init_time(*std::min_element(ts.begin(), ts.end()));
+        app = head->head_appender();
+        return app->add_batch(tsids, ts, vs);
+    }
+
+    error::Error add_group(const std::vector<tagtree::TSID>& tsids, int64_t t,
+                           const std::vector<double>& vs)
+    {
+        if (app) return app->add_group(tsids, t, vs);
+        head->init_time(t);
+        app = head->head_appender();
+        return app->add_group(tsids, t, vs);
+    }
+
     error::Error commit()
     {
         if (!app) return error::Error();
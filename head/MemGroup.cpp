@@ -0,0 +1,101 @@
+#include <limits>
+
+#include "db/DBUtils.hpp"
+#include "head/HeadUtils.hpp"
+#include "head/MemGroup.hpp"
+
+namespace tsdb {
+namespace head {
+
+MemGroup::MemGroup(const std::vector<tagtree::TSID>& tsids,
+                   const std::vector<MemSeriesPtr>& members,
+                   int64_t chunk_range)
+    : tsids(tsids), members(members), chunk_range(chunk_range),
+      next_at(std::numeric_limits<int64_t>::min()),
+      max_time_(std::numeric_limits<int64_t>::min()), released_(false),
+      left_(false)
+{}
+
+bool MemGroup::append(int64_t timestamp, const double* values)
+{
+    if (left_.load()) {
+        release();
+        return false;
+    }
+
+    base::MutexLockGuard lock(mutex_);
+    if (released_ || timestamp <= max_time_) return false;
+
+    // Chunks are cut like those of a single series, see MemSeries::append().
+    if (head_chunk &&
+        head_chunk->num_samples() == SAMPLES_PER_CHUNK / 4)
+        next_at =
+            compute_chunk_end_time(slots[0]->min_time, max_time_, next_at);
+    if ((!head_chunk || timestamp >= next_at) && !cut(timestamp))
+        return false;
+
+    head_chunk->append(timestamp, values);
+    max_time_ = timestamp;
+    for (size_t i = 0; i < members.size(); ++i) {
+        base::MutexLockGuard series_lock(members[i]->mutex_);
+        slots[i]->max_time = timestamp;
+    }
+    return true;
+}
+
+bool MemGroup::cut(int64_t timestamp)
+{
+    // Members only get samples through the group, this can only fail for the
+    // first chunk of a group.
+    for (const MemSeriesPtr& s : members) {
+        base::MutexLockGuard series_lock(s->mutex_);
+        if (s->max_time() >= timestamp) return false;
+    }
+
+    head_chunk.reset(new chunk::GroupChunk(tsids));
+    next_at = db::range_for_timestamp(timestamp, chunk_range);
+    slots.clear();
+    for (size_t i = 0; i < members.size(); ++i) {
+        // Group chunks are not spilled to the chunk mapper, their members
+        // keep reading them from the shared group chunk. The slots cover
+        // the row appended next, readers may find them before it.
+        slots.emplace_back(new MemChunk(
+            std::hash<tagtree::TSID>()(tsids[i]),
+            std::shared_ptr<chunk::ChunkInterface>(
+                new chunk::GroupSlotChunk(head_chunk, i)),
+            timestamp, timestamp));
+        base::MutexLockGuard series_lock(members[i]->mutex_);
+        members[i]->chunks.push_back(slots.back());
+        members[i]->appender.reset();
+    }
+    return true;
+}
+
+void MemGroup::release()
+{
+    base::MutexLockGuard lock(mutex_);
+    if (released_) return;
+    released_ = true;
+    for (const MemSeriesPtr& s : members) {
+        base::MutexLockGuard series_lock(s->mutex_);
+        if (s->group.get() == this) s->group.reset();
+    }
+    members.clear();
+    slots.clear();
+    head_chunk.reset();
+}
+
+bool MemGroup::released()
+{
+    base::MutexLockGuard lock(mutex_);
+    return released_;
+}
+
+int64_t MemGroup::max_time()
+{
+    base::MutexLockGuard lock(mutex_);
+    return max_time_;
+}
+
+} // namespace head
+} // namespace tsdb
@@ -0,0 +1,78 @@
+#ifndef MEMGROUP_H
+#define MEMGROUP_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "base/Mutex.hpp"
+#include "chunk/GroupChunk.hpp"
+#include "head/MemSeries.hpp"
+#include "tagtree/tsid.h"
+
+namespace tsdb {
+namespace head {
+
+// MemGroup holds series scraped together, added through
+// HeadAppender::add_group(). Their samples are appended row by row to a
+// shared chunk::GroupChunk which stores every timestamp once for the whole
+// group. Each member sees its slot of the group chunk as one of its own
+// chunks, so queries, GC and snapshots read it like any other head chunk.
+//
+// While a series is a member, MemSeries::group points to its group. A sample
+// added to a member on its own makes it leave(), the group is released on its
+// next row and the rows after it go to a new group.
+//
+// Groups live in the head only. Their rows are logged to the WAL as the
+// samples of the members, so after a restart they come back as chunks of the
+// members' own, with the same samples, until the next add_group() forms the
+// group again.
+//
+// Locks are taken in the order Head::groups_mutex_, MemGroup::mutex_,
+// MemSeries::mutex_.
+class MemGroup {
+public:
+    const std::vector<tagtree::TSID> tsids; // Sorted.
+
+    // members[i] is the series of tsids[i].
+    MemGroup(const std::vector<tagtree::TSID>& tsids,
+             const std::vector<MemSeriesPtr>& members, int64_t chunk_range);
+
+    // append adds the row of values at timestamp, values[i] belonging to
+    // tsids[i]. It fails for rows not newer than the last one and once the
+    // group is released or a member left it.
+    bool append(int64_t timestamp, const double* values);
+
+    // leave is called by a member under its lock when it takes a sample of
+    // its own.
+    void leave() { left_.store(true); }
+
+    // release detaches the members. Their chunks stay, the next sample of a
+    // member cuts a chunk of its own.
+    void release();
+
+    bool released();
+
+    int64_t max_time();
+
+private:
+    base::MutexLock mutex_;
+    std::vector<MemSeriesPtr> members;
+    int64_t chunk_range;
+    int64_t next_at; // Timestamp at which to cut the next group chunk.
+    int64_t max_time_;
+    bool released_;
+    std::atomic<bool> left_;
+    std::shared_ptr<chunk::GroupChunk> head_chunk;
+    // The chunk metas of head_chunk in the members' chunks.
+    std::vector<std::shared_ptr<MemChunk>> slots;
+
+    // cut starts a new group chunk. It fails if a member already holds
+    // samples at or after timestamp.
+    bool cut(int64_t timestamp);
+};
+
+} // namespace head
+} // namespace tsdb
+
+#endif
@@ -1,45 +1,58 @@
+#include <algorithm>
+
 #include "head/MemSeries.hpp"
 #include "base/Logging.hpp"
 #include "base/TSDBException.hpp"
-#include "chunk/XORAppender.hpp"
-#include "chunk/XORChunk.hpp"
-#include "chunk/XORIterator.hpp"
+#include "chunk/ChunkUtils.hpp"
+#include "chunk/IntChunk.hpp"
 #include "db/DBUtils.hpp"
+#include "head/ChunkDiskMapper.hpp"
+#include "head/SeriesSlab.hpp"
 
 namespace tsdb {
 namespace head {
 
-MemIterator::MemIterator(const std::shared_ptr<MemChunk>& m, const Sample* buf)
+static SeriesSlab& series_slab()
 {
-    iterator = m->chunk->iterator();
-    id = -1;
-    total = m->chunk->num_samples();
-    sample_buf[0] = buf[0];
-    sample_buf[1] = buf[1];
-    sample_buf[2] = buf[2];
-    sample_buf[3] = buf[3];
+    // Never destructed, series may still be released by retired epochs or
+    // other static objects during exit.
+    static SeriesSlab* slab = new SeriesSlab(sizeof(MemSeries));
+    return *slab;
 }
 
-std::pair<int64_t, double> MemIterator::at() const
-{
-    if (total - id > 4) return iterator->at();
-    return {sample_buf[4 - (total - id)].t, sample_buf[4 - (total - id)].v};
-}
+MemSeries::MemSeries(tagtree::TSID tsid, int64_t chunk_range)
+    : mutex_(), refs(0), tsid(tsid), chunk_range(chunk_range),
+      first_chunk(0), next_at(std::numeric_limits<int64_t>::min()),
+      pending_samples(0)
+{}
+
+void* MemSeries::operator new(size_t size) { return series_slab().alloc(); }
+
+void MemSeries::operator delete(void* p) { series_slab().free(p); }
 
-bool MemIterator::next() const
+uint64_t MemSeries::ref() { return series_slab().ref(this); }
+
+void MemSeries::invalidate_ref() { series_slab().invalidate(this); }
+
+MemSeriesPtr MemSeries::from_ref(uint64_t ref)
 {
-    if (id + 1 >= total) return false;
-    ++id;
-    if (total - id > 4) return iterator->next();
-    return true;
+    MemSeries* s = static_cast<MemSeries*>(series_slab().resolve(ref));
+    if (!s) return nullptr;
+
+    // The slot may be freed and reused at any time, so only take a reference
+    // if the series is still alive and check the generation again afterwards.
+    int r = s->refs.load();
+    do {
+        if (r == 0) return nullptr;
+    } while (!s->refs.compare_exchange_weak(r, r + 1));
+    MemSeriesPtr p(s, false);
+    if (!series_slab().resolve(ref)) return nullptr;
+    return p;
 }
 
-bool MemIterator::error() const { return iterator->error(); }
+size_t MemSeries::slab_bytes() { return series_slab().bytes(); }
 
-MemSeries::MemSeries(tagtree::TSID tsid, int64_t chunk_range)
-    : mutex_(), tsid(tsid), chunk_range(chunk_range), first_chunk(0),
-      next_at(std::numeric_limits<int64_t>::min()), pending_commit(false)
-{}
+size_t MemSeries::slab_size() { return series_slab().size(); }
 
 int64_t MemSeries::min_time()
 {
@@ -60,19 +73,23 @@ std::shared_ptr<MemChunk> MemSeries::head()
 }
 
 // Return (success, created_chunk)
-std::pair<bool, bool> MemSeries::append(int64_t timestamp, double value)
+std::pair<bool, bool> MemSeries::append(int64_t timestamp, double value,
+                                        int64_t ooo_window,
+                                        ChunkDiskMapper* chunk_mapper)
 {
 
     bool chunk_created = false;
     std::shared_ptr<MemChunk> h = head();
     if (!h) {
-        h = cut(timestamp);
+        h = cut(timestamp, value);
         chunk_created = true;
     }
     int num_samples = h->chunk->num_samples();
 
-    // TODO(Alec), add out of order data.
-    if (h->max_time >= timestamp) return {false, chunk_created};
+    if (h->max_time >= timestamp) {
+        if (ooo_window <= 0) return {false, chunk_created};
+        return {!append_ooo(timestamp, value, ooo_window), chunk_created};
+    }
 
     // If we reach 25% of a chunk's desired sample count, set a definitive time
     // at which to start the next chunk.
@@ -82,28 +99,135 @@ std::pair<bool, bool> MemSeries::append(int64_t timestamp, double value)
     if (num_samples == SAMPLES_PER_CHUNK / 4)
         next_at = compute_chunk_end_time(h->min_time, h->max_time, next_at);
 
-    if (timestamp >= next_at) {
-        h = cut(timestamp);
+    // Without an appender the head chunk was loaded from the chunk mapper.
+    if (timestamp >= next_at || !appender) {
+        if (chunk_mapper && appender) spill(chunk_mapper, *h);
+        h = cut(timestamp, value);
         chunk_created = true;
-    }
+    } else if (h->chunk->encoding() == chunk::EncInt &&
+               !chunk::IntChunk::is_integral(value))
+        rewrite_head(chunk::EncXOR);
 
     appender->append(timestamp, value);
 
     h->max_time = timestamp;
 
-    sample_buf[0] = sample_buf[1];
-    sample_buf[1] = sample_buf[2];
-    sample_buf[2] = sample_buf[3];
-    sample_buf[3].reset(timestamp, value);
-
     return {true, chunk_created};
 }
 
-std::shared_ptr<MemChunk> MemSeries::cut(int64_t timestamp)
+error::Error MemSeries::append_ooo(int64_t timestamp, double value,
+                                  int64_t ooo_window)
+{
+    if (timestamp < chunks.back()->max_time - ooo_window)
+        return ErrOutOfOrderSample;
+
+    // Attribute the sample to a chunk within the same chunk_range, so that
+    // chunks keep not crossing its boundaries. Take the last chunk starting
+    // before the sample, or the one after it if the sample lies in the gap
+    // behind a chunk of an earlier range.
+    int64_t range = db::range_for_timestamp(timestamp, chunk_range);
+    int i = chunks.size() - 1;
+    while (i > 0 && chunks[i]->min_time > timestamp)
+        --i;
+    if (chunks[i]->min_time <= timestamp &&
+        db::range_for_timestamp(chunks[i]->min_time, chunk_range) != range &&
+        i + 1 < chunks.size())
+        ++i;
+    MemChunk& c = *chunks[i];
+    if (db::range_for_timestamp(c.min_time, chunk_range) != range)
+        return ErrOutOfOrderSample;
+
+    // A sample at the timestamp of one already held, in the chunk or among
+    // the out-of-order ones, is only accepted if it repeats its value, and
+    // then kept once.
+    if (timestamp >= c.min_time && timestamp <= c.max_time) {
+        std::unique_ptr<chunk::ChunkIteratorInterface> it = c.chunk->iterator();
+        while (it->next()) {
+            std::pair<int64_t, double> p = it->at();
+            if (p.first < timestamp) continue;
+            if (p.first == timestamp)
+                return p.second == value ? error::Error() : ErrAmendSample;
+            break;
+        }
+    }
+    if (!ooo) ooo.reset(new std::vector<Sample>());
+    std::vector<Sample>::iterator it = std::lower_bound(
+        ooo->begin(), ooo->end(), timestamp,
+        [](const Sample& s, int64_t t) { return s.t < t; });
+    if (it != ooo->end() && it->t == timestamp)
+        return it->v == value ? error::Error() : ErrAmendSample;
+    ooo->insert(it, Sample(timestamp, value));
+
+    if (timestamp < c.min_time) c.min_time = timestamp;
+    if (timestamp > c.max_time) c.max_time = timestamp;
+
+    if (ooo->size() >= OOO_CAPACITY) flush_ooo();
+    return error::Error();
+}
+
+std::shared_ptr<chunk::ChunkInterface> MemSeries::merge_ooo(const MemChunk& c)
+{
+    if (!ooo) return c.chunk;
+    auto by_time = [](const Sample& s, int64_t t) { return s.t < t; };
+    std::vector<Sample>::const_iterator first =
+        std::lower_bound(ooo->begin(), ooo->end(), c.min_time, by_time);
+    std::vector<Sample>::const_iterator last =
+        std::lower_bound(first, ooo->cend(), c.max_time, by_time);
+    if (last != ooo->cend() && last->t == c.max_time) ++last;
+    if (first == last) return c.chunk;
+
+    uint8_t encoding = c.chunk->encoding();
+    for (std::vector<Sample>::const_iterator i = first;
+         i != last && encoding == chunk::EncInt; ++i) {
+        if (!chunk::IntChunk::is_integral(i->v)) encoding = chunk::EncXOR;
+    }
+    std::shared_ptr<chunk::ChunkInterface> merged =
+        chunk::new_chunk(encoding == chunk::EncInt ? chunk::EncInt
+                                                   : chunk::EncXOR);
+    std::unique_ptr<chunk::ChunkAppenderInterface> app = merged->appender();
+    std::unique_ptr<chunk::ChunkIteratorInterface> it = c.chunk->iterator();
+    bool ok = it->next();
+    while (ok || first != last) {
+        if (!ok || (first != last && first->t < it->at().first)) {
+            app->append(first->t, first->v);
+            ++first;
+            continue;
+        }
+        std::pair<int64_t, double> p = it->at();
+        // Samples appended in order win over out-of-order ones.
+        if (first != last && first->t == p.first) ++first;
+        app->append(p.first, p.second);
+        ok = it->next();
+    }
+    return merged;
+}
+
+void MemSeries::flush_ooo()
+{
+    if (!ooo) return;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        std::shared_ptr<chunk::ChunkInterface> c = merge_ooo(*chunks[i]);
+        if (c == chunks[i]->chunk) continue;
+        chunks[i]->chunk = c;
+        if (i + 1 < chunks.size()) continue;
+
+        // The head chunk is replaced, continue appending to the new one.
+        try {
+            appender = c->appender();
+        } catch (const base::TSDBException& e) {
+            LOG_ERROR << "MemSeries flush_ooo, error: " << e.what();
+            exit(1);
+        }
+    }
+    ooo.reset();
+}
+
+std::shared_ptr<MemChunk> MemSeries::cut(int64_t timestamp, double value)
 {
     chunks.emplace_back(new MemChunk(
         std::hash<tagtree::TSID>()(tsid),
-        std::shared_ptr<chunk::ChunkInterface>(new chunk::XORChunk()),
+        chunk::new_chunk(chunk::IntChunk::is_integral(value) ? chunk::EncInt
+                                                             : chunk::EncXOR),
         timestamp, std::numeric_limits<int64_t>::min()));
 
     // Set upper bound on when the next chunk must be started. An earlier
@@ -127,6 +251,39 @@ std::shared_ptr<MemChunk> MemSeries::cut(int64_t timestamp)
     return chunks.back();
 }
 
+void MemSeries::reopen()
+{
+    std::shared_ptr<MemChunk> h = head();
+    if (!h) return;
+    rewrite_head(h->chunk->encoding());
+}
+
+void MemSeries::rewrite_head(uint8_t encoding)
+{
+    std::shared_ptr<MemChunk> h = head();
+    if (!h) return;
+    std::shared_ptr<chunk::ChunkInterface> c = chunk::new_chunk(encoding);
+    std::unique_ptr<chunk::ChunkAppenderInterface> app = c->appender();
+    std::unique_ptr<chunk::ChunkIteratorInterface> it = h->chunk->iterator();
+    while (it->next()) {
+        std::pair<int64_t, double> p = it->at();
+        app->append(p.first, p.second);
+    }
+    h->chunk = c;
+    appender = std::move(app);
+}
+
+void MemSeries::spill(ChunkDiskMapper* chunk_mapper, MemChunk& c)
+{
+    std::pair<std::shared_ptr<chunk::ChunkInterface>, error::Error> p =
+        chunk_mapper->write_chunk(tsid, c.min_time, c.max_time, c.chunk.get());
+    if (p.second) {
+        LOG_ERROR << "msg=\"spill head chunk\" err=" << p.second.error();
+        return;
+    }
+    c.chunk = p.first;
+}
+
 std::deque<std::shared_ptr<chunk::ChunkMeta>> MemSeries::chunks_meta()
 {
     return chunks;
@@ -137,12 +294,8 @@ void MemSeries::reset()
     chunks.clear();
     first_chunk = 0;
     next_at = std::numeric_limits<int64_t>::min();
-    sample_buf[0].reset();
-    sample_buf[1].reset();
-    sample_buf[2].reset();
-    sample_buf[3].reset();
-    pending_commit = false;
     appender.reset();
+    ooo.reset();
 }
 
 error::Error MemSeries::appendable(int64_t timestamp, double value)
@@ -170,21 +323,30 @@ int MemSeries::truncate_chunk_before(int64_t timestamp)
         chunks.pop_front();
         ++first_chunk;
     }
+    if (ooo) {
+        // Drop the out-of-order samples of the removed chunks.
+        if (chunks.empty())
+            ooo.reset();
+        else
+            ooo->erase(ooo->begin(),
+                       std::lower_bound(ooo->begin(), ooo->end(),
+                                        chunks.front()->min_time,
+                                        [](const Sample& s, int64_t t) {
+                                            return s.t < t;
+                                        }));
+    }
     return first_chunk - last;
 }
 
 // No need to worry about the MemSeries invalidation problem if gc
-// because the iterator is in safe mode which will iterate on a copy anyway.
+// because the iterator in safe mode keeps the chunk's buffer alive and only
+// reads the samples appended before it was created.
 std::unique_ptr<chunk::ChunkIteratorInterface> MemSeries::iterator(int id)
 {
     std::shared_ptr<MemChunk> c = chunk(id);
     if (!c) return nullptr;
-    if (id - first_chunk < chunks.size()) return c->chunk->iterator();
-
-    // Serve the last 4 samples for the last chunk from the sample buffer
-    // as their compressed bytes may be mutated by added samples.
-    return std::unique_ptr<chunk::ChunkIteratorInterface>(
-        new MemIterator(c, sample_buf));
+    if (ooo) return merge_ooo(*c)->iterator();
+    return c->chunk->iterator();
 }
 
 } // namespace head
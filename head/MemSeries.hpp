@@ -8,53 +8,113 @@
 #include "head/HeadUtils.hpp"
 #include "label/Label.hpp"
 
+#include <atomic>
+#include <boost/intrusive_ptr.hpp>
 #include <deque>
+#include <vector>
 
 namespace tsdb {
 namespace head {
 
 typedef chunk::ChunkMeta MemChunk;
 
-class MemIterator : public chunk::ChunkIteratorInterface {
-private:
-    std::unique_ptr<ChunkIteratorInterface> iterator;
-    mutable int id; // chunk id.
-    int total;
-    Sample sample_buf[4];
+class ChunkDiskMapper;
+class MemGroup;
 
-public:
-    MemIterator(const std::shared_ptr<MemChunk>& m, const Sample* buf);
-    std::pair<int64_t, double> at() const;
-    bool next() const;
-    bool error() const;
-};
+class MemSeries;
+typedef boost::intrusive_ptr<MemSeries> MemSeriesPtr;
 
 // TODO(Alec), should come up with some other ways of recording chunk ids when
 // introducing UPDATE and Random Delete.
+//
+// MemSeries are allocated from a process wide SeriesSlab and reference counted
+// intrusively through MemSeriesPtr.
 class MemSeries {
 public:
     base::MutexLock mutex_;
+    std::atomic<int> refs;
     tagtree::TSID tsid;
     // std::unique_ptr<MemChunk> head_chunk;
     std::deque<std::shared_ptr<MemChunk>> chunks;
     int64_t chunk_range;
     int64_t first_chunk;
     int64_t next_at; // Timestamp at which to cut the next chunk
-    Sample sample_buf[4];
-    bool pending_commit;
+    // Number of samples appenders added to the series and did not commit or
+    // roll back yet, gc() keeps the series while there are any. They are
+    // counted under the stripe lock, or under the series lock once the
+    // reference has been checked for add_fast(), so gc() never misses them.
+    std::atomic<int> pending_samples;
     std::unique_ptr<chunk::ChunkAppenderInterface> appender;
+    // Samples which arrived out of order within the head's out-of-order
+    // window, sorted by timestamp. Each one widens the time range of the chunk
+    // it was attributed to, they are merged into it on reads and once
+    // OOO_CAPACITY of them piled up. Allocated on the first such sample.
+    std::unique_ptr<std::vector<Sample>> ooo;
+    // The group the series was added to by HeadAppender::add_group(), see
+    // MemGroup. A sample added to the series on its own takes it out of the
+    // group.
+    std::shared_ptr<MemGroup> group;
 
     MemSeries(tagtree::TSID tsid, int64_t chunk_range);
 
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+
+    // ref returns an opaque reference to the series which stays valid until
+    // the series is removed from the head. from_ref resolves it back and
+    // returns nullptr once the reference became stale.
+    uint64_t ref();
+    void invalidate_ref();
+    static MemSeriesPtr from_ref(uint64_t ref);
+
+    // Bytes reserved by and number of series living in the slab.
+    static size_t slab_bytes();
+    static size_t slab_size();
+
     int64_t min_time();
     int64_t max_time();
 
     std::shared_ptr<MemChunk> head();
 
     // Return (success, created_chunk)
-    std::pair<bool, bool> append(int64_t timestamp, double value);
-
-    std::shared_ptr<MemChunk> cut(int64_t timestamp);
+    //
+    // Samples not newer than the head chunk are accepted as long as they are
+    // at most ooo_window older than it. If a chunk_mapper is given, the head
+    // chunk is spilled to it when the next one is cut.
+    std::pair<bool, bool> append(int64_t timestamp, double value,
+                                 int64_t ooo_window = 0,
+                                 ChunkDiskMapper* chunk_mapper = nullptr);
+
+    // append_ooo adds a sample not newer than the head chunk. It fails with
+    // ErrOutOfOrderSample if the sample is outside the window or its
+    // chunk_range has no chunk left, and with ErrAmendSample if a sample at
+    // the same timestamp with another value is held already.
+    error::Error append_ooo(int64_t timestamp, double value,
+                            int64_t ooo_window);
+
+    // merge_ooo returns the chunk of c with the out-of-order samples in its
+    // time range merged in, or c's own chunk if there are none.
+    std::shared_ptr<chunk::ChunkInterface> merge_ooo(const MemChunk& c);
+
+    // flush_ooo merges all out-of-order samples into their chunks.
+    void flush_ooo();
+
+    // cut starts a new head chunk. Chunks whose first value is integral are
+    // cut as chunk::IntChunk and switch to chunk::XORChunk on the first value
+    // which is not.
+    std::shared_ptr<MemChunk> cut(int64_t timestamp, double value);
+
+    // reopen copies the head chunk into a new chunk and appends to it, for
+    // series whose head chunk was loaded read only.
+    void reopen();
+
+    // rewrite_head copies the head chunk into a new chunk of the given
+    // encoding and appends to it from then on.
+    void rewrite_head(uint8_t encoding);
+
+    // spill replaces the chunk of c by one read from the chunk_mapper. The
+    // chunk stays on the heap if writing it fails.
+    void spill(ChunkDiskMapper* chunk_mapper, MemChunk& c);
 
     std::deque<std::shared_ptr<chunk::ChunkMeta>> chunks_meta();
 
@@ -73,6 +133,16 @@ public:
     std::unique_ptr<chunk::ChunkIteratorInterface> iterator(int id);
 };
 
+inline void intrusive_ptr_add_ref(MemSeries* s)
+{
+    s->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void intrusive_ptr_release(MemSeries* s)
+{
+    if (s->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete s;
+}
+
 } // namespace head
 } // namespace tsdb
 
@@ -0,0 +1,210 @@
+#include "head/SeriesMap.hpp"
+#include "base/Epoch.hpp"
+
+namespace tsdb {
+namespace head {
+
+namespace {
+
+const int GROUP_WIDTH = 8;
+
+const int8_t CTRL_EMPTY = -128; // 0b10000000
+const int8_t CTRL_DELETED = -2; // 0b11111110
+
+const uint64_t LSBS = 0x0101010101010101ULL;
+const uint64_t MSBS = 0x8080808080808080ULL;
+
+inline uint64_t hash_tsid(tagtree::TSID tsid)
+{
+    // TSIDs are usually dense, mix them so that both h1 and h2 are spread.
+    uint64_t h = static_cast<uint64_t>(tsid) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+inline uint64_t h1(uint64_t hash) { return hash >> 7; }
+inline int8_t h2(uint64_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+
+// A group keeps the control byte of slot i in the bits [8i, 8i + 8). The
+// match functions return a mask with the high bit set in every matching byte.
+// match() may report false positives, the caller compares the keys anyway.
+inline uint64_t match(uint64_t group, int8_t h)
+{
+    uint64_t x = group ^ (LSBS * static_cast<uint8_t>(h));
+    return (x - LSBS) & ~x & MSBS;
+}
+
+inline uint64_t match_empty(uint64_t group)
+{
+    return (group & (~group << 6)) & MSBS;
+}
+
+inline int lowest_byte(uint64_t mask) { return __builtin_ctzll(mask) >> 3; }
+
+inline int8_t ctrl_byte(uint64_t group, int i)
+{
+    return static_cast<int8_t>(group >> (8 * i));
+}
+
+inline uint64_t set_ctrl_byte(uint64_t group, int i, int8_t h)
+{
+    return (group & ~(0xffULL << (8 * i))) |
+           (static_cast<uint64_t>(static_cast<uint8_t>(h)) << (8 * i));
+}
+
+} // namespace
+
+SeriesMap::Table::Table(int cap)
+    : cap(cap), ctrl(new std::atomic<uint64_t>[cap / GROUP_WIDTH]),
+      slots(new Slot[cap])
+{
+    for (int i = 0; i < cap / GROUP_WIDTH; ++i)
+        ctrl[i].store(MSBS, std::memory_order_relaxed); // All CTRL_EMPTY.
+}
+
+SeriesMap::Table::~Table()
+{
+    delete[] ctrl;
+    delete[] slots;
+}
+
+SeriesMap::SeriesMap() : table(nullptr), size_(0), growth_left(0) {}
+
+SeriesMap::~SeriesMap() { delete table.load(); }
+
+MemSeries* SeriesMap::get(tagtree::TSID tsid) const
+{
+    Table* t = table.load(std::memory_order_acquire);
+    if (!t) return nullptr;
+    uint64_t hash = hash_tsid(tsid);
+    uint64_t mask = t->cap / GROUP_WIDTH - 1;
+    uint64_t g = h1(hash) & mask;
+    int8_t h = h2(hash);
+    // Triangular probing visits every group as their number is a power of 2.
+    for (uint64_t step = 1;; ++step) {
+        uint64_t group = t->ctrl[g].load(std::memory_order_acquire);
+        for (uint64_t m = match(group, h); m; m &= m - 1) {
+            const Slot& s = t->slots[g * GROUP_WIDTH + lowest_byte(m)];
+            if (s.tsid == tsid) return s.series;
+        }
+        if (match_empty(group)) return nullptr;
+        g = (g + step) & mask;
+    }
+}
+
+std::pair<MemSeries*, bool> SeriesMap::get_or_insert(tagtree::TSID tsid,
+                                                     MemSeries* s)
+{
+    MemSeries* existing = get(tsid);
+    if (existing) return {existing, false};
+
+    Table* t = table.load(std::memory_order_relaxed);
+    if (!t)
+        resize(GROUP_WIDTH);
+    else if (growth_left == 0)
+        // Grow if the table is more than half full with live entries,
+        // otherwise rehash into the same size to drop the tombstones.
+        resize(size_ + 1 > t->cap * 7 / 16 ? t->cap * 2 : t->cap);
+    t = table.load(std::memory_order_relaxed);
+
+    uint64_t hash = hash_tsid(tsid);
+    uint64_t mask = t->cap / GROUP_WIDTH - 1;
+    uint64_t g = h1(hash) & mask;
+    for (uint64_t step = 1;; ++step) {
+        uint64_t group = t->ctrl[g].load(std::memory_order_relaxed);
+        uint64_t m = match_empty(group);
+        if (m) {
+            int i = lowest_byte(m);
+            Slot& slot = t->slots[g * GROUP_WIDTH + i];
+            slot.tsid = tsid;
+            slot.series = s;
+            // Publish the slot.
+            t->ctrl[g].store(set_ctrl_byte(group, i, h2(hash)),
+                             std::memory_order_release);
+            break;
+        }
+        g = (g + step) & mask;
+    }
+    --growth_left;
+    ++size_;
+    return {s, true};
+}
+
+MemSeries* SeriesMap::erase(tagtree::TSID tsid)
+{
+    Table* t = table.load(std::memory_order_relaxed);
+    if (!t) return nullptr;
+    uint64_t hash = hash_tsid(tsid);
+    uint64_t mask = t->cap / GROUP_WIDTH - 1;
+    uint64_t g = h1(hash) & mask;
+    int8_t h = h2(hash);
+    for (uint64_t step = 1;; ++step) {
+        uint64_t group = t->ctrl[g].load(std::memory_order_relaxed);
+        for (uint64_t m = match(group, h); m; m &= m - 1) {
+            int i = lowest_byte(m);
+            if (t->slots[g * GROUP_WIDTH + i].tsid != tsid) continue;
+            // The slot keeps its content for concurrent readers, it still
+            // counts against growth_left until the next rehash.
+            t->ctrl[g].store(set_ctrl_byte(group, i, CTRL_DELETED),
+                             std::memory_order_release);
+            --size_;
+            return t->slots[g * GROUP_WIDTH + i].series;
+        }
+        if (match_empty(group)) return nullptr;
+        g = (g + step) & mask;
+    }
+}
+
+int SeriesMap::capacity() const
+{
+    Table* t = table.load(std::memory_order_relaxed);
+    return t ? t->cap : 0;
+}
+
+MemSeries* SeriesMap::at(int i) const
+{
+    Table* t = table.load(std::memory_order_relaxed);
+    uint64_t group =
+        t->ctrl[i / GROUP_WIDTH].load(std::memory_order_relaxed);
+    if (ctrl_byte(group, i % GROUP_WIDTH) < 0) return nullptr;
+    return t->slots[i].series;
+}
+
+void SeriesMap::resize(int new_cap)
+{
+    Table* old = table.load(std::memory_order_relaxed);
+    Table* t = new Table(new_cap);
+    uint64_t mask = new_cap / GROUP_WIDTH - 1;
+    for (int i = 0; old && i < old->cap; ++i) {
+        uint64_t old_group =
+            old->ctrl[i / GROUP_WIDTH].load(std::memory_order_relaxed);
+        if (ctrl_byte(old_group, i % GROUP_WIDTH) < 0) continue;
+        uint64_t hash = hash_tsid(old->slots[i].tsid);
+        uint64_t g = h1(hash) & mask;
+        for (uint64_t step = 1;; ++step) {
+            uint64_t group = t->ctrl[g].load(std::memory_order_relaxed);
+            uint64_t m = match_empty(group);
+            if (m) {
+                int j = lowest_byte(m);
+                t->slots[g * GROUP_WIDTH + j] = old->slots[i];
+                t->ctrl[g].store(set_ctrl_byte(group, j, h2(hash)),
+                                 std::memory_order_relaxed);
+                break;
+            }
+            g = (g + step) & mask;
+        }
+    }
+    growth_left = new_cap - new_cap / 8 - size_;
+
+    table.store(t, std::memory_order_release);
+    if (old) base::EpochManager::instance().retire([old]() { delete old; });
+}
+
+size_t SeriesMap::bytes() const
+{
+    Table* t = table.load(std::memory_order_relaxed);
+    if (!t) return 0;
+    return t->cap * sizeof(Slot) + t->cap;
+}
+
+} // namespace head
+} // namespace tsdb
@@ -0,0 +1,78 @@
+#ifndef SERIESMAP_H
+#define SERIESMAP_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+#include "tagtree/tsid.h"
+
+namespace tsdb {
+namespace head {
+
+class MemSeries;
+
+// SeriesMap is a flat open addressing table from TSID to MemSeries modelled
+// after SwissTable. Every slot has a control byte which is either CTRL_EMPTY,
+// CTRL_DELETED or the low 7 bits of the hash. Lookups match a group of 8
+// control bytes at once and only touch the slots whose byte matches. The TSID
+// is kept inline next to the series pointer, so a hit costs a single slot
+// access.
+//
+// The map does not own the series, references are handled by the caller.
+// It is not thread-safe.
+class SeriesMap {
+public:
+    struct Slot {
+        tagtree::TSID tsid;
+        MemSeries* series;
+    };
+
+    SeriesMap();
+    ~SeriesMap();
+
+    SeriesMap(const SeriesMap&) = delete;
+    SeriesMap& operator=(const SeriesMap&) = delete;
+
+    MemSeries* get(tagtree::TSID tsid) const;
+
+    // Return <the series stored under tsid, if s being inserted>.
+    std::pair<MemSeries*, bool> get_or_insert(tagtree::TSID tsid,
+                                              MemSeries* s);
+
+    // Return the removed series or nullptr.
+    MemSeries* erase(tagtree::TSID tsid);
+
+    // Slots can be walked from 0 to capacity(), at() returns nullptr for
+    // unused slots. erase() never moves other entries, so it is safe to erase
+    // while walking.
+    int capacity() const;
+    MemSeries* at(int i) const;
+
+    int size() const { return size_; }
+
+    // Bytes allocated for control bytes and slots.
+    size_t bytes() const;
+
+private:
+    struct Table {
+        int cap; // A power of 2 no less than the group width.
+        std::atomic<uint64_t>* ctrl; // One word per group of control bytes.
+        Slot* slots;
+
+        explicit Table(int cap);
+        ~Table();
+    };
+
+    std::atomic<Table*> table; // nullptr until the first insert.
+    int size_;
+    int growth_left;
+
+    void resize(int new_cap);
+};
+
+} // namespace head
+} // namespace tsdb
+
+#endif
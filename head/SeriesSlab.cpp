@@ -0,0 +1,103 @@
+#include "head/SeriesSlab.hpp"
+#include "base/Logging.hpp"
+
+namespace tsdb {
+namespace head {
+
+SeriesSlab::SeriesSlab(size_t object_size, int slots_per_block)
+    : mutex_(), slots_per_block(slots_per_block),
+      blocks(new std::atomic<uint8_t*>[MAX_BLOCKS]), num_blocks(0),
+      free_list(nullptr), next_slot(slots_per_block), live(0)
+{
+    // The free list link lives in the object part of a freed slot.
+    if (object_size < sizeof(void*)) object_size = sizeof(void*);
+    slot_size =
+        sizeof(Header) + ((object_size + 15) & ~static_cast<size_t>(15));
+    for (int i = 0; i < MAX_BLOCKS; ++i)
+        blocks[i].store(nullptr, std::memory_order_relaxed);
+}
+
+SeriesSlab::~SeriesSlab()
+{
+    for (int i = 0; i < num_blocks.load(); ++i)
+        delete[] blocks[i].load();
+}
+
+void* SeriesSlab::alloc()
+{
+    base::MutexLockGuard lock(mutex_);
+    ++live;
+    if (free_list) {
+        void* p = free_list;
+        free_list = *reinterpret_cast<void**>(p);
+        return p;
+    }
+    if (next_slot == slots_per_block) {
+        int n = num_blocks.load(std::memory_order_relaxed);
+        if (n == MAX_BLOCKS) {
+            LOG_FATAL << "msg=\"series slab exhausted\" blocks=" << n;
+        }
+        // Zeroed, so that resolving a forged reference to a never used slot
+        // finds an object without references.
+        uint8_t* block = new uint8_t[slot_size * slots_per_block]();
+        for (int i = 0; i < slots_per_block; ++i) {
+            Header* h = reinterpret_cast<Header*>(block + slot_size * i);
+            h->generation.store(0, std::memory_order_relaxed);
+            h->index = n * slots_per_block + i;
+        }
+        blocks[n].store(block, std::memory_order_release);
+        num_blocks.store(n + 1, std::memory_order_release);
+        next_slot = 0;
+    }
+    uint8_t* block =
+        blocks[num_blocks.load(std::memory_order_relaxed) - 1].load(
+            std::memory_order_relaxed);
+    return block + slot_size * next_slot++ + sizeof(Header);
+}
+
+void SeriesSlab::free(void* p)
+{
+    invalidate(p);
+    base::MutexLockGuard lock(mutex_);
+    --live;
+    *reinterpret_cast<void**>(p) = free_list;
+    free_list = p;
+}
+
+uint64_t SeriesSlab::ref(void* p)
+{
+    Header* h = header(p);
+    return (static_cast<uint64_t>(h->generation.load()) << 32) |
+           (static_cast<uint64_t>(h->index) + 1);
+}
+
+void SeriesSlab::invalidate(void* p) { header(p)->generation.fetch_add(1); }
+
+void* SeriesSlab::resolve(uint64_t ref)
+{
+    uint64_t index = (ref & 0xffffffffULL);
+    if (index == 0) return nullptr;
+    --index;
+    uint64_t block = index / slots_per_block;
+    if (block >= num_blocks.load(std::memory_order_acquire)) return nullptr;
+    uint8_t* slot = blocks[block].load(std::memory_order_acquire) +
+                    slot_size * (index % slots_per_block);
+    Header* h = reinterpret_cast<Header*>(slot);
+    if (h->generation.load() != static_cast<uint32_t>(ref >> 32))
+        return nullptr;
+    return slot + sizeof(Header);
+}
+
+size_t SeriesSlab::bytes()
+{
+    return num_blocks.load() * slot_size * slots_per_block;
+}
+
+size_t SeriesSlab::size()
+{
+    base::MutexLockGuard lock(mutex_);
+    return live;
+}
+
+} // namespace head
+} // namespace tsdb
@@ -0,0 +1,73 @@
+#ifndef SERIESSLAB_H
+#define SERIESSLAB_H
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/Mutex.hpp"
+
+namespace tsdb {
+namespace head {
+
+// SeriesSlab hands out fixed size slots for MemSeries. Slots are carved out of
+// large blocks, so a series pays no per-allocation malloc overhead and series
+// created together share pages. Freed slots go to a free list and are reused,
+// blocks are never given back while the slab lives.
+//
+// Every slot starts with a small header holding its index and a generation
+// which is bumped whenever the object in the slot is invalidated or freed.
+// ref() packs both into an opaque reference, resolve() maps it back to the
+// slot as long as the generation still matches. Since slot memory stays
+// mapped, resolve() is safe against concurrent frees, callers only have to
+// re-check the generation once they hold the object.
+class SeriesSlab {
+private:
+    struct Header {
+        std::atomic<uint32_t> generation;
+        uint32_t index;
+        uint64_t padding_; // Keeps the object 16-byte aligned.
+    };
+
+    static const int MAX_BLOCKS = 1 << 16;
+
+    base::MutexLock mutex_;
+    size_t slot_size; // Including the header.
+    int slots_per_block;
+    std::unique_ptr<std::atomic<uint8_t*>[]> blocks;
+    std::atomic<int> num_blocks;
+    void* free_list;
+    int next_slot; // Next never used slot in the last block.
+    size_t live;
+
+    static Header* header(void* p)
+    {
+        return reinterpret_cast<Header*>(p) - 1;
+    }
+
+public:
+    SeriesSlab(size_t object_size, int slots_per_block = 4096);
+    ~SeriesSlab();
+
+    void* alloc();
+    void free(void* p);
+
+    // Reference of the object at p, never 0.
+    uint64_t ref(void* p);
+
+    // Make all references handed out for the object at p stale.
+    void invalidate(void* p);
+
+    // Return the object ref was taken from, or nullptr if it is stale.
+    void* resolve(uint64_t ref);
+
+    // Bytes reserved by the slab and number of slots in use.
+    size_t bytes();
+    size_t size();
+};
+
+} // namespace head
+} // namespace tsdb
+
+#endif
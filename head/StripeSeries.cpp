@@ -1,92 +1,206 @@
 #include "head/StripeSeries.hpp"
+#include "base/Epoch.hpp"
 #include "base/Logging.hpp"
 #include "head/HeadUtils.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <limits>
 
 namespace tsdb {
 namespace head {
 
 StripeSeries::StripeSeries() : series(STRIPE_SIZE), locks(STRIPE_SIZE) {}
 
+StripeSeries::~StripeSeries()
+{
+    // Drop the references held by the maps.
+    for (int i = 0; i < STRIPE_SIZE; ++i) {
+        for (int slot = 0; slot < series[i].capacity(); ++slot) {
+            MemSeries* s = series[i].at(slot);
+            if (s) intrusive_ptr_release(s);
+        }
+    }
+}
+
 // gc garbage collects old chunks that are strictly before mint and removes
 // series entirely that have no chunks left. return <set of removed series,
 // number of removed chunks>
 std::pair<std::unordered_set<tagtree::TSID>, int>
 StripeSeries::gc(int64_t min_time)
 {
-    // Run through all series and truncate old chunks. Mark those with no
-    // chunks left as deleted and store their ID.
     std::unordered_set<tagtree::TSID> rm_series;
     int rm_chunks = 0;
-    for (int i = 0; i < STRIPE_SIZE; ++i) {
-        base::PadRWLockGuard lock_i(locks[i], 1);
-
-        // Iterate over all series sharing the same hash mod.
-        std::shared_ptr<MemSeries> temp;
-        std::unordered_map<tagtree::TSID, std::shared_ptr<MemSeries>>::iterator
-            series_it = series[i].begin();
-        while (series_it != series[i].end()) {
-            auto sp = series_it->second;
-            base::MutexLockGuard series_lock(sp->mutex_);
-            rm_chunks += sp->truncate_chunk_before(min_time);
-
-            if (!sp->chunks.empty() || sp->pending_commit) {
-                ++series_it;
-                continue;
-            }
-            // Since serieslist_it will be removed, we increment it here.
-            auto temp_series = series_it;
-            ++series_it;
-
-            // This makes sure the series_ will not be deconstructed when
-            // its lock being held. And provide ref for deleting series.
-            temp = temp_series->second;
-
-            // The series is gone entirely. We need to keep the series lock
-            // and make sure we have acquired the stripe locks for hash and
-            // ID of the series alike. If we don't hold them all, there's a
-            // very small chance that a series receives samples again while
-            // we are half-way into deleting it.
-            int j = static_cast<int>(
-                std::hash<tagtree::TSID>()(temp_series->second->tsid) &
-                STRIPE_MASK);
-            if (i != j) {
-                base::PadRWLockGuard lock_j(locks[j], 1);
-                rm_series.insert(temp_series->second->tsid);
-                series[j].erase(series[j].find(temp->tsid));
-            } else {
-                rm_series.insert(temp_series->second->tsid);
-                series[j].erase(series[j].find(temp->tsid));
-            }
-        }
+    int stripe = 0;
+    int64_t max_pause = 0;
+    while (stripe < STRIPE_SIZE) {
+        std::pair<std::unordered_set<tagtree::TSID>, int> rm =
+            gc_step(min_time, &stripe, std::numeric_limits<int>::max(),
+                    &max_pause);
+        rm_series.insert(rm.first.begin(), rm.first.end());
+        rm_chunks += rm.second;
+    }
+    return {rm_series, rm_chunks};
+}
+
+std::pair<std::unordered_set<tagtree::TSID>, int>
+StripeSeries::gc_step(int64_t min_time, int* stripe, int max_series,
+                      int64_t* max_pause)
+{
+    std::unordered_set<tagtree::TSID> rm_series;
+    int rm_chunks = 0;
+    // References held by the maps for the removed series. They are dropped
+    // once no lock-free reader can still see the series.
+    std::shared_ptr<std::vector<MemSeries*>> removed(
+        new std::vector<MemSeries*>());
+    int visited = 0;
+    while (*stripe < STRIPE_SIZE && visited < max_series) {
+        auto t0 = std::chrono::steady_clock::now();
+        visited +=
+            gc_stripe(*stripe, min_time, &rm_series, &rm_chunks, removed.get());
+        int64_t pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - t0)
+                            .count();
+        if (pause > *max_pause) *max_pause = pause;
+        ++*stripe;
     }
 
+    if (!removed->empty()) {
+        base::EpochManager::instance().retire([removed]() {
+            for (MemSeries* s : *removed)
+                intrusive_ptr_release(s);
+        });
+    }
+    base::EpochManager::instance().reclaim();
+
     return {rm_series, rm_chunks};
 }
 
-std::shared_ptr<MemSeries> StripeSeries::get_by_id(tagtree::TSID tsid)
+int StripeSeries::gc_stripe(int i, int64_t min_time,
+                            std::unordered_set<tagtree::TSID>* rm_series,
+                            int* rm_chunks, std::vector<MemSeries*>* removed)
+{
+    // Run through the series of the stripe and truncate old chunks. Mark
+    // those with no chunks left as deleted and store their ID.
+    base::PadRWLockGuard lock_i(locks[i], 1);
+    int visited = 0;
+
+    // Iterate over all series sharing the same hash mod. Erasing from the
+    // SeriesMap leaves the other slots in place.
+    for (int slot = 0; slot < series[i].capacity(); ++slot) {
+        MemSeries* sp = series[i].at(slot);
+        if (!sp) continue;
+        ++visited;
+
+        // This makes sure the series will not be deconstructed when its lock
+        // being held.
+        MemSeriesPtr temp(sp);
+        base::MutexLockGuard series_lock(sp->mutex_);
+        *rm_chunks += sp->truncate_chunk_before(min_time);
+
+        if (!sp->chunks.empty() || sp->pending_samples > 0) continue;
+
+        // The series is gone entirely. Series are only indexed by the hash of
+        // their TSID, so the stripe lock we hold is the only one needed to
+        // keep it from receiving samples while being deleted.
+        rm_series->insert(sp->tsid);
+        series[i].erase(sp->tsid);
+        // References cached by appenders are stale from now on.
+        sp->invalidate_ref();
+        removed->push_back(sp);
+    }
+    return visited;
+}
+
+MemSeriesPtr StripeSeries::get_by_id(tagtree::TSID tsid)
 {
     uint64_t i = std::hash<tagtree::TSID>()(tsid) & STRIPE_MASK;
-    std::unordered_map<tagtree::TSID, std::shared_ptr<MemSeries>>::iterator r;
-    base::PadRWLockGuard lock_i(locks[i], 0);
-    if ((r = series[i].find(tsid)) == series[i].end()) {
-        return nullptr;
+    // Readers do not take the stripe lock. The epoch guard keeps the table
+    // and the series alive until the reference has been taken.
+    base::EpochGuard guard;
+    return MemSeriesPtr(series[i].get(tsid));
+}
+
+void StripeSeries::get_batch(const tagtree::TSID* tsids, int n,
+                             MemSeries** out)
+{
+    // Positions in tsids ordered by stripe, counting sorted. Kept per thread
+    // so that batches do not allocate them again.
+    static thread_local std::vector<int> starts;
+    static thread_local std::vector<int> order;
+    starts.assign(STRIPE_SIZE + 1, 0);
+    order.resize(n);
+    for (int i = 0; i < n; ++i)
+        ++starts[(std::hash<tagtree::TSID>()(tsids[i]) & STRIPE_MASK) + 1];
+    for (int i = 0; i < STRIPE_SIZE; ++i)
+        starts[i + 1] += starts[i];
+    for (int i = 0; i < n; ++i)
+        order[starts[std::hash<tagtree::TSID>()(tsids[i]) & STRIPE_MASK]++] =
+            i;
+
+    // starts[i] is now the end of stripe i.
+    int i = 0;
+    for (int stripe = 0; stripe < STRIPE_SIZE && i < n; ++stripe) {
+        if (i == starts[stripe]) continue;
+        base::PadRWLockGuard lock_i(locks[stripe], 0);
+        for (; i < starts[stripe]; ++i) {
+            MemSeries* s = series[stripe].get(tsids[order[i]]);
+            if (s) s->pending_samples.fetch_add(1);
+            out[order[i]] = s;
+        }
     }
-    return r->second;
+}
+
+MemSeriesPtr StripeSeries::get_pinned(tagtree::TSID tsid)
+{
+    uint64_t i = std::hash<tagtree::TSID>()(tsid) & STRIPE_MASK;
+    base::PadRWLockGuard lock_i(locks[i], 0);
+    MemSeries* s = series[i].get(tsid);
+    if (s) s->pending_samples.fetch_add(1);
+    return MemSeriesPtr(s);
 }
 
 // Return <MemSeries, if the series being set>.
-std::pair<std::shared_ptr<MemSeries>, bool>
-StripeSeries::get_or_set(tagtree::TSID tsid,
-                         const std::shared_ptr<MemSeries>& s)
+std::pair<MemSeriesPtr, bool>
+StripeSeries::get_or_set(tagtree::TSID tsid, const MemSeriesPtr& s, bool pin)
 {
     uint64_t i = std::hash<tagtree::TSID>()(tsid) & STRIPE_MASK;
-    {
-        base::PadRWLockGuard lock_i(locks[i], 1);
-        series[i][tsid] = s;
+    base::PadRWLockGuard lock_i(locks[i], 1);
+    std::pair<MemSeries*, bool> r = series[i].get_or_insert(tsid, s.get());
+    if (r.second) intrusive_ptr_add_ref(r.first);
+    if (pin) r.first->pending_samples.fetch_add(1);
+    return {MemSeriesPtr(r.first), r.second};
+}
+
+void StripeSeries::for_each(int i, const std::function<void(MemSeries*)>& f)
+{
+    base::PadRWLockGuard lock_i(locks[i], 0);
+    for (int slot = 0; slot < series[i].capacity(); ++slot) {
+        MemSeries* s = series[i].at(slot);
+        if (s) f(s);
+    }
+}
+
+int StripeSeries::size()
+{
+    int n = 0;
+    for (int i = 0; i < STRIPE_SIZE; ++i) {
+        base::PadRWLockGuard lock_i(locks[i], 0);
+        n += series[i].size();
+    }
+    return n;
+}
+
+size_t StripeSeries::bytes()
+{
+    size_t b = series.capacity() * sizeof(SeriesMap) +
+               locks.capacity() * sizeof(base::PadRWMutexLock);
+    for (int i = 0; i < STRIPE_SIZE; ++i) {
+        base::PadRWLockGuard lock_i(locks[i], 0);
+        b += series[i].bytes();
     }
-    return {s, true};
+    return b + MemSeries::slab_bytes();
 }
 
 } // namespace head
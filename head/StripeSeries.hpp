@@ -1,11 +1,14 @@
 #ifndef STRIPESERIES_H
 #define STRIPESERIES_H
 
+#include <functional>
+#include <memory>
 #include <unordered_set>
 #include <vector>
 
 #include "base/Mutex.hpp"
 #include "head/MemSeries.hpp"
+#include "head/SeriesMap.hpp"
 
 namespace tsdb {
 namespace head {
@@ -14,25 +17,66 @@ namespace head {
 // The locks are padded to not be on the same cache line. Filling the padded
 // space with the maps was profiled to be slower – likely due to the additional
 // pointer dereferences.
+//
+// Only writers (get_or_set, get_batch and gc) take the stripe locks, get_by_id
+// is lock-free and relies on epoch based reclamation, see SeriesMap.
 class StripeSeries {
 public:
-    std::vector<std::unordered_map<tagtree::TSID, std::shared_ptr<MemSeries>>>
-        series; // Index by TSID.
+    // Index by TSID. Every stored series holds one reference.
+    std::vector<SeriesMap> series;
     std::vector<base::PadRWMutexLock>
         locks; // To align cache line (multiples of 64 bytes)
 
     StripeSeries();
+    ~StripeSeries();
 
     // gc garbage collects old chunks that are strictly before mint and removes
     // series entirely that have no chunks left. return <set of removed series,
     // number of removed chunks>
     std::pair<std::unordered_set<tagtree::TSID>, int> gc(int64_t min_time);
 
-    std::shared_ptr<MemSeries> get_by_id(tagtree::TSID tsid);
+    // gc_step is one increment of gc(). It collects the stripes from *stripe
+    // on and stops after the stripe at which max_series series have been
+    // visited, so that appends and lookups are only held up by one stripe at
+    // a time. *stripe is advanced past the collected stripes, the pass is
+    // complete once it reaches STRIPE_SIZE. max_pause is raised to the
+    // longest time in nanoseconds a stripe lock was held.
+    std::pair<std::unordered_set<tagtree::TSID>, int>
+    gc_step(int64_t min_time, int* stripe, int max_series, int64_t* max_pause);
 
-    // Return <MemSeries, if the series being set>.
-    std::pair<std::shared_ptr<MemSeries>, bool>
-    get_or_set(tagtree::TSID tsid, const std::shared_ptr<MemSeries>& s);
+    // get_by_id never blocks behind get_or_set() or gc().
+    MemSeriesPtr get_by_id(tagtree::TSID tsid);
+
+    // get_batch looks up n series at once. The ids are grouped by stripe so
+    // that every stripe is visited once under a single read lock. Each found
+    // series gets one pending sample counted while the stripe lock is still
+    // held, which keeps gc() from dropping it and makes the raw pointers in
+    // out safe to use until the caller gives the pending samples back.
+    // Missing series are set to nullptr.
+    void get_batch(const tagtree::TSID* tsids, int n, MemSeries** out);
+
+    // get_pinned is get_batch() for a single series.
+    MemSeriesPtr get_pinned(tagtree::TSID tsid);
+
+    // Return <MemSeries, if the series being set>. If pin is set, the series
+    // returned gets one pending sample under the stripe lock.
+    std::pair<MemSeriesPtr, bool> get_or_set(tagtree::TSID tsid,
+                                             const MemSeriesPtr& s,
+                                             bool pin = false);
+
+    // for_each calls f with every series of stripe i while holding the
+    // stripe's read lock.
+    void for_each(int i, const std::function<void(MemSeries*)>& f);
+
+    // Number of series and bytes used by the stripes and the series slab.
+    int size();
+    size_t bytes();
+
+private:
+    // Return the number of visited series.
+    int gc_stripe(int i, int64_t min_time,
+                  std::unordered_set<tagtree::TSID>* rm_series, int* rm_chunks,
+                  std::vector<MemSeries*>* removed);
 };
 
 } // namespace head
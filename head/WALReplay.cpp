@@ -0,0 +1,272 @@
+#include "head/WALReplay.hpp"
+
+#include <boost/bind.hpp>
+#include <chrono>
+#include <limits>
+
+#include "base/Logging.hpp"
+#include "head/Head.hpp"
+#include "tsdbutil/RecordDecoder.hpp"
+
+namespace tsdb {
+namespace head {
+
+namespace {
+
+// The WAL shard of a series is picked by its hash modulo the number of shards
+// as well, mix the hash so that all partitions get series of the shard.
+int partition_of(tagtree::TSID tsid, int n)
+{
+    uint64_t h = std::hash<tagtree::TSID>()(tsid) * 0x9E3779B97F4A7C15ULL;
+    return (h >> 32) % n;
+}
+
+} // namespace
+
+WALReplay::Partition::Partition()
+    : not_empty(mutex_), not_full(mutex_), closed(false),
+      mint(std::numeric_limits<int64_t>::max()),
+      maxt(std::numeric_limits<int64_t>::min()), samples(0), unknown_refs(0)
+{}
+
+WALReplay::WALReplay(Head* head, int num_partitions) : head(head)
+{
+    if (num_partitions < 1) num_partitions = 1;
+    for (int i = 0; i < num_partitions; ++i)
+        partitions.emplace_back(new Partition());
+    for (std::unique_ptr<Partition>& p : partitions)
+        p->thread = std::thread(&WALReplay::apply, this, p.get());
+}
+
+WALReplay::~WALReplay() { close(); }
+
+wal::CorruptionError WALReplay::run(wal::SegmentReader* reader)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t num_records = 0;
+    uint64_t num_bytes = 0;
+
+    // Records being decoded, in WAL order.
+    std::deque<std::shared_ptr<Record>> inflight;
+    wal::CorruptionError cerr;
+    while (!cerr && reader->next()) {
+        std::pair<uint8_t*, int> r = reader->record();
+        std::shared_ptr<Record> rec(new Record());
+        // Full records are decoded from the mapping, which the reader keeps
+        // until they are decoded. Others are copied before the next read.
+        rec->pin = reader->pin();
+        if (!rec->pin) {
+            rec->data.assign(r.first, r.first + r.second);
+            r.first = rec->data.data();
+        }
+        rec->ptr = r.first;
+        rec->len = r.second;
+        rec->segment = reader->segment();
+        rec->offset = reader->offset();
+        ++num_records;
+        num_bytes += r.second;
+
+        if (head->pool_->numThreads() > 0)
+            head->pool_->run(boost::bind(&WALReplay::decode, rec));
+        else
+            decode(rec);
+        inflight.push_back(rec);
+        if (inflight.size() >= MAX_INFLIGHT_RECORDS) {
+            cerr = dispatch(inflight.front().get());
+            inflight.pop_front();
+        }
+    }
+    // Records behind a corrupted one are still waited for, their decoding
+    // may not outlive the replay.
+    for (std::shared_ptr<Record>& rec : inflight) {
+        if (!cerr)
+            cerr = dispatch(rec.get());
+        else {
+            base::MutexLockGuard lock(rec->mutex_);
+            while (!rec->decoded)
+                rec->cond.wait();
+        }
+    }
+    if (!cerr && reader->error()) cerr = reader->cerror();
+
+    // Samples before a corruption are kept, the WAL is repaired after them.
+    close();
+    if (cerr) return cerr;
+
+    error::Error err = all_stones.iter(
+        static_cast<std::function<error::Error(tagtree::TSID,
+                                               const tombstone::Intervals&)>>(
+            [this](tagtree::TSID tsid, const tombstone::Intervals& itv) {
+                return head->chunk_rewrite(tsid, itv);
+            }));
+    if (err)
+        return wal::CorruptionError(
+            -1, 0, error::Error("deleting samples from tombstones"));
+
+    uint64_t num_samples = 0;
+    uint64_t unknown_refs = 0;
+    for (std::unique_ptr<Partition>& p : partitions) {
+        num_samples += p->samples;
+        unknown_refs += p->unknown_refs;
+    }
+    if (unknown_refs > 0)
+        LOG_WARN << "msg=\"unknown series references count=" << unknown_refs;
+
+    double secs = std::chrono::duration_cast<std::chrono::duration<double>>(
+                      std::chrono::steady_clock::now() - t0)
+                      .count();
+    if (secs <= 0) secs = 1e-9;
+    LOG_INFO << "msg=\"WAL replay complete\" records=" << num_records
+             << " bytes=" << num_bytes << " samples=" << num_samples
+             << " partitions=" << static_cast<int>(partitions.size())
+             << " duration=" << static_cast<int64_t>(secs * 1000)
+             << "ms MB/s=" << num_bytes / secs / (1024 * 1024)
+             << " samples/s=" << num_samples / secs;
+    return wal::CorruptionError();
+}
+
+void WALReplay::decode(const std::shared_ptr<Record>& rec)
+{
+    error::Error err;
+    if (rec->len < 1)
+        err = error::Error("record length < 1");
+    else {
+        rec->type = rec->ptr[0];
+        if (rec->type == tsdbutil::RECORD_SERIES) {
+            if (tsdbutil::RecordDecoder::series(rec->ptr, rec->len,
+                                                rec->series))
+                err = error::Error("decode series");
+        } else if (rec->type == tsdbutil::RECORD_SAMPLES ||
+                   rec->type == tsdbutil::RECORD_COMPACT_SAMPLES) {
+            if (tsdbutil::RecordDecoder::samples(rec->ptr, rec->len,
+                                                 rec->samples))
+                err = error::Error("decode samples");
+        } else if (rec->type == tsdbutil::RECORD_TOMBSTONES) {
+            if (tsdbutil::RecordDecoder::tombstones(rec->ptr, rec->len,
+                                                    rec->stones))
+                err = error::Error("decode tombstones");
+        } else
+            err = error::Error("invalid record type " +
+                               std::to_string(rec->type));
+    }
+    rec->ptr = nullptr;
+    rec->pin.reset();
+    std::vector<uint8_t>().swap(rec->data);
+
+    base::MutexLockGuard lock(rec->mutex_);
+    rec->err = err;
+    rec->decoded = true;
+    rec->cond.notify();
+}
+
+wal::CorruptionError WALReplay::dispatch(Record* rec)
+{
+    {
+        base::MutexLockGuard lock(rec->mutex_);
+        while (!rec->decoded)
+            rec->cond.wait();
+    }
+    if (rec->err)
+        return wal::CorruptionError(rec->segment, rec->offset, rec->err);
+
+    int n = partitions.size();
+    if (rec->type == tsdbutil::RECORD_SERIES) {
+        for (tsdbutil::RefSeries& s : rec->series) {
+            Partition* p = partitions[partition_of(s.tsid, n)].get();
+            p->pending.series.push_back(s.tsid);
+            if (p->pending.series.size() >= BATCH_SAMPLES) flush(p);
+        }
+    } else if (rec->type == tsdbutil::RECORD_SAMPLES ||
+               rec->type == tsdbutil::RECORD_COMPACT_SAMPLES) {
+        int64_t min_valid_time = head->valid_time.get();
+        for (tsdbutil::RefSample& s : rec->samples) {
+            if (s.t < min_valid_time) continue;
+            Partition* p = partitions[partition_of(s.tsid, n)].get();
+            p->pending.samples.push_back(s);
+            if (p->pending.samples.size() >= BATCH_SAMPLES) flush(p);
+        }
+    } else {
+        for (tsdbutil::Stone& s : rec->stones) {
+            for (tombstone::Interval& itvl : s.itvls) {
+                if (itvl.max_time < head->valid_time.get()) continue;
+                all_stones.add_interval(s.tsid, itvl);
+            }
+        }
+    }
+    return wal::CorruptionError();
+}
+
+void WALReplay::flush(Partition* p)
+{
+    if (p->pending.series.empty() && p->pending.samples.empty()) return;
+    base::MutexLockGuard lock(p->mutex_);
+    while (p->queue.size() >= MAX_QUEUED_BATCHES)
+        p->not_full.wait();
+    p->queue.push_back(std::move(p->pending));
+    p->pending = Batch();
+    p->not_empty.notify();
+}
+
+void WALReplay::apply(Partition* p)
+{
+    while (true) {
+        Batch batch;
+        {
+            base::MutexLockGuard lock(p->mutex_);
+            while (p->queue.empty() && !p->closed)
+                p->not_empty.wait();
+            if (p->queue.empty()) break;
+            batch = std::move(p->queue.front());
+            p->queue.pop_front();
+            p->not_full.notify();
+        }
+        apply_batch(p, batch);
+    }
+    if (p->samples > 0) head->update_min_max_time(p->mint, p->maxt);
+    // Drop the references before the head goes on with gc().
+    p->series_map.clear();
+}
+
+void WALReplay::apply_batch(Partition* p, Batch& batch)
+{
+    for (tagtree::TSID tsid : batch.series) {
+        std::pair<MemSeriesPtr, bool> s = head->get_or_create(tsid);
+        if (s.second) head->attach_mapped_chunks(s.first);
+    }
+
+    for (const tsdbutil::RefSample& s : batch.samples) {
+        MemSeriesPtr ms;
+        auto it = p->series_map.find(s.tsid);
+        if (it == p->series_map.end()) {
+            ms = head->series->get_by_id(s.tsid);
+            if (!ms) {
+                ++p->unknown_refs;
+                continue;
+            }
+            p->series_map[s.tsid] = ms;
+        } else
+            ms = it->second;
+        ms->append(s.t, s.v, head->ooo_window, head->chunk_mapper.get());
+        if (s.t > p->maxt) p->maxt = s.t;
+        if (s.t < p->mint) p->mint = s.t;
+        ++p->samples;
+    }
+}
+
+void WALReplay::close()
+{
+    for (std::unique_ptr<Partition>& p : partitions) {
+        if (p->thread.joinable()) {
+            flush(p.get());
+            base::MutexLockGuard lock(p->mutex_);
+            p->closed = true;
+            p->not_empty.notify();
+        }
+    }
+    for (std::unique_ptr<Partition>& p : partitions) {
+        if (p->thread.joinable()) p->thread.join();
+    }
+}
+
+} // namespace head
+} // namespace tsdb
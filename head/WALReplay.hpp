@@ -0,0 +1,119 @@
+#ifndef WALREPLAY_H
+#define WALREPLAY_H
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "base/Condition.hpp"
+#include "base/Mutex.hpp"
+#include "tombstone/MemTombstones.hpp"
+#include "tsdbutil/tsdbutils.hpp"
+#include "wal/WAL.hpp"
+
+namespace tsdb {
+namespace head {
+
+class Head;
+
+// WALReplay loads a WAL into the head as a pipeline of three stages:
+//
+//  1. The caller reads the records one after another.
+//  2. The records are decoded in parallel on the head pool, at most
+//     MAX_INFLIGHT_RECORDS ahead of the oldest record not yet dispatched.
+//  3. Decoded records are dispatched in WAL order to the partitions. Every
+//     partition owns the series whose TSID hashes to it and applies their
+//     series and samples on its own thread, so no two partitions touch the
+//     same series.
+//
+// A partition receives the records of its series in WAL order and creates
+// the series of a batch before appending its samples, so series records are
+// always applied before the samples depending on them. The partition queues
+// are bounded, reading and decoding are held back while the partitions
+// catch up.
+class WALReplay {
+public:
+    static const int MAX_INFLIGHT_RECORDS = 64;
+    static const int MAX_QUEUED_BATCHES = 16;
+    static const int BATCH_SAMPLES = 8192;
+
+    WALReplay(Head* head, int num_partitions);
+    ~WALReplay();
+
+    wal::CorruptionError run(wal::SegmentReader* reader);
+
+private:
+    struct Record {
+        // The record in the reader's mapping, held by pin, or in data.
+        const uint8_t* ptr;
+        int len;
+        std::shared_ptr<const void> pin;
+        std::vector<uint8_t> data;
+        int segment;
+        int offset;
+
+        base::MutexLock mutex_;
+        base::Condition cond;
+        bool decoded;
+
+        tsdbutil::RECORD_ENTRY_TYPE type;
+        std::vector<tsdbutil::RefSeries> series;
+        std::vector<tsdbutil::RefSample> samples;
+        std::vector<tsdbutil::Stone> stones;
+        error::Error err;
+
+        Record() : ptr(nullptr), len(0), cond(mutex_), decoded(false) {}
+    };
+
+    // The series of a batch are created before its samples are appended.
+    struct Batch {
+        std::vector<tagtree::TSID> series;
+        std::vector<tsdbutil::RefSample> samples;
+    };
+
+    struct Partition {
+        base::MutexLock mutex_;
+        base::Condition not_empty;
+        base::Condition not_full;
+        std::deque<Batch> queue;
+        bool closed;
+        std::thread thread;
+
+        Batch pending; // Filled by the dispatcher, not yet queued.
+
+        // Owned by the partition thread.
+        std::unordered_map<tagtree::TSID, MemSeriesPtr> series_map;
+        int64_t mint;
+        int64_t maxt;
+        uint64_t samples;
+        uint64_t unknown_refs;
+
+        Partition();
+    };
+
+    Head* head;
+    std::vector<std::unique_ptr<Partition>> partitions;
+
+    // Stones are only applied once all the samples are in.
+    tombstone::MemTombstones all_stones;
+
+    static void decode(const std::shared_ptr<Record>& rec);
+
+    wal::CorruptionError dispatch(Record* rec);
+
+    void flush(Partition* p);
+
+    void apply(Partition* p);
+
+    void apply_batch(Partition* p, Batch& batch);
+
+    void close();
+};
+
+} // namespace head
+} // namespace tsdb
+
+#endif
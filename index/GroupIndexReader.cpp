@@ -0,0 +1,111 @@
+#include "index/GroupIndexReader.hpp"
+#include "base/Endian.hpp"
+#include "base/Logging.hpp"
+#include "index/PostingSet.hpp"
+#include "tsdbutil/DecBuf.hpp"
+
+namespace tsdb {
+namespace index {
+
+GroupIndexReader::GroupIndexReader(std::shared_ptr<tsdbutil::ByteSlice> b)
+    : IndexReader(b)
+{
+    if (err_) return;
+    if (version != INDEX_VERSION_V2 ||
+        !read_group_postings_table(group_postings_table)) {
+        LOG_ERROR << "Fail to create GroupIndexReader, error reading group "
+                     "postings table";
+        this->b.reset();
+        err_ = true;
+    }
+}
+
+GroupIndexReader::GroupIndexReader(const std::string& filename)
+    : IndexReader(filename)
+{
+    if (err_) return;
+    if (version != INDEX_VERSION_V2 ||
+        !read_group_postings_table(group_postings_table)) {
+        LOG_ERROR << "Fail to create GroupIndexReader, error reading group "
+                     "postings table";
+        b.reset();
+        err_ = true;
+    }
+}
+
+// ┌─────────────────────┬────────────────────┐
+// │ len <4b>            │ #entries <4b>      │
+// ├─────────────────────┴────────────────────┤
+// │ ref(group_1) <uvarint>                   │
+// ├──────────────────────────────────────────┤
+// │  ...                                     │
+// ├──────────────────────────────────────────┤
+// │ ref(group_n) <uvarint>                   │
+// ├──────────────────────────────────────────┤
+// │  CRC32 <4b>                              │
+// └──────────────────────────────────────────┘
+bool GroupIndexReader::read_group_postings_table(uint64_t offset)
+{
+    std::pair<const uint8_t*, int> table_begin = b->range(offset, offset + 8);
+    if (table_begin.second != 8) return false;
+    uint32_t len = base::get_uint32_big_endian(table_begin.first);
+    uint32_t num_entries = base::get_uint32_big_endian(table_begin.first + 4);
+    tsdbutil::DecBuf dec_buf(table_begin.first + 8, len - 4);
+
+    groups.reserve(num_entries);
+    for (uint32_t i = 0; i < num_entries; i++)
+        groups.push_back(dec_buf.get_unsigned_variant());
+    return dec_buf.err == tsdbutil::NO_ERR;
+}
+
+// ┌──────────────────────────────────────────────────────────────────┐
+// │ len <uvarint>                                                    │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ #series <uvarint>                                                │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ tsid_1 <8b> ... tsid_n <8b>                                      │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ CRC32 <4b>                                                       │
+// └──────────────────────────────────────────────────────────────────┘
+std::pair<std::unique_ptr<PostingsInterface>, bool>
+GroupIndexReader::group_postings(uint64_t group_ref)
+{
+    if (!b) return {nullptr, false};
+
+    if (group_ref == ALL_GROUP_POSTINGS) {
+        std::set<tagtree::TSID> all(groups.begin(), groups.end());
+        return {std::make_unique<PostingSet>(all), true};
+    }
+
+    uint64_t ref = group_ref * 16;
+    std::pair<const uint8_t*, int> start =
+        b->range(ref, ref + base::MAX_VARINT_LEN_64);
+    if (start.second <= 0) return {nullptr, false};
+    int decoded;
+    uint64_t len =
+        base::decode_unsigned_varint(start.first, decoded, start.second);
+    if (decoded <= 0) return {nullptr, false};
+    tsdbutil::DecBuf dec_buf(start.first + decoded, len);
+
+    uint64_t num_series = dec_buf.get_unsigned_variant();
+    std::set<tagtree::TSID> tsids;
+    for (uint64_t i = 0; i < num_series; i++)
+        tsids.insert(dec_buf.get_tsid());
+    if (dec_buf.err != tsdbutil::NO_ERR) {
+        LOG_ERROR << "Fail to read group postings " << group_ref;
+        return {nullptr, false};
+    }
+    return {std::make_unique<PostingSet>(tsids), true};
+}
+
+std::unique_ptr<PostingsInterface>
+GroupIndexReader::sorted_group_postings(std::unique_ptr<PostingsInterface>&& p)
+{
+    std::set<tagtree::TSID> refs;
+    while (p->next())
+        refs.insert(p->at());
+    return std::make_unique<PostingSet>(refs);
+}
+
+} // namespace index
+} // namespace tsdb
@@ -0,0 +1,37 @@
+#ifndef GROUPINDEXREADER_H
+#define GROUPINDEXREADER_H
+
+#include <vector>
+
+#include "index/IndexReader.hpp"
+
+namespace tsdb {
+namespace index {
+
+// GroupIndexReader reads the index of a GroupBlock written by
+// GroupIndexWriter.
+class GroupIndexReader : public IndexReader {
+private:
+    std::vector<uint64_t> groups; // Group refs.
+
+    bool read_group_postings_table(uint64_t offset);
+
+public:
+    GroupIndexReader(std::shared_ptr<tsdbutil::ByteSlice> b);
+    GroupIndexReader(const std::string& filename);
+
+    // 1. Get the series of the group postings entry at group_ref.
+    // 2. Pass ALL_GROUP_POSTINGS, get the refs of all group postings entries.
+    std::pair<std::unique_ptr<PostingsInterface>, bool>
+    group_postings(uint64_t group_ref);
+
+    // Groups are written in the order of their first series, sorting the refs
+    // sorts the groups.
+    std::unique_ptr<PostingsInterface>
+    sorted_group_postings(std::unique_ptr<PostingsInterface>&& p);
+};
+
+} // namespace index
+} // namespace tsdb
+
+#endif
@@ -0,0 +1,110 @@
+#include "index/GroupIndexWriter.hpp"
+#include "base/Checksum.hpp"
+#include "base/Logging.hpp"
+
+namespace tsdb {
+namespace index {
+
+GroupIndexWriter::GroupIndexWriter(const std::string& filename)
+    : IndexWriter(filename, INDEX_VERSION_V2), group_toc()
+{}
+
+// 0 succeed, -1 error
+int GroupIndexWriter::ensure_stage(IndexWriterStage s)
+{
+    if (s == stage) {
+        return 0;
+    }
+    if (s < stage) {
+        LOG_ERROR << "Invalid stage: " << stage_to_string(s) << ", current at "
+                  << stage_to_string(stage);
+        return -1;
+    }
+
+    if (s == IDX_STAGE_SERIES) {
+        group_toc.series = pos;
+    } else if (s == IDX_STAGE_GROUP_POSTINGS) {
+        group_toc.group_postings = pos;
+    } else if (s == IDX_STAGE_DONE) {
+        group_toc.label_indices_table = pos;
+        write_offset_table();
+        group_toc.group_postings_table = pos;
+        write_group_postings_table();
+
+        write_group_TOC();
+    }
+
+    stage = s;
+    return 0;
+}
+
+std::pair<uint64_t, int>
+GroupIndexWriter::add_group(const std::vector<tagtree::TSID>& tsids)
+{
+    if (ensure_stage(IDX_STAGE_GROUP_POSTINGS) == -1)
+        return {0, INVALID_STAGE};
+
+    // Align each entry to 16 bytes
+    add_padding(16);
+    uint64_t ref = pos / 16;
+    buf2.reset();
+    buf2.put_unsigned_variant(tsids.size());
+    for (tagtree::TSID tsid : tsids)
+        buf2.put_tsid(tsid);
+
+    buf1.reset();
+    buf1.put_unsigned_variant(buf2.len());          // Len in the beginning
+    buf2.put_BE_uint32(base::GetCrc32(buf2.get())); // Crc32 in the end
+    write({buf1.get(), buf2.get()});
+
+    groups.push_back(ref);
+    return {ref, 0};
+}
+
+// ┌─────────────────────┬────────────────────┐
+// │ len <4b>            │ #entries <4b>      │
+// ├─────────────────────┴────────────────────┤
+// │ ref(group_1) <uvarint>                   │
+// ├──────────────────────────────────────────┤
+// │  ...                                     │
+// ├──────────────────────────────────────────┤
+// │ ref(group_n) <uvarint>                   │
+// ├──────────────────────────────────────────┤
+// │  CRC32 <4b>                              │
+// └──────────────────────────────────────────┘
+void GroupIndexWriter::write_group_postings_table()
+{
+    buf2.reset();
+    buf2.put_BE_uint32(groups.size());
+    for (uint64_t ref : groups)
+        buf2.put_unsigned_variant(ref);
+
+    buf1.reset();
+    buf1.put_BE_uint32(buf2.len());
+    buf2.put_BE_uint32(base::GetCrc32(buf2.get())); // Crc32 in the end
+
+    write({buf1.get(), buf2.get()});
+}
+
+// The fields of GroupTOC not used by the index are 0.
+void GroupIndexWriter::write_group_TOC()
+{
+    buf1.reset();
+    buf1.put_BE_uint64(group_toc.symbols);
+    buf1.put_BE_uint64(group_toc.series);
+    buf1.put_BE_uint64(group_toc.label_indices);
+    buf1.put_BE_uint64(group_toc.label_indices_table);
+    buf1.put_BE_uint64(group_toc.postings);
+    buf1.put_BE_uint64(group_toc.postings_table);
+    buf1.put_BE_uint64(group_toc.group_postings);
+    buf1.put_BE_uint64(group_toc.group_postings_table);
+    buf1.put_BE_uint32(base::GetCrc32(buf1.get())); // Crc32 in the end
+
+    write({buf1.get()});
+}
+
+// ensure_stage() is not virtual any more in ~IndexWriter().
+GroupIndexWriter::~GroupIndexWriter() { close(); }
+
+} // namespace index
+} // namespace tsdb
@@ -0,0 +1,49 @@
+#ifndef GROUPINDEXWRITER_H
+#define GROUPINDEXWRITER_H
+
+#include <vector>
+
+#include "index/IndexWriter.hpp"
+
+namespace tsdb {
+namespace index {
+
+// GroupIndexWriter writes the index of a GroupBlock, i.e. the series of an
+// IndexWriter followed by the postings of the groups sharing group chunks, see
+// docs/format/group_index.md.
+class GroupIndexWriter : public IndexWriter {
+private:
+    GroupTOC group_toc;
+    std::vector<uint64_t> groups; // Group refs in insertion order.
+
+    void write_group_postings_table();
+    void write_group_TOC();
+
+public:
+    GroupIndexWriter(const std::string& filename);
+
+    // 0 succeed, -1 error
+    int ensure_stage(IndexWriterStage s);
+
+    // ┌──────────────────────────────────────────────────────────────────┐
+    // │ len <uvarint>                                                    │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ #series <uvarint>                                                │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ tsid_1 <8b> ... tsid_n <8b>                                      │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ CRC32 <4b>                                                       │
+    // └──────────────────────────────────────────────────────────────────┘
+    //
+    // add_group adds the postings of a group, tsids must be sorted. Groups
+    // are added after all series. Return <group ref, 0> on success, the ref
+    // is the offset of the entry / 16.
+    std::pair<uint64_t, int> add_group(const std::vector<tagtree::TSID>& tsids);
+
+    ~GroupIndexWriter();
+};
+
+} // namespace index
+} // namespace tsdb
+
+#endif
@@ -12,7 +12,8 @@
 namespace tsdb {
 namespace index {
 
-IndexReader::IndexReader(std::shared_ptr<tsdbutil::ByteSlice> b) : err_(false)
+IndexReader::IndexReader(std::shared_ptr<tsdbutil::ByteSlice> b)
+    : err_(false), version(INDEX_VERSION_V1), group_postings_table(0)
 {
     if (!validate(b)) {
         LOG_ERROR << "Fail to create IndexReader, invalid ByteSlice";
@@ -23,7 +24,8 @@ IndexReader::IndexReader(std::shared_ptr<tsdbutil::ByteSlice> b) : err_(false)
     init();
 }
 
-IndexReader::IndexReader(const std::string& filename) : err_(false)
+IndexReader::IndexReader(const std::string& filename)
+    : err_(false), version(INDEX_VERSION_V1), group_postings_table(0)
 {
     std::shared_ptr<tsdbutil::ByteSlice> temp =
         std::shared_ptr<tsdbutil::ByteSlice>(new tsdbutil::MMapSlice(filename));
@@ -39,16 +41,31 @@ IndexReader::IndexReader(const std::string& filename) : err_(false)
 
 void IndexReader::init()
 {
-    std::pair<TOC, bool> toc_pair = toc_from_ByteSlice(b.get());
-    if (!toc_pair.second) {
-        LOG_ERROR << "Fail to create IndexReader, error reading TOC";
-        b.reset();
-        err_ = true;
-        return;
+    uint64_t table;
+    if (version == INDEX_VERSION_V2) {
+        std::pair<GroupTOC, bool> toc_pair =
+            group_toc_from_ByteSlice(b.get());
+        if (!toc_pair.second) {
+            LOG_ERROR << "Fail to create IndexReader, error reading group TOC";
+            b.reset();
+            err_ = true;
+            return;
+        }
+        table = toc_pair.first.label_indices_table;
+        group_postings_table = toc_pair.first.group_postings_table;
+    } else {
+        std::pair<TOC, bool> toc_pair = toc_from_ByteSlice(b.get());
+        if (!toc_pair.second) {
+            LOG_ERROR << "Fail to create IndexReader, error reading TOC";
+            b.reset();
+            err_ = true;
+            return;
+        }
+        table = toc_pair.first.label_indices_table;
     }
 
     // Read label indices table
-    if (!read_offset_table(toc_pair.first.label_indices_table)) {
+    if (!read_offset_table(table)) {
         LOG_ERROR
             << "Fail to create IndexReader, error reading label indices table";
         b.reset();
@@ -78,7 +95,8 @@ bool IndexReader::validate(const std::shared_ptr<tsdbutil::ByteSlice>& b)
         LOG_ERROR << "Not beginning with MAGIC_INDEX";
         return false;
     }
-    if (*((b->range(4, 5)).first) != INDEX_VERSION_V1) {
+    version = *((b->range(4, 5)).first);
+    if (version != INDEX_VERSION_V1 && version != INDEX_VERSION_V2) {
         LOG_ERROR << "Invalid Index Version";
         return false;
     }
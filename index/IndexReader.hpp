@@ -12,13 +12,16 @@ namespace tsdb {
 namespace index {
 
 class IndexReader : public block::IndexReaderInterface {
-private:
+protected:
     std::shared_ptr<tsdbutil::ByteSlice> b;
 
     bool err_;
 
     // offset table
     std::unordered_map<tagtree::TSID, uint64_t> offset_table;
+    uint8_t version;
+    // Offset of the group postings table of a group index, 0 otherwise.
+    uint64_t group_postings_table;
 
 public:
     IndexReader(std::shared_ptr<tsdbutil::ByteSlice> b);
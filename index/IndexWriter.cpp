@@ -13,9 +13,9 @@ namespace tsdb {
 namespace index {
 
 // All the dirs inside filename should be existed.
-IndexWriter::IndexWriter(const std::string& filename)
+IndexWriter::IndexWriter(const std::string& filename, uint8_t version)
     : pos(0), stage(IDX_STAGE_NONE), buf1(1 << 22), buf2(1 << 22),
-      uint32_cache(1 << 15)
+      uint32_cache(1 << 15), version(version)
 {
     boost::filesystem::path p(filename);
     if (boost::filesystem::exists(p)) boost::filesystem::remove_all(p);
@@ -32,7 +32,7 @@ void IndexWriter::write_meta()
 {
     buf1.reset();
     buf1.put_BE_uint32(MAGIC_INDEX);
-    buf1.put_byte(INDEX_VERSION_V1);
+    buf1.put_byte(version);
     write({buf1.get()});
 }
 
@@ -211,6 +211,7 @@ void IndexWriter::write_TOC()
 
 void IndexWriter::close()
 {
+    if (!f) return;
     ensure_stage(IDX_STAGE_DONE);
     // #ifdef INDEX_DEBUG
     // LOG_DEBUG << toc_string(toc) << " end:" << pos;
@@ -218,6 +219,7 @@ void IndexWriter::close()
     // #endif
     fflush(f);
     fclose(f);
+    f = nullptr;
 }
 
 IndexWriter::~IndexWriter() { close(); }
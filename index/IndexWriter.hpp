@@ -15,7 +15,7 @@ namespace tsdb {
 namespace index {
 
 class IndexWriter : public block::IndexWriterInterface {
-private:
+protected:
     FILE* f;
     uint64_t pos;
 
@@ -30,11 +30,12 @@ private:
 
     std::unordered_map<tagtree::TSID, uint64_t> series; // Series offsets
 
-    int version;
+    uint8_t version;
 
 public:
     // All the dirs inside filename should be existed.
-    IndexWriter(const std::string& filename);
+    IndexWriter(const std::string& filename,
+                uint8_t version = INDEX_VERSION_V1);
 
     void write_meta();
 
@@ -43,7 +44,7 @@ public:
     void add_padding(uint64_t padding);
 
     // 0 succeed, -1 error
-    int ensure_stage(IndexWriterStage s);
+    virtual int ensure_stage(IndexWriterStage s);
 
     // clang-format off
     // ┌──────────────────────────────────────────────────────────────────────────┐
@@ -96,7 +97,7 @@ public:
     void write_TOC();
 
     void close();
-    ~IndexWriter();
+    virtual ~IndexWriter();
 };
 
 } // namespace index
@@ -43,6 +43,19 @@ bool ChainSeriesIterator::next() const{
     return next();
 }
 
+int ChainSeriesIterator::next_batch(int64_t * ts, double * vs, int max) const{
+    if(!cur)
+        return 0;
+    while(true){
+        int n = cur->next_batch(ts, vs, max);
+        if(n > 0 || cur->error() || i == series->size() - 1)
+            return n;
+        ++ i;
+        cur.reset();
+        cur = series->at(i)->iterator();
+    }
+}
+
 bool ChainSeriesIterator::error() const{
     return cur->error();
 }
@@ -26,6 +26,8 @@ class ChainSeriesIterator: public SeriesIteratorInterface{
 
         bool next() const;
 
+        int next_batch(int64_t * ts, double * vs, int max) const;
+
         bool error() const;
 };
 
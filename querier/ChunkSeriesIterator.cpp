@@ -1,6 +1,7 @@
 #include "querier/ChunkSeriesIterator.hpp"
 #include "chunk/DeleteIterator.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 namespace tsdb {
@@ -24,8 +25,13 @@ ChunkSeriesIterator::ChunkSeriesIterator(
         err_ = true;
         return;
     }
+    open_chunk();
+}
+
+void ChunkSeriesIterator::open_chunk() const
+{
     std::unique_ptr<chunk::ChunkIteratorInterface> temp =
-        chunks.front()->chunk->iterator();
+        chunks[i]->chunk->iterator();
     if (!intervals.empty())
         cur.reset(new chunk::DeleteIterator(std::move(temp), intervals.cbegin(),
                                             intervals.cend()));
@@ -51,17 +57,7 @@ bool ChunkSeriesIterator::seek(int64_t t) const
         ++i;
     }
 
-    if (last != i) {
-        std::unique_ptr<chunk::ChunkIteratorInterface> temp =
-            chunks[i]->chunk->iterator();
-        if (intervals.size() > 0)
-            cur.reset(new chunk::DeleteIterator(
-                std::move(temp), intervals.cbegin(), intervals.cend()));
-        else {
-            cur.reset();
-            cur = std::move(temp);
-        }
-    }
+    if (last != i) open_chunk();
 
     while (cur->next()) {
         if (cur->at().first >= t) return true;
@@ -97,19 +93,43 @@ bool ChunkSeriesIterator::next() const
     if (i == chunks.size() - 1) return false;
 
     ++i;
-    std::unique_ptr<chunk::ChunkIteratorInterface> temp =
-        chunks[i]->chunk->iterator();
-    if (intervals.size() > 0)
-        cur.reset(new chunk::DeleteIterator(std::move(temp), intervals.cbegin(),
-                                            intervals.cend()));
-    else {
-        cur.reset();
-        cur = std::move(temp);
-    }
+    open_chunk();
 
     return next();
 }
 
+int ChunkSeriesIterator::next_batch(int64_t* ts, double* vs, int max) const
+{
+    if (err_) return 0;
+
+    while (true) {
+        int n = cur->next_batch(ts, vs, max);
+        if (n > 0) {
+            int b = std::lower_bound(ts, ts + n, min_time) - ts;
+            int e = std::upper_bound(ts + b, ts + n, max_time) - ts;
+            if (b > 0) {
+                std::copy(ts + b, ts + e, ts);
+                std::copy(vs + b, vs + e, vs);
+            }
+            // Nothing follows a sample past max_time.
+            if (e > b || e < n) return e - b;
+            continue;
+        }
+
+        if (cur->error()) {
+            err_ = true;
+            return 0;
+        }
+
+        do {
+            if (i == chunks.size() - 1) return 0;
+            ++i;
+        } while (chunks[i]->max_time < min_time);
+        if (chunks[i]->min_time > max_time) return 0;
+        open_chunk();
+    }
+}
+
 bool ChunkSeriesIterator::error() const { return err_; }
 
 } // namespace querier
@@ -23,6 +23,9 @@ private:
     const tombstone::Intervals& intervals;
     mutable bool err_;
 
+    // Points cur at chunk i.
+    void open_chunk() const;
+
 public:
     ChunkSeriesIterator(
         const std::vector<std::shared_ptr<chunk::ChunkMeta>>& chunks,
@@ -36,6 +39,10 @@ public:
 
     bool next() const;
 
+    // The batches are clipped to the time range with a binary search on
+    // their timestamps, chunks ending before it are not decoded.
+    int next_batch(int64_t* ts, double* vs, int max) const;
+
     bool error() const;
 };
 
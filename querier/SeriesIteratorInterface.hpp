@@ -13,6 +13,20 @@ class SeriesIteratorInterface{
         virtual std::pair<int64_t, double> at() const=0;
         virtual bool next() const=0;
         virtual bool error() const=0;
+
+        // next_batch reads up to max of the next samples into ts and vs and
+        // returns their number, 0 once the iterator is exhausted or failed.
+        // It can be mixed with next(), at() is not valid after it.
+        virtual int next_batch(int64_t * ts, double * vs, int max) const{
+            int n = 0;
+            while(n < max && next()){
+                std::pair<int64_t, double> p = at();
+                ts[n] = p.first;
+                vs[n] = p.second;
+                ++ n;
+            }
+            return n;
+        }
         virtual ~SeriesIteratorInterface()=default;
 };
 
@@ -0,0 +1,283 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdlib.h>
+#include <vector>
+
+#include "chunk/ChimpChunk.hpp"
+#include "chunk/ChunkUtils.hpp"
+#include "chunk/IntChunk.hpp"
+#include "chunk/XORChunk.hpp"
+#include "test/TestUtils.hpp"
+
+using namespace std;
+using namespace tsdb;
+
+namespace {
+
+const int CHUNK_BENCH_CHUNKS = 10000;
+const int CHUNK_BENCH_SAMPLES = 120;
+const int CHUNK_BENCH_ROUNDS = 20;
+const int64_t CHUNK_BENCH_INTERVAL = 15000;
+
+// Samples of scrapes slightly jittered in time, every chunk worth either a
+// counter growing by small integer amounts or a gauge drifting around a level.
+// With counters_only all chunks are counters.
+vector<pair<int64_t, double>> scrape_samples(bool counters_only = false){
+    mt19937_64 rng(0);
+    vector<pair<int64_t, double>> samples;
+    samples.reserve(CHUNK_BENCH_CHUNKS * CHUNK_BENCH_SAMPLES);
+    for(int i = 0; i < CHUNK_BENCH_CHUNKS; ++ i){
+        bool counter = counters_only || i % 2 == 0;
+        double v = counter ? rng() % 100000 : 0.5 + (rng() % 1000) / 10.0;
+        for(int j = 0; j < CHUNK_BENCH_SAMPLES; ++ j){
+            if(counter)
+                v += rng() % 10;
+            else
+                v += (static_cast<int>(rng() % 21) - 10) / 100.0;
+            samples.emplace_back(j * CHUNK_BENCH_INTERVAL + rng() % 50, v);
+        }
+    }
+    return samples;
+}
+
+const int TSBS_HOSTS = 100;
+const int TSBS_SAMPLES = 8640;  // A day every 10s.
+const char * TSBS_FIELDS[] = {"usage_user", "usage_system", "usage_idle", "usage_nice", "usage_iowait",
+                              "usage_irq", "usage_softirq", "usage_steal", "usage_guest", "usage_guest_nice"};
+
+// tsbs_cpu_series returns the series of the TSBS cpu use case. They are read
+// from the file named by $TSBS_DATA, generated by tsbs_generate_data in the
+// influx format, or else generated like TSBS does as random walks clamped to
+// [0, 100] with normally distributed steps, written out as integers.
+vector<vector<pair<int64_t, double>>> tsbs_cpu_series(){
+    vector<vector<pair<int64_t, double>>> series;
+    const char * name = getenv("TSBS_DATA");
+    if(name){
+        // cpu,hostname=host_0,... usage_user=58,usage_system=2,... 1451606400000000000
+        map<string, int> ids;
+        ifstream in(name);
+        string line;
+        while(getline(in, line)){
+            size_t tags = line.find(' ');
+            size_t fields = line.find(' ', tags + 1);
+            if(tags == string::npos || fields == string::npos)
+                continue;
+            int64_t t = stoll(line.substr(fields + 1)) / 1000000;
+            stringstream ss(line.substr(tags + 1, fields - tags - 1));
+            string field;
+            while(getline(ss, field, ',')){
+                size_t eq = field.find('=');
+                string key = line.substr(0, tags) + " " + field.substr(0, eq);
+                auto it = ids.find(key);
+                if(it == ids.end()){
+                    it = ids.emplace(key, series.size()).first;
+                    series.emplace_back();
+                }
+                // Integers are suffixed by i, which stod() stops at.
+                series[it->second].emplace_back(t, stod(field.substr(eq + 1)));
+            }
+        }
+        return series;
+    }
+
+    mt19937_64 rng(0);
+    normal_distribution<double> step(0, 1);
+    for(int h = 0; h < TSBS_HOSTS; ++ h){
+        for(int f = 0; f < 10; ++ f){
+            series.emplace_back();
+            double v = (rng() % 10000) / 100.0;
+            for(int i = 0; i < TSBS_SAMPLES; ++ i){
+                v = min(100.0, max(0.0, v + step(rng)));
+                series.back().emplace_back(1451606400000 + i * 10000, static_cast<int>(v));
+            }
+        }
+    }
+    return series;
+}
+
+}
+
+// xorchunk_bench reports the samples per second appended to XOR chunks, and
+// decoded from them read in place as the querier does for chunks of
+// persisted blocks.
+void xorchunk_bench(){
+    vector<pair<int64_t, double>> data = scrape_samples();
+
+    vector<shared_ptr<chunk::XORChunk>> chunks;
+    uint64_t bytes = 0;
+    auto s = chrono::steady_clock::now();
+    for(int i = 0; i < CHUNK_BENCH_CHUNKS; ++ i){
+        shared_ptr<chunk::XORChunk> c(new chunk::XORChunk());
+        unique_ptr<chunk::ChunkAppenderInterface> app = c->appender();
+        for(int j = 0; j < CHUNK_BENCH_SAMPLES; ++ j)
+            app->append(data[i * CHUNK_BENCH_SAMPLES + j].first, data[i * CHUNK_BENCH_SAMPLES + j].second);
+        bytes += c->size();
+        chunks.push_back(c);
+    }
+    double append_secs = chrono::duration<double>(chrono::steady_clock::now() - s).count();
+    TEST_COUT << "samples=" << data.size() << " bytes=" << bytes << " append=" << append_secs
+              << "s samples/s=" << data.size() / append_secs << endl;
+
+    for(bool batch: {false, true}){
+        uint64_t samples = 0;
+        double sum = 0;
+        int64_t ts[CHUNK_BENCH_SAMPLES];
+        double vs[CHUNK_BENCH_SAMPLES];
+        s = chrono::steady_clock::now();
+        for(int r = 0; r < CHUNK_BENCH_ROUNDS; ++ r){
+            for(const shared_ptr<chunk::XORChunk> & c: chunks){
+                chunk::XORChunk rc(c->bytes(), c->size());
+                unique_ptr<chunk::ChunkIteratorInterface> it = rc.iterator();
+                if(batch){
+                    int n;
+                    while((n = it->next_batch(ts, vs, CHUNK_BENCH_SAMPLES)) > 0){
+                        for(int i = 0; i < n; ++ i)
+                            sum += vs[i];
+                        samples += n;
+                    }
+                }
+                else{
+                    while(it->next()){
+                        sum += it->at().second;
+                        ++ samples;
+                    }
+                }
+                ASSERT_FALSE(it->error());
+            }
+        }
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - s).count();
+        ASSERT_EQ(static_cast<uint64_t>(CHUNK_BENCH_CHUNKS) * CHUNK_BENCH_SAMPLES * CHUNK_BENCH_ROUNDS, samples);
+
+        TEST_COUT << "samples=" << samples << " decode" << (batch ? " batch=" : "=") << secs << "s samples/s="
+                  << samples / secs << " checksum=" << sum << endl;
+    }
+}
+
+// intchunk_bench compares int chunks with XOR chunks holding the same counter
+// samples, by size and by the samples per second decoded in batches.
+void intchunk_bench(){
+    vector<pair<int64_t, double>> data = scrape_samples(true);
+
+    vector<shared_ptr<chunk::ChunkInterface>> int_chunks;
+    vector<shared_ptr<chunk::ChunkInterface>> xor_chunks;
+    uint64_t int_bytes = 0;
+    uint64_t xor_bytes = 0;
+    for(int i = 0; i < CHUNK_BENCH_CHUNKS; ++ i){
+        shared_ptr<chunk::ChunkInterface> ic(new chunk::IntChunk());
+        shared_ptr<chunk::ChunkInterface> xc(new chunk::XORChunk());
+        unique_ptr<chunk::ChunkAppenderInterface> int_app = ic->appender();
+        unique_ptr<chunk::ChunkAppenderInterface> xor_app = xc->appender();
+        for(int j = 0; j < CHUNK_BENCH_SAMPLES; ++ j){
+            ASSERT_TRUE(chunk::IntChunk::is_integral(data[i * CHUNK_BENCH_SAMPLES + j].second));
+            int_app->append(data[i * CHUNK_BENCH_SAMPLES + j].first, data[i * CHUNK_BENCH_SAMPLES + j].second);
+            xor_app->append(data[i * CHUNK_BENCH_SAMPLES + j].first, data[i * CHUNK_BENCH_SAMPLES + j].second);
+        }
+        int_bytes += ic->size();
+        xor_bytes += xc->size();
+        int_chunks.push_back(ic);
+        xor_chunks.push_back(xc);
+    }
+    TEST_COUT << "samples=" << data.size() << " int bytes=" << int_bytes << " xor bytes=" << xor_bytes << endl;
+
+    for(bool use_int: {true, false}){
+        vector<shared_ptr<chunk::ChunkInterface>> & chunks = use_int ? int_chunks : xor_chunks;
+        uint64_t samples = 0;
+        double sum = 0;
+        int64_t ts[CHUNK_BENCH_SAMPLES];
+        double vs[CHUNK_BENCH_SAMPLES];
+        auto s = chrono::steady_clock::now();
+        for(int r = 0; r < CHUNK_BENCH_ROUNDS; ++ r){
+            for(const shared_ptr<chunk::ChunkInterface> & c: chunks){
+                unique_ptr<chunk::ChunkInterface> rc;
+                if(use_int)
+                    rc.reset(new chunk::IntChunk(c->bytes(), c->size()));
+                else
+                    rc.reset(new chunk::XORChunk(c->bytes(), c->size()));
+                unique_ptr<chunk::ChunkIteratorInterface> it = rc->iterator();
+                int n;
+                while((n = it->next_batch(ts, vs, CHUNK_BENCH_SAMPLES)) > 0){
+                    for(int i = 0; i < n; ++ i)
+                        sum += vs[i];
+                    samples += n;
+                }
+                ASSERT_FALSE(it->error());
+            }
+        }
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - s).count();
+        ASSERT_EQ(static_cast<uint64_t>(CHUNK_BENCH_CHUNKS) * CHUNK_BENCH_SAMPLES * CHUNK_BENCH_ROUNDS, samples);
+
+        TEST_COUT << (use_int ? "int" : "xor") << " samples=" << samples << " decode batch=" << secs
+                  << "s samples/s=" << samples / secs << " checksum=" << sum << endl;
+    }
+}
+
+// chimpchunk_bench compares Chimp chunks with XOR chunks, and int chunks where
+// the values allow it, by size and by the samples per second decoded in
+// batches. The series are those of the TSBS cpu use case, which are integers,
+// and the same with two decimals like most gauges.
+void chimpchunk_bench(){
+    vector<vector<pair<int64_t, double>>> tsbs = tsbs_cpu_series();
+    vector<vector<pair<int64_t, double>>> decimals = tsbs;
+    mt19937_64 rng(0);
+    for(vector<pair<int64_t, double>> & samples: decimals){
+        for(pair<int64_t, double> & p: samples)
+            p.second += (rng() % 100) / 100.0;
+    }
+
+    for(bool integral: {true, false}){
+        const vector<vector<pair<int64_t, double>>> & series = integral ? tsbs : decimals;
+        for(uint8_t encoding: {chunk::EncXOR, chunk::EncChimp, chunk::EncInt}){
+            if(encoding == chunk::EncInt && !integral)
+                continue;
+            vector<shared_ptr<chunk::ChunkInterface>> chunks;
+            uint64_t bytes = 0;
+            uint64_t total = 0;
+            auto s = chrono::steady_clock::now();
+            for(const vector<pair<int64_t, double>> & samples: series){
+                for(size_t i = 0; i < samples.size(); i += CHUNK_BENCH_SAMPLES){
+                    shared_ptr<chunk::ChunkInterface> c = chunk::new_chunk(encoding);
+                    unique_ptr<chunk::ChunkAppenderInterface> app = c->appender();
+                    for(size_t j = i; j < samples.size() && j < i + CHUNK_BENCH_SAMPLES; ++ j)
+                        app->append(samples[j].first, samples[j].second);
+                    bytes += c->size();
+                    total += c->num_samples();
+                    chunks.push_back(c);
+                }
+            }
+            double append_secs = chrono::duration<double>(chrono::steady_clock::now() - s).count();
+            const char * name = encoding == chunk::EncChimp ? "chimp" : (encoding == chunk::EncInt ? "int" : "xor");
+            TEST_COUT << (integral ? "tsbs cpu " : "tsbs cpu with decimals ") << name << " series=" << series.size()
+                      << " samples=" << total << " bytes=" << bytes << " bits/sample=" << bytes * 8.0 / total
+                      << " append samples/s=" << total / append_secs << endl;
+
+            uint64_t samples = 0;
+            double sum = 0;
+            int64_t ts[CHUNK_BENCH_SAMPLES];
+            double vs[CHUNK_BENCH_SAMPLES];
+            s = chrono::steady_clock::now();
+            for(int r = 0; r < CHUNK_BENCH_ROUNDS; ++ r){
+                for(const shared_ptr<chunk::ChunkInterface> & c: chunks){
+                    shared_ptr<chunk::ChunkInterface> rc = chunk::from_data(encoding, c->bytes(), c->size());
+                    unique_ptr<chunk::ChunkIteratorInterface> it = rc->iterator();
+                    int n;
+                    while((n = it->next_batch(ts, vs, CHUNK_BENCH_SAMPLES)) > 0){
+                        for(int i = 0; i < n; ++ i)
+                            sum += vs[i];
+                        samples += n;
+                    }
+                    ASSERT_FALSE(it->error());
+                }
+            }
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - s).count();
+            ASSERT_EQ(total * CHUNK_BENCH_ROUNDS, samples);
+
+            TEST_COUT << (integral ? "tsbs cpu " : "tsbs cpu with decimals ") << name << " samples=" << samples
+                      << " decode batch=" << secs << "s samples/s=" << samples / secs << " checksum=" << sum << endl;
+        }
+    }
+}
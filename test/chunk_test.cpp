@@ -0,0 +1,408 @@
+#include <boost/filesystem.hpp>
+#include <cmath>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "base/Endian.hpp"
+#include "base/ThreadPool.hpp"
+#include "chunk/ChimpChunk.hpp"
+#include "chunk/ChunkReader.hpp"
+#include "chunk/ChunkUtils.hpp"
+#include "chunk/ChunkWriter.hpp"
+#include "chunk/IntChunk.hpp"
+#include "chunk/XORChunk.hpp"
+#include "compact/LeveledCompactor.hpp"
+#include "head/Head.hpp"
+#include "head/HeadChunkReader.hpp"
+#include "head/HeadIndexReader.hpp"
+
+using namespace std;
+using namespace tsdb;
+
+namespace {
+
+typedef vector<pair<int64_t, double>> Samples;
+
+Samples read_all(chunk::ChunkInterface * c){
+    Samples samples;
+    unique_ptr<chunk::ChunkIteratorInterface> it = c->iterator();
+    while(it->next())
+        samples.push_back(it->at());
+    EXPECT_FALSE(it->error());
+    return samples;
+}
+
+Samples read_batches(chunk::ChunkInterface * c, int batch){
+    Samples samples;
+    unique_ptr<chunk::ChunkIteratorInterface> it = c->iterator();
+    vector<int64_t> ts(batch);
+    vector<double> vs(batch);
+    int n;
+    while((n = it->next_batch(&ts[0], &vs[0], batch)) > 0){
+        for(int i = 0; i < n; ++ i)
+            samples.emplace_back(ts[i], vs[i]);
+    }
+    EXPECT_FALSE(it->error());
+    return samples;
+}
+
+shared_ptr<chunk::IntChunk> int_chunk(const Samples & samples){
+    shared_ptr<chunk::IntChunk> c(new chunk::IntChunk());
+    unique_ptr<chunk::ChunkAppenderInterface> app = c->appender();
+    for(const pair<int64_t, double> & p: samples){
+        EXPECT_TRUE(chunk::IntChunk::is_integral(p.second)) << p.second;
+        app->append(p.first, p.second);
+    }
+    return c;
+}
+
+// expect_roundtrip reads the samples back from the chunk being appended to
+// and from its bytes.
+void expect_roundtrip(const Samples & samples){
+    shared_ptr<chunk::IntChunk> c = int_chunk(samples);
+    EXPECT_EQ(static_cast<int>(samples.size()), c->num_samples());
+    EXPECT_EQ(samples, read_all(c.get()));
+    EXPECT_EQ(samples, read_batches(c.get(), 7));
+
+    vector<uint8_t> bytes(c->bytes(), c->bytes() + c->size());
+    chunk::IntChunk rc(bytes.data(), bytes.size());
+    EXPECT_EQ(static_cast<int>(samples.size()), rc.num_samples());
+    EXPECT_EQ(samples, read_all(&rc));
+    EXPECT_EQ(samples, read_batches(&rc, 1000));
+}
+
+int varint_len(int64_t v){
+    uint8_t b[base::MAX_VARINT_LEN_64];
+    return base::encode_signed_varint(b, v);
+}
+
+// The position of the first block of c.
+size_t first_block(const Samples & samples){
+    return 2 + varint_len(samples[0].first) + varint_len(static_cast<int64_t>(samples[0].second)) +
+           varint_len(samples[1].first - samples[0].first) +
+           varint_len(static_cast<int64_t>(samples[1].second) - static_cast<int64_t>(samples[0].second));
+}
+
+// Values compared by their bits, so that NaNs and -0.0 compare as written.
+vector<pair<int64_t, uint64_t>> value_bits(const Samples & samples){
+    vector<pair<int64_t, uint64_t>> r;
+    for(const pair<int64_t, double> & p: samples){
+        uint64_t b;
+        memcpy(&b, &p.second, sizeof(b));
+        r.emplace_back(p.first, b);
+    }
+    return r;
+}
+
+double from_bits(uint64_t b){
+    double v;
+    memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+void expect_chimp_roundtrip(const Samples & samples){
+    chunk::ChimpChunk c;
+    unique_ptr<chunk::ChunkAppenderInterface> app = c.appender();
+    for(const pair<int64_t, double> & p: samples)
+        app->append(p.first, p.second);
+    EXPECT_EQ(static_cast<int>(samples.size()), c.num_samples());
+    EXPECT_EQ(value_bits(samples), value_bits(read_all(&c)));
+    EXPECT_EQ(value_bits(samples), value_bits(read_batches(&c, 7)));
+
+    vector<uint8_t> bytes(c.bytes(), c.bytes() + c.size());
+    chunk::ChimpChunk rc(bytes.data(), bytes.size());
+    EXPECT_EQ(static_cast<int>(samples.size()), rc.num_samples());
+    EXPECT_EQ(value_bits(samples), value_bits(read_all(&rc)));
+    EXPECT_EQ(value_bits(samples), value_bits(read_batches(&rc, 1000)));
+}
+
+}
+
+TEST(IntChunkTest, IsIntegral){
+    EXPECT_TRUE(chunk::IntChunk::is_integral(0.0));
+    EXPECT_FALSE(chunk::IntChunk::is_integral(-0.0));
+    EXPECT_TRUE(chunk::IntChunk::is_integral(-1.0));
+    EXPECT_FALSE(chunk::IntChunk::is_integral(1.5));
+    EXPECT_TRUE(chunk::IntChunk::is_integral(-9223372036854775808.0));
+    EXPECT_FALSE(chunk::IntChunk::is_integral(9223372036854775808.0));
+    EXPECT_FALSE(chunk::IntChunk::is_integral(numeric_limits<double>::quiet_NaN()));
+    EXPECT_FALSE(chunk::IntChunk::is_integral(numeric_limits<double>::infinity()));
+    EXPECT_FALSE(chunk::IntChunk::is_integral(-numeric_limits<double>::infinity()));
+}
+
+// The first two samples are stored apart from the blocks, the lengths around
+// them and around a block boundary.
+TEST(IntChunkTest, Lengths){
+    for(int n: {0, 1, 2, 3, 129, 130, 131, 256, 258, 1000}){
+        Samples samples;
+        for(int i = 0; i < n; ++ i)
+            samples.emplace_back(1000 + i * 15000 + i % 3, i * i % 97);
+        SCOPED_TRACE(n);
+        expect_roundtrip(samples);
+    }
+}
+
+TEST(IntChunkTest, Widths){
+    // Constant intervals and values pack with width 0.
+    Samples samples;
+    for(int i = 0; i < 130; ++ i)
+        samples.emplace_back(i * 15000, 7);
+    expect_roundtrip(samples);
+    shared_ptr<chunk::IntChunk> c = int_chunk(samples);
+    size_t pos = first_block(samples);
+    ASSERT_EQ(pos + 2, c->size());
+    EXPECT_EQ(0, c->bytes()[pos]);
+    EXPECT_EQ(0, c->bytes()[pos + 1]);
+
+    // A value delta of -2^63 after one of 0 takes all 64 bits.
+    samples.clear();
+    for(int i = 0; i < 200; ++ i)
+        samples.emplace_back(i * 15000, i % 3 == 2 ? -9223372036854775808.0 : 0);
+    expect_roundtrip(samples);
+    c = int_chunk(samples);
+    pos = first_block(samples);
+    EXPECT_EQ(0, c->bytes()[pos]);
+    EXPECT_EQ(64, c->bytes()[pos + 1]);
+}
+
+// Deltas are computed wrapping around at 64 bits.
+TEST(IntChunkTest, NegativeAndWrappingDeltas){
+    mt19937_64 rng(3);
+    Samples samples;
+    int64_t t = 0;
+    for(int i = 0; i < 500; ++ i){
+        // Values spread over the whole int64 range, with their low bits
+        // cleared so that they are exact doubles.
+        int64_t v = static_cast<int64_t>(rng() & ~0xfffULL);
+        t -= static_cast<int64_t>(rng() % 100000);
+        samples.emplace_back(t, static_cast<double>(v));
+    }
+    samples.emplace_back(numeric_limits<int64_t>::max(), -9223372036854775808.0);
+    samples.emplace_back(numeric_limits<int64_t>::min(), 0);
+    samples.emplace_back(numeric_limits<int64_t>::max(), -1);
+    expect_roundtrip(samples);
+}
+
+// Iterators read the chunk as it was when they were created, while the
+// appender goes on and packs the block they are reading.
+TEST(IntChunkTest, IterateWhileAppending){
+    Samples samples;
+    for(int i = 0; i < 300; ++ i)
+        samples.emplace_back(i * 15000, i * 3);
+    shared_ptr<chunk::IntChunk> c(new chunk::IntChunk());
+    unique_ptr<chunk::ChunkAppenderInterface> app = c->appender();
+    vector<unique_ptr<chunk::ChunkIteratorInterface>> its;
+    for(size_t i = 0; i < samples.size(); ++ i){
+        app->append(samples[i].first, samples[i].second);
+        if(i % 43 == 0 || i == 129 || i == 130)
+            its.push_back(c->iterator());
+    }
+    for(unique_ptr<chunk::ChunkIteratorInterface> & it: its){
+        Samples got;
+        while(it->next())
+            got.push_back(it->at());
+        EXPECT_FALSE(it->error());
+        ASSERT_FALSE(got.empty());
+        EXPECT_EQ(Samples(samples.begin(), samples.begin() + got.size()), got);
+    }
+    EXPECT_EQ(samples, read_all(c.get()));
+}
+
+// A series cuts an int chunk for integral values and rewrites its head chunk
+// into a XOR chunk on the first value which is not.
+TEST(IntChunkTest, HeadSwitchesToXOR){
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+    pool->start(2);
+    head::Head h(3600 * 1000, nullptr, pool);
+    ASSERT_FALSE(h.init(numeric_limits<int64_t>::min()));
+
+    Samples samples;
+    for(int i = 0; i < 100; ++ i)
+        samples.emplace_back(i * 1000, i == 90 ? 0.5 : i);
+    for(size_t i = 0; i < samples.size(); ++ i){
+        auto app = h.appender();
+        ASSERT_FALSE(app->add(1, samples[i].first, samples[i].second).second);
+        ASSERT_FALSE(app->commit());
+        head::MemSeriesPtr s = h.series->get_by_id(1);
+        EXPECT_EQ(i < 90 ? chunk::EncInt : chunk::EncXOR, s->chunks.back()->chunk->encoding()) << i;
+    }
+    ASSERT_EQ(1, h.series->get_by_id(1)->chunks.size());
+
+    // HeadChunkReader hands out the head chunk of either encoding.
+    head::HeadIndexReader ir(&h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    head::HeadChunkReader cr(&h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    vector<shared_ptr<chunk::ChunkMeta>> metas;
+    ASSERT_TRUE(ir.series(1, metas));
+    ASSERT_EQ(1, metas.size());
+    pair<shared_ptr<chunk::ChunkInterface>, bool> c = cr.chunk(1, metas[0]->ref);
+    ASSERT_TRUE(c.second);
+    EXPECT_EQ(chunk::EncXOR, c.first->encoding());
+    EXPECT_EQ(samples, read_all(c.first.get()));
+}
+
+TEST(IntChunkTest, HeadChunkReader){
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+    pool->start(2);
+    head::Head h(3600 * 1000, nullptr, pool);
+    ASSERT_FALSE(h.init(numeric_limits<int64_t>::min()));
+
+    Samples samples;
+    for(int i = 0; i < 200; ++ i)
+        samples.emplace_back(i * 1000, i * 7 - 300);
+    for(const pair<int64_t, double> & p: samples){
+        auto app = h.appender();
+        ASSERT_FALSE(app->add(1, p.first, p.second).second);
+        ASSERT_FALSE(app->commit());
+    }
+
+    head::HeadIndexReader ir(&h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    head::HeadChunkReader cr(&h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    vector<shared_ptr<chunk::ChunkMeta>> metas;
+    ASSERT_TRUE(ir.series(1, metas));
+    Samples got;
+    for(const shared_ptr<chunk::ChunkMeta> & m: metas){
+        pair<shared_ptr<chunk::ChunkInterface>, bool> c = cr.chunk(1, m->ref);
+        ASSERT_TRUE(c.second);
+        EXPECT_EQ(chunk::EncInt, c.first->encoding());
+        Samples part = read_batches(c.first.get(), 64);
+        got.insert(got.end(), part.begin(), part.end());
+    }
+    EXPECT_EQ(samples, got);
+}
+
+// Int chunks written to a block come back as int chunks.
+TEST(IntChunkTest, ChunkReader){
+    string dir = "chunk_test/int";
+    boost::filesystem::remove_all(dir);
+
+    vector<Samples> series;
+    vector<shared_ptr<chunk::ChunkMeta>> metas;
+    for(int n: {1, 2, 129, 130}){
+        Samples samples;
+        for(int i = 0; i < n; ++ i)
+            samples.emplace_back(i * 15000, n - i);
+        metas.emplace_back(new chunk::ChunkMeta(int_chunk(samples), samples.front().first, samples.back().first));
+        series.push_back(samples);
+    }
+    {
+        chunk::ChunkWriter w(dir);
+        w.write_chunks(metas);
+    }
+
+    chunk::ChunkReader r(dir);
+    ASSERT_FALSE(r.error());
+    for(size_t i = 0; i < metas.size(); ++ i){
+        pair<shared_ptr<chunk::ChunkInterface>, bool> c = r.chunk(1, metas[i]->ref);
+        ASSERT_TRUE(c.second);
+        EXPECT_EQ(chunk::EncInt, c.first->encoding());
+        EXPECT_EQ(series[i], read_all(c.first.get()));
+        EXPECT_EQ(series[i], read_batches(c.first.get(), 100));
+    }
+}
+
+// Values are XORed with one of the 128 values before them, taken from a
+// window which wraps around many times in a chunk.
+TEST(ChimpChunkTest, WindowWrap){
+    mt19937_64 rng(5);
+    Samples samples;
+    vector<uint64_t> bits;
+    for(int i = 0; i < 1000; ++ i){
+        uint64_t b;
+        if(i < 130)
+            b = 0x4049000000000000ULL | (rng() & 0xfffffffffULL);
+        else if(i % 5 == 0)
+            b = bits[i - 128];                  // Oldest value in the window.
+        else if(i % 5 == 1)
+            b = bits[i - 129];                  // Just out of the window.
+        else if(i % 5 == 2)
+            b = bits[i - 100] ^ (rng() & 0xff0000);  // Many trailing zeros.
+        else if(i % 5 == 3)
+            b = bits[i - 1] ^ (rng() & 0xffffffffULL);
+        else
+            b = rng();
+        bits.push_back(b);
+        samples.emplace_back(i * 15000 + i % 7, from_bits(b));
+    }
+    for(int n: {1, 2, 3, 128, 129, 130, 257, 1000}){
+        SCOPED_TRACE(n);
+        expect_chimp_roundtrip(Samples(samples.begin(), samples.begin() + n));
+    }
+}
+
+TEST(ChimpChunkTest, SpecialValues){
+    const double specials[] = {
+        numeric_limits<double>::quiet_NaN(),
+        -numeric_limits<double>::quiet_NaN(),
+        from_bits(0x7ff0000000000001ULL),      // Signaling NaN.
+        from_bits(0x7ff8dead0000beefULL),      // NaN with a payload.
+        numeric_limits<double>::infinity(),
+        -numeric_limits<double>::infinity(),
+        0.0,
+        -0.0,
+        numeric_limits<double>::denorm_min(),
+        -numeric_limits<double>::denorm_min(),
+        numeric_limits<double>::min(),
+        numeric_limits<double>::max(),
+        numeric_limits<double>::lowest(),
+        1.0,
+    };
+    const int n = sizeof(specials) / sizeof(specials[0]);
+    Samples samples;
+    for(int i = 0; i < 600; ++ i)
+        samples.emplace_back(i * 1000, specials[(i * i + i / 3) % n]);
+    expect_chimp_roundtrip(samples);
+
+    // Every pair of them in a row.
+    samples.clear();
+    for(int i = 0; i < n; ++ i){
+        for(int j = 0; j < n; ++ j){
+            samples.emplace_back(static_cast<int64_t>(samples.size()) * 1000, specials[i]);
+            samples.emplace_back(static_cast<int64_t>(samples.size()) * 1000, specials[j]);
+        }
+    }
+    expect_chimp_roundtrip(samples);
+}
+
+TEST(ChimpChunkTest, IdenticalValues){
+    for(double v: {0.0, -0.0, 42.5, numeric_limits<double>::quiet_NaN(), numeric_limits<double>::infinity()}){
+        Samples samples;
+        for(int i = 0; i < 300; ++ i)
+            samples.emplace_back(i * 15000, v);
+        SCOPED_TRACE(v);
+        expect_chimp_roundtrip(samples);
+    }
+}
+
+// Compaction can be set to rewrite float chunks into Chimp chunks, which are
+// smaller for gauges with decimals and read back the same samples.
+TEST(ChimpChunkTest, Recode){
+    EXPECT_FALSE(compact::LeveledCompactor({1000}, nullptr, block::OriginalBlock, chunk::EncChimp).error());
+    EXPECT_FALSE(compact::LeveledCompactor({1000}, nullptr, block::OriginalBlock, chunk::EncXOR).error());
+    EXPECT_TRUE(compact::LeveledCompactor({1000}, nullptr, block::OriginalBlock, chunk::EncInt).error());
+
+    mt19937_64 rng(7);
+    Samples samples;
+    double v = 50;
+    for(int i = 0; i < 120; ++ i){
+        v += static_cast<int>(rng() % 201 - 100) / 100.0;
+        samples.emplace_back(i * 15000, v);
+    }
+    shared_ptr<chunk::ChunkInterface> x(new chunk::XORChunk());
+    unique_ptr<chunk::ChunkAppenderInterface> app = x->appender();
+    for(const pair<int64_t, double> & p: samples)
+        app->append(p.first, p.second);
+
+    pair<shared_ptr<chunk::ChunkInterface>, error::Error> c = chunk::recode_chunk(x, chunk::EncChimp);
+    ASSERT_FALSE(c.second);
+    EXPECT_EQ(chunk::EncChimp, c.first->encoding());
+    EXPECT_LT(c.first->size(), x->size());
+    EXPECT_EQ(value_bits(samples), value_bits(read_all(c.first.get())));
+
+    c = chunk::recode_chunk(c.first, chunk::EncXOR);
+    ASSERT_FALSE(c.second);
+    EXPECT_EQ(chunk::EncXOR, c.first->encoding());
+    EXPECT_EQ(value_bits(samples), value_bits(read_all(c.first.get())));
+}
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "base/ThreadPool.hpp"
+#include "head/Head.hpp"
+#include "head/HeadIndexReader.hpp"
+#include "test/TestUtils.hpp"
+
+using namespace std;
+using namespace tsdb;
+
+namespace {
+
+const int INGEST_THREADS = 16;
+const int QUERY_THREADS = 16;
+const int SERIES_PER_THREAD = 10000;
+const int64_t INTERVAL = 15000;
+const double BENCH_SECONDS = 5;
+
+// Every ingest thread owns its own TSID range and moves to a fresh range every
+// 20 rounds, so that the GC loop keeps removing series while queries run.
+void ingest(head::Head * h, int id, atomic<bool> * stop, atomic<int64_t> * total, atomic<int64_t> * ts){
+    int64_t samples = 0;
+    for(int round = 0; !stop->load(); ++ round){
+        uint64_t base_id = (static_cast<uint64_t>(round / 20) * INGEST_THREADS + id) * SERIES_PER_THREAD + 1;
+        int64_t t = (round + 1) * INTERVAL;
+        auto app = h->appender();
+        for(int i = 0; i < SERIES_PER_THREAD; ++ i)
+            app->add(base_id + i, t, i);
+        app->commit();
+        samples += SERIES_PER_THREAD;
+        int64_t cur = ts->load();
+        while(cur < t && !ts->compare_exchange_weak(cur, t));
+    }
+    total->fetch_add(samples);
+}
+
+void query(head::Head * h, int id, atomic<bool> * stop, atomic<int64_t> * total, vector<int64_t> * hist){
+    mt19937_64 rng(id);
+    head::HeadIndexReader ir(h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    vector<shared_ptr<chunk::ChunkMeta>> chunks;
+    int64_t lookups = 0;
+    hist->assign(64, 0);
+    while(!stop->load()){
+        chunks.clear();
+        auto s = chrono::steady_clock::now();
+        ir.series(rng() % (INGEST_THREADS * SERIES_PER_THREAD * 4) + 1, chunks);
+        int64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - s).count();
+        // Power of 2 buckets.
+        ++ (*hist)[64 - __builtin_clzll(ns | 1)];
+        ++ lookups;
+    }
+    total->fetch_add(lookups);
+}
+
+// Upper bound in ns of the bucket holding the q-th quantile.
+int64_t quantile(const vector<int64_t> & hist, double q){
+    int64_t total = 0;
+    for(int64_t c: hist)
+        total += c;
+    int64_t seen = 0;
+    for(int i = 0; i < hist.size(); ++ i){
+        seen += hist[i];
+        if(seen >= q * total)
+            return static_cast<int64_t>(1) << i;
+    }
+    return static_cast<int64_t>(1) << (hist.size() - 1);
+}
+
+}
+
+// head_contention_bench runs 16 ingest threads and 16 query threads against one
+// head while another thread garbage collects old series.
+void head_contention_bench(){
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+    pool->start(8);
+    head::Head h(3600 * 1000, nullptr, pool);
+    h.init(numeric_limits<int64_t>::min());
+
+    atomic<bool> stop(false);
+    atomic<int64_t> ingested(0), queried(0), ts(0);
+    vector<vector<int64_t>> hists(QUERY_THREADS);
+    vector<thread> threads;
+    for(int i = 0; i < INGEST_THREADS; ++ i)
+        threads.emplace_back(ingest, &h, i, &stop, &ingested, &ts);
+    for(int i = 0; i < QUERY_THREADS; ++ i)
+        threads.emplace_back(query, &h, i, &stop, &queried, &hists[i]);
+
+    int gc_runs = 0;
+    auto start = chrono::steady_clock::now();
+    while(chrono::duration<double>(chrono::steady_clock::now() - start).count() < BENCH_SECONDS){
+        this_thread::sleep_for(chrono::milliseconds(100));
+        h.series->gc(ts.load() - 10 * INTERVAL);
+        ++ gc_runs;
+    }
+    stop.store(true);
+    for(auto & t: threads)
+        t.join();
+    double d = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<int64_t> hist(64, 0);
+    for(auto & hi: hists)
+        for(int i = 0; i < 64; ++ i)
+            hist[i] += hi[i];
+    TEST_COUT << "ingest=" << ingested.load() / d << " samples/s query=" << queried.load() / d
+              << " lookups/s gc_runs=" << gc_runs << endl;
+    TEST_COUT << "lookup latency(ns, bucket upper bound) p50=" << quantile(hist, 0.5) << " p99=" << quantile(hist, 0.99)
+              << " p99.9=" << quantile(hist, 0.999) << " max=" << quantile(hist, 1) << endl;
+}
+
+// head_batch_bench appends scrapes of BATCH_SERIES series to two heads
+// without WAL, to one sample by sample through add() and to the other through
+// add_batch(). The rounds alternate between the heads, so that both see the
+// same state of the allocator.
+void head_batch_bench(){
+    const int BATCH_SERIES = 100000;
+    const int ROUNDS = 20;
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+    pool->start(4);
+    head::Head heads[2] = {{3600 * 1000, nullptr, pool}, {3600 * 1000, nullptr, pool}};
+    for(head::Head & h: heads)
+        h.init(numeric_limits<int64_t>::min());
+
+    vector<tagtree::TSID> tsids(BATCH_SERIES);
+    for(int i = 0; i < BATCH_SERIES; ++ i)
+        tsids[i] = i + 1;
+    vector<int64_t> ts(BATCH_SERIES);
+    vector<double> vs(BATCH_SERIES);
+    double d[2] = {0, 0};
+    for(int round = 0; round < ROUNDS; ++ round){
+        fill(ts.begin(), ts.end(), (round + 1) * INTERVAL);
+        for(int i = 0; i < BATCH_SERIES; ++ i)
+            vs[i] = round * i;
+        for(int batch = 0; batch < 2; ++ batch){
+            auto start = chrono::steady_clock::now();
+            auto app = heads[batch].appender();
+            if(batch)
+                app->add_batch(tsids, ts, vs);
+            else{
+                for(int i = 0; i < BATCH_SERIES; ++ i)
+                    app->add(tsids[i], ts[i], vs[i]);
+            }
+            app->commit();
+            d[batch] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+    }
+    TEST_COUT << "add samples/s=" << BATCH_SERIES * ROUNDS / d[0]
+              << " add_batch samples/s=" << BATCH_SERIES * ROUNDS / d[1] << endl;
+}
@@ -0,0 +1,532 @@
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/ThreadPool.hpp"
+#include "chunk/XORChunk.hpp"
+#include "head/Head.hpp"
+#include "head/HeadChunkReader.hpp"
+#include "head/HeadIndexReader.hpp"
+#include "wal/WAL.hpp"
+
+using namespace std;
+using namespace tsdb;
+
+namespace {
+
+const int64_t CHUNK_RANGE = 3600 * 1000;
+const int64_t INTERVAL = 15000;
+
+typedef vector<pair<int64_t, double>> Samples;
+
+class TestHead{
+public:
+    shared_ptr<base::ThreadPool> pool;
+    unique_ptr<head::Head> h;
+
+    // A head without WAL if dir is empty.
+    TestHead(const string & dir, int64_t ooo_window = 0){
+        pool.reset(new base::ThreadPool());
+        pool->start(2);
+        unique_ptr<wal::WAL> w;
+        if(!dir.empty())
+            w.reset(new wal::WAL(dir + "/wal", pool));
+        h.reset(new head::Head(CHUNK_RANGE, std::move(w), pool, ooo_window));
+        EXPECT_FALSE(h->init(numeric_limits<int64_t>::min()));
+    }
+};
+
+Samples read_series(head::Head * h, tagtree::TSID tsid){
+    Samples samples;
+    head::HeadIndexReader ir(h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    head::HeadChunkReader cr(h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    vector<shared_ptr<chunk::ChunkMeta>> chunks;
+    if(!ir.series(tsid, chunks))
+        return samples;
+    for(const shared_ptr<chunk::ChunkMeta> & c: chunks){
+        pair<shared_ptr<chunk::ChunkInterface>, bool> chk = cr.chunk(tsid, c->ref);
+        EXPECT_TRUE(chk.second);
+        if(!chk.second)
+            continue;
+        auto it = chk.first->iterator();
+        while(it->next())
+            samples.push_back(it->at());
+        EXPECT_FALSE(it->error());
+    }
+    return samples;
+}
+
+}
+
+// Within one commit the samples of a series added by add() are appended
+// before those added by add_batch(), each in the order they were added. The
+// WAL replays them in the same order.
+TEST(HeadAppenderTest, MixedAddAndBatch){
+    string dir = "head_test/mixed";
+    boost::filesystem::remove_all(dir);
+    map<tagtree::TSID, Samples> expected;
+    {
+        TestHead th(dir);
+        auto app = th.h->appender();
+        ASSERT_FALSE(app->add(1, 1 * INTERVAL, 1).second);
+        ASSERT_FALSE(app->add_batch({1, 2, 1}, {2 * INTERVAL, 1 * INTERVAL, 3 * INTERVAL}, {2, 10, 3}));
+        ASSERT_FALSE(app->add(2, 2 * INTERVAL, 20).second);
+        ASSERT_FALSE(app->add_batch({3, 2}, {1 * INTERVAL, 3 * INTERVAL}, {100, 30}));
+        ASSERT_FALSE(app->add(3, 2 * INTERVAL, 200).second);
+        ASSERT_FALSE(app->commit());
+
+        expected[1] = {{1 * INTERVAL, 1}, {2 * INTERVAL, 2}, {3 * INTERVAL, 3}};
+        // The sample added by add_batch() at 1 * INTERVAL comes after the one
+        // added by add() at 2 * INTERVAL and is out of order.
+        expected[2] = {{2 * INTERVAL, 20}, {3 * INTERVAL, 30}};
+        expected[3] = {{2 * INTERVAL, 200}};
+        for(const auto & p: expected)
+            EXPECT_EQ(p.second, read_series(th.h.get(), p.first)) << "series " << p.first;
+
+        // The next commit goes on after all of them.
+        app = th.h->appender();
+        ASSERT_FALSE(app->add_batch({1, 2, 3}, {4 * INTERVAL, 4 * INTERVAL, 4 * INTERVAL}, {4, 40, 400}));
+        ASSERT_FALSE(app->add(1, 5 * INTERVAL, 5).second);
+        ASSERT_FALSE(app->commit());
+        expected[1].emplace_back(5 * INTERVAL, 5);
+        expected[2].emplace_back(4 * INTERVAL, 40);
+        expected[3].emplace_back(4 * INTERVAL, 400);
+        for(const auto & p: expected)
+            EXPECT_EQ(p.second, read_series(th.h.get(), p.first)) << "series " << p.first;
+    }
+
+    TestHead th(dir);
+    for(const auto & p: expected)
+        EXPECT_EQ(p.second, read_series(th.h.get(), p.first)) << "series " << p.first;
+}
+
+// Series only created by add() or add_batch() have no chunks until the
+// commit, gc() must keep them until then.
+TEST(HeadAppenderTest, BatchAgainstGC){
+    TestHead th("");
+    head::Head * h = th.h.get();
+    // Set the head's time range, so that commits go to a head appender.
+    {
+        auto app = h->appender();
+        ASSERT_FALSE(app->add(1, INTERVAL, 0).second);
+        ASSERT_FALSE(app->commit());
+    }
+
+    atomic<bool> stop(false);
+    atomic<int> gc_runs(0);
+    thread gc([h, &stop, &gc_runs](){
+        while(!stop.load()){
+            h->gc();
+            ++ gc_runs;
+        }
+    });
+
+    const int ROUNDS = 200;
+    const int SERIES = 64;
+    for(int round = 0; round < ROUNDS; ++ round){
+        tagtree::TSID base = 1000 + round * SERIES;
+        vector<tagtree::TSID> tsids;
+        for(int i = 0; i < SERIES; i += 2)
+            tsids.push_back(base + i);
+        vector<int64_t> ts(tsids.size(), INTERVAL);
+        vector<double> vs(tsids.size(), round);
+
+        // Half of the rounds find the series created without chunks by a
+        // rolled back appender, gc() may be removing them already.
+        if(round % 2 == 0){
+            auto app = h->appender();
+            for(int i = 0; i < SERIES; ++ i)
+                ASSERT_FALSE(app->add(base + i, INTERVAL, round).second);
+            ASSERT_FALSE(app->rollback());
+        }
+
+        auto app = h->appender();
+        ASSERT_FALSE(app->add_batch(tsids, ts, vs));
+        for(int i = 1; i < SERIES; i += 2)
+            ASSERT_FALSE(app->add(base + i, INTERVAL, round).second);
+        // Give gc() time to run over the new series.
+        this_thread::sleep_for(chrono::microseconds(200));
+        if(round % 3 == 2){
+            ASSERT_FALSE(app->rollback());
+            continue;
+        }
+        ASSERT_FALSE(app->commit());
+
+        for(int i = 0; i < SERIES; ++ i){
+            ASSERT_TRUE(h->series->get_by_id(base + i)) << "round " << round << " series " << i;
+            EXPECT_EQ(Samples({{INTERVAL, static_cast<double>(round)}}), read_series(h, base + i));
+        }
+    }
+    stop.store(true);
+    gc.join();
+    EXPECT_GT(gc_runs.load(), 0);
+
+    // Rolled back series were left without chunks and are collected.
+    h->gc();
+    EXPECT_FALSE(h->series->get_by_id(1000 + 2 * SERIES));
+    EXPECT_TRUE(h->series->get_by_id(1000 + 3 * SERIES));
+}
+
+namespace {
+
+const int64_t OOO_WINDOW = 10 * INTERVAL;
+
+head::MemSeriesPtr new_series(){
+    return head::MemSeriesPtr(new head::MemSeries(1, CHUNK_RANGE));
+}
+
+// read_chunks reads the chunks of s with their out-of-order samples merged
+// in, as HeadChunkReader does.
+Samples read_chunks(head::MemSeries * s){
+    Samples samples;
+    for(const shared_ptr<head::MemChunk> & c: s->chunks){
+        auto it = s->merge_ooo(*c)->iterator();
+        while(it->next())
+            samples.push_back(it->at());
+        EXPECT_FALSE(it->error());
+    }
+    return samples;
+}
+
+}
+
+// Samples up to the window older than the newest one are accepted, older
+// ones are rejected.
+TEST(OOOTest, Window){
+    head::MemSeriesPtr s = new_series();
+    for(int i = 0; i < 100; ++ i)
+        ASSERT_TRUE(s->append(i * INTERVAL, i, OOO_WINDOW).first);
+    // Without a window nothing older than the newest sample is accepted.
+    EXPECT_FALSE(s->append(95 * INTERVAL + 1, 0).first);
+    EXPECT_FALSE(s->append(99 * INTERVAL, 99).first);
+
+    int64_t oldest = 99 * INTERVAL - OOO_WINDOW;
+    EXPECT_EQ(head::ErrOutOfOrderSample, s->append_ooo(oldest - 1, 0, OOO_WINDOW));
+    EXPECT_FALSE(s->append(oldest - 1, 0, OOO_WINDOW).first);
+    EXPECT_TRUE(s->append(oldest + 1, 0.5, OOO_WINDOW).first);
+    EXPECT_TRUE(s->append(98 * INTERVAL + 1, 1.5, OOO_WINDOW).first);
+    ASSERT_TRUE(s->ooo);
+    EXPECT_EQ(2, s->ooo->size());
+
+    Samples expected;
+    for(int i = 0; i < 100; ++ i){
+        expected.emplace_back(i * INTERVAL, i);
+        if(i * INTERVAL == oldest)
+            expected.emplace_back(oldest + 1, 0.5);
+        if(i == 98)
+            expected.emplace_back(98 * INTERVAL + 1, 1.5);
+    }
+    EXPECT_EQ(expected, read_chunks(s.get()));
+}
+
+// A sample at the timestamp of one held in the chunk or among the
+// out-of-order ones is accepted if it repeats its value and kept once, and
+// rejected with the same error otherwise.
+TEST(OOOTest, Duplicates){
+    head::MemSeriesPtr s = new_series();
+    for(int i = 0; i < 10; ++ i)
+        ASSERT_TRUE(s->append(i * INTERVAL, i, OOO_WINDOW).first);
+    ASSERT_FALSE(s->append_ooo(5 * INTERVAL + 1, 0.5, OOO_WINDOW));
+
+    // In the chunk, the head chunk's last sample included.
+    EXPECT_EQ(head::ErrAmendSample, s->append_ooo(5 * INTERVAL, 7, OOO_WINDOW));
+    EXPECT_EQ(head::ErrAmendSample, s->append_ooo(9 * INTERVAL, 7, OOO_WINDOW));
+    EXPECT_FALSE(s->append_ooo(5 * INTERVAL, 5, OOO_WINDOW));
+    EXPECT_FALSE(s->append_ooo(9 * INTERVAL, 9, OOO_WINDOW));
+    // Among the out-of-order samples.
+    EXPECT_EQ(head::ErrAmendSample, s->append_ooo(5 * INTERVAL + 1, 7, OOO_WINDOW));
+    EXPECT_FALSE(s->append_ooo(5 * INTERVAL + 1, 0.5, OOO_WINDOW));
+    ASSERT_TRUE(s->ooo);
+    EXPECT_EQ(1, s->ooo->size());
+
+    Samples expected;
+    for(int i = 0; i < 10; ++ i){
+        expected.emplace_back(i * INTERVAL, i);
+        if(i == 5)
+            expected.emplace_back(5 * INTERVAL + 1, 0.5);
+    }
+    EXPECT_EQ(expected, read_chunks(s.get()));
+
+    // Once merged into the chunk, the out-of-order sample is checked there.
+    s->flush_ooo();
+    EXPECT_EQ(head::ErrAmendSample, s->append_ooo(5 * INTERVAL + 1, 7, OOO_WINDOW));
+    EXPECT_FALSE(s->append_ooo(5 * INTERVAL + 1, 0.5, OOO_WINDOW));
+    EXPECT_FALSE(s->ooo);
+    EXPECT_EQ(expected, read_chunks(s.get()));
+}
+
+// Out-of-order samples go to the chunk of their chunk_range, chunks keep not
+// crossing its boundaries.
+TEST(OOOTest, ChunkRangeAttribution){
+    const int64_t window = 20 * INTERVAL;
+    head::MemSeriesPtr s = new_series();
+    // The first chunk ends 3 intervals before the boundary, the second starts
+    // 2 intervals after it.
+    for(int i = -10; i <= 10; ++ i){
+        if(i > -3 && i < 2)
+            continue;
+        ASSERT_TRUE(s->append(CHUNK_RANGE + i * INTERVAL, i, window).first);
+    }
+    ASSERT_EQ(2, s->chunks.size());
+    ASSERT_EQ(CHUNK_RANGE - 3 * INTERVAL, s->chunks[0]->max_time);
+    ASSERT_EQ(CHUNK_RANGE + 2 * INTERVAL, s->chunks[1]->min_time);
+
+    // Behind the first chunk, within its range.
+    ASSERT_TRUE(s->append(CHUNK_RANGE - 1, -0.5, window).first);
+    // In the gap before the second chunk, within its range.
+    ASSERT_TRUE(s->append(CHUNK_RANGE, 0.5, window).first);
+    // Within the second chunk.
+    ASSERT_TRUE(s->append(CHUNK_RANGE + 3 * INTERVAL + 1, 3.5, window).first);
+
+    EXPECT_EQ(CHUNK_RANGE - 10 * INTERVAL, s->chunks[0]->min_time);
+    EXPECT_EQ(CHUNK_RANGE - 1, s->chunks[0]->max_time);
+    EXPECT_EQ(CHUNK_RANGE, s->chunks[1]->min_time);
+    EXPECT_EQ(CHUNK_RANGE + 10 * INTERVAL, s->chunks[1]->max_time);
+
+    Samples first = {{CHUNK_RANGE - 1, -0.5}};
+    Samples second = {{CHUNK_RANGE, 0.5}, {CHUNK_RANGE + 3 * INTERVAL + 1, 3.5}};
+    for(int i = -10; i <= 10; ++ i){
+        if(i > -3 && i < 2)
+            continue;
+        (i < 0 ? first : second).emplace_back(CHUNK_RANGE + i * INTERVAL, i);
+    }
+    sort(first.begin(), first.end());
+    sort(second.begin(), second.end());
+    s->flush_ooo();
+    ASSERT_EQ(2, s->chunks.size());
+    for(int i = 0; i < 2; ++ i){
+        Samples got;
+        auto it = s->chunks[i]->chunk->iterator();
+        while(it->next())
+            got.push_back(it->at());
+        EXPECT_EQ(i == 0 ? first : second, got);
+    }
+}
+
+// The out-of-order samples are merged into their chunks once OOO_CAPACITY of
+// them piled up, the head chunk goes on taking samples in order.
+TEST(OOOTest, FlushAtCapacity){
+    head::MemSeriesPtr s = new_series();
+    Samples expected;
+    for(int i = 0; i < 2 * head::OOO_CAPACITY + 2; i += 2){
+        ASSERT_TRUE(s->append(i * INTERVAL, i, 4 * head::OOO_CAPACITY * INTERVAL).first);
+        expected.emplace_back(i * INTERVAL, i);
+    }
+    for(int i = 1; i < 2 * head::OOO_CAPACITY; i += 2){
+        ASSERT_TRUE(s->append(i * INTERVAL, i, 4 * head::OOO_CAPACITY * INTERVAL).first);
+        expected.emplace_back(i * INTERVAL, i);
+        if(i + 2 < 2 * head::OOO_CAPACITY){
+            ASSERT_TRUE(s->ooo);
+            EXPECT_EQ(i / 2 + 1, s->ooo->size());
+        }
+    }
+    EXPECT_FALSE(s->ooo);
+    ASSERT_EQ(1, s->chunks.size());
+    EXPECT_EQ(expected.size(), s->chunks[0]->chunk->num_samples());
+
+    int64_t t = (2 * head::OOO_CAPACITY + 2) * INTERVAL;
+    ASSERT_TRUE(s->append(t, 1000).first);
+    expected.emplace_back(t, 1000);
+    sort(expected.begin(), expected.end());
+    EXPECT_EQ(expected, read_chunks(s.get()));
+}
+
+// An int chunk with a merged out-of-order value which is not integral becomes
+// a XOR chunk, the head chunk keeps taking samples after the switch.
+TEST(OOOTest, IntToXORMerge){
+    head::MemSeriesPtr s = new_series();
+    Samples expected;
+    for(int i = 0; i < 20; i += 2){
+        ASSERT_TRUE(s->append(i * INTERVAL, i, OOO_WINDOW).first);
+        expected.emplace_back(i * INTERVAL, i);
+    }
+    ASSERT_EQ(chunk::EncInt, s->chunks[0]->chunk->encoding());
+
+    // Integral out-of-order values keep the int chunk.
+    ASSERT_TRUE(s->append(17 * INTERVAL, 17, OOO_WINDOW).first);
+    expected.emplace_back(17 * INTERVAL, 17);
+    EXPECT_EQ(chunk::EncInt, s->merge_ooo(*s->chunks[0])->encoding());
+
+    ASSERT_TRUE(s->append(15 * INTERVAL, 15.25, OOO_WINDOW).first);
+    expected.emplace_back(15 * INTERVAL, 15.25);
+    sort(expected.begin(), expected.end());
+    EXPECT_EQ(chunk::EncXOR, s->merge_ooo(*s->chunks[0])->encoding());
+    EXPECT_EQ(chunk::EncInt, s->chunks[0]->chunk->encoding());
+    EXPECT_EQ(expected, read_chunks(s.get()));
+
+    s->flush_ooo();
+    EXPECT_EQ(chunk::EncXOR, s->chunks[0]->chunk->encoding());
+    ASSERT_TRUE(s->append(20 * INTERVAL, 20, OOO_WINDOW).first);
+    ASSERT_TRUE(s->append(21 * INTERVAL, 21.5, OOO_WINDOW).first);
+    expected.emplace_back(20 * INTERVAL, 20);
+    expected.emplace_back(21 * INTERVAL, 21.5);
+    ASSERT_EQ(1, s->chunks.size());
+    EXPECT_EQ(expected, read_chunks(s.get()));
+}
+
+// Through the head, out-of-order samples are read merged in by
+// HeadChunkReader and come back from the WAL.
+TEST(OOOTest, Head){
+    string dir = "head_test/ooo";
+    boost::filesystem::remove_all(dir);
+    Samples expected;
+    {
+        TestHead th(dir, OOO_WINDOW);
+        auto app = th.h->appender();
+        for(int i = 0; i < 50; i += 2){
+            ASSERT_FALSE(app->add(1, i * INTERVAL, i).second);
+            expected.emplace_back(i * INTERVAL, i);
+        }
+        ASSERT_FALSE(app->commit());
+        app = th.h->appender();
+        for(int i = 41; i < 50; i += 2){
+            ASSERT_FALSE(app->add(1, i * INTERVAL, i + 0.5).second);
+            expected.emplace_back(i * INTERVAL, i + 0.5);
+        }
+        // Out of the window and a duplicate with another value.
+        ASSERT_FALSE(app->add(1, 30 * INTERVAL, 0).second);
+        ASSERT_FALSE(app->add(1, 44 * INTERVAL, 0).second);
+        ASSERT_FALSE(app->commit());
+        sort(expected.begin(), expected.end());
+        EXPECT_EQ(expected, read_series(th.h.get(), 1));
+    }
+
+    TestHead th(dir, OOO_WINDOW);
+    EXPECT_EQ(expected, read_series(th.h.get(), 1));
+}
+
+namespace {
+
+int num_chunks(head::Head * h, tagtree::TSID tsid){
+    head::HeadIndexReader ir(h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    vector<shared_ptr<chunk::ChunkMeta>> chunks;
+    ir.series(tsid, chunks);
+    return chunks.size();
+}
+
+}
+
+// A sample added to a member on its own is kept, the series leaves its group
+// and the next row forms the group again.
+TEST(GroupTest, MemberLeaves){
+    TestHead th("");
+    auto app = th.h->appender();
+    ASSERT_FALSE(app->add_group({2, 1}, 1 * INTERVAL, {20, 10}));
+    ASSERT_FALSE(app->add_group({1, 2}, 2 * INTERVAL, {11, 21}));
+    ASSERT_FALSE(app->commit());
+    ASSERT_FALSE(app->add(1, 3 * INTERVAL, 12).second);
+    ASSERT_FALSE(app->commit());
+    ASSERT_FALSE(app->add_group({1, 2}, 4 * INTERVAL, {13, 23}));
+    ASSERT_FALSE(app->commit());
+
+    EXPECT_EQ(Samples({{1 * INTERVAL, 10}, {2 * INTERVAL, 11}, {3 * INTERVAL, 12}, {4 * INTERVAL, 13}}), read_series(th.h.get(), 1));
+    EXPECT_EQ(Samples({{1 * INTERVAL, 20}, {2 * INTERVAL, 21}, {4 * INTERVAL, 23}}), read_series(th.h.get(), 2));
+    EXPECT_EQ(3, num_chunks(th.h.get(), 1));
+    EXPECT_EQ(2, num_chunks(th.h.get(), 2));
+}
+
+// Rows not newer than the samples of their members are rejected by
+// add_group(), be these in the head or pending in the appender.
+TEST(GroupTest, OutOfOrderRow){
+    TestHead th("");
+    auto app = th.h->appender();
+    ASSERT_FALSE(app->add(2, 5 * INTERVAL, 0).second);
+    ASSERT_FALSE(app->commit());
+    EXPECT_EQ(head::ErrOutOfOrderSample, app->add_group({1, 2}, 5 * INTERVAL, {1, 2}));
+    ASSERT_FALSE(app->add_group({1, 3}, 6 * INTERVAL, {1, 3}));
+    EXPECT_EQ(head::ErrOutOfOrderSample, app->add_group({1, 3}, 6 * INTERVAL, {1, 3}));
+    EXPECT_EQ(head::ErrOutOfOrderSample, app->add_group({3, 4}, 5 * INTERVAL, {3, 4}));
+    ASSERT_FALSE(app->commit());
+
+    EXPECT_EQ(Samples({{6 * INTERVAL, 1}}), read_series(th.h.get(), 1));
+    EXPECT_EQ(Samples({{5 * INTERVAL, 0}}), read_series(th.h.get(), 2));
+    EXPECT_EQ(Samples({{6 * INTERVAL, 3}}), read_series(th.h.get(), 3));
+    EXPECT_EQ(Samples(), read_series(th.h.get(), 4));
+}
+
+// Groups are only formed at commit, a rolled back row leaves the groups of
+// its members alone.
+TEST(GroupTest, Rollback){
+    TestHead th("");
+    auto app = th.h->appender();
+    ASSERT_FALSE(app->add_group({1, 2}, 1 * INTERVAL, {10, 20}));
+    ASSERT_FALSE(app->commit());
+    ASSERT_FALSE(app->add_group({1, 3}, 2 * INTERVAL, {11, 31}));
+    ASSERT_FALSE(app->rollback());
+    ASSERT_FALSE(app->add_group({1, 2}, 3 * INTERVAL, {12, 22}));
+    ASSERT_FALSE(app->commit());
+
+    EXPECT_EQ(Samples({{1 * INTERVAL, 10}, {3 * INTERVAL, 12}}), read_series(th.h.get(), 1));
+    EXPECT_EQ(1, num_chunks(th.h.get(), 1));
+    EXPECT_EQ(Samples(), read_series(th.h.get(), 3));
+}
+
+// Groups are not kept across restarts, their rows come back from the WAL as
+// samples of the members.
+TEST(GroupTest, Restart){
+    string dir = "head_test/group";
+    boost::filesystem::remove_all(dir);
+    map<tagtree::TSID, Samples> expected;
+    {
+        TestHead th(dir);
+        auto app = th.h->appender();
+        for(int i = 0; i < 10; ++ i)
+            ASSERT_FALSE(app->add_group({1, 2, 3}, i * INTERVAL, {double(i), i + 0.5, 3.0}));
+        ASSERT_FALSE(app->commit());
+        ASSERT_FALSE(app->add(2, 10 * INTERVAL, 10).second);
+        ASSERT_FALSE(app->add_group({1, 3}, 11 * INTERVAL, {11, 3}));
+        ASSERT_FALSE(app->commit());
+        for(tagtree::TSID tsid = 1; tsid <= 3; ++ tsid)
+            expected[tsid] = read_series(th.h.get(), tsid);
+    }
+
+    TestHead th(dir);
+    for(tagtree::TSID tsid = 1; tsid <= 3; ++ tsid)
+        EXPECT_EQ(expected[tsid], read_series(th.h.get(), tsid));
+    EXPECT_EQ(11u, expected[1].size());
+    EXPECT_EQ(11u, expected[2].size());
+}
+
+// Slots of an open group are read while rows are appended, the size and the
+// bytes of a chunk always match.
+TEST(GroupTest, ReadWhileAppending){
+    TestHead th("");
+    const int rows = 2000;
+    thread writer([&th](){
+        auto app = th.h->appender();
+        for(int i = 0; i < rows; ++ i){
+            ASSERT_FALSE(app->add_group({1, 2}, i * 1000, {double(i), -double(i)}));
+            ASSERT_FALSE(app->commit());
+        }
+    });
+
+    int last = 0;
+    while(last < rows){
+        head::HeadIndexReader ir(th.h.get(), numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+        head::HeadChunkReader cr(th.h.get(), numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+        vector<shared_ptr<chunk::ChunkMeta>> chunks;
+        if(!ir.series(1, chunks))
+            continue;
+        int n = 0;
+        for(const shared_ptr<chunk::ChunkMeta> & c: chunks){
+            pair<shared_ptr<chunk::ChunkInterface>, bool> chk = cr.chunk(1, c->ref);
+            ASSERT_TRUE(chk.second);
+            chunk::XORChunk copy(chk.first->bytes(), chk.first->size());
+            auto it = copy.iterator();
+            while(it->next()){
+                ASSERT_EQ(n * 1000, it->at().first);
+                ASSERT_EQ(n, it->at().second);
+                ++ n;
+            }
+            ASSERT_FALSE(it->error());
+        }
+        ASSERT_GE(n, last);
+        last = n;
+    }
+    writer.join();
+}
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "tsdbutil/RecordDecoder.hpp"
+#include "tsdbutil/RecordEncoder.hpp"
+
+using namespace std;
+using namespace tsdb;
+
+namespace {
+
+// Values are compared bit by bit, so that NaNs match.
+void expect_samples_eq(const vector<tsdbutil::RefSample> & expected, const vector<tsdbutil::RefSample> & got){
+    ASSERT_EQ(expected.size(), got.size());
+    for(size_t i = 0; i < expected.size(); ++ i){
+        EXPECT_EQ(expected[i].tsid, got[i].tsid) << "sample " << i;
+        EXPECT_EQ(expected[i].t, got[i].t) << "sample " << i;
+        EXPECT_EQ(0, memcmp(&expected[i].v, &got[i].v, sizeof(double))) << "sample " << i;
+    }
+}
+
+vector<uint8_t> encode(const vector<tsdbutil::RefSample> & samples){
+    vector<uint8_t> rec;
+    tsdbutil::RecordEncoder::compact_samples(samples, rec);
+    return rec;
+}
+
+// A scrape of 1000 series with values of all kinds.
+vector<tsdbutil::RefSample> scrape(){
+    vector<tsdbutil::RefSample> samples;
+    mt19937_64 rng(7);
+    double special[] = {0.0, -0.0, 1.0, -1.0, numeric_limits<double>::quiet_NaN(),
+                        numeric_limits<double>::infinity(), -numeric_limits<double>::infinity(),
+                        numeric_limits<double>::denorm_min(), numeric_limits<double>::max()};
+    for(int i = 0; i < 1000; ++ i){
+        double v;
+        if(i % 3 == 0)
+            v = static_cast<double>(rng() % 100000);
+        else if(i % 3 == 1)
+            v = special[i % 9];
+        else
+            v = (rng() % 1000000) / 7.0;
+        samples.emplace_back(i * 3 + 1, 1600000000000, v);
+    }
+    return samples;
+}
+
+}
+
+TEST(RecordTest, CompactSamplesRoundtrip){
+    vector<tsdbutil::RefSample> samples = scrape();
+    vector<uint8_t> rec = encode(samples);
+    ASSERT_FALSE(rec.empty());
+    EXPECT_EQ(tsdbutil::RECORD_COMPACT_SAMPLES, rec[0]);
+
+    vector<tsdbutil::RefSample> decoded;
+    error::Error err = tsdbutil::RecordDecoder::samples(rec.data(), rec.size(), decoded);
+    ASSERT_FALSE(err) << err.error();
+    expect_samples_eq(samples, decoded);
+
+    decoded.clear();
+    err = tsdbutil::RecordDecoder::samples(rec, decoded);
+    ASSERT_FALSE(err) << err.error();
+    expect_samples_eq(samples, decoded);
+
+    // The columnar encoder writes the same record.
+    vector<tagtree::TSID> tsids;
+    vector<int64_t> ts;
+    vector<double> vs;
+    for(const tsdbutil::RefSample & s: samples){
+        tsids.push_back(s.tsid);
+        ts.push_back(s.t);
+        vs.push_back(s.v);
+    }
+    vector<uint8_t> columnar;
+    tsdbutil::RecordEncoder::compact_samples(&tsids[0], &ts[0], &vs[0], tsids.size(), columnar);
+    EXPECT_EQ(rec, columnar);
+}
+
+TEST(RecordTest, CompactSamplesSingleAndEmpty){
+    vector<tsdbutil::RefSample> samples;
+    EXPECT_TRUE(encode(samples).empty());
+
+    samples.emplace_back(numeric_limits<tagtree::TSID>::max(), numeric_limits<int64_t>::min(), -1.5);
+    vector<uint8_t> rec = encode(samples);
+    vector<tsdbutil::RefSample> decoded;
+    error::Error err = tsdbutil::RecordDecoder::samples(rec.data(), rec.size(), decoded);
+    ASSERT_FALSE(err) << err.error();
+    expect_samples_eq(samples, decoded);
+}
+
+// Unsorted samples come back grouped by series in increasing id order, the
+// samples of a series in the order they were added.
+TEST(RecordTest, CompactSamplesUnsorted){
+    vector<tsdbutil::RefSample> samples;
+    mt19937_64 rng(11);
+    for(int round = 0; round < 5; ++ round){
+        for(int i = 0; i < 200; ++ i)
+            samples.emplace_back(rng() % 300 + 1, 1000 * round + rng() % 3, (rng() % 1000) / 10.0);
+    }
+    // Timestamps going backwards within a series are kept as they are.
+    samples.emplace_back(5, -1000, 1);
+    samples.emplace_back(5, -2000, 2);
+
+    vector<uint8_t> rec = encode(samples);
+    vector<tsdbutil::RefSample> decoded;
+    error::Error err = tsdbutil::RecordDecoder::samples(rec.data(), rec.size(), decoded);
+    ASSERT_FALSE(err) << err.error();
+
+    vector<tsdbutil::RefSample> expected = samples;
+    stable_sort(expected.begin(), expected.end(), [](const tsdbutil::RefSample & lhs, const tsdbutil::RefSample & rhs){
+        return lhs.tsid < rhs.tsid;
+    });
+    expect_samples_eq(expected, decoded);
+}
+
+TEST(RecordTest, CompactSamplesTruncated){
+    vector<tsdbutil::RefSample> samples = scrape();
+    samples.emplace_back(1, 1600000015000, 3);
+    vector<uint8_t> rec = encode(samples);
+    for(size_t len = 0; len < rec.size(); ++ len){
+        vector<tsdbutil::RefSample> decoded;
+        EXPECT_TRUE(tsdbutil::RecordDecoder::samples(rec.data(), len, decoded)) << "length " << len;
+    }
+}
+
+TEST(RecordTest, CompactSamplesCorrupted){
+    vector<tsdbutil::RefSample> samples;
+    samples.emplace_back(1, 10, 1);
+    samples.emplace_back(2, 10, 2);
+    vector<uint8_t> rec = encode(samples);
+    // type, base_time, num_runs = 1, length = 2, delta = 0, num_series = 2,
+    // id_delta = 1, num_samples = 1, value header, ...
+    ASSERT_EQ(1, rec[2]);
+    ASSERT_EQ(2, rec[3]);
+    ASSERT_EQ(2, rec[5]);
+    ASSERT_EQ(1, rec[7]);
+
+    vector<tsdbutil::RefSample> decoded;
+    vector<uint8_t> bad = rec;
+
+    // More runs than bytes left.
+    bad[2] = 100;
+    EXPECT_TRUE(tsdbutil::RecordDecoder::samples(bad.data(), bad.size(), decoded));
+
+    // Fewer timestamps than samples.
+    bad = rec;
+    bad[3] = 1;
+    EXPECT_TRUE(tsdbutil::RecordDecoder::samples(bad.data(), bad.size(), decoded));
+
+    // More timestamps than samples.
+    bad = rec;
+    bad[3] = 3;
+    EXPECT_TRUE(tsdbutil::RecordDecoder::samples(bad.data(), bad.size(), decoded));
+
+    // More samples than bytes left.
+    bad = rec;
+    bad[7] = 100;
+    EXPECT_TRUE(tsdbutil::RecordDecoder::samples(bad.data(), bad.size(), decoded));
+
+    // Leading and trailing zero bytes of more than 8 bytes.
+    bad = rec;
+    bad[8] = 0x99;
+    EXPECT_TRUE(tsdbutil::RecordDecoder::samples(bad.data(), bad.size(), decoded));
+
+    // Bytes behind the last series.
+    bad = rec;
+    bad.push_back(0);
+    EXPECT_TRUE(tsdbutil::RecordDecoder::samples(bad.data(), bad.size(), decoded));
+}
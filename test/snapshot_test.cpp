@@ -0,0 +1,272 @@
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/Checksum.hpp"
+#include "base/Endian.hpp"
+#include "base/ThreadPool.hpp"
+#include "head/Head.hpp"
+#include "head/HeadChunkReader.hpp"
+#include "head/HeadIndexReader.hpp"
+#include "head/HeadSnapshot.hpp"
+#include "wal/checkpoint.hpp"
+#include "wal/WAL.hpp"
+
+using namespace std;
+using namespace tsdb;
+
+namespace {
+
+const int64_t CHUNK_RANGE = 3600 * 1000;
+const int64_t INTERVAL = 15000;
+// Series 1 to 3 end within the range appenders still accept after series 4.
+const int64_t BASE = 900 * INTERVAL;
+
+typedef map<tagtree::TSID, vector<pair<int64_t, double>>> SeriesSamples;
+
+class TestHead{
+public:
+    shared_ptr<base::ThreadPool> pool;
+    unique_ptr<head::Head> h;
+
+    TestHead(const string & dir){
+        pool.reset(new base::ThreadPool());
+        pool->start(2);
+        unique_ptr<wal::WAL> w(new wal::WAL(dir + "/wal", pool));
+        h.reset(new head::Head(CHUNK_RANGE, std::move(w), pool, 10 * INTERVAL, dir + "/chunks"));
+    }
+};
+
+// add appends the samples to the head and to expected, which is kept
+// sorted by time.
+void add(head::Head * h, SeriesSamples * expected, tagtree::TSID tsid, int64_t t, double v){
+    auto app = h->appender();
+    ASSERT_FALSE(app->add(tsid, t, v).second);
+    ASSERT_FALSE(app->commit());
+    vector<pair<int64_t, double>> & samples = (*expected)[tsid];
+    samples.insert(upper_bound(samples.begin(), samples.end(), make_pair(t, v)), make_pair(t, v));
+}
+
+vector<pair<int64_t, double>> read_series(head::Head * h, tagtree::TSID tsid){
+    vector<pair<int64_t, double>> samples;
+    head::HeadIndexReader ir(h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    head::HeadChunkReader cr(h, numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max());
+    vector<shared_ptr<chunk::ChunkMeta>> chunks;
+    if(!ir.series(tsid, chunks))
+        return samples;
+    for(const shared_ptr<chunk::ChunkMeta> & c: chunks){
+        pair<shared_ptr<chunk::ChunkInterface>, bool> chk = cr.chunk(tsid, c->ref);
+        EXPECT_TRUE(chk.second);
+        if(!chk.second)
+            continue;
+        auto it = chk.first->iterator();
+        while(it->next())
+            samples.push_back(it->at());
+    }
+    return samples;
+}
+
+void expect_head_eq(head::Head * h, const SeriesSamples & expected){
+    for(const auto & p: expected)
+        EXPECT_EQ(p.second, read_series(h, p.first)) << "series " << p.first;
+}
+
+// fill adds
+//   1: integral values, its open head chunk is an int chunk,
+//   2: float values, its open head chunk is a XOR chunk,
+//   3: out-of-order samples within the window,
+//   4: enough samples for chunks spilled to the chunk mapper.
+void fill(head::Head * h, SeriesSamples * expected){
+    for(int i = 0; i < 1000; ++ i)
+        add(h, expected, 4, i * INTERVAL, i % 13 + 0.5);
+    for(int i = 0; i < 50; ++ i){
+        add(h, expected, 1, BASE + i * INTERVAL, i * 3);
+        add(h, expected, 2, BASE + i * INTERVAL, i / 7.0);
+        add(h, expected, 3, BASE + i * 2 * INTERVAL, i);
+    }
+    for(int i = 0; i < 4; ++ i)
+        add(h, expected, 3, BASE + (95 - i * 2) * INTERVAL, -i);
+}
+
+string snapshot_file(const string & dir){
+    pair<pair<string, int>, error::Error> sp = head::last_snapshot(dir + "/wal");
+    EXPECT_FALSE(sp.second) << sp.second.error();
+    return sp.first.first;
+}
+
+vector<uint8_t> read_file(const string & name){
+    ifstream in(name, ios::binary);
+    return vector<uint8_t>((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+void write_file(const string & name, const vector<uint8_t> & data){
+    ofstream out(name, ios::binary | ios::trunc);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+}
+
+TEST(SnapshotTest, CloseReopen){
+    string dir = "snapshot_test/reopen";
+    boost::filesystem::remove_all(dir);
+    SeriesSamples expected;
+    {
+        TestHead th(dir);
+        ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+        fill(th.h.get(), &expected);
+        ASSERT_GT(th.h->series->get_by_id(4)->chunks.size(), 3);
+        ASSERT_FALSE(th.h->snapshot());
+    }
+    ASSERT_FALSE(snapshot_file(dir).empty());
+
+    TestHead th(dir);
+    ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+    expect_head_eq(th.h.get(), expected);
+    EXPECT_EQ(0, th.h->MinTime());
+    EXPECT_EQ(999 * INTERVAL, th.h->MaxTime());
+    // The snapshot is stale once the WAL is written on.
+    EXPECT_TRUE(head::last_snapshot(dir + "/wal").second);
+
+    // The open head chunks were reopened, samples go on into them.
+    head::MemSeriesPtr s1 = th.h->series->get_by_id(1);
+    head::MemSeriesPtr s2 = th.h->series->get_by_id(2);
+    size_t n1 = s1->chunks.size();
+    size_t n2 = s2->chunks.size();
+    EXPECT_EQ(chunk::EncInt, s1->chunks.back()->chunk->encoding());
+    EXPECT_EQ(chunk::EncXOR, s2->chunks.back()->chunk->encoding());
+    add(th.h.get(), &expected, 1, BASE + 50 * INTERVAL, 150);
+    add(th.h.get(), &expected, 2, BASE + 50 * INTERVAL, 0.25);
+    EXPECT_EQ(n1, s1->chunks.size());
+    EXPECT_EQ(n2, s2->chunks.size());
+    expect_head_eq(th.h.get(), expected);
+}
+
+// A snapshot is stale if a checkpoint at or after its segment exists, the
+// head then replays the checkpoint and the WAL instead.
+TEST(SnapshotTest, StaleSnapshot){
+    string dir = "snapshot_test/stale";
+    boost::filesystem::remove_all(dir);
+    SeriesSamples expected;
+    {
+        TestHead th(dir);
+        ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+        fill(th.h.get(), &expected);
+        ASSERT_FALSE(th.h->snapshot());
+    }
+    string name = snapshot_file(dir);
+    vector<uint8_t> snapshot = read_file(name);
+    {
+        TestHead th(dir);
+        ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+        for(int i = 1000; i < 1100; ++ i)
+            add(th.h.get(), &expected, 4, i * INTERVAL, i);
+    }
+
+    // Checkpoint all segments, the samples logged after the snapshot are only
+    // left in the checkpoint.
+    {
+        shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+        pool->start(1);
+        wal::WAL w(dir + "/wal", pool);
+        ASSERT_FALSE(w.error());
+        pair<pair<int, int>, error::Error> segs = w.segments(dir + "/wal");
+        ASSERT_FALSE(segs.second);
+        pair<int, error::Error> cut = w.cut_segment();
+        ASSERT_FALSE(cut.second);
+        pair<wal::CheckpointStats, error::Error> ckp = wal::checkpoint(
+            &w, segs.first.first, cut.first - 1, [](tagtree::TSID){ return true; },
+            numeric_limits<int64_t>::min());
+        ASSERT_FALSE(ckp.second) << ckp.second.error();
+        ASSERT_FALSE(w.truncate(cut.first));
+    }
+    write_file(name, snapshot);
+
+    TestHead th(dir);
+    ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+    expect_head_eq(th.h.get(), expected);
+    EXPECT_TRUE(head::last_snapshot(dir + "/wal").second);
+}
+
+// A section failing its CRC makes the whole snapshot invalid before any of it
+// is loaded.
+TEST(SnapshotTest, CorruptedSectionCRC){
+    string dir = "snapshot_test/crc";
+    boost::filesystem::remove_all(dir);
+    SeriesSamples expected;
+    {
+        TestHead th(dir);
+        ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+        fill(th.h.get(), &expected);
+        ASSERT_FALSE(th.h->snapshot());
+    }
+    string name = snapshot_file(dir);
+    vector<uint8_t> snapshot = read_file(name);
+    // The first section starts right after the header.
+    snapshot[8 + 9] ^= 0x1;
+    write_file(name, snapshot);
+    ASSERT_TRUE(head::SnapshotReader(name).error());
+
+    TestHead th(dir);
+    ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+    expect_head_eq(th.h.get(), expected);
+}
+
+// A section with a valid CRC may still not decode. The series loaded from the
+// other sections are cleared again and the whole WAL is replayed.
+TEST(SnapshotTest, UndecodableSection){
+    string dir = "snapshot_test/decode";
+    boost::filesystem::remove_all(dir);
+    SeriesSamples expected;
+    {
+        TestHead th(dir);
+        ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+        fill(th.h.get(), &expected);
+        // More series than fit into one section.
+        auto app = th.h->appender();
+        for(tagtree::TSID tsid = 100; tsid < 100 + head::SNAPSHOT_SECTION_SERIES; ++ tsid)
+            ASSERT_FALSE(app->add(tsid, 999 * INTERVAL, tsid).second);
+        ASSERT_FALSE(app->commit());
+        for(tagtree::TSID tsid = 100; tsid < 100 + head::SNAPSHOT_SECTION_SERIES; ++ tsid)
+            expected[tsid].emplace_back(999 * INTERVAL, tsid);
+        ASSERT_FALSE(th.h->snapshot());
+    }
+    string name = snapshot_file(dir);
+    vector<uint8_t> snapshot = read_file(name);
+    size_t size = snapshot.size();
+    uint64_t table = base::get_uint64_big_endian(&snapshot[size - 8]);
+    uint32_t num_sections = base::get_uint32_big_endian(&snapshot[table]);
+    ASSERT_EQ(2, num_sections);
+
+    // Give the first chunk of the last section an unknown encoding, then fix
+    // up the CRCs.
+    uint8_t * entry = &snapshot[table + 4 + 20];
+    uint64_t off = base::get_uint64_big_endian(entry);
+    uint64_t len = base::get_uint64_big_endian(entry + 8);
+    const uint8_t * p = &snapshot[off + 9];
+    int decoded = 0;
+    for(int i = 0; i < 5; ++ i){
+        // first_chunk, next_at, num_chunks, mint and maxt.
+        base::decode_unsigned_varint(p, decoded, len);
+        p += decoded;
+    }
+    snapshot[p - snapshot.data()] = 0x7f;
+    base::put_uint32_big_endian(entry + 16, base::GetCrc32(&snapshot[off], len));
+    base::put_uint32_big_endian(&snapshot[table + 4 + 2 * 20],
+                                base::GetCrc32(&snapshot[table], 4 + 2 * 20));
+    write_file(name, snapshot);
+    head::SnapshotReader reader(name);
+    ASSERT_FALSE(reader.error()) << reader.error().error();
+    EXPECT_TRUE(reader.read_section(1, [](head::SnapshotSeries &){}));
+
+    TestHead th(dir);
+    ASSERT_FALSE(th.h->init(numeric_limits<int64_t>::min()));
+    expect_head_eq(th.h.get(), expected);
+    EXPECT_EQ(0, th.h->MinTime());
+    EXPECT_EQ(999 * INTERVAL, th.h->MaxTime());
+    // The snapshot is not loaded a second time.
+    EXPECT_TRUE(head::last_snapshot(dir + "/wal").second);
+}
@@ -1,12 +1,55 @@
 #include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
 // #include <google/profiler.h>
 
 void db_bench();
 void xorchunk_bench();
+void intchunk_bench();
+void chimpchunk_bench();
+void head_contention_bench();
+void head_batch_bench();
+void wal_compression_bench();
 
+namespace {
+
+struct Bench{
+    const char * name;
+    void (*run)();
+};
+
+const Bench BENCHES[] = {
+    {"db", db_bench},
+    {"xorchunk", xorchunk_bench},
+    {"intchunk", intchunk_bench},
+    {"chimpchunk", chimpchunk_bench},
+    {"head_contention", head_contention_bench},
+    {"head_batch", head_batch_bench},
+    {"wal_compression", wal_compression_bench},
+};
+
+}
+
+// Benchmarks run instead of the tests when TSDB_BENCH lists their names,
+// separated by commas, or is "all", e.g. TSDB_BENCH=intchunk,xorchunk.
 int main(int argc, char *argv[]){
     ::testing::InitGoogleTest(&argc, argv);
-    ::testing::GTEST_FLAG(filter) = "DBTest*";
-    // db_bench();
-    return RUN_ALL_TESTS();
-}
\ No newline at end of file
+    const char * env = getenv("TSDB_BENCH");
+    if(env == nullptr || *env == '\0')
+        return RUN_ALL_TESTS();
+
+    std::string benches = std::string(",") + env + ",";
+    int ran = 0;
+    for(const Bench & b: BENCHES){
+        if(benches != ",all," && benches.find(std::string(",") + b.name + ",") == std::string::npos)
+            continue;
+        b.run();
+        ++ ran;
+    }
+    if(ran == 0){
+        fprintf(stderr, "no benchmark matches TSDB_BENCH=%s\n", env);
+        return 1;
+    }
+    return 0;
+}
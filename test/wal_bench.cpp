@@ -0,0 +1,106 @@
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "base/ThreadPool.hpp"
+#include "tsdbutil/RecordDecoder.hpp"
+#include "tsdbutil/RecordEncoder.hpp"
+#include "test/TestUtils.hpp"
+#include "wal/WAL.hpp"
+
+using namespace std;
+using namespace tsdb;
+
+namespace {
+
+const int WAL_BENCH_SERIES = 10000;
+const int WAL_BENCH_SCRAPES = 200;
+const int64_t WAL_BENCH_INTERVAL = 15000;
+
+// One record per scrape of all the series, counters mostly growing by small
+// integer amounts and gauges drifting around a level.
+vector<vector<uint8_t>> scrape_records(bool compact){
+    mt19937_64 rng(0);
+    vector<tagtree::TSID> tsids(WAL_BENCH_SERIES);
+    vector<int64_t> ts(WAL_BENCH_SERIES);
+    vector<double> vs(WAL_BENCH_SERIES);
+    for(int i = 0; i < WAL_BENCH_SERIES; ++ i){
+        tsids[i] = i + 1;
+        vs[i] = (i % 2 == 0) ? rng() % 100000 : 0.5 + (rng() % 1000) / 10.0;
+    }
+    vector<vector<uint8_t>> recs(WAL_BENCH_SCRAPES);
+    for(int k = 0; k < WAL_BENCH_SCRAPES; ++ k){
+        for(int i = 0; i < WAL_BENCH_SERIES; ++ i){
+            ts[i] = k * WAL_BENCH_INTERVAL;
+            if(i % 2 == 0)
+                vs[i] += rng() % 10;
+            else
+                vs[i] += (static_cast<int>(rng() % 21) - 10) / 100.0;
+        }
+        if(compact)
+            tsdbutil::RecordEncoder::compact_samples(&tsids[0], &ts[0], &vs[0], WAL_BENCH_SERIES, recs[k]);
+        else{
+            vector<tsdbutil::RefSample> samples;
+            for(int i = 0; i < WAL_BENCH_SERIES; ++ i)
+                samples.emplace_back(tsids[i], ts[i], vs[i]);
+            tsdbutil::RecordEncoder::samples(samples, recs[k]);
+        }
+    }
+    return recs;
+}
+
+uint64_t dir_bytes(const string & dir){
+    uint64_t bytes = 0;
+    for(boost::filesystem::directory_iterator it(dir); it != boost::filesystem::directory_iterator(); ++ it)
+        bytes += boost::filesystem::file_size(it->path());
+    return bytes;
+}
+
+}
+
+// wal_compression_bench writes the same scrapes to a WAL with and without
+// record compression, for both sample record formats, and reports the bytes
+// written and the time to read and decode them back.
+void wal_compression_bench(){
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+    pool->start(2);
+    for(bool compact: {false, true}){
+        vector<vector<uint8_t>> recs = scrape_records(compact);
+        for(bool compress: {false, true}){
+            string dir = "wal_bench/wal";
+            boost::filesystem::remove_all("wal_bench");
+
+            auto s = chrono::steady_clock::now();
+            {
+                wal::WAL w(dir, pool, wal::SEGMENT_SIZE, wal::SYNC_NONE, wal::DEFAULT_SYNC_INTERVAL, compress);
+                ASSERT_FALSE(w.error());
+                for(const vector<uint8_t> & rec: recs)
+                    ASSERT_FALSE(w.log(rec));
+            }
+            double write_secs = chrono::duration<double>(chrono::steady_clock::now() - s).count();
+            uint64_t bytes = dir_bytes(dir);
+
+            s = chrono::steady_clock::now();
+            uint64_t samples = 0;
+            {
+                wal::SegmentReader r(dir);
+                vector<tsdbutil::RefSample> rs;
+                while(r.next()){
+                    pair<uint8_t *, int> rec = r.record();
+                    rs.clear();
+                    ASSERT_FALSE(tsdbutil::RecordDecoder::samples(rec.first, rec.second, rs));
+                    samples += rs.size();
+                }
+                ASSERT_FALSE(r.error());
+            }
+            double read_secs = chrono::duration<double>(chrono::steady_clock::now() - s).count();
+            ASSERT_EQ(static_cast<uint64_t>(WAL_BENCH_SERIES) * WAL_BENCH_SCRAPES, samples);
+
+            TEST_COUT << "records=" << (compact ? "compact" : "plain") << " compression=" << compress
+                      << " bytes=" << bytes << " write=" << write_secs << "s replay=" << read_secs << "s" << endl;
+        }
+    }
+    boost::filesystem::remove_all("wal_bench");
+}
@@ -0,0 +1,258 @@
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base/Checksum.hpp"
+#include "base/Endian.hpp"
+#include "base/ThreadPool.hpp"
+#include "wal/WAL.hpp"
+
+using namespace std;
+using namespace tsdb;
+
+namespace {
+
+const int TEST_SEGMENT_SIZE = 4 * 32 * 1024;
+
+// Records of distinct, easily told apart content.
+vector<uint8_t> test_record(int i, int size){
+    vector<uint8_t> rec(size);
+    for(int j = 0; j < size; ++ j)
+        rec[j] = static_cast<uint8_t>(i * 31 + j);
+    return rec;
+}
+
+vector<vector<uint8_t>> read_all(const string & dir, error::Error * err){
+    vector<vector<uint8_t>> recs;
+    wal::SegmentReader r(dir);
+    while(r.next()){
+        pair<uint8_t *, int> rec = r.record();
+        recs.emplace_back(rec.first, rec.first + rec.second);
+    }
+    *err = r.error();
+    return recs;
+}
+
+// Records zlib shrinks to about a third, random bytes of a small alphabet.
+vector<uint8_t> compressible_record(int seed, int size){
+    mt19937_64 rng(seed);
+    vector<uint8_t> rec(size);
+    for(int j = 0; j < size; ++ j)
+        rec[j] = "abcd"[rng() % 4];
+    return rec;
+}
+
+vector<uint8_t> read_file(const string & name){
+    ifstream in(name, ios::binary);
+    return vector<uint8_t>((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+void write_file(const string & name, const vector<uint8_t> & data){
+    ofstream out(name, ios::binary | ios::trunc);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+// single_record_segment writes a segment holding one full record of the
+// given type in its first page.
+void single_record_segment(const string & dir, wal::RECORD_TYPE type, const vector<uint8_t> & rec){
+    boost::filesystem::remove_all(dir);
+    boost::filesystem::create_directories(dir);
+    vector<uint8_t> page(wal::PAGE_SIZE, 0);
+    page[0] = type;
+    base::put_uint16_big_endian(&page[1], rec.size());
+    base::put_uint32_big_endian(&page[3], base::GetCrc32(rec));
+    copy(rec.begin(), rec.end(), page.begin() + wal::HEADER_SIZE);
+    write_file(wal::segment_name(dir, 0), page);
+}
+
+int count_recycled(const string & dir){
+    int n = 0;
+    boost::filesystem::directory_iterator end_itr;
+    for(boost::filesystem::directory_iterator itr(dir); itr != end_itr; ++ itr){
+        string name = itr->path().filename().string();
+        if(name.compare(0, wal::RECYCLED_PREFIX.length(), wal::RECYCLED_PREFIX) == 0)
+            ++ n;
+    }
+    return n;
+}
+
+}
+
+// A recycled segment is zeroed and as large as the segment size. If the
+// process dies while writing it, ~WAL() does not trim its tail and the
+// replay has to read through the zero pages.
+TEST(WALTest, RecycledSegmentReplaysAfterCrash){
+    string dir = "wal_test/recycle";
+    boost::filesystem::remove_all(dir);
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+    pool->start(2);
+
+    {
+        wal::WAL w(dir, pool, TEST_SEGMENT_SIZE);
+        ASSERT_FALSE(w.error());
+        for(int i = 0; i < 40; ++ i)
+            ASSERT_FALSE(w.log(test_record(i, 10000)));
+        pair<int, error::Error> cut = w.cut_segment();
+        ASSERT_FALSE(cut.second);
+        ASSERT_FALSE(w.truncate(cut.first));
+    }
+    int recycled = count_recycled(dir);
+    ASSERT_GT(recycled, 0);
+
+    // The WAL is never closed, as if the process crashed.
+    wal::WAL * w = new wal::WAL(dir, pool, TEST_SEGMENT_SIZE);
+    ASSERT_FALSE(w->error());
+    vector<vector<uint8_t>> logged;
+    for(int i = 0; i < 20; ++ i){
+        logged.push_back(test_record(100 + i, 10000));
+        ASSERT_FALSE(w->log(logged.back()));
+    }
+    // The records went on into a recycled segment.
+    EXPECT_LT(count_recycled(dir), recycled);
+    pair<pair<int, int>, error::Error> segs = w->segments(dir);
+    ASSERT_FALSE(segs.second);
+    EXPECT_EQ(static_cast<uintmax_t>(TEST_SEGMENT_SIZE),
+              boost::filesystem::file_size(wal::segment_name(dir, segs.first.second)));
+
+    error::Error err;
+    vector<vector<uint8_t>> replayed = read_all(dir, &err);
+    ASSERT_FALSE(err) << err.error();
+    EXPECT_EQ(logged, replayed);
+}
+
+// A compressed record larger than two pages is split into FIRST, MIDDLE and
+// LAST fragments all marked as compressed. Small and incompressible records
+// of the same WAL are written as they are.
+TEST(WALTest, CompressedFragmentsReplay){
+    string dir = "wal_test/compressed";
+    boost::filesystem::remove_all(dir);
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+    pool->start(2);
+
+    vector<vector<uint8_t>> logged;
+    logged.push_back(compressible_record(1, 400000));
+    logged.push_back(test_record(2, 100));
+    logged.push_back(test_record(3, 100000));
+    logged.push_back(compressible_record(4, 10000));
+    {
+        wal::WAL w(dir, pool, 64 * wal::PAGE_SIZE, wal::SYNC_NONE, wal::DEFAULT_SYNC_INTERVAL, true);
+        ASSERT_FALSE(w.error());
+        for(const vector<uint8_t> & rec: logged)
+            ASSERT_FALSE(w.log(rec));
+    }
+    // Uncompressed records follow in a WAL reopened without compression.
+    {
+        wal::WAL w(dir, pool, 64 * wal::PAGE_SIZE);
+        ASSERT_FALSE(w.error());
+        logged.push_back(compressible_record(5, 300000));
+        ASSERT_FALSE(w.log(logged.back()));
+    }
+
+    pair<vector<wal::SegmentRef>, error::Error> segs = wal::list_segments(dir);
+    ASSERT_FALSE(segs.second);
+    ASSERT_EQ(2, segs.first.size());
+    vector<uint8_t> seg = read_file(segs.first[0].name);
+    ASSERT_GT(seg.size(), 3 * wal::PAGE_SIZE);
+    EXPECT_EQ(wal::RECORD_FIRST | wal::RECORD_COMPRESSED_MASK, seg[0]);
+    EXPECT_EQ(wal::RECORD_MIDDLE | wal::RECORD_COMPRESSED_MASK, seg[wal::PAGE_SIZE]);
+    EXPECT_EQ(wal::RECORD_MIDDLE | wal::RECORD_COMPRESSED_MASK, seg[2 * wal::PAGE_SIZE]);
+    seg = read_file(segs.first[1].name);
+    EXPECT_EQ(wal::RECORD_FIRST, seg[0]);
+
+    error::Error err;
+    vector<vector<uint8_t>> replayed = read_all(dir, &err);
+    ASSERT_FALSE(err) << err.error();
+    EXPECT_EQ(logged, replayed);
+
+    // The fragments of a record have to agree on the compression.
+    seg = read_file(segs.first[0].name);
+    seg[wal::PAGE_SIZE] = wal::RECORD_MIDDLE;
+    write_file(segs.first[0].name, seg);
+    replayed = read_all(dir, &err);
+    EXPECT_TRUE(err);
+    EXPECT_TRUE(replayed.empty());
+}
+
+TEST(WALTest, CompressedRecordLengthGuard){
+    string dir = "wal_test/guard";
+
+    // A length zlib cannot reach from the 102 bytes of the record.
+    vector<uint8_t> rec(100, 0);
+    int n = base::encode_unsigned_varint(rec.data(), 200000);
+    ASSERT_EQ(3, n);
+    rec.resize(n + 99);
+    single_record_segment(dir, wal::RECORD_FULL | wal::RECORD_COMPRESSED_MASK, rec);
+    error::Error err;
+    vector<vector<uint8_t>> replayed = read_all(dir, &err);
+    EXPECT_TRUE(replayed.empty());
+    ASSERT_TRUE(err);
+    EXPECT_NE(string::npos, err.error().find("invalid compressed record length")) << err.error();
+
+    // A length within the bound but not matching the data.
+    rec.assign(100, 0);
+    n = base::encode_unsigned_varint(rec.data(), 1000);
+    rec.resize(n + 99);
+    single_record_segment(dir, wal::RECORD_FULL | wal::RECORD_COMPRESSED_MASK, rec);
+    replayed = read_all(dir, &err);
+    EXPECT_TRUE(replayed.empty());
+    ASSERT_TRUE(err);
+    EXPECT_NE(string::npos, err.error().find("decompress record")) << err.error();
+
+    // The same bytes uncompressed are a valid record.
+    single_record_segment(dir, wal::RECORD_FULL, rec);
+    replayed = read_all(dir, &err);
+    ASSERT_FALSE(err) << err.error();
+    ASSERT_EQ(1, replayed.size());
+    EXPECT_EQ(rec, replayed[0]);
+}
+
+// Pinned records stay valid after the reader released the pages behind it
+// and moved on to the next segment.
+TEST(WALTest, PinnedRecords){
+    string dir = "wal_test/pinned";
+    boost::filesystem::remove_all(dir);
+    shared_ptr<base::ThreadPool> pool(new base::ThreadPool());
+    pool->start(2);
+
+    vector<vector<uint8_t>> logged;
+    {
+        wal::WAL w(dir, pool, 256 * wal::PAGE_SIZE);
+        ASSERT_FALSE(w.error());
+        for(int i = 0; i < 4000; ++ i){
+            logged.push_back(test_record(i, 3000));
+            ASSERT_FALSE(w.log(logged.back()));
+        }
+    }
+
+    wal::SegmentReader r(dir);
+    vector<shared_ptr<const void>> pins;
+    vector<pair<uint8_t *, int>> pinned;
+    vector<vector<uint8_t>> copied;
+    while(r.next()){
+        pair<uint8_t *, int> rec = r.record();
+        shared_ptr<const void> pin = r.pin();
+        if(pin){
+            pins.push_back(pin);
+            pinned.push_back(rec);
+            copied.emplace_back();
+        }
+        else
+            copied.emplace_back(rec.first, rec.first + rec.second);
+    }
+    ASSERT_FALSE(r.error()) << r.error().error();
+    ASSERT_EQ(logged.size(), copied.size());
+    EXPECT_GT(pinned.size(), logged.size() / 2);
+
+    size_t j = 0;
+    for(size_t i = 0; i < logged.size(); ++ i){
+        if(!copied[i].empty()){
+            EXPECT_EQ(logged[i], copied[i]);
+            continue;
+        }
+        ASSERT_EQ(logged[i], vector<uint8_t>(pinned[j].first, pinned[j].first + pinned[j].second));
+        ++ j;
+    }
+}
@@ -7,7 +7,7 @@ RECORD_ENTRY_TYPE RecordDecoder::type(const std::vector<uint8_t>& rec)
 {
     if (rec.empty()) return RECORD_INVALID;
     if (rec[0] != RECORD_SERIES && rec[0] != RECORD_SAMPLES &&
-        rec[0] != RECORD_TOMBSTONES)
+        rec[0] != RECORD_TOMBSTONES && rec[0] != RECORD_COMPACT_SAMPLES)
         return RECORD_INVALID;
     return rec[0];
 }
@@ -15,7 +15,7 @@ RECORD_ENTRY_TYPE RecordDecoder::type(const uint8_t* rec, int length)
 {
     if (length < 1) return RECORD_INVALID;
     if (rec[0] != RECORD_SERIES && rec[0] != RECORD_SAMPLES &&
-        rec[0] != RECORD_TOMBSTONES)
+        rec[0] != RECORD_TOMBSTONES && rec[0] != RECORD_COMPACT_SAMPLES)
         return RECORD_INVALID;
     return rec[0];
 }
@@ -187,6 +187,8 @@ error::Error RecordDecoder::series(const uint8_t* rec, int length,
 error::Error RecordDecoder::samples(const std::vector<uint8_t>& rec,
                                     std ::vector<RefSample>& refsamples)
 {
+    if (!rec.empty() && rec[0] == RECORD_COMPACT_SAMPLES)
+        return compact_samples(rec.data(), rec.size(), refsamples);
     tsdbutil::DecBuf decbuf(&(rec[0]), rec.size());
 
     if (decbuf.get_byte() != RECORD_SAMPLES)
@@ -214,6 +216,8 @@ error::Error RecordDecoder::samples(const std::vector<uint8_t>& rec,
 error::Error RecordDecoder::samples(const uint8_t* rec, int length,
                                     std::vector<RefSample>& refsamples)
 {
+    if (length > 0 && rec[0] == RECORD_COMPACT_SAMPLES)
+        return compact_samples(rec, length, refsamples);
     tsdbutil::DecBuf decbuf(rec, length);
 
     if (decbuf.get_byte() != RECORD_SAMPLES)
@@ -325,6 +329,86 @@ error::Error RecordDecoder::samples(const uint8_t* rec, int length,
 //     return error::Error();
 // }
 
+// ┌──────────────────────────────────────────────────────────────────┐
+// │ type = 7 <1b>                                                    │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ base_time <varint>                                               │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ num_runs <uvarint>                                               │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ ┌─────────────────────┬────────────────────────────────────────┐ │
+// │ │ length <uvarint>    │ timestamp - base_time <varint>         │ │
+// │ └─────────────────────┴────────────────────────────────────────┘ │
+// │                              . . .                               │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ num_series <uvarint>                                             │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ ┌─────────────────────┬────────────────────────────────────────┐ │
+// │ │ id_delta <uvarint>  │ num_samples <uvarint>                  │ │
+// │ ├─────────────────────┴──┬─────────────────────────────────────┤ │
+// │ │ lead << 4 | trail <1b> │ xor <8 - lead - trail bytes>        │ │
+// │ └────────────────────────┴─────────────────────────────────────┘ │
+// │                              . . .                               │
+// └──────────────────────────────────────────────────────────────────┘
+error::Error RecordDecoder::compact_samples(const uint8_t* rec, int length,
+                                            std::vector<RefSample>& refsamples)
+{
+    tsdbutil::DecBuf decbuf(rec, length);
+
+    if (decbuf.get_byte() != RECORD_COMPACT_SAMPLES)
+        return error::Error("invalid record type");
+    int64_t base_time = decbuf.get_signed_variant();
+
+    // Every run and value takes at least one byte.
+    uint64_t num_runs = decbuf.get_unsigned_variant();
+    if (num_runs > decbuf.len()) return error::Error("invalid number of runs");
+    std::vector<std::pair<uint64_t, int64_t>> runs;
+    runs.reserve(num_runs);
+    for (uint64_t i = 0; i < num_runs; ++i) {
+        uint64_t l = decbuf.get_unsigned_variant();
+        int64_t t = base_time + decbuf.get_signed_variant();
+        runs.emplace_back(l, t);
+    }
+
+    uint64_t num_series = decbuf.get_unsigned_variant();
+    size_t run = 0;
+    uint64_t left = runs.empty() ? 0 : runs[0].first;
+    tagtree::TSID tsid = 0;
+    for (uint64_t i = 0; i < num_series && decbuf.error() == NO_ERR; ++i) {
+        tsid += decbuf.get_unsigned_variant();
+        uint64_t n = decbuf.get_unsigned_variant();
+        if (n > decbuf.len()) return error::Error("invalid number of samples");
+        uint64_t prev = 0;
+        for (uint64_t j = 0; j < n; ++j) {
+            while (left == 0 && run + 1 < runs.size())
+                left = runs[++run].first;
+            if (left == 0) return error::Error("timestamps exhausted");
+            --left;
+
+            uint8_t c = decbuf.get_byte();
+            int lead = c >> 4;
+            int trail = c & 0xf;
+            if (lead + trail > 8) return error::Error("invalid value header");
+            uint64_t x = 0;
+            for (int k = lead + trail; k < 8; ++k)
+                x = x << 8 | decbuf.get_byte();
+            if (trail < 8) x <<= trail * 8;
+            prev ^= x;
+            refsamples.emplace_back(tsid, runs[run].second,
+                                    base::decode_double(prev));
+        }
+    }
+
+    if (decbuf.error() != NO_ERR) return error::Error(decbuf.error_str());
+    // Every timestamp belongs to a sample.
+    if (left > 0 || run + 1 < runs.size())
+        return error::Error("timestamps left in entry");
+    if (decbuf.len() > 0)
+        return error::Error("unexpected " + std::to_string(decbuf.len()) +
+                            " bytes left in entry");
+    return error::Error();
+}
+
 // ┌─────────────────────────────────────────────────────┐
 // │ type = 3 <1b>                                       │
 // ├─────────────────────────────────────────────────────┤
@@ -344,10 +428,12 @@ error::Error RecordDecoder::tombstones(const std::vector<uint8_t>& rec,
         return error::Error("invalid record type");
 
     while (decbuf.len() > 0 && decbuf.error() == NO_ERR) {
-        stones.emplace_back(
-            decbuf.get_tsid(),
-            tombstone::Intervals(
-                {{decbuf.get_signed_variant(), decbuf.get_signed_variant()}}));
+        // The order in which arguments are evaluated is unspecified, read the
+        // fields one by one.
+        tagtree::TSID tsid = decbuf.get_tsid();
+        int64_t mint = decbuf.get_signed_variant();
+        int64_t maxt = decbuf.get_signed_variant();
+        stones.emplace_back(tsid, tombstone::Intervals({{mint, maxt}}));
     }
 
     if (decbuf.error() != NO_ERR) return error::Error(decbuf.error_str());
@@ -365,10 +451,12 @@ error::Error RecordDecoder::tombstones(const uint8_t* rec, int length,
         return error::Error("invalid record type");
 
     while (decbuf.len() > 0 && decbuf.error() == NO_ERR) {
-        stones.emplace_back(
-            decbuf.get_tsid(),
-            tombstone::Intervals(
-                {{decbuf.get_signed_variant(), decbuf.get_signed_variant()}}));
+        // The order in which arguments are evaluated is unspecified, read the
+        // fields one by one.
+        tagtree::TSID tsid = decbuf.get_tsid();
+        int64_t mint = decbuf.get_signed_variant();
+        int64_t maxt = decbuf.get_signed_variant();
+        stones.emplace_back(tsid, tombstone::Intervals({{mint, maxt}}));
     }
 
     if (decbuf.error() != NO_ERR) return error::Error(decbuf.error_str());
@@ -15,6 +15,10 @@ namespace tsdbutil {
 // RecordDecoder decodes series, sample, and tombstone records.
 // The zero value is ready to use.
 class RecordDecoder {
+private:
+    static error::Error compact_samples(const uint8_t* rec, int length,
+                                        std::vector<RefSample>& refsamples);
+
 public:
     static RECORD_ENTRY_TYPE type(const std::vector<uint8_t>& rec);
     static RECORD_ENTRY_TYPE type(const uint8_t* rec, int length);
@@ -77,7 +81,8 @@ public:
     // │                              . . .                               │
     // └──────────────────────────────────────────────────────────────────┘
     //
-    // Samples appends samples in rec to the given slice.
+    // Samples appends samples in rec to the given slice. Compact sample
+    // records (type 7, see RecordEncoder::compact_samples) are decoded too.
     static error::Error samples(const std::vector<uint8_t>& rec,
                                 std::vector<RefSample>& refsamples);
     static error::Error samples(const uint8_t* rec, int length,
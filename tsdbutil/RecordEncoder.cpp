@@ -1,8 +1,117 @@
 #include "tsdbutil/RecordEncoder.hpp"
 
+#include <algorithm>
+
 namespace tsdb {
 namespace tsdbutil {
 
+namespace {
+
+// put_xor stores the bytes of x between its leading and trailing zero bytes.
+uint8_t* put_xor(uint8_t* p, uint64_t x)
+{
+    if (x == 0) {
+        *p++ = 8 << 4;
+        return p;
+    }
+    int lead = __builtin_clzll(x) / 8;
+    int trail = __builtin_ctzll(x) / 8;
+    *p++ = static_cast<uint8_t>(lead << 4 | trail);
+    for (int i = 7 - lead; i >= trail; --i)
+        *p++ = static_cast<uint8_t>(x >> (i * 8));
+    return p;
+}
+
+struct RefSampleColumns {
+    const RefSample* s;
+
+    tagtree::TSID tsid(int i) const { return s[i].tsid; }
+    int64_t t(int i) const { return s[i].t; }
+    double v(int i) const { return s[i].v; }
+};
+
+struct SampleColumns {
+    const tagtree::TSID* tsids;
+    const int64_t* ts;
+    const double* vs;
+
+    tagtree::TSID tsid(int i) const { return tsids[i]; }
+    int64_t t(int i) const { return ts[i]; }
+    double v(int i) const { return vs[i]; }
+};
+
+// <tsid, position> of unsorted samples. Sorting the pairs keeps the order
+// within a series without the buffer of a stable sort. Kept per thread so that
+// encoding does not allocate once warmed up.
+thread_local std::vector<std::pair<tagtree::TSID, int>> compact_order;
+
+template <typename Columns>
+void encode_compact(const Columns& c, int n, std::vector<uint8_t>& rec)
+{
+    if (n == 0) return;
+    bool sorted = true;
+    for (int i = 1; i < n && sorted; ++i)
+        sorted = c.tsid(i - 1) <= c.tsid(i);
+    if (!sorted) {
+        compact_order.clear();
+        for (int i = 0; i < n; ++i)
+            compact_order.emplace_back(c.tsid(i), i);
+        std::sort(compact_order.begin(), compact_order.end());
+    }
+    auto at = [&](int i) { return sorted ? i : compact_order[i].second; };
+
+    int num_runs = 1;
+    int num_series = 1;
+    for (int i = 1; i < n; ++i) {
+        if (c.t(at(i)) != c.t(at(i - 1))) ++num_runs;
+        if (c.tsid(at(i)) != c.tsid(at(i - 1))) ++num_series;
+    }
+
+    // Write in place, the record is cut to its real size at the end.
+    size_t start = rec.size();
+    rec.resize(start + 1 + 3 * base::MAX_VARINT_LEN_64 +
+               2 * base::MAX_VARINT_LEN_64 * (num_runs + num_series) + 9 * n);
+    uint8_t* p = rec.data() + start;
+
+    *p++ = RECORD_COMPACT_SAMPLES;
+    int64_t base_time = c.t(at(0));
+    p += base::encode_signed_varint(p, base_time);
+
+    p += base::encode_unsigned_varint(p, num_runs);
+    int run = 1;
+    for (int i = 1; i <= n; ++i) {
+        if (i < n && c.t(at(i)) == c.t(at(i - 1))) {
+            ++run;
+            continue;
+        }
+        p += base::encode_unsigned_varint(p, run);
+        p += base::encode_signed_varint(p, c.t(at(i - 1)) - base_time);
+        run = 1;
+    }
+
+    p += base::encode_unsigned_varint(p, num_series);
+    tagtree::TSID last_tsid = 0;
+    int i = 0;
+    while (i < n) {
+        tagtree::TSID tsid = c.tsid(at(i));
+        int j = i + 1;
+        while (j < n && c.tsid(at(j)) == tsid)
+            ++j;
+        p += base::encode_unsigned_varint(p, tsid - last_tsid);
+        p += base::encode_unsigned_varint(p, j - i);
+        uint64_t prev = 0;
+        for (; i < j; ++i) {
+            uint64_t v = base::encode_double(c.v(at(i)));
+            p = put_xor(p, v ^ prev);
+            prev = v;
+        }
+        last_tsid = tsid;
+    }
+    rec.resize(p - rec.data());
+}
+
+} // namespace
+
 // ┌────────────────────────────────────────────┐
 // │ type = 1 <1b>                              │
 // ├────────────────────────────────────────────┤
@@ -22,14 +131,15 @@ namespace tsdbutil {
 void RecordEncoder::series(const std::vector<RefSeries>& refseries,
                            std::vector<uint8_t>& rec)
 {
-    tsdbutil::EncBuf encbuf(10 * refseries.size());
-    encbuf.put_byte(RECORD_SERIES);
+    size_t start = rec.size();
+    rec.resize(start + 1 + 8 * refseries.size());
+    uint8_t* p = rec.data() + start;
+    *p++ = RECORD_SERIES;
 
     for (auto&& r : refseries) {
-        encbuf.put_tsid(r.tsid);
+        base::put_uint64_big_endian(p, static_cast<uint64_t>(r.tsid));
+        p += 8;
     }
-
-    rec.insert(rec.end(), encbuf.b.begin(), encbuf.b.begin() + encbuf.index);
 }
 
 // ┌────────────────────────────────────────────────┐
@@ -125,6 +235,40 @@ void RecordEncoder::samples(const std::vector<RefSample>& refsamples,
     rec.insert(rec.end(), encbuf.b.begin(), encbuf.b.begin() + encbuf.index);
 }
 
+// ┌──────────────────────────────────────────────────────────────────┐
+// │ type = 7 <1b>                                                    │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ base_time <varint>                                               │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ num_runs <uvarint>                                               │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ ┌─────────────────────┬────────────────────────────────────────┐ │
+// │ │ length <uvarint>    │ timestamp - base_time <varint>         │ │
+// │ └─────────────────────┴────────────────────────────────────────┘ │
+// │                              . . .                               │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ num_series <uvarint>                                             │
+// ├──────────────────────────────────────────────────────────────────┤
+// │ ┌─────────────────────┬────────────────────────────────────────┐ │
+// │ │ id_delta <uvarint>  │ num_samples <uvarint>                  │ │
+// │ ├─────────────────────┴──┬─────────────────────────────────────┤ │
+// │ │ lead << 4 | trail <1b> │ xor <8 - lead - trail bytes>        │ │
+// │ └────────────────────────┴─────────────────────────────────────┘ │
+// │                              . . .                               │
+// └──────────────────────────────────────────────────────────────────┘
+void RecordEncoder::compact_samples(const std::vector<RefSample>& refsamples,
+                                    std::vector<uint8_t>& rec)
+{
+    encode_compact(RefSampleColumns{refsamples.data()}, refsamples.size(), rec);
+}
+
+void RecordEncoder::compact_samples(const tagtree::TSID* tsids,
+                                    const int64_t* ts, const double* vs, int n,
+                                    std::vector<uint8_t>& rec)
+{
+    encode_compact(SampleColumns{tsids, ts, vs}, n, rec);
+}
+
 // ┌──────────────────────────────────────────────────────────────────────┐
 // │ type = 5 <1b>                                                        │
 // ├──────────────────────────────────────────────────────────────────────┤
@@ -73,6 +73,40 @@ public:
     static void samples(const std::vector<RefSample>& refsamples,
                         std::vector<uint8_t>& rec);
 
+    // ┌──────────────────────────────────────────────────────────────────┐
+    // │ type = 7 <1b>                                                    │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ base_time <varint>                                               │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ num_runs <uvarint>                                               │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ ┌─────────────────────┬────────────────────────────────────────┐ │
+    // │ │ length <uvarint>    │ timestamp - base_time <varint>         │ │
+    // │ └─────────────────────┴────────────────────────────────────────┘ │
+    // │                              . . .                               │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ num_series <uvarint>                                             │
+    // ├──────────────────────────────────────────────────────────────────┤
+    // │ ┌─────────────────────┬────────────────────────────────────────┐ │
+    // │ │ id_delta <uvarint>  │ num_samples <uvarint>                  │ │
+    // │ ├─────────────────────┴──┬─────────────────────────────────────┤ │
+    // │ │ lead << 4 | trail <1b> │ xor <8 - lead - trail bytes>        │ │
+    // │ └────────────────────────┴─────────────────────────────────────┘ │
+    // │                              . . .                               │
+    // └──────────────────────────────────────────────────────────────────┘
+    //
+    // Compact samples are grouped by series in increasing id order, keeping
+    // their order within a series. Ids are encoded as deltas to the previous
+    // series, timestamps as runs of equal timestamps, which turns a scrape
+    // into a single run. Every value is xor-ed with the previous value of its
+    // series in the record (0 for the first one), only the bytes between the
+    // leading and trailing zero bytes of the result are stored.
+    static void compact_samples(const std::vector<RefSample>& refsamples,
+                                std::vector<uint8_t>& rec);
+    static void compact_samples(const tagtree::TSID* tsids, const int64_t* ts,
+                                const double* vs, int n,
+                                std::vector<uint8_t>& rec);
+
     // ┌──────────────────────────────────────────────────────────────────────┐
     // │ type = 5 <1b>                                                        │
     // ├──────────────────────────────────────────────────────────────────────┤
@@ -31,5 +31,6 @@ const RECORD_ENTRY_TYPE RECORD_TOMBSTONES = 3;
 const RECORD_ENTRY_TYPE RECORD_GROUP_SERIES = 4;
 const RECORD_ENTRY_TYPE RECORD_GROUP_SAMPLES = 5;
 const RECORD_ENTRY_TYPE RECORD_GROUP_TOMBSTONES = 6;
+const RECORD_ENTRY_TYPE RECORD_COMPACT_SAMPLES = 7;
 
 }}
\ No newline at end of file
@@ -60,14 +60,14 @@ public:
     int64_t t;
     double v;
     // TODO(Alec), decide whether to add MemSeries.
-    std::shared_ptr<head::MemSeries> series;
+    head::MemSeriesPtr series;
 
     RefSample() = default;
     RefSample(tagtree::TSID tsid, int64_t t, double v)
         : tsid(tsid), t(t), v(v)
     {}
     RefSample(tagtree::TSID tsid, int64_t t, double v,
-              const std::shared_ptr<head::MemSeries>& series)
+              const head::MemSeriesPtr& series)
         : tsid(tsid), t(t), v(v), series(series)
     {}
 };
@@ -118,6 +118,7 @@ extern const RECORD_ENTRY_TYPE RECORD_TOMBSTONES;
 extern const RECORD_ENTRY_TYPE RECORD_GROUP_SERIES;
 extern const RECORD_ENTRY_TYPE RECORD_GROUP_SAMPLES;
 extern const RECORD_ENTRY_TYPE RECORD_GROUP_TOMBSTONES;
+extern const RECORD_ENTRY_TYPE RECORD_COMPACT_SAMPLES;
 
 } // namespace tsdbutil
 } // namespace tsdb
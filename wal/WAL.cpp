@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <boost/bind.hpp>
+#include <climits>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <chrono>
@@ -7,7 +8,13 @@
 #include <stdio.h>
 #include <string>
 #include <string.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <zlib.h>
 // #include <boost/algorithm/string/predicate.hpp>
 #include <iostream>
 #include <vector>
@@ -26,6 +33,41 @@ std::string segment_name(const std::string & dir, int i){
     return tsdbutil::filepath_join(dir, (boost::format("%08d") % i).str());
 }
 
+std::string recycled_name(const std::string & dir, int i){
+    return tsdbutil::filepath_join(dir, (boost::format(RECYCLED_PREFIX + "%08d") % i).str());
+}
+
+namespace{
+
+const uint8_t zero_page[32 * 1024] = {0};
+
+// zero_file zeroes the file and syncs it. FALLOC_FL_ZERO_RANGE zeroes it
+// without writing the data and keeps the blocks allocated, so that writing
+// the file again does not allocate blocks. File systems without it get the
+// zeros written.
+error::Error zero_file(int fd, off_t size){
+    if(fallocate(fd, FALLOC_FL_ZERO_RANGE, 0, size) != 0){
+        if(errno != EOPNOTSUPP)
+            return error::Error("error fallocate: " + std::string(strerror(errno)));
+        std::vector<uint8_t> zeros(1024 * 1024, 0);
+        off_t off = 0;
+        while(off < size){
+            ssize_t written = pwrite(fd, zeros.data(), std::min(static_cast<off_t>(zeros.size()), size - off), off);
+            if(written < 0){
+                if(errno == EINTR)
+                    continue;
+                return error::Error("error pwrite: " + std::string(strerror(errno)));
+            }
+            off += written;
+        }
+    }
+    if(fdatasync(fd) != 0)
+        return error::Error("error fdatasync: " + std::string(strerror(errno)));
+    return error::Error();
+}
+
+}
+
 void close_segment(std::shared_ptr<Segment> segment){
     auto t0 = std::chrono::high_resolution_clock::now();
     if(segment->get_close())
@@ -44,27 +86,19 @@ void close_segment(std::shared_ptr<Segment> segment){
 Segment::Segment(const std::string & dir, int index, bool write): dir_(dir), index_(index), closed(true) {
     std::string name = segment_name(dir, index);
     if(write){
-        f = fopen(name.c_str(), "ab");
-        if(!f){
+        // Segments are only opened for writing while they are empty, either
+        // new or recycled and zeroed. The writer writes at explicit offsets,
+        // the file is not opened for appending as it may be preallocated.
+        int fd = ::open(name.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd < 0){
             err_.set("Cannot open segment file: " + name);
             return;
         }
-
-        // If the last page is torn, fill it with zeros.
-        // In case it was torn after all records were written successfully, this
-        // will just pad the page and everything will be fine.
-        // If it was torn mid-record, a full read (which the caller should do anyway
-        // to ensure integrity) will detect it as a corruption by the end.
-        int size_ = ftell(f);
-        if((size_ = size_ % PAGE_SIZE) != 0){
-            LOG_WARN << "msg=\"last page of the wal is torn, filling it with zeros\""
-                << " segment=", name;
-            std::vector<char> pad_zero(PAGE_SIZE - size_, 0);
-            if(fwrite(&(pad_zero[0]), 1, PAGE_SIZE - size_, f) != PAGE_SIZE - size_){
-                fclose(f);
-                err_.set("error zero-padding torn page");
-                return;
-            }
+        f = fdopen(fd, "r+b");
+        if(!f){
+            ::close(fd);
+            err_.set("Cannot open segment file: " + name);
+            return;
         }
     }
     else{
@@ -148,7 +182,22 @@ std::pair<std::vector<SegmentRef>, error::Error> list_segments(const std::string
     return {r, error::Error()};
 }
 
-WAL::WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool_, int segment_size): dir_(dir), pool_(pool_), segment_size(segment_size), done_pages(0){
+WAL::WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool_, int segment_size, SyncPolicy sync_policy, int sync_interval, bool compress):
+        dir_(dir),
+        segment_size(segment_size),
+        segment_offset(0),
+        done_pages(0),
+        pool_(pool_),
+        sync_policy(sync_policy),
+        sync_interval(sync_interval),
+        unsynced(false),
+        last_sync(std::chrono::steady_clock::now()),
+        queue_cond_(queue_mutex_),
+        done_cond_(queue_mutex_),
+        enqueued(0),
+        completed(0),
+        stopping(false),
+        compress_(compress){
     if(!boost::filesystem::create_directories(dir)){
         LOG_INFO << "WAL Directory existed: " << dir;
     }
@@ -164,13 +213,25 @@ WAL::WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool
 
     page = std::unique_ptr<Page>(new Page());
 
-    std::shared_ptr<Segment> segment_(new Segment(dir, rp.first.second));
+    load_recycled();
+
+    // Records are never appended to a segment written before, the WAL starts
+    // over with a new one unless the last is empty.
+    int index = rp.first.second;
+    if(boost::filesystem::exists(segment_name(dir, index)) && boost::filesystem::file_size(segment_name(dir, index)) > 0)
+        ++ index;
+    std::shared_ptr<Segment> segment_(new Segment(dir, index));
     if(segment_->err_){
         err_.set(segment_->err_);
         return;
     }
 
     err_.set(set_segment(segment_));
+    if(err_)
+        return;
+
+    writer.reset(new base::Thread(boost::bind(&WAL::run_writer, this), "wal-writer"));
+    writer->start();
 }
 
 std::pair<std::pair<int, int>, error::Error> WAL::segments(const std::string & dir){
@@ -184,12 +245,65 @@ std::pair<std::pair<int, int>, error::Error> WAL::segments(const std::string & d
 
 error::Error WAL::set_segment(const std::shared_ptr<Segment> & s){
     segment = s;
-    if(fseek(s->f, 0L, SEEK_END) != 0)
-        return error::Error("error seek");
-    int size_ = ftell(s->f);
-    if(fseek(s->f, 0L, SEEK_SET) != 0)
-        return error::Error("error seek");
-    done_pages = size_ / PAGE_SIZE;
+    done_pages = 0;
+    segment_offset = 0;
+
+    // Allocate the whole segment up front, so that writing it does not grow
+    // the file. A recycled segment is allocated already.
+    int fd = fileno(s->f);
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+        return error::Error("error fstat: " + std::string(strerror(errno)));
+    if(st.st_size < segment_size && fallocate(fd, 0, 0, segment_size) != 0)
+        LOG_WARN << "msg=\"cannot preallocate WAL segment\" segment=" << segment_name(s->dir_, s->index_) << " err=" << strerror(errno);
+    return error::Error();
+}
+
+void WAL::load_recycled(){
+    boost::filesystem::directory_iterator end_itr;
+    for(boost::filesystem::directory_iterator itr(dir_); itr != end_itr; ++ itr){
+        std::string name = itr->path().filename().string();
+        if(name.compare(0, RECYCLED_PREFIX.length(), RECYCLED_PREFIX) != 0)
+            continue;
+        // Segments interrupted while being zeroed and those of another
+        // segment size are dropped.
+        if(!tsdbutil::is_number(name.substr(RECYCLED_PREFIX.length())) ||
+            recycled.size() >= MAX_RECYCLED_SEGMENTS ||
+            boost::filesystem::file_size(itr->path()) != static_cast<uintmax_t>(segment_size)){
+            std::remove(itr->path().string().c_str());
+            continue;
+        }
+        recycled.push_back(itr->path().string());
+    }
+}
+
+error::Error WAL::recycle(const SegmentRef & ref){
+    {
+        base::RWLockGuard lock(mutex_, 0);
+        if(recycled.size() >= MAX_RECYCLED_SEGMENTS || boost::filesystem::file_size(ref.name) != static_cast<uintmax_t>(segment_size)){
+            if(std::remove(ref.name.c_str()) != 0)
+                return error::Error("error remove " + ref.name);
+            return error::Error();
+        }
+    }
+    // The segment is zeroed under a temporary name, it is only picked up
+    // once it is entirely zero.
+    std::string name = recycled_name(dir_, ref.index);
+    std::string tmp = name + ".tmp";
+    boost::filesystem::rename(ref.name, tmp);
+    int fd = ::open(tmp.c_str(), O_WRONLY);
+    if(fd < 0)
+        return error::Error("error open " + tmp);
+    error::Error err = zero_file(fd, segment_size);
+    ::close(fd);
+    if(err){
+        std::remove(tmp.c_str());
+        return error::wrap(err, "zero recycled segment");
+    }
+    boost::filesystem::rename(tmp, name);
+
+    base::RWLockGuard lock(mutex_, 1);
+    recycled.push_back(name);
     return error::Error();
 }
 
@@ -201,7 +315,17 @@ error::Error WAL::next_segment(){
         if(err)
             return err;
     }
+    error::Error err = write_pages();
+    if(err)
+        return err;
     // std::cerr << "segment->index_ " << segment->index_ << std::endl;
+    if(!recycled.empty()){
+        boost::system::error_code ec;
+        boost::filesystem::rename(recycled.back(), segment_name(dir_, segment->index_ + 1), ec);
+        if(ec)
+            LOG_WARN << "msg=\"cannot reuse recycled segment\" segment=" << recycled.back() << " err=" << ec.message();
+        recycled.pop_back();
+    }
     std::shared_ptr<Segment> next(new Segment(dir_, segment->index_ + 1));
     if(next->err_)
         return error::wrap(next->err_, "create new segment file");
@@ -209,119 +333,115 @@ error::Error WAL::next_segment(){
     // Don't block further writes by fsyncing the last segment.
     pool_->run(boost::bind(&close_segment, segment));
     
-    error::Error err = set_segment(next);
+    unsynced = false;
+    err = set_segment(next);
     if(err)
         return err;
 
     return error::Error();
 }
 
-// flush_page writes the new contents of the page to disk. If no more records will fit into
-// the page, the remaining bytes will be set to zero and a new page will be started.
+std::pair<int, error::Error> WAL::cut_segment(){
+    base::RWLockGuard lock(mutex_, 1);
+    if(!segment)
+        return {0, error::Error("no active segment")};
+    if(done_pages > 0 || page->alloc > 0){
+        error::Error err = next_segment();
+        if(err)
+            return {0, err};
+    }
+    return {segment->index_, error::Error()};
+}
+
+// flush_page hands the page to the writer once no more records fit into it,
+// the remaining bytes are left zero and a new page is started.
 // If clear is true, this is enforced regardless of how many bytes are left in the page.
 error::Error WAL::flush_page(bool clear){
     clear = clear || page->full();
+    if(!clear || page->alloc == 0)
+        return error::Error();
 
-    // No more data will fit into the page. Enqueue and clear it.
-    if(clear && page->alloc > 0){
-        page->alloc = PAGE_SIZE; // Write till end of page.
-    }
-    int to_write = page->alloc - page->flushed;
-    if(fwrite(page->buf_ + page->flushed, 1, to_write, segment->f) != to_write)
-        return error::Error("error fwrite");
-    page->flushed += to_write;
-
-    // We flushed an entire page, prepare a new one.
-    if(clear){
-        page->reset(true);
-        ++ done_pages;
+    // No more data will fit into the page. Write till end of page.
+    page->alloc = PAGE_SIZE;
+    full_pages.push_back(std::move(page));
+    if(free_pages.empty())
+        page.reset(new Page());
+    else{
+        page = std::move(free_pages.back());
+        free_pages.pop_back();
     }
+    ++ done_pages;
     return error::Error();
 }
 
-// log writes rec to the log and forces a flush of the current page if its
-// the final record of a batch, the record is bigger than the page size or
-// the current page is full.
-error::Error WAL::log(const std::vector<uint8_t> & rec, bool final){
-    base::RWLockGuard lock(mutex_, 1);
-
-    // If the record is too big to fit within the active page in the current
-    // segment, terminate the active segment and advance to the next one.
-    // This ensures that records do not cross segment boundaries.
-    int available = page->remaining() - HEADER_SIZE + (PAGE_SIZE - HEADER_SIZE) * (segment_size / PAGE_SIZE - done_pages - 1);
-    // std::cerr << "done_pages: " << done_pages << " page->remaining(): " << page->remaining() << " available: " << available << " rec.size(): " << rec.size() << std::endl;
-    // NOTICE(Alec), Here need to cast to int first because available may be negative.
-    if(static_cast<int>(rec.size()) > available){
-        error::Error err = next_segment();
-        if(err)
-            return err;
-    }
-
-    // Populate as many pages as necessary to fit the record.
-    // Be careful to always do one pass to ensure we write zero-length records.
-    int i = 0;
-    int remaining = rec.size();
-    const uint8_t * index = &(rec[0]);
-    while(i == 0 || remaining > 0){
-        // If page cannot fit the whole header, continue next page.
-        if((PAGE_SIZE - page->alloc) - HEADER_SIZE <= 0){
-            error::Error err = flush_page(true);
-            if(err)
-                return err;
+error::Error WAL::write_pages(){
+    std::vector<struct iovec> & iov = iov_;
+    iov.clear();
+    for(std::unique_ptr<Page> & p: full_pages)
+        iov.push_back({p->buf_ + p->flushed, static_cast<size_t>(PAGE_SIZE - p->flushed)});
+    if(page->alloc > page->flushed)
+        iov.push_back({page->buf_ + page->flushed, static_cast<size_t>(page->alloc - page->flushed)});
+
+    int fd = fileno(segment->f);
+    size_t i = 0;
+    while(i < iov.size()){
+        ssize_t written = pwritev(fd, &iov[i], std::min(iov.size() - i, static_cast<size_t>(IOV_MAX)), segment_offset);
+        if(written < 0){
+            if(errno == EINTR)
+                continue;
+            return error::Error("error pwritev: " + std::string(strerror(errno)));
         }
-        int l = std::min(remaining, (PAGE_SIZE - page->alloc) - HEADER_SIZE);
-        RECORD_TYPE type;
-        if(i == 0 && l == remaining)
-            type = RECORD_FULL;
-        else if(l == remaining)
-            type = RECORD_LAST;
-        else if(i == 0)
-            type = RECORD_FIRST;
-        else
-            type = RECORD_MIDDLE;
-        // LOG_INFO << "type: " << type << "remaining: " << remaining;
-        page->buf_[page->alloc ++] = type;
-        base::put_uint16_big_endian(page->buf_ + page->alloc, l);
-        page->alloc += 2;
-        uint32_t crc = base::GetCrc32(index, l);
-        base::put_uint32_big_endian(page->buf_ + page->alloc, crc);
-        page->alloc += 4;
-        // LOG_DEBUG << "remaining:" << remaining << " page->alloc:" << page->alloc << " l:" << l;
-        memcpy(page->buf_ + page->alloc, index, l);
-        // LOG_DEBUG << "after memcpy";
-        index += l;
-        remaining -= l;
-        page->alloc += l;
-
-        // By definition when a record is split it means its size is bigger than
-        // the page boundary so the current page would be full and needs to be flushed.
-        // On contrary if we wrote a full record, we can fit more records of the batch
-        // into the page before flushing it.
-        if(final || type != RECORD_FULL || page->full()){
-            error::Error err = flush_page(false);
-            if(err)
-                return err;
+        segment_offset += written;
+        unsynced = true;
+        // Skip what has been written, pwritev may stop short.
+        while(i < iov.size() && written >= static_cast<ssize_t>(iov[i].iov_len)){
+            written -= iov[i].iov_len;
+            ++ i;
+        }
+        if(written > 0){
+            iov[i].iov_base = static_cast<uint8_t *>(iov[i].iov_base) + written;
+            iov[i].iov_len -= written;
         }
-        ++ i;
     }
+
+    page->flushed = page->alloc;
+    for(std::unique_ptr<Page> & p: full_pages){
+        p->reset(true);
+        free_pages.push_back(std::move(p));
+    }
+    full_pages.clear();
     return error::Error();
 }
 
-error::Error WAL::log(const std::vector<std::vector<uint8_t>> & recs){
-    for(int i = 0; i < recs.size(); i ++){
-        error::Error err = log(recs[i], i == recs.size() - 1);
-        if(err)
-            return err;
-    }
+error::Error WAL::sync_segment(){
+    if(!segment || !unsynced)
+        return error::Error();
+    if(fdatasync(fileno(segment->f)) != 0)
+        return error::Error("error fdatasync: " + std::string(strerror(errno)));
+    unsynced = false;
+    last_sync = std::chrono::steady_clock::now();
     return error::Error();
 }
 
-error::Error WAL::log(const uint8_t * p, int length, bool final){
-    base::RWLockGuard lock(mutex_, 1);
+bool WAL::compress_record(const std::vector<uint8_t> & rec){
+    uLongf bound = compressBound(rec.size());
+    compress_buf.resize(base::MAX_VARINT_LEN_64 + bound);
+    int n = base::encode_unsigned_varint(compress_buf.data(), rec.size());
+    if(compress2(compress_buf.data() + n, &bound, rec.data(), rec.size(), Z_BEST_SPEED) != Z_OK)
+        return false;
+    if(n + bound >= rec.size())
+        return false;
+    compress_buf.resize(n + bound);
+    return true;
+}
 
+// add_record frames the record into pages. It forces the current page to the
+// writer if the record is bigger than the page size or the page is full.
+error::Error WAL::add_record(const uint8_t * p, int length, bool compressed){
     // If the record is too big to fit within the active page in the current
     // segment, terminate the active segment and advance to the next one.
     // This ensures that records do not cross segment boundaries.
+    // NOTICE(Alec), available may be negative.
     int available = page->remaining() - HEADER_SIZE + (PAGE_SIZE - HEADER_SIZE) * (segment_size / PAGE_SIZE - done_pages - 1);
     if(length > available){
         error::Error err = next_segment();
@@ -349,7 +469,7 @@ error::Error WAL::log(const uint8_t * p, int length, bool final){
             type = RECORD_FIRST;
         else
             type = RECORD_MIDDLE;
-        page->buf_[page->alloc ++] = type;
+        page->buf_[page->alloc ++] = compressed ? (type | RECORD_COMPRESSED_MASK) : type;
         base::put_uint16_big_endian(page->buf_ + page->alloc, l);
         page->alloc += 2;
         uint32_t crc = base::GetCrc32(p, l);
@@ -362,9 +482,7 @@ error::Error WAL::log(const uint8_t * p, int length, bool final){
 
         // By definition when a record is split it means its size is bigger than
         // the page boundary so the current page would be full and needs to be flushed.
-        // On contrary if we wrote a full record, we can fit more records of the batch
-        // into the page before flushing it.
-        if(final || type != RECORD_FULL || page->full()){
+        if(type != RECORD_FULL || page->full()){
             error::Error err = flush_page(false);
             if(err)
                 return err;
@@ -374,9 +492,143 @@ error::Error WAL::log(const uint8_t * p, int length, bool final){
     return error::Error();
 }
 
+// write_batch writes the records with one pwritev() and syncs them as the
+// SyncPolicy asks. An empty batch only syncs when the interval is due.
+error::Error WAL::write_batch(std::vector<std::vector<uint8_t>> & batch){
+    base::RWLockGuard lock(mutex_, 1);
+    if(!segment)
+        return error::Error("no active segment");
+    for(const std::vector<uint8_t> & rec: batch){
+        error::Error err;
+        if(compress_ && rec.size() >= COMPRESS_MIN_RECORD_SIZE && compress_record(rec))
+            err = add_record(compress_buf.data(), compress_buf.size(), true);
+        else
+            err = add_record(rec.data(), rec.size());
+        if(err)
+            return err;
+    }
+    error::Error err = write_pages();
+    if(err)
+        return err;
+
+    if(sync_policy == SYNC_BATCH ||
+        (sync_policy == SYNC_INTERVAL && std::chrono::steady_clock::now() - last_sync >= std::chrono::milliseconds(sync_interval)))
+        return sync_segment();
+    return error::Error();
+}
+
+void WAL::run_writer(){
+    std::vector<std::vector<uint8_t>> batch;
+    while(true){
+        uint64_t ticket;
+        {
+            base::MutexLockGuard lock(queue_mutex_);
+            if(queue.empty() && !stopping){
+                if(sync_policy == SYNC_INTERVAL)
+                    queue_cond_.waitForSeconds(sync_interval / 1000.0);
+                else
+                    queue_cond_.wait();
+            }
+            if(queue.empty() && stopping)
+                return;
+            batch.swap(queue);
+            ticket = enqueued;
+        }
+
+        error::Error err = write_batch(batch);
+        if(err)
+            LOG_ERROR << "msg=\"write WAL batch\" err=" << err.error();
+        if(batch.empty() && !err)
+            continue;
+
+        base::MutexLockGuard lock(queue_mutex_);
+        recycle_records(batch);
+        if(err)
+            write_err_ = err;
+        else
+            completed = ticket;
+        done_cond_.notifyAll();
+    }
+}
+
+error::Error WAL::submit(std::vector<std::vector<uint8_t>> & recs, uint64_t * ticket){
+    return submit(recs.data(), recs.size(), ticket);
+}
+
+error::Error WAL::submit(std::vector<uint8_t> * recs, int n, uint64_t * ticket){
+    base::MutexLockGuard lock(queue_mutex_);
+    if(write_err_)
+        return error::wrap(write_err_, "WAL write failed before");
+    for(int i = 0; i < n; ++ i)
+        queue.push_back(std::move(recs[i]));
+    *ticket = ++ enqueued;
+    queue_cond_.notify();
+    return error::Error();
+}
+
+std::vector<uint8_t> WAL::reserve(size_t len){
+    std::vector<uint8_t> rec;
+    {
+        base::MutexLockGuard lock(queue_mutex_);
+        if(!free_records.empty()){
+            rec = std::move(free_records.back());
+            free_records.pop_back();
+        }
+    }
+    rec.reserve(len);
+    return rec;
+}
+
+void WAL::recycle_records(std::vector<std::vector<uint8_t>> & batch){
+    for(std::vector<uint8_t> & rec: batch){
+        if(free_records.size() >= MAX_FREE_RECORD_BUFFERS)
+            break;
+        if(rec.capacity() == 0 || rec.capacity() > MAX_FREE_RECORD_BUFFER_SIZE)
+            continue;
+        rec.clear();
+        free_records.push_back(std::move(rec));
+    }
+    batch.clear();
+}
+
+error::Error WAL::wait(uint64_t ticket){
+    base::MutexLockGuard lock(queue_mutex_);
+    while(completed < ticket && !write_err_)
+        done_cond_.wait();
+    if(completed < ticket)
+        return write_err_;
+    return error::Error();
+}
+
+error::Error WAL::enqueue(std::vector<std::vector<uint8_t>> & recs){
+    uint64_t ticket;
+    error::Error err = submit(recs, &ticket);
+    if(err)
+        return err;
+    return wait(ticket);
+}
+
+error::Error WAL::log(const std::vector<uint8_t> & rec, bool final){
+    std::vector<std::vector<uint8_t>> recs(1, rec);
+    return enqueue(recs);
+}
+
+error::Error WAL::log(const std::vector<std::vector<uint8_t>> & recs){
+    std::vector<std::vector<uint8_t>> copy(recs);
+    return enqueue(copy);
+}
+
+error::Error WAL::log(const uint8_t * p, int length, bool final){
+    std::vector<std::vector<uint8_t>> recs(1, std::vector<uint8_t>(p, p + length));
+    return enqueue(recs);
+}
+
+error::Error WAL::log(std::vector<std::vector<uint8_t>> && recs){
+    return enqueue(recs);
+}
+
 // Repair attempts to repair the WAL based on the error.
 // It discards all data after the corruption.
-// No lock here.
 error::Error WAL::repair(const CorruptionError & cerr){
     // We could probably have a mode that only discards torn records right around
     // the corruption to preserve as data much as possible.
@@ -395,37 +647,43 @@ error::Error WAL::repair(const CorruptionError & cerr){
     if(sp.second)
         return sp.second;
 
-    for(auto const& ref: sp.first){
-        if(segment->index_ == ref.index){
-            flush_page(false);
-            segment.reset();
+    std::string temp_file;
+    {
+        // The records are logged again through the writer, which needs the
+        // lock, once the clean segment is in place.
+        base::RWLockGuard lock(mutex_, 1);
+        for(auto const& ref: sp.first){
+            if(segment && segment->index_ == ref.index){
+                write_pages();
+                segment.reset();
+            }
+            if(ref.index <= cerr.segment)
+                continue;
+            if(std::remove(ref.name.c_str()) != 0)
+                return error::Error("error remove " + ref.name);
+            LOG_WARN << "WAL::repair remove " << ref.name;
         }
-        if(ref.index <= cerr.segment)
-            continue;
-        if(std::remove(ref.name.c_str()) != 0)
-            return error::Error("error remove " + ref.name);
-        LOG_WARN << "WAL::repair remove " << ref.name;
-    }
-    // Regardless of the corruption offset, no record reaches into the previous segment.
-    // So we can safely repair the WAL by removing the segment and re-inserting all
-    // its records up to the corruption.
-    std::string corrupted_file = segment_name(dir_, cerr.segment);
-    if(!boost::filesystem::exists(corrupted_file))
-        return error::Error();
-    LOG_WARN << "msg=\"rewrite corrupted segment\" segment=" << cerr.segment;
-
-    std::string temp_file = corrupted_file + ".repair";
-    boost::filesystem::rename(corrupted_file, temp_file);
-    // Create a clean segment and make it the active one.
-    std::shared_ptr<Segment> s(new Segment(dir_, cerr.segment));
-    if(s->err_)
-        return s->err_;
-    error::Error err = set_segment(s);
-    if(err)
-        return err;
+        // Regardless of the corruption offset, no record reaches into the previous segment.
+        // So we can safely repair the WAL by removing the segment and re-inserting all
+        // its records up to the corruption.
+        std::string corrupted_file = segment_name(dir_, cerr.segment);
+        if(!boost::filesystem::exists(corrupted_file))
+            return error::Error();
+        LOG_WARN << "msg=\"rewrite corrupted segment\" segment=" << cerr.segment;
+
+        temp_file = corrupted_file + ".repair";
+        boost::filesystem::rename(corrupted_file, temp_file);
+        // Create a clean segment and make it the active one.
+        std::shared_ptr<Segment> s(new Segment(dir_, cerr.segment));
+        if(s->err_)
+            return s->err_;
+        error::Error err = set_segment(s);
+        if(err)
+            return err;
+
+        page->reset(true);
+    }
 
-    page->reset(true);
-    
     SegmentReader reader(temp_file, dir_, cerr.segment);
     if(reader.error())
         return error::wrap(reader.error(), "create SegmentReader");
@@ -437,7 +695,7 @@ error::Error WAL::repair(const CorruptionError & cerr){
             break;
         auto rec_pair = reader.record();
         // LOG_DEBUG << "rec length: " << rec_pair.second;
-        err = log(rec_pair.first, rec_pair.second);
+        error::Error err = log(rec_pair.first, rec_pair.second);
         if(err){
             reader.clear();
             std::remove(temp_file.c_str());
@@ -453,33 +711,50 @@ error::Error WAL::repair(const CorruptionError & cerr){
 
 // truncate drops all segments before i.
 error::Error WAL::truncate(int i){
-    if(segment->index() < i)
-        close_segment(segment);
+    {
+        base::RWLockGuard lock(mutex_, 1);
+        if(segment->index() < i)
+            close_segment(segment);
+    }
     auto refs = list_segments(dir_);
     if(refs.second)
         return refs.second;
     for(auto const& ref: refs.first){
         if(ref.index >= i)
             break;
-        if(std::remove(ref.name.c_str()) != 0)
-            return error::Error("error remove " + ref.name);
+        error::Error err = recycle(ref);
+        if(err)
+            return err;
     }
     return error::Error();
 }
 
 void WAL::sync(){
-    if(segment){
-        // flush data from user space to kernel space.
-        fflush(segment->f);
-        // flush data from kernel space to disk.
+    base::RWLockGuard lock(mutex_, 1);
+    // Records are written by the writer, only flush data from kernel space to disk.
+    if(segment)
         fsync(fileno(segment->f));
-    }
 }
 
 WAL::~WAL(){
     LOG_INFO << "close WAL: " << dir_;
+    if(writer){
+        // The writer drains the queue before exiting.
+        {
+            base::MutexLockGuard lock(queue_mutex_);
+            stopping = true;
+            queue_cond_.notify();
+        }
+        writer->join();
+    }
     base::RWLockGuard lock(mutex_, 1);
+    if(!segment)
+        return;
     flush_page(true);
+    write_pages();
+    // Cut the preallocated tail, the segment is not written anymore.
+    if(!segment->get_close() && ftruncate(fileno(segment->f), segment_offset) != 0)
+        LOG_WARN << "msg=\"cannot trim WAL segment\" segment=" << segment_name(segment->dir_, segment->index_) << " err=" << strerror(errno);
     close_segment(segment);
 }
 
@@ -506,7 +781,7 @@ error::Error validate_record(int i, RECORD_TYPE type){
     }
 }
 
-SegmentReader::SegmentReader(const std::string & dir, bool directory): segment_index(0), segment_offset(0), offset_reset(false), page_offset(0), eof(false){
+SegmentReader::SegmentReader(const std::string & dir, bool directory): segment_index(0), segment_offset(0), page_(nullptr), page_offset(0), map_(nullptr), map_size_(0), page_start_(0), dropped_(0), rec_ptr(nullptr), rec_len(0), eof(false){
     if(directory){
         std::pair<std::vector<SegmentRef>, error::Error> sp = list_segments(dir);
         if(sp.second){
@@ -529,46 +804,28 @@ SegmentReader::SegmentReader(const std::string & dir, bool directory): segment_i
             return;
         }
     }
-    if(!read_page()){
-        if(err_){
-            err_.set("read_page()");
-            return;
-        }
-    }
-    record_.reserve(PAGE_SIZE / 2);
+    init();
 }
 
-SegmentReader::SegmentReader(const SegmentRef & ref): segment_index(0), segment_offset(0), offset_reset(false), page_offset(0), eof(false){
+SegmentReader::SegmentReader(const SegmentRef & ref): segment_index(0), segment_offset(0), page_(nullptr), page_offset(0), map_(nullptr), map_size_(0), page_start_(0), dropped_(0), rec_ptr(nullptr), rec_len(0), eof(false){
     segments.emplace_back(new Segment(ref.name));
     if(segments.back()->err_){
         err_.set(segments.back()->err_);
         return;
     }
-    if(!read_page()){
-        if(err_){
-            err_.set("read_page()");
-            return;
-        }
-    }
-    record_.reserve(PAGE_SIZE / 2);
+    init();
 }
 
-SegmentReader::SegmentReader(const std::string & name, const std::string & dir, int index): segment_index(0), segment_offset(0), offset_reset(false), page_offset(0), eof(false){
+SegmentReader::SegmentReader(const std::string & name, const std::string & dir, int index): segment_index(0), segment_offset(0), page_(nullptr), page_offset(0), map_(nullptr), map_size_(0), page_start_(0), dropped_(0), rec_ptr(nullptr), rec_len(0), eof(false){
     segments.emplace_back(new Segment(name, dir, index));
     if(segments.back()->err_){
         err_.set(segments.back()->err_);
         return;
     }
-    if(!read_page()){
-        if(err_){
-            err_.set("read_page()");
-            return;
-        }
-    }
-    record_.reserve(PAGE_SIZE / 2);
+    init();
 }
 
-SegmentReader::SegmentReader(const std::deque<SegmentRange> & segs): segment_index(0), segment_offset(0), offset_reset(false), page_offset(0), eof(false){
+SegmentReader::SegmentReader(const std::deque<SegmentRange> & segs): segment_index(0), segment_offset(0), page_(nullptr), page_offset(0), map_(nullptr), map_size_(0), page_start_(0), dropped_(0), rec_ptr(nullptr), rec_len(0), eof(false){
     for(const SegmentRange & seg: segs){
         std::pair<std::vector<SegmentRef>, error::Error> sp = list_segments(seg.dir);
         if(sp.second){
@@ -590,6 +847,14 @@ SegmentReader::SegmentReader(const std::deque<SegmentRange> & segs): segment_ind
         }
         // std::cerr << "num: " << segments.size() << std::endl;
     }
+    init();
+}
+
+SegmentReader::~SegmentReader(){
+    unmap_segment();
+}
+
+void SegmentReader::init(){
     if(!read_page()){
         if(err_){
             err_.set("read_page()");
@@ -599,32 +864,86 @@ SegmentReader::SegmentReader(const std::deque<SegmentRange> & segs): segment_ind
     record_.reserve(PAGE_SIZE / 2);
 }
 
-// Read one page from current segment.
-// Pad zeros if page size < PAGE_SIZE.
-bool SegmentReader::read_page(){
-    if(segment_index == segments.size()){
-        eof = true;
+bool SegmentReader::map_segment(){
+    int fd = fileno(segments[segment_index]->f);
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        err_.set("error fstat " + segment_name(segments[segment_index]->dir_, segments[segment_index]->index_));
         return false;
     }
-    if(offset_reset){
-        offset_reset = false;
-        segment_offset = 0;
+    if(st.st_size == 0)
+        return true;
+    void * m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(m == MAP_FAILED){
+        err_.set("error mmap " + segment_name(segments[segment_index]->dir_, segments[segment_index]->index_));
+        return false;
     }
-    int read = fread(buf, 1, PAGE_SIZE, segments[segment_index]->f);
-    page_offset = 0;
-    if(read != PAGE_SIZE){
-        if(feof(segments[segment_index]->f)){
-            offset_reset = true;
+    map_ = reinterpret_cast<uint8_t *>(m);
+    map_size_ = st.st_size;
+    size_t size = map_size_;
+    mapping_.reset(map_, [size](uint8_t * p){ munmap(p, size); });
+    page_start_ = 0;
+    dropped_ = 0;
+    madvise(map_, map_size_, MADV_SEQUENTIAL);
+    return true;
+}
+
+void SegmentReader::unmap_segment(){
+    if(map_){
+        // Pinned records keep the mapping.
+        mapping_.reset();
+        pins_.clear();
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+}
+
+bool SegmentReader::read_page(){
+    if(eof)
+        return false;
+    if(map_ && page_start_ + PAGE_SIZE < map_size_){
+        page_start_ += PAGE_SIZE;
+        // Release the pages behind, the records returned from them are gone
+        // unless pinned.
+        size_t drop = page_start_;
+        while(!pins_.empty() && pins_.front().second.expired())
+            pins_.pop_front();
+        if(!pins_.empty() && pins_.front().first < drop)
+            drop = pins_.front().first;
+        if(drop > dropped_ && drop - dropped_ >= SEGMENT_READER_DROP_BYTES){
+            madvise(map_ + dropped_, drop - dropped_, MADV_DONTNEED);
+            dropped_ = drop;
+        }
+    }
+    else{
+        if(map_){
+            unmap_segment();
             ++ segment_index;
-            if(read == 0)
-                return read_page();
-            memset(buf + read, 0, PAGE_SIZE - read);
+            segment_offset = 0;
         }
-        else{
-            err_.set("error fread");
-            return false;
+        // Skip empty segments.
+        while(true){
+            if(segment_index == segments.size()){
+                eof = true;
+                return false;
+            }
+            if(!map_segment())
+                return false;
+            if(map_)
+                break;
+            ++ segment_index;
         }
     }
+
+    page_offset = 0;
+    if(page_start_ + PAGE_SIZE <= map_size_)
+        page_ = map_ + page_start_;
+    else{
+        int read = map_size_ - page_start_;
+        memcpy(buf, map_ + page_start_, read);
+        memset(buf + read, 0, PAGE_SIZE - read);
+        page_ = buf;
+    }
     return true;
 }
 
@@ -632,8 +951,11 @@ bool SegmentReader::next(){
     if(err_ || eof)
         return false;
     record_.clear();
+    rec_ptr = nullptr;
+    rec_len = 0;
 
     int i = 0;
+    bool compressed = false;
     while(true){
         // If the remaining space of the page cannot fit the whole header, continue next page.
         if(page_offset + HEADER_SIZE >= PAGE_SIZE){
@@ -644,7 +966,7 @@ bool SegmentReader::next(){
             }
         }
 
-        record_type = buf[page_offset ++];
+        record_type = page_[page_offset ++];
         // std::cerr << "type: " << record_type << std::endl;
         if(record_type == RECORD_PAGE_TERM){
             if(page_offset == PAGE_SIZE)
@@ -653,22 +975,31 @@ bool SegmentReader::next(){
             // We are pedantic and check whether the zeros are actually up
             // to a page boundary.
             // It's not strictly necessary but may catch sketchy state early.
-            for(; page_offset < PAGE_SIZE; ++ page_offset){
-                if(buf[page_offset] != 0){
-                    err_.set("unexpected non-zero byte in padded page");
-                    return false;
-                }
+            // Preallocated and recycled segments end with zero pages.
+            if(memcmp(page_ + page_offset, zero_page, PAGE_SIZE - page_offset) != 0){
+                err_.set("unexpected non-zero byte in padded page");
+                return false;
             }
+            page_offset = PAGE_SIZE;
             continue;
         }
 
+        // All the fragments of a record agree on the compression.
+        if(i == 0)
+            compressed = (record_type & RECORD_COMPRESSED_MASK) != 0;
+        else if(compressed != ((record_type & RECORD_COMPRESSED_MASK) != 0)){
+            err_.set("inconsistent compression of record fragments");
+            return false;
+        }
+        record_type &= ~RECORD_COMPRESSED_MASK;
+
         err_ = validate_record(i, record_type);
         if(err_)
             return false;
 
-        int length = base::get_uint16_big_endian(buf + page_offset);
+        int length = base::get_uint16_big_endian(page_ + page_offset);
         page_offset += 2;
-        uint32_t crc32 = base::get_uint32_big_endian(buf + page_offset);
+        uint32_t crc32 = base::get_uint32_big_endian(page_ + page_offset);
         page_offset += 4;
 
         // fix error of empty record.
@@ -679,25 +1010,56 @@ bool SegmentReader::next(){
             return false;
         }
 
-        uint32_t validate_crc32 = base::GetCrc32(buf + page_offset, length);
+        uint32_t validate_crc32 = base::GetCrc32(page_ + page_offset, length);
         if(crc32 != validate_crc32){
             err_.set("invalid checksum " + std::to_string(validate_crc32) + ", expected " + std::to_string(crc32));
             return false;
         }
-        for(int j = page_offset; j < page_offset + length; ++ j)
-            record_.push_back(buf[j]);
+        // A full record is returned in place, fragments are collected.
+        if(record_type == RECORD_FULL){
+            rec_ptr = page_ + page_offset;
+            rec_len = length;
+        }
+        else
+            record_.insert(record_.end(), page_ + page_offset, page_ + page_offset + length);
         page_offset += length;
 
         segment_offset += HEADER_SIZE + length;
 
-        if(record_type == RECORD_FULL || record_type == RECORD_LAST)
-            return true;
+        if(record_type == RECORD_FULL || record_type == RECORD_LAST){
+            if(!compressed)
+                return true;
+            if(!rec_ptr){
+                rec_ptr = record_.data();
+                rec_len = record_.size();
+            }
+            return decompress();
+        }
         // Only increment i for non-zero records since we use it
         // to determine valid content record sequences.
         ++ i;
     }
 }
 
+bool SegmentReader::decompress(){
+    int decoded = 0;
+    uint64_t length = base::decode_unsigned_varint(rec_ptr, decoded, rec_len);
+    // zlib does not compress better than about 1:1032.
+    if(decoded <= 0 || length > static_cast<uint64_t>(rec_len) * 1032){
+        err_.set("invalid compressed record length");
+        return false;
+    }
+    decompressed_.resize(length);
+    uLongf dest_len = length;
+    if(uncompress(decompressed_.data(), &dest_len, rec_ptr + decoded, rec_len - decoded) != Z_OK || dest_len != length){
+        err_.set("decompress record");
+        return false;
+    }
+    rec_ptr = decompressed_.data();
+    rec_len = length;
+    return true;
+}
+
 error::Error SegmentReader::error(){
     return err_;
 }
@@ -708,9 +1070,20 @@ CorruptionError SegmentReader::cerror(){
     return CorruptionError();
 }
 
+std::shared_ptr<const void> SegmentReader::pin(){
+    // Records copied into record_, decompressed_ or buf are not in place.
+    if(!map_ || !rec_ptr || rec_ptr < map_ || rec_ptr >= map_ + map_size_)
+        return nullptr;
+    std::shared_ptr<const void> p = std::make_shared<std::shared_ptr<uint8_t>>(mapping_);
+    pins_.emplace_back(page_start_, p);
+    return p;
+}
+
 // <ptr, length>.
 std::pair<uint8_t *, int> SegmentReader::record(){
-    return std::make_pair(&(record_[0]), record_.size());
+    if(rec_ptr)
+        return std::make_pair(const_cast<uint8_t *>(rec_ptr), rec_len);
+    return std::make_pair(record_.data(), static_cast<int>(record_.size()));
 }
 
 int SegmentReader::segment(){
@@ -725,6 +1098,7 @@ int SegmentReader::offset(){
 
 // Close all Segments.
 void SegmentReader::clear(){
+    unmap_segment();
     segments.clear();
 }
 
@@ -1,11 +1,17 @@
 #ifndef WAL_H
 #define WAL_H
 #include <boost/noncopyable.hpp>
+#include <chrono>
 #include <cstring>
+#include <deque>
+#include <memory>
 #include <string>
+#include <sys/uio.h>
 
+#include "base/Condition.hpp"
 #include "base/Error.hpp"
 #include "base/Mutex.hpp"
+#include "base/Thread.hpp"
 #include "base/ThreadPool.hpp"
 #include "wal/WALUtils.hpp"
 
@@ -14,15 +20,21 @@ namespace wal{
 
 std::string segment_name(const std::string & dir, int i);
 
+// recycled_name is the name of segment i once it has been truncated and is
+// kept for reuse.
+std::string recycled_name(const std::string & dir, int i);
+
 class Page: boost::noncopyable{
     public:
         int alloc;
         int flushed;
         uint8_t buf_[32 * 1024];
 
+        // Pages are written whole, the bytes behind the records must be zero.
         Page(){
             alloc = 0;
             flushed = 0;
+            memset(buf_, 0, PAGE_SIZE);
         }
 
         bool full(){
@@ -117,48 +129,140 @@ class CorruptionError{
 std::pair<std::vector<SegmentRef>, error::Error> list_segments(const std::string & dir);
 
 // TODO(Alec), add metrics to monitor.
+//
+// Records are written by a dedicated writer thread. log() queues the records
+// and waits until the writer has written them, the writer frames everything
+// queued meanwhile into pages and writes them with a single pwritev(), then
+// syncs them according to the SyncPolicy. Concurrent committers thereby share
+// the cost of the write and of the sync.
 class WAL: boost::noncopyable{
     private:
         std::string dir_; // [...]/wal
         int segment_size;
-        base::RWMutexLock mutex_;
+        base::RWMutexLock mutex_; // Guards segment and pages.
         std::shared_ptr<Segment> segment;
+        uint64_t segment_offset; // Written bytes of segment.
         std::unique_ptr<Page> page;
+        std::vector<std::unique_ptr<Page>> full_pages; // Not written yet.
+        std::vector<std::unique_ptr<Page>> free_pages;
         int done_pages;
+        std::vector<struct iovec> iov_; // Scratch of write_pages().
         std::shared_ptr<base::ThreadPool> pool_;
         error::Error err_;
 
+        SyncPolicy sync_policy;
+        int sync_interval; // ms
+        bool unsynced;
+        std::chrono::steady_clock::time_point last_sync;
+
+        // Group commit. Every log() call takes the next ticket, the writer
+        // completes the tickets of a batch at once.
+        base::MutexLock queue_mutex_;
+        base::Condition queue_cond_; // Wakes the writer.
+        base::Condition done_cond_;  // Wakes the committers.
+        std::vector<std::vector<uint8_t>> queue;
+        std::vector<std::vector<uint8_t>> free_records; // Reused by reserve().
+        uint64_t enqueued;
+        uint64_t completed;
+        error::Error write_err_;     // A failed write fails all later logs.
+        bool stopping;
+        std::unique_ptr<base::Thread> writer;
+
+        void run_writer();
+        error::Error write_batch(std::vector<std::vector<uint8_t>> & batch);
+
+        // Records of COMPRESS_MIN_RECORD_SIZE bytes and more are compressed
+        // with zlib at its fastest level, unless that does not shrink them.
+        bool compress_;
+        std::vector<uint8_t> compress_buf;
+
+        // add_record frames the record into pages, compressed marks the
+        // fragments with RECORD_COMPRESSED_MASK.
+        error::Error add_record(const uint8_t * p, int length, bool compressed=false);
+
+        // compress_record compresses the record into compress_buf, it returns
+        // false if the record is better left as it is.
+        bool compress_record(const std::vector<uint8_t> & rec);
+
+        // write_pages writes the pages filled since the last call.
+        error::Error write_pages();
+
+        error::Error sync_segment();
+
+        // Zeroed segments of segment_size bytes, reused by next_segment()
+        // instead of creating new files.
+        std::vector<std::string> recycled;
+
+        void load_recycled();
+
+        // recycle zeroes a truncated segment and keeps it for reuse, or
+        // removes it if enough segments are kept already.
+        error::Error recycle(const SegmentRef & ref);
+
+        // recycle_records keeps the buffers of written records for reserve().
+        void recycle_records(std::vector<std::vector<uint8_t>> & batch);
+
+        // enqueue moves the records to the queue and waits for the writer.
+        error::Error enqueue(std::vector<std::vector<uint8_t>> & recs);
+
     public:
-        WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool_, int segment_size=SEGMENT_SIZE);
+        WAL(const std::string & dir, const std::shared_ptr<base::ThreadPool> & pool_, int segment_size=SEGMENT_SIZE,
+            SyncPolicy sync_policy=SYNC_NONE, int sync_interval=DEFAULT_SYNC_INTERVAL, bool compress=false);
         std::string dir(){ return dir_; }
+        bool compression(){ return compress_; }
         int pages_per_segment(){ return segment_size / PAGE_SIZE; }
         std::pair<std::pair<int, int>, error::Error> segments(const std::string & dir);
         error::Error set_segment(const std::shared_ptr<Segment> & s);
 
-        // truncate drops all segments before i.
+        // truncate drops all segments before i. Up to MAX_RECYCLED_SEGMENTS
+        // of them are zeroed and reused as the next segments.
         error::Error truncate(int i);
 
         // next_segment creates the next segment and closes the previous one.
         error::Error next_segment();
 
-        // flush_page writes the new contents of the page to disk. If no more records will fit into
-        // the page, the remaining bytes will be set to zero and a new page will be started.
+        // cut_segment makes sure that the records written so far are all in
+        // the segments before the returned index. A new segment is only
+        // started if the current one holds records.
+        std::pair<int, error::Error> cut_segment();
+
+        // flush_page hands the page to the writer once no more records fit into it,
+        // the remaining bytes are left zero and a new page is started.
         // If clear is true, this is enforced regardless of how many bytes are left in the page.
         error::Error flush_page(bool clear);
 
-        // log writes rec to the log and forces a flush of the current page if its
-        // the final record of a batch, the record is bigger than the page size or
-        // the current page is full.
+        // log writes rec to the log. It returns once the record has been written
+        // (and synced if the SyncPolicy asks so) together with all the records
+        // logged concurrently. final is kept for compatibility, every call
+        // ends a batch.
         error::Error log(const std::vector<uint8_t> & rec, bool final=true);
         error::Error log(const std::vector<std::vector<uint8_t>> & recs);
         error::Error log(const uint8_t * p, int length, bool final=true);
 
+        // log writes all the records with one ticket and takes their ownership.
+        error::Error log(std::vector<std::vector<uint8_t>> && recs);
+
+        // reserve returns an empty buffer with room for len bytes to encode a
+        // record into before handing it to submit() or log(). The buffers
+        // return once their records have been written, so that committers
+        // logging steadily neither allocate nor grow their records.
+        std::vector<uint8_t> reserve(size_t len);
+
+        // submit queues the records without waiting for them, wait(*ticket)
+        // returns once they have been written. It takes the ownership of the
+        // records. Committers logging to several WALs submit to all of them
+        // before waiting so that the writes overlap.
+        error::Error submit(std::vector<std::vector<uint8_t>> & recs, uint64_t * ticket);
+        error::Error submit(std::vector<uint8_t> * recs, int n, uint64_t * ticket);
+        error::Error wait(uint64_t ticket);
+
         // Repair attempts to repair the WAL based on the error.
         // It discards all data after the corruption.
         error::Error repair(const CorruptionError & cerr);
 
         std::shared_ptr<base::ThreadPool> pool(){ return pool_; }
 
+        // sync forces the written records to disk.
         void sync();
 
         error::Error error(){ return err_; }
@@ -167,28 +271,57 @@ class WAL: boost::noncopyable{
 
 error::Error validate_record(int i, RECORD_TYPE type);
 
-class SegmentReader{
+// SegmentReader reads the records of a sequence of segments. The segments are
+// memory-mapped one at a time and read sequentially, full records are returned
+// in place and only records spanning several pages are copied. Pages already
+// read are released from the mapping as the reader goes on, except those of
+// records pinned by pin(). Compressed records are returned decompressed.
+class SegmentReader: boost::noncopyable{
     private:
         std::vector<std::shared_ptr<Segment> > segments;
         int segment_index;
         int segment_offset;
-        bool offset_reset;
         error::Error err_;
 
         RECORD_TYPE record_type;
-        uint8_t buf[32 * 1024];
+        uint8_t buf[32 * 1024];   // Torn last page of a segment padded with zeros.
+        const uint8_t * page_;    // Current page, in the mapping or in buf.
         int page_offset;
 
-        std::vector<uint8_t> record_;
+        uint8_t * map_;           // Mapping of the current segment.
+        size_t map_size_;
+        std::shared_ptr<uint8_t> mapping_; // Unmaps map_ once the pins are gone.
+        size_t page_start_;       // Offset of page_ in the mapping.
+        size_t dropped_;          // Pages before this offset are released.
+        // Pins of the current mapping by offset of their page, oldest first.
+        std::deque<std::pair<size_t, std::weak_ptr<const void>>> pins_;
+
+        std::vector<uint8_t> record_; // Reassembled fragmented record.
+        std::vector<uint8_t> decompressed_;
+        const uint8_t * rec_ptr;
+        int rec_len;
         bool eof;
 
+        void init();
+
+        // decompress inflates the compressed record at rec_ptr into
+        // decompressed_ and returns it from there.
+        bool decompress();
+
+        // map_segment maps segments[segment_index], map_ stays null if the
+        // segment is empty.
+        bool map_segment();
+        void unmap_segment();
+
     public:
         SegmentReader(const std::string & dir, bool directory=true);
         SegmentReader(const SegmentRef & ref);
         SegmentReader(const std::string & name, const std::string & dir, int index);
         SegmentReader(const std::deque<SegmentRange> & segs);
+        ~SegmentReader();
 
-        // Read one page from current segment.
+        // Move to the next page, in the next segment once the current one is
+        // exhausted.
         // Pad zeros if page size < PAGE_SIZE.
         bool read_page();
 
@@ -198,9 +331,15 @@ class SegmentReader{
 
         CorruptionError cerror();
 
-        // <ptr, length>.
+        // <ptr, length>. The record is valid until the next call to next().
         std::pair<uint8_t *, int> record();
 
+        // pin keeps a record returned in place valid after next(), until the
+        // returned handle is released. Its page is neither released nor
+        // unmapped meanwhile. Copied records cannot be pinned, the handle is
+        // then null.
+        std::shared_ptr<const void> pin();
+
         int segment();
 
         int offset();
@@ -9,6 +9,7 @@ const RECORD_TYPE RECORD_FULL = 1;
 const RECORD_TYPE RECORD_FIRST = 2;
 const RECORD_TYPE RECORD_MIDDLE = 3;
 const RECORD_TYPE RECORD_LAST = 4;
+const RECORD_TYPE RECORD_COMPRESSED_MASK = 0x08;
 std::string record_type_string(RECORD_TYPE type_){
     switch(type_){
         case 0:
@@ -30,5 +31,12 @@ std::string record_type_string(RECORD_TYPE type_){
 const int SEGMENT_SIZE = 128 * 1024 * 1024;
 const int PAGE_SIZE = 32 * 1024;
 const int HEADER_SIZE = 7;
+const std::string RECYCLED_PREFIX = "recycled.";
+const int MAX_RECYCLED_SEGMENTS = 4;
+const int SEGMENT_READER_DROP_BYTES = 4 * 1024 * 1024;
+const int MAX_FREE_RECORD_BUFFERS = 64;
+const int MAX_FREE_RECORD_BUFFER_SIZE = 1024 * 1024;
+const int COMPRESS_MIN_RECORD_SIZE = 512;
+const int DEFAULT_SYNC_INTERVAL = 1000;
 
 }}
\ No newline at end of file
@@ -14,12 +14,38 @@ extern const RECORD_TYPE RECORD_FULL;
 extern const RECORD_TYPE RECORD_FIRST;
 extern const RECORD_TYPE RECORD_MIDDLE;
 extern const RECORD_TYPE RECORD_LAST;
+// Set in the type of every fragment of a compressed record. The fragments
+// hold the uvarint length of the record followed by its zlib stream, their
+// CRCs cover the compressed bytes.
+extern const RECORD_TYPE RECORD_COMPRESSED_MASK;
 std::string record_type_string(RECORD_TYPE type_);
 
 // WAL meta.
 extern const int SEGMENT_SIZE;
 extern const int PAGE_SIZE;
 extern const int HEADER_SIZE;
+// Segments are preallocated to the segment size. Truncated segments are kept
+// under RECYCLED_PREFIX for reuse, at most MAX_RECYCLED_SEGMENTS of them.
+extern const std::string RECYCLED_PREFIX;
+extern const int MAX_RECYCLED_SEGMENTS;
+// SegmentReader releases the pages it has read in steps of this many bytes.
+extern const int SEGMENT_READER_DROP_BYTES;
+// Record buffers handed out by WAL::reserve() are reused once their records
+// have been written, at most MAX_FREE_RECORD_BUFFERS of them and only those
+// not larger than MAX_FREE_RECORD_BUFFER_SIZE.
+extern const int MAX_FREE_RECORD_BUFFERS;
+extern const int MAX_FREE_RECORD_BUFFER_SIZE;
+// A compressing WAL leaves records below this size uncompressed.
+extern const int COMPRESS_MIN_RECORD_SIZE;
+
+// When the WAL writer syncs written records to disk. A record handed to
+// WAL::log() survives a crash of the process once log() returns. It survives
+// a crash of the machine
+//   SYNC_NONE:     only once its segment has been closed.
+//   SYNC_INTERVAL: at most sync_interval ms after log() returned.
+//   SYNC_BATCH:    once log() returns.
+enum SyncPolicy{ SYNC_NONE, SYNC_INTERVAL, SYNC_BATCH };
+extern const int DEFAULT_SYNC_INTERVAL; // ms
 
 }}
 
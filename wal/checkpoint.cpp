@@ -1,8 +1,11 @@
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/range/iterator_range.hpp>
+#include <chrono>
+#include <thread>
 // #include <iostream>
 
+#include "base/Endian.hpp"
 #include "tsdbutil/RecordDecoder.hpp"
 #include "tsdbutil/RecordEncoder.hpp"
 #include "tsdbutil/tsdbutils.hpp"
@@ -13,6 +16,27 @@ namespace wal {
 
 const std::string CHECKPOINT_PREFIX = "checkpoint.";
 
+namespace {
+
+// Throttled checkpoints sleep off their advance every this many bytes.
+const int64_t CHECKPOINT_THROTTLE_BYTES = 1024 * 1024;
+
+// all_kept tells whether keep holds for all the series of a series record,
+// without decoding it.
+bool all_kept(const uint8_t* rec, int length,
+              const std::function<bool(tagtree::TSID)>& keep)
+{
+    if (length < 1 || (length - 1) % 8 != 0) return false;
+    for (int i = 1; i < length; i += 8) {
+        if (!keep(static_cast<tagtree::TSID>(
+                base::get_uint64_big_endian(rec + i))))
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
 // last_checkpoint returns the directory name and index of the most recent
 // checkpoint. If dir does not contain any checkpoints, ErrNotFound is returned.
 std::pair<std::pair<std::string, int>, error::Error>
@@ -87,9 +111,14 @@ error::Error delete_checkpoints(const std::string& dir, int max_index)
 // segmented format as the original WAL itself.
 // This makes it easy to read it through the WAL package and concatenate
 // it with the original WAL.
+//
+// Series records whose series are all kept are copied as they are. Reading
+// is throttled to bytes_per_sec if it is positive, and the checkpoint gives up
+// as soon as *cancel is set.
 std::pair<CheckpointStats, error::Error>
 checkpoint(WAL* wal, int from, int to,
-           const std::function<bool(tagtree::TSID)>& keep, int64_t mint)
+           const std::function<bool(tagtree::TSID)>& keep, int64_t mint,
+           int64_t bytes_per_sec, const std::atomic<bool>* cancel)
 {
     CheckpointStats stats;
     std::deque<SegmentRange> seg_ranges;
@@ -120,6 +149,8 @@ checkpoint(WAL* wal, int from, int to,
     std::string cpdir = tsdbutil::filepath_join(
         wal->dir(), (boost::format(CHECKPOINT_PREFIX + "%06d") % to).str());
     std::string cpdirtmp = cpdir + ".tmp";
+    // Left over by a checkpoint that failed or was cancelled.
+    boost::filesystem::remove_all(cpdirtmp);
 
     {
         WAL cp_wal(cpdirtmp, wal->pool());
@@ -135,17 +166,36 @@ checkpoint(WAL* wal, int from, int to,
 
         int count = 0;
         std::vector<std::vector<uint8_t>> recs;
+        auto start = std::chrono::steady_clock::now();
+        int64_t read_bytes = 0;
+        int64_t throttled_bytes = 0;
         while (reader.next()) {
+            if (cancel && cancel->load())
+                return {CheckpointStats(),
+                        error::Error("checkpoint cancelled")};
             series.clear();
             samples.clear();
             stones.clear();
 
             std::pair<uint8_t*, int> rec = reader.record();
+            read_bytes += rec.second;
+            if (bytes_per_sec > 0 &&
+                read_bytes - throttled_bytes >= CHECKPOINT_THROTTLE_BYTES) {
+                throttled_bytes = read_bytes;
+                auto due = start + std::chrono::microseconds(
+                                       read_bytes * 1000000 / bytes_per_sec);
+                std::this_thread::sleep_until(due);
+            }
             tsdbutil::RECORD_ENTRY_TYPE type =
                 tsdbutil::RecordDecoder::type(rec.first, rec.second);
             // std::cerr << "type: " << (int)(rec.first[0]) << ", " <<
             // (int)(type) << std::endl;
-            if (type == tsdbutil::RECORD_SERIES) {
+            if (type == tsdbutil::RECORD_SERIES &&
+                all_kept(rec.first, rec.second, keep)) {
+                stats.total_series += (rec.second - 1) / 8;
+                recs.emplace_back(rec.first, rec.first + rec.second);
+                count += rec.second;
+            } else if (type == tsdbutil::RECORD_SERIES) {
                 error::Error err = tsdbutil::RecordDecoder::series(
                     rec.first, rec.second, series);
                 if (err)
@@ -193,7 +243,8 @@ checkpoint(WAL* wal, int from, int to,
             //     }
             //     stats.dropped_series += rm_count;
             // }
-            else if (type == tsdbutil::RECORD_SAMPLES) {
+            else if (type == tsdbutil::RECORD_SAMPLES ||
+                     type == tsdbutil::RECORD_COMPACT_SAMPLES) {
                 error::Error err = tsdbutil::RecordDecoder::samples(
                     rec.first, rec.second, samples);
                 if (err)
@@ -211,7 +262,8 @@ checkpoint(WAL* wal, int from, int to,
                 }
                 if (!samples.empty()) {
                     recs.push_back(std::vector<uint8_t>());
-                    tsdbutil::RecordEncoder::samples(samples, recs.back());
+                    tsdbutil::RecordEncoder::compact_samples(samples,
+                                                             recs.back());
                     count += recs.back().size();
                 }
                 stats.dropped_samples += rm_count;
@@ -1,6 +1,7 @@
 #ifndef WAL_CHECKPOINT_H
 #define WAL_CHECKPOINT_H
 
+#include <atomic>
 #include <functional>
 
 #include "tagtree/tsid.h"
@@ -42,9 +43,20 @@ error::Error delete_checkpoints(const std::string& dir, int max_index);
 // segmented format as the original WAL itself.
 // This makes it easy to read it through the WAL package and concatenate
 // it with the original WAL.
+//
+// Series records whose series are all kept are copied as they are. Reading
+// is throttled to bytes_per_sec if it is positive, and the checkpoint gives up
+// as soon as *cancel is set.
+//
+// Checkpoints are not incremental: the previous checkpoint is read and
+// written again as a whole, so every checkpoint costs about as much as the
+// series and samples kept. all_kept() only spares the decoding of series
+// records, keep is still called for every series, and sample records are
+// always decoded and encoded again.
 std::pair<CheckpointStats, error::Error>
 checkpoint(WAL* wal, int from, int to,
-           const std::function<bool(tagtree::TSID)>& keep, int64_t mint);
+           const std::function<bool(tagtree::TSID)>& keep, int64_t mint,
+           int64_t bytes_per_sec = 0, const std::atomic<bool>* cancel = nullptr);
 
 } // namespace wal
 } // namespace tsdb